@@ -1,5 +1,8 @@
 #include "audio_file.hpp"
+#include "genesis.hpp"
 #include "os.hpp"
+#include "sample_convert.hpp"
+#include "resample.hpp"
 
 #include <stdint.h>
 
@@ -96,158 +99,104 @@ static const int bit_rate_list[] = {
     320000,
 };
 
-static const float int24_min = -8388608.0f;
-static const float int24_max = 8388607.0f;
+// Number of samples converted at a time from packed frames before they are
+// split into channels. Small enough to stay in L1 cache.
+static const int IMPORT_BLOCK_SAMPLES = 2048;
 
-static int import_frame_uint8(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    uint8_t *ptr = avframe->extended_data[0];
-    double min = 0.0;
-    double max = (double)UINT8_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int frame = 0; frame < avframe->nb_samples; frame += 1) {
-        for (int ch = 0; ch < audio_file->channels.length(); ch += 1, ptr += 1) {
-            uint8_t sample = *ptr;
-            double dbl_sample = (((double)sample) - min) / half_range - 1.0;
-            err = err || audio_file->channels.at(ch).samples.append(dbl_sample);
-        }
+// grows every channel by frame_count samples and points dest at the first
+// new sample of each
+static int reserve_import_frames(GenesisAudioFile *audio_file, int frame_count, float **dest) {
+    int err;
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
+        List<float> *samples = &audio_file->channels.at(ch).samples;
+        int old_length = samples->length();
+        if ((err = samples->resize(old_length + frame_count)))
+            return err;
+        dest[ch] = samples->raw() + old_length;
     }
-    return err;
+    return 0;
 }
 
-static int import_frame_int16(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    uint8_t *ptr = avframe->extended_data[0];
-    double min = (double)INT16_MIN;
-    double max = (double)INT16_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int frame = 0; frame < avframe->nb_samples; frame += 1) {
-        for (int ch = 0; ch < audio_file->channels.length(); ch += 1, ptr += 2) {
-            int16_t *sample = reinterpret_cast<int16_t*>(ptr);
-            double dbl_sample = (((double)*sample) - min) / half_range - 1.0;
-            err = err || audio_file->channels.at(ch).samples.append(dbl_sample);
-        }
+static int import_packed(const AVFrame *avframe, GenesisAudioFile *audio_file,
+        SampleConvertToFloatFn *to_float, int bytes_per_sample)
+{
+    float *dest[GENESIS_MAX_CHANNELS];
+    int err;
+    if ((err = reserve_import_frames(audio_file, avframe->nb_samples, dest)))
+        return err;
+
+    int channel_count = audio_file->channels.length();
+    const uint8_t *src = avframe->extended_data[0];
+    if (!to_float) {
+        sample_convert_deinterleave(dest, 0, (const float *)src, channel_count, avframe->nb_samples);
+        return 0;
     }
-    return err;
+
+    float block[IMPORT_BLOCK_SAMPLES];
+    int block_frames = IMPORT_BLOCK_SAMPLES / channel_count;
+    for (int frame = 0; frame < avframe->nb_samples; frame += block_frames) {
+        int count = min(block_frames, avframe->nb_samples - frame);
+        to_float(block, src + frame * channel_count * bytes_per_sample, count * channel_count);
+        sample_convert_deinterleave(dest, frame, block, channel_count, count);
+    }
+    return 0;
 }
 
-static int import_frame_int32(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    uint8_t *ptr = avframe->extended_data[0];
-    double min = (double)INT32_MIN;
-    double max = (double)INT32_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int frame = 0; frame < avframe->nb_samples; frame += 1) {
-        for (int ch = 0; ch < audio_file->channels.length(); ch += 1, ptr += 4) {
-            int32_t *sample = reinterpret_cast<int32_t*>(ptr);
-            double dbl_sample = (((double)*sample) - min) / half_range - 1.0;
-            err = err || audio_file->channels.at(ch).samples.append(dbl_sample);
-        }
+static int import_planar(const AVFrame *avframe, GenesisAudioFile *audio_file,
+        SampleConvertToFloatFn *to_float)
+{
+    float *dest[GENESIS_MAX_CHANNELS];
+    int err;
+    if ((err = reserve_import_frames(audio_file, avframe->nb_samples, dest)))
+        return err;
+
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
+        if (to_float)
+            to_float(dest[ch], avframe->extended_data[ch], avframe->nb_samples);
+        else
+            memcpy(dest[ch], avframe->extended_data[ch], avframe->nb_samples * sizeof(float));
     }
-    return err;
+    return 0;
+}
+
+static int import_frame_uint8(const AVFrame *avframe, GenesisAudioFile *audio_file) {
+    return import_packed(avframe, audio_file, sample_convert_u8_to_float, 1);
+}
+
+static int import_frame_int16(const AVFrame *avframe, GenesisAudioFile *audio_file) {
+    return import_packed(avframe, audio_file, sample_convert_s16_to_float, 2);
+}
+
+static int import_frame_int32(const AVFrame *avframe, GenesisAudioFile *audio_file) {
+    return import_packed(avframe, audio_file, sample_convert_s32_to_float, 4);
 }
 
 static int import_frame_float(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    uint8_t *ptr = avframe->extended_data[0];
-    int err = 0;
-    for (int frame = 0; frame < avframe->nb_samples; frame += 1) {
-        for (int ch = 0; ch < audio_file->channels.length(); ch += 1, ptr += 4) {
-            float *sample = reinterpret_cast<float*>(ptr);
-            double dbl_sample = *sample;
-            err = err || audio_file->channels.at(ch).samples.append(dbl_sample);
-        }
-    }
-    return err;
+    return import_packed(avframe, audio_file, nullptr, 4);
 }
 
 static int import_frame_double(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    uint8_t *ptr = avframe->extended_data[0];
-    int err = 0;
-    for (int frame = 0; frame < avframe->nb_samples; frame += 1) {
-        for (int ch = 0; ch < audio_file->channels.length(); ch += 1, ptr += 8) {
-            double *sample = reinterpret_cast<double*>(ptr);
-            err = err || audio_file->channels.at(ch).samples.append(*sample);
-        }
-    }
-    return err;
+    return import_packed(avframe, audio_file, sample_convert_double_to_float, 8);
 }
 
 static int import_frame_uint8_planar(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    double min = 0.0;
-    double max = (double)UINT8_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-        uint8_t *ptr = avframe->extended_data[ch];
-        Channel *channel = &audio_file->channels.at(ch);
-        for (int frame = 0; frame < avframe->nb_samples; frame += 1, ptr += 1) {
-            uint8_t sample = *ptr;
-            double dbl_sample = (((double)sample) - min) / half_range - 1.0;
-            err = err || channel->samples.append(dbl_sample);
-        }
-    }
-    return err;
+    return import_planar(avframe, audio_file, sample_convert_u8_to_float);
 }
 
 static int import_frame_int16_planar(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    double min = (double)INT16_MIN;
-    double max = (double)INT16_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-        uint8_t *ptr = avframe->extended_data[ch];
-        Channel *channel = &audio_file->channels.at(ch);
-        for (int frame = 0; frame < avframe->nb_samples; frame += 1, ptr += 2) {
-            int16_t *sample = reinterpret_cast<int16_t*>(ptr);
-            double dbl_sample = (((double)*sample) - min) / half_range - 1.0;
-            err = err || channel->samples.append(dbl_sample);
-        }
-    }
-    return err;
+    return import_planar(avframe, audio_file, sample_convert_s16_to_float);
 }
 
 static int import_frame_int32_planar(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    double min = (double)INT32_MIN;
-    double max = (double)INT32_MAX;
-    double half_range = max / 2.0 - min / 2.0;
-    int err = 0;
-    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-        uint8_t *ptr = avframe->extended_data[ch];
-        Channel *channel = &audio_file->channels.at(ch);
-        for (int frame = 0; frame < avframe->nb_samples; frame += 1, ptr += 4) {
-            int32_t *sample = reinterpret_cast<int32_t*>(ptr);
-            double dbl_sample = (((double)*sample) - min) / half_range - 1.0;
-            err = err || channel->samples.append(dbl_sample);
-        }
-    }
-    return err;
+    return import_planar(avframe, audio_file, sample_convert_s32_to_float);
 }
 
 static int import_frame_float_planar(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    int err = 0;
-    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-        uint8_t *ptr = avframe->extended_data[ch];
-        Channel *channel = &audio_file->channels.at(ch);
-        for (int frame = 0; frame < avframe->nb_samples; frame += 1, ptr += 4) {
-            float *sample = reinterpret_cast<float*>(ptr);
-            double dbl_sample = *sample;
-            err = err || channel->samples.append(dbl_sample);
-        }
-    }
-    return err;
+    return import_planar(avframe, audio_file, nullptr);
 }
 
 static int import_frame_double_planar(const AVFrame *avframe, GenesisAudioFile *audio_file) {
-    int err = 0;
-    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-        uint8_t *ptr = avframe->extended_data[ch];
-        Channel *channel = &audio_file->channels.at(ch);
-        for (int frame = 0; frame < avframe->nb_samples; frame += 1, ptr += 8) {
-            double *sample = reinterpret_cast<double*>(ptr);
-            err = err || channel->samples.append(*sample);
-        }
-    }
-    return err;
+    return import_planar(avframe, audio_file, sample_convert_double_to_float);
 }
 
 static int decode_interrupt_cb(void *ctx) {
@@ -343,28 +292,30 @@ static int channel_layout_init_from_ffmpeg(uint64_t ffmpeg_channel_layout, Sound
     return 0;
 }
 
-int genesis_audio_file_load(struct GenesisContext *context,
-        const char *input_filename, struct GenesisAudioFile **out_audio_file)
-{
-    *out_audio_file = nullptr;
-    GenesisAudioFile *audio_file = create_zero<GenesisAudioFile>();
-    if (!audio_file) {
-        genesis_audio_file_destroy(audio_file);
-        return GenesisErrorNoMem;
-    }
+static const int STREAM_CHUNK_COUNT = 64;
+static const int STREAM_READAHEAD_CHUNKS = 4;
+static const int STREAM_MAX_PREFETCH_THREADS = 4;
+// 64 MiB of chunk memory per context
+static const long STREAM_DEFAULT_CHANNEL_CHUNK_BUDGET = 1024;
+// a request this far past the decoded position is cheaper to seek to than to
+// decode up to
+static const long STREAM_SEEK_THRESHOLD_FRAMES = 2 * AUDIO_FILE_CHUNK_FRAMES;
 
+// opens the file and its decoder and reads the header. the caller destroys
+// audio_file on error.
+static int open_audio_file(struct GenesisContext *context, const char *input_filename,
+        GenesisAudioFile *audio_file, int *out_stream_index)
+{
+    audio_file->genesis_context = context;
     audio_file->ic = avformat_alloc_context();
-    if (!audio_file->ic) {
-        genesis_audio_file_destroy(audio_file);
+    if (!audio_file->ic)
         return GenesisErrorNoMem;
-    }
 
     audio_file->ic->interrupt_callback.callback = decode_interrupt_cb;
     audio_file->ic->interrupt_callback.opaque = NULL;
 
     int av_err = avformat_open_input(&audio_file->ic, input_filename, NULL, NULL);
     if (av_err < 0) {
-        genesis_audio_file_destroy(audio_file);
         if (av_err == AVERROR(ENOMEM)) {
             return GenesisErrorNoMem;
         } else if (av_err == AVERROR(EIO)) {
@@ -380,10 +331,8 @@ int genesis_audio_file_load(struct GenesisContext *context,
         }
     }
 
-    if ((av_err = avformat_find_stream_info(audio_file->ic, NULL)) < 0) {
-        genesis_audio_file_destroy(audio_file);
+    if ((av_err = avformat_find_stream_info(audio_file->ic, NULL)) < 0)
         return GenesisErrorDecodingAudio;
-    }
 
     // set all streams to discard. in a few lines here we will find the audio
     // stream and cancel discarding it
@@ -392,31 +341,23 @@ int genesis_audio_file_load(struct GenesisContext *context,
 
     AVCodec *decoder = NULL;
     int audio_stream_index = av_find_best_stream(audio_file->ic, AVMEDIA_TYPE_AUDIO, -1, -1, &decoder, 0);
-    if (audio_stream_index < 0) {
-        genesis_audio_file_destroy(audio_file);
+    if (audio_stream_index < 0)
         return GenesisErrorNoAudioFound;
-    }
-    if (!decoder) {
-        genesis_audio_file_destroy(audio_file);
+    if (!decoder)
         return GenesisErrorNoDecoderFound;
-    }
 
     AVStream *audio_st = audio_file->ic->streams[audio_stream_index];
     audio_st->discard = AVDISCARD_DEFAULT;
 
     audio_file->codec_ctx = audio_st->codec;
     av_err = avcodec_open2(audio_file->codec_ctx, decoder, NULL);
-    if (av_err < 0) {
-        genesis_audio_file_destroy(audio_file);
+    if (av_err < 0)
         return GenesisErrorDecodingAudio;
-    }
 
     if (!audio_file->codec_ctx->channel_layout)
         audio_file->codec_ctx->channel_layout = av_get_default_channel_layout(audio_file->codec_ctx->channels);
-    if (!audio_file->codec_ctx->channel_layout) {
-        genesis_audio_file_destroy(audio_file);
+    if (!audio_file->codec_ctx->channel_layout)
         return GenesisErrorNoAudioFound;
-    }
 
     // copy the audio stream metadata to the context metadata
     av_dict_copy(&audio_file->ic->metadata, audio_st->metadata, 0);
@@ -429,116 +370,927 @@ int genesis_audio_file_load(struct GenesisContext *context,
 
     int genesis_err = channel_layout_init_from_ffmpeg(audio_file->codec_ctx->channel_layout,
            &audio_file->channel_layout);
-    if (genesis_err) {
-        genesis_audio_file_destroy(audio_file);
+    if (genesis_err)
         return genesis_err;
-    }
 
     audio_file->sample_rate = audio_file->codec_ctx->sample_rate;
     long channel_count = audio_file->channel_layout.channel_count;
 
-    int (*import_frame)(const AVFrame *, GenesisAudioFile *);
     switch (audio_file->codec_ctx->sample_fmt) {
         default:
             panic("unrecognized sample format");
             break;
         case AV_SAMPLE_FMT_U8:
-            import_frame = import_frame_uint8;
+            audio_file->import_frame = import_frame_uint8;
             break;
         case AV_SAMPLE_FMT_S16:
-            import_frame = import_frame_int16;
+            audio_file->import_frame = import_frame_int16;
             break;
         case AV_SAMPLE_FMT_S32:
-            import_frame = import_frame_int32;
+            audio_file->import_frame = import_frame_int32;
             break;
         case AV_SAMPLE_FMT_FLT:
-            import_frame = import_frame_float;
+            audio_file->import_frame = import_frame_float;
             break;
         case AV_SAMPLE_FMT_DBL:
-            import_frame = import_frame_double;
+            audio_file->import_frame = import_frame_double;
             break;
 
         case AV_SAMPLE_FMT_U8P:
-            import_frame = import_frame_uint8_planar;
+            audio_file->import_frame = import_frame_uint8_planar;
             break;
         case AV_SAMPLE_FMT_S16P:
-            import_frame = import_frame_int16_planar;
+            audio_file->import_frame = import_frame_int16_planar;
             break;
         case AV_SAMPLE_FMT_S32P:
-            import_frame = import_frame_int32_planar;
+            audio_file->import_frame = import_frame_int32_planar;
             break;
         case AV_SAMPLE_FMT_FLTP:
-            import_frame = import_frame_float_planar;
+            audio_file->import_frame = import_frame_float_planar;
             break;
         case AV_SAMPLE_FMT_DBLP:
-            import_frame = import_frame_double_planar;
+            audio_file->import_frame = import_frame_double_planar;
             break;
     }
 
-    if (audio_file->channels.resize(channel_count)) {
-        genesis_audio_file_destroy(audio_file);
-        return GenesisErrorNoMem;
+    if (audio_file->channels.resize(channel_count))
+        return GenesisErrorNoMem;
+    for (int i = 0; i < audio_file->channels.length(); i += 1) {
+        audio_file->channels.at(i).samples.clear();
+    }
+
+    audio_file->in_frame = av_frame_alloc();
+    if (!audio_file->in_frame)
+        return GenesisErrorNoMem;
+
+    *out_stream_index = audio_stream_index;
+    return 0;
+}
+
+static void close_decoder(GenesisAudioFile *audio_file) {
+    av_frame_free(&audio_file->in_frame); audio_file->in_frame = nullptr;
+    avcodec_close(audio_file->codec_ctx); audio_file->codec_ctx = nullptr;
+    avformat_close_input(&audio_file->ic); audio_file->ic = nullptr;
+}
+
+// decodes every packet into channels. if on_decoded is given it is called
+// after each packet, so that the caller can drain channels as it goes.
+static int decode_packets(GenesisAudioFile *audio_file, int audio_stream_index,
+        int (*on_decoded)(GenesisAudioFile *, void *), void *userdata)
+{
+    AVPacket pkt;
+    memset(&pkt, 0, sizeof(AVPacket));
+    int err;
+
+    for (;;) {
+        int av_err = av_read_frame(audio_file->ic, &pkt);
+        if (av_err == AVERROR_EOF) {
+            break;
+        } else if (av_err < 0) {
+            return GenesisErrorDecodingAudio;
+        }
+        int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx,
+                audio_file->in_frame, audio_file->import_frame);
+        av_packet_unref(&pkt);
+        if (negative_err == -GenesisErrorDecodingAudio) {
+            // ignore decoding errors and try the next frame
+            continue;
+        } else if (negative_err < 0) {
+            return -negative_err;
+        }
+        if (on_decoded && (err = on_decoded(audio_file, userdata)))
+            return err;
+    }
+
+    // flush
+    for (;;) {
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+        pkt.stream_index = audio_stream_index;
+        int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx,
+                audio_file->in_frame, audio_file->import_frame);
+        if (negative_err == -GenesisErrorDecodingAudio) {
+            // treat decoding errors as EOFs
+            break;
+        } else if (negative_err < 0) {
+            return -negative_err;
+        } else if (negative_err == 0) {
+            break;
+        }
+        if (on_decoded && (err = on_decoded(audio_file, userdata)))
+            return err;
+    }
+
+    return 0;
+}
+
+// decodes the whole file into channels and closes the decoder
+static int decode_all(GenesisAudioFile *audio_file, int audio_stream_index) {
+    int err;
+    if ((err = decode_packets(audio_file, audio_stream_index, nullptr, nullptr)))
+        return err;
+    close_decoder(audio_file);
+    return 0;
+}
+
+// Decoded sample files: a header page, then blocks of AUDIO_FILE_CHUNK_FRAMES
+// frames, each stored planar like a stream cache chunk. Samples are native
+// float; these files are a local cache, not an interchange format.
+// header: magic, sample rate, channel count, channel ids, frame count, key
+// length, key. all integers big endian.
+static const char decoded_file_magic[8] = {'G', 'N', 'S', 'P', 'C', 'M', '0', '1'};
+static const int DECODED_FILE_HEADER_SIZE = 4096;
+static const int DECODED_FILE_MAX_KEY_SIZE = 1024;
+
+static_assert(8 + 4 + 4 + 4 * GENESIS_MAX_CHANNELS + 8 + 4 + DECODED_FILE_MAX_KEY_SIZE <=
+        DECODED_FILE_HEADER_SIZE, "decoded file header does not fit");
+
+static void write_decoded_file_header(uint8_t *header, const GenesisAudioFile *audio_file,
+        long frame_count, const void *key, int key_len)
+{
+    memset(header, 0, DECODED_FILE_HEADER_SIZE);
+    memcpy(header, decoded_file_magic, 8);
+    int offset = 8;
+    write_uint32be(&header[offset], audio_file->sample_rate); offset += 4;
+    write_uint32be(&header[offset], audio_file->channel_layout.channel_count); offset += 4;
+    for (int ch = 0; ch < GENESIS_MAX_CHANNELS; ch += 1) {
+        uint32_t channel_id = (ch < audio_file->channel_layout.channel_count) ?
+            audio_file->channel_layout.channels[ch] : 0;
+        write_uint32be(&header[offset], channel_id); offset += 4;
+    }
+    write_uint64be(&header[offset], frame_count); offset += 8;
+    write_uint32be(&header[offset], key_len); offset += 4;
+    memcpy(&header[offset], key, key_len);
+}
+
+struct DecodedFileWriter {
+    FILE *file;
+    long frame_count;
+};
+
+static int write_decoded_block(GenesisAudioFile *audio_file, DecodedFileWriter *writer) {
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
+        List<float> *samples = &audio_file->channels.at(ch).samples;
+        size_t amt_written = fwrite(samples->raw(), sizeof(float), AUDIO_FILE_CHUNK_FRAMES, writer->file);
+        if (amt_written != AUDIO_FILE_CHUNK_FRAMES)
+            return GenesisErrorFileAccess;
+        samples->remove_range(0, AUDIO_FILE_CHUNK_FRAMES);
+    }
+    return 0;
+}
+
+static int write_decoded_blocks(GenesisAudioFile *audio_file, void *userdata) {
+    DecodedFileWriter *writer = (DecodedFileWriter *)userdata;
+    int err;
+    while (audio_file->channels.at(0).samples.length() >= AUDIO_FILE_CHUNK_FRAMES) {
+        if ((err = write_decoded_block(audio_file, writer)))
+            return err;
+        writer->frame_count += AUDIO_FILE_CHUNK_FRAMES;
+    }
+    return 0;
+}
+
+int genesis_audio_file_write_decoded(struct GenesisContext *context,
+        const char *input_filename, const char *output_path, const void *key, int key_len)
+{
+    if (key_len < 0 || key_len > DECODED_FILE_MAX_KEY_SIZE)
+        return GenesisErrorInvalidParam;
+
+    GenesisAudioFile *audio_file = create_zero<GenesisAudioFile>();
+    if (!audio_file)
+        return GenesisErrorNoMem;
+
+    int err;
+    int audio_stream_index;
+    if ((err = open_audio_file(context, input_filename, audio_file, &audio_stream_index))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
+
+    // write to a temporary file and rename it into place, so that a crash
+    // never leaves a half written file at output_path. a file which is cut
+    // short anyway fails the size check in genesis_audio_file_load_decoded.
+    ByteBuffer output_dir = os_path_dirname(output_path);
+    OsTempFile tmp_file;
+    if ((err = os_create_temp_file(output_dir.raw(), &tmp_file))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
+
+    uint8_t header[DECODED_FILE_HEADER_SIZE];
+    DecodedFileWriter writer;
+    writer.file = tmp_file.file;
+    writer.frame_count = 0;
+
+    // the frame count is not known until the end; write the header again then
+    write_decoded_file_header(header, audio_file, 0, key, key_len);
+    if (fwrite(header, 1, DECODED_FILE_HEADER_SIZE, writer.file) != DECODED_FILE_HEADER_SIZE)
+        err = GenesisErrorFileAccess;
+
+    if (!err)
+        err = decode_packets(audio_file, audio_stream_index, write_decoded_blocks, &writer);
+
+    if (!err) {
+        // pad the last block with silence
+        long remaining = audio_file->channels.at(0).samples.length();
+        if (remaining > 0) {
+            for (int ch = 0; ch < audio_file->channels.length() && !err; ch += 1) {
+                List<float> *samples = &audio_file->channels.at(ch).samples;
+                if (samples->resize(AUDIO_FILE_CHUNK_FRAMES)) {
+                    err = GenesisErrorNoMem;
+                    break;
+                }
+                for (int i = remaining; i < AUDIO_FILE_CHUNK_FRAMES; i += 1)
+                    samples->at(i) = 0.0f;
+            }
+            if (!err)
+                err = write_decoded_block(audio_file, &writer);
+            writer.frame_count += remaining;
+        }
+    }
+
+    if (!err) {
+        write_decoded_file_header(header, audio_file, writer.frame_count, key, key_len);
+        if (fseek(writer.file, 0, SEEK_SET) ||
+            fwrite(header, 1, DECODED_FILE_HEADER_SIZE, writer.file) != DECODED_FILE_HEADER_SIZE)
+        {
+            err = GenesisErrorFileAccess;
+        }
+    }
+
+    if (fclose(writer.file) && !err)
+        err = GenesisErrorFileAccess;
+    genesis_audio_file_destroy(audio_file);
+
+    if (!err)
+        err = os_rename_clobber(tmp_file.path.raw(), output_path);
+    if (err)
+        os_delete(tmp_file.path.raw());
+    return err;
+}
+
+int genesis_audio_file_load_decoded(struct GenesisContext *context, const char *path,
+        const void *key, int key_len, struct GenesisAudioFile **out_audio_file)
+{
+    *out_audio_file = nullptr;
+    GenesisAudioFile *audio_file = create_zero<GenesisAudioFile>();
+    if (!audio_file)
+        return GenesisErrorNoMem;
+    audio_file->genesis_context = context;
+
+    int err;
+    if ((err = os_map_file_read_only(path, &audio_file->mapped_file))) {
+        genesis_audio_file_destroy(audio_file);
+        return (err == GenesisErrorEmptyFile) ? GenesisErrorInvalidFormat : err;
+    }
+
+    size_t size = audio_file->mapped_file.size;
+    const uint8_t *header = (const uint8_t *)audio_file->mapped_file.address;
+    if (size < (size_t)DECODED_FILE_HEADER_SIZE || memcmp(header, decoded_file_magic, 8) != 0) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorInvalidFormat;
+    }
+
+    int offset = 8;
+    int sample_rate = read_uint32be(&header[offset]); offset += 4;
+    int channel_count = read_uint32be(&header[offset]); offset += 4;
+    if (sample_rate <= 0 || channel_count <= 0 || channel_count > GENESIS_MAX_CHANNELS) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorInvalidFormat;
+    }
+    SoundIoChannelLayout *layout = &audio_file->channel_layout;
+    layout->channel_count = channel_count;
+    for (int ch = 0; ch < GENESIS_MAX_CHANNELS; ch += 1) {
+        if (ch < channel_count)
+            layout->channels[ch] = (SoundIoChannelId)read_uint32be(&header[offset]);
+        offset += 4;
+    }
+    long frame_count = read_uint64be(&header[offset]); offset += 8;
+    int stored_key_len = read_uint32be(&header[offset]); offset += 4;
+    if (stored_key_len != key_len || memcmp(&header[offset], key, key_len) != 0) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorInvalidFormat;
+    }
+
+    long block_count = (frame_count + AUDIO_FILE_CHUNK_FRAMES - 1) / AUDIO_FILE_CHUNK_FRAMES;
+    size_t expected_size = DECODED_FILE_HEADER_SIZE +
+        block_count * channel_count * AUDIO_FILE_CHUNK_FRAMES * sizeof(float);
+    if (frame_count < 0 || size != expected_size) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorInvalidFormat;
+    }
+
+    layout->name = nullptr;
+    int builtin_layout_count = soundio_channel_layout_builtin_count();
+    for (int i = 0; i < builtin_layout_count; i += 1) {
+        const SoundIoChannelLayout *builtin_layout = soundio_channel_layout_get_builtin(i);
+        if (soundio_channel_layout_equal(builtin_layout, layout)) {
+            layout->name = builtin_layout->name;
+            break;
+        }
+    }
+
+    if (audio_file->channels.resize(channel_count)) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorNoMem;
+    }
+
+    audio_file->sample_rate = sample_rate;
+    audio_file->mapped_frame_count = frame_count;
+    audio_file->mapped_samples = (const float *)(audio_file->mapped_file.address + DECODED_FILE_HEADER_SIZE);
+
+    *out_audio_file = audio_file;
+    return 0;
+}
+
+int genesis_audio_file_load(struct GenesisContext *context,
+        const char *input_filename, struct GenesisAudioFile **out_audio_file)
+{
+    *out_audio_file = nullptr;
+    GenesisAudioFile *audio_file = create_zero<GenesisAudioFile>();
+    if (!audio_file) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorNoMem;
+    }
+
+    int err;
+    int audio_stream_index;
+    if ((err = open_audio_file(context, input_filename, audio_file, &audio_stream_index))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
+
+    if ((err = decode_all(audio_file, audio_stream_index))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
+
+    *out_audio_file = audio_file;
+    return 0;
+}
+
+// wraps the sample format specific import_frame. after a seek, the first
+// decoded frame tells us where the decoder actually landed.
+static int import_frame_streaming(const AVFrame *avframe, GenesisAudioFile *audio_file) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    if (cache->staging_start_unknown) {
+        int64_t ts = av_frame_get_best_effort_timestamp(avframe);
+        if (ts != AV_NOPTS_VALUE) {
+            AVStream *st = audio_file->ic->streams[cache->stream_index];
+            if (st->start_time != AV_NOPTS_VALUE)
+                ts -= st->start_time;
+            AVRational sample_time_base = {1, audio_file->sample_rate};
+            cache->staging_start = av_rescale_q(ts, st->time_base, sample_time_base);
+        }
+        cache->staging_start_unknown = false;
+    }
+    return audio_file->import_frame(avframe, audio_file);
+}
+
+static void stream_seek(GenesisAudioFile *audio_file, long frame_index) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    AVStream *st = audio_file->ic->streams[cache->stream_index];
+    AVRational sample_time_base = {1, audio_file->sample_rate};
+    int64_t ts = av_rescale_q(frame_index, sample_time_base, st->time_base);
+    if (st->start_time != AV_NOPTS_VALUE)
+        ts += st->start_time;
+
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1)
+        audio_file->channels.at(ch).samples.clear();
+    cache->staging_start = frame_index;
+    cache->staging_start_unknown = false;
+
+    if (av_seek_frame(audio_file->ic, cache->stream_index, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        // the chunk is left silent
+        cache->eof = true;
+        return;
+    }
+    avcodec_flush_buffers(audio_file->codec_ctx);
+    cache->staging_start_unknown = true;
+    cache->eof = false;
+}
+
+static void stream_discard_before(GenesisAudioFile *audio_file, long frame_index) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    long count = min(frame_index - cache->staging_start,
+            (long)audio_file->channels.at(0).samples.length());
+    if (count <= 0)
+        return;
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1)
+        audio_file->channels.at(ch).samples.remove_range(0, count);
+    cache->staging_start += count;
+}
+
+static void stream_decode_until(GenesisAudioFile *audio_file, long frame_index) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    AVPacket pkt;
+    memset(&pkt, 0, sizeof(AVPacket));
+
+    while (!cache->eof && (cache->staging_start_unknown ||
+            cache->staging_start + audio_file->channels.at(0).samples.length() < frame_index))
+    {
+        if (av_read_frame(audio_file->ic, &pkt) < 0) {
+            // end of file or read error. flush the decoder and stop.
+            for (;;) {
+                av_init_packet(&pkt);
+                pkt.data = NULL;
+                pkt.size = 0;
+                pkt.stream_index = cache->stream_index;
+                int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx,
+                        audio_file->in_frame, import_frame_streaming);
+                if (negative_err <= 0)
+                    break;
+            }
+            cache->eof = true;
+            break;
+        }
+        int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx,
+                audio_file->in_frame, import_frame_streaming);
+        av_packet_unref(&pkt);
+        if (negative_err < 0 && negative_err != -GenesisErrorDecodingAudio) {
+            // out of memory. the rest of the chunk is left silent
+            break;
+        }
+    }
+}
+
+// decodes one chunk into dest. anything the decoder can not produce is silence.
+static void stream_fill_chunk(GenesisAudioFile *audio_file, long chunk_index, float *dest) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    long start = chunk_index * AUDIO_FILE_CHUNK_FRAMES;
+    long end = min(start + AUDIO_FILE_CHUNK_FRAMES, cache->frame_count);
+
+    long staging_end = cache->staging_start + audio_file->channels.at(0).samples.length();
+    if (start < cache->staging_start || start > staging_end + STREAM_SEEK_THRESHOLD_FRAMES)
+        stream_seek(audio_file, start);
+    else
+        stream_discard_before(audio_file, start);
+
+    stream_decode_until(audio_file, end);
+
+    long staged_count = audio_file->channels.at(0).samples.length();
+    long copy_start = max(start, cache->staging_start);
+    long copy_end = min(end, cache->staging_start + staged_count);
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
+        float *out = dest + ch * AUDIO_FILE_CHUNK_FRAMES;
+        memset(out, 0, AUDIO_FILE_CHUNK_FRAMES * sizeof(float));
+        if (copy_end > copy_start) {
+            const float *in = audio_file->channels.at(ch).samples.raw();
+            memcpy(out + (copy_start - start), in + (copy_start - cache->staging_start),
+                    (copy_end - copy_start) * sizeof(float));
+        }
+    }
+
+    stream_discard_before(audio_file, end);
+}
+
+static GenesisAudioFileChunk *stream_find_chunk(AudioFileStreamCache *cache, long chunk_index) {
+    for (int i = 0; i < cache->chunk_count; i += 1) {
+        GenesisAudioFileChunk *chunk = &cache->chunks[i];
+        if (chunk->chunk_index.load(std::memory_order_relaxed) == chunk_index)
+            return chunk;
+    }
+    return nullptr;
+}
+
+// picks the least recently used chunk of the file which no reader has pinned
+// and marks it empty. returns nullptr if every chunk is pinned.
+static GenesisAudioFileChunk *stream_evict_chunk(AudioFileStreamCache *cache) {
+    bool tried[STREAM_CHUNK_COUNT] = {};
+    for (;;) {
+        GenesisAudioFileChunk *victim = nullptr;
+        int victim_index = -1;
+        for (int i = 0; i < cache->chunk_count; i += 1) {
+            GenesisAudioFileChunk *chunk = &cache->chunks[i];
+            if (tried[i] || chunk->pin_count.load() > 0)
+                continue;
+            if (!victim || chunk->last_used.load() < victim->last_used.load()) {
+                victim = chunk;
+                victim_index = i;
+            }
+        }
+        if (!victim)
+            return nullptr;
+        tried[victim_index] = true;
+
+        long old_chunk_index = victim->chunk_index.exchange(-1);
+        if (victim->pin_count.load() == 0)
+            return victim;
+        // a reader pinned it after we looked
+        victim->chunk_index.store(old_chunk_index);
+    }
+}
+
+// takes the memory of the least recently used loaded chunk of any file of
+// the pool which no reader has pinned. returns false if every chunk is
+// pinned. pool->mutex must be locked.
+static bool stream_pool_evict(AudioFileStreamPool *pool) {
+    for (;;) {
+        GenesisAudioFile *victim_file = nullptr;
+        GenesisAudioFileChunk *victim = nullptr;
+        for (int file_i = 0; file_i < pool->files.length(); file_i += 1) {
+            GenesisAudioFile *audio_file = pool->files.at(file_i);
+            AudioFileStreamCache *cache = audio_file->stream_cache;
+            for (int i = 0; i < cache->chunk_count; i += 1) {
+                GenesisAudioFileChunk *chunk = &cache->chunks[i];
+                // empty slots with memory are being filled
+                if (!chunk->samples || chunk->chunk_index.load() < 0 || chunk->pin_count.load() > 0)
+                    continue;
+                if (!victim || chunk->last_used.load() < victim->last_used.load()) {
+                    victim = chunk;
+                    victim_file = audio_file;
+                }
+            }
+        }
+        if (!victim)
+            return false;
+
+        long old_chunk_index = victim->chunk_index.exchange(-1);
+        if (victim->pin_count.load() > 0) {
+            // a reader pinned it after we looked
+            victim->chunk_index.store(old_chunk_index);
+            continue;
+        }
+        int channel_count = victim_file->channel_layout.channel_count;
+        destroy(victim->samples, channel_count * AUDIO_FILE_CHUNK_FRAMES);
+        victim->samples = nullptr;
+        pool->channel_chunks_used -= channel_count;
+        return true;
+    }
+}
+
+// returns an empty slot of the file with memory to decode a chunk into, or
+// nullptr if every chunk it could use is pinned or out of memory.
+static GenesisAudioFileChunk *stream_reserve_chunk(GenesisAudioFile *audio_file) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    AudioFileStreamPool *pool = cache->pool;
+    int channel_count = audio_file->channel_layout.channel_count;
+
+    OsMutexLocker locker(pool->mutex);
+    GenesisAudioFileChunk *chunk = nullptr;
+    for (int i = 0; i < cache->chunk_count; i += 1) {
+        GenesisAudioFileChunk *slot = &cache->chunks[i];
+        if (slot->chunk_index.load() >= 0)
+            continue;
+        chunk = slot;
+        if (slot->samples)
+            break;
+    }
+    if (!chunk)
+        chunk = stream_evict_chunk(cache);
+    if (!chunk || chunk->samples)
+        return chunk;
+
+    while (pool->channel_chunks_used + channel_count > pool->channel_chunk_budget) {
+        if (!stream_pool_evict(pool))
+            return nullptr;
+    }
+    chunk->samples = allocate_zero<float>(channel_count * AUDIO_FILE_CHUNK_FRAMES);
+    if (!chunk->samples)
+        return nullptr;
+    pool->channel_chunks_used += channel_count;
+    return chunk;
+}
+
+// returns false if there was no memory for the chunk
+static bool stream_load_chunk(GenesisAudioFile *audio_file, long chunk_index) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    if (stream_find_chunk(cache, chunk_index))
+        return true;
+    GenesisAudioFileChunk *chunk = stream_reserve_chunk(audio_file);
+    if (!chunk)
+        return false;
+    stream_fill_chunk(audio_file, chunk_index, chunk->samples);
+    chunk->last_used.store(cache->pool->use_clock.load());
+    chunk->chunk_index.store(chunk_index);
+    return true;
+}
+
+// decodes the chunks readers asked for, in order
+static void stream_load_requested(GenesisAudioFile *audio_file) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    long wanted[AUDIO_FILE_REQUEST_COUNT];
+    int wanted_count = 0;
+    for (int i = 0; i < AUDIO_FILE_REQUEST_COUNT; i += 1) {
+        long chunk_index = cache->requests[i].exchange(-1);
+        if (chunk_index < 0)
+            continue;
+        // keep sorted so that sequential requests decode without seeking
+        int j = wanted_count;
+        for (; j > 0 && wanted[j - 1] > chunk_index; j -= 1)
+            wanted[j] = wanted[j - 1];
+        wanted[j] = chunk_index;
+        wanted_count += 1;
+    }
+
+    for (int i = 0; i < wanted_count && !cache->closing.load(); i += 1)
+        stream_load_chunk(audio_file, wanted[i]);
+}
+
+// marks the next file with requests, which no other thread is decoding for,
+// as busy and returns it. files are taken in turn so that one busy file does
+// not starve the others.
+static GenesisAudioFile *stream_pool_claim_file(AudioFileStreamPool *pool) {
+    OsMutexLocker locker(pool->mutex);
+    int file_count = pool->files.length();
+    for (int n = 0; n < file_count; n += 1) {
+        int file_i = (pool->next_file_index + n) % file_count;
+        GenesisAudioFile *audio_file = pool->files.at(file_i);
+        AudioFileStreamCache *cache = audio_file->stream_cache;
+        if (cache->busy || !cache->pending.load())
+            continue;
+        cache->pending.store(false);
+        cache->busy = true;
+        pool->next_file_index = file_i + 1;
+        return audio_file;
+    }
+    return nullptr;
+}
+
+static void stream_pool_thread_run(void *arg) {
+    AudioFileStreamPool *pool = (AudioFileStreamPool *)arg;
+    for (;;) {
+        int wake_seq = pool->wake_seq.load();
+        if (!pool->running.load())
+            break;
+
+        GenesisAudioFile *audio_file = stream_pool_claim_file(pool);
+        if (!audio_file) {
+            os_futex_wait(reinterpret_cast<int*>(&pool->wake_seq), wake_seq);
+            continue;
+        }
+
+        stream_load_requested(audio_file);
+
+        OsMutexLocker locker(pool->mutex);
+        audio_file->stream_cache->busy = false;
+        os_cond_broadcast(pool->cond, pool->mutex);
+    }
+}
+
+int audio_file_stream_pool_create(AudioFileStreamPool **out_pool) {
+    *out_pool = nullptr;
+    AudioFileStreamPool *pool = create_zero<AudioFileStreamPool>();
+    if (!pool)
+        return GenesisErrorNoMem;
+    pool->channel_chunk_budget = STREAM_DEFAULT_CHANNEL_CHUNK_BUDGET;
+    if (!(pool->mutex = os_mutex_create()) || !(pool->cond = os_cond_create())) {
+        audio_file_stream_pool_destroy(pool);
+        return GenesisErrorNoMem;
+    }
+    *out_pool = pool;
+    return 0;
+}
+
+void audio_file_stream_pool_destroy(AudioFileStreamPool *pool) {
+    if (!pool)
+        return;
+    assert(pool->files.length() == 0);
+    if (pool->threads) {
+        pool->running.store(false);
+        pool->wake_seq += 1;
+        os_futex_wake(reinterpret_cast<int*>(&pool->wake_seq), pool->thread_count);
+        for (int i = 0; i < pool->thread_count; i += 1)
+            os_thread_destroy(pool->threads[i]);
+        destroy(pool->threads, pool->thread_count);
+    }
+    os_cond_destroy(pool->cond);
+    os_mutex_destroy(pool->mutex);
+    destroy(pool, 1);
+}
+
+void audio_file_stream_pool_set_budget(AudioFileStreamPool *pool, long channel_chunk_count) {
+    OsMutexLocker locker(pool->mutex);
+    pool->channel_chunk_budget = channel_chunk_count;
+}
+
+// threads start with the first streaming file so that contexts which never
+// stream do not pay for them. pool->mutex must be locked.
+static int stream_pool_start_threads(AudioFileStreamPool *pool) {
+    if (pool->threads)
+        return 0;
+    int thread_count = clamp(1, os_concurrency(), STREAM_MAX_PREFETCH_THREADS);
+    OsThread **threads = allocate_zero<OsThread *>(thread_count);
+    if (!threads)
+        return GenesisErrorNoMem;
+    pool->running.store(true);
+    for (int i = 0; i < thread_count; i += 1) {
+        int err;
+        if ((err = os_thread_create(stream_pool_thread_run, pool, false, &threads[i]))) {
+            pool->running.store(false);
+            pool->wake_seq += 1;
+            os_futex_wake(reinterpret_cast<int*>(&pool->wake_seq), i);
+            for (int j = 0; j < i; j += 1)
+                os_thread_destroy(threads[j]);
+            destroy(threads, thread_count);
+            return err;
+        }
+    }
+    pool->threads = threads;
+    pool->thread_count = thread_count;
+    return 0;
+}
+
+static int stream_pool_add_file(AudioFileStreamPool *pool, GenesisAudioFile *audio_file) {
+    OsMutexLocker locker(pool->mutex);
+    int err;
+    if ((err = stream_pool_start_threads(pool)))
+        return err;
+    if (pool->files.append(audio_file))
+        return GenesisErrorNoMem;
+    audio_file->stream_cache->pool = pool;
+    return 0;
+}
+
+// waits for the prefetch thread decoding for the file, if any, and gives the
+// memory of its chunks back to the pool
+static void stream_pool_remove_file(AudioFileStreamPool *pool, GenesisAudioFile *audio_file) {
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    int channel_count = audio_file->channel_layout.channel_count;
+    cache->closing.store(true);
+
+    OsMutexLocker locker(pool->mutex);
+    for (int i = 0; i < pool->files.length(); i += 1) {
+        if (pool->files.at(i) == audio_file) {
+            pool->files.swap_remove(i);
+            break;
+        }
+    }
+    while (cache->busy)
+        os_cond_wait(pool->cond, pool->mutex);
+    for (int i = 0; i < cache->chunk_count; i += 1) {
+        GenesisAudioFileChunk *chunk = &cache->chunks[i];
+        if (chunk->samples) {
+            destroy(chunk->samples, channel_count * AUDIO_FILE_CHUNK_FRAMES);
+            chunk->samples = nullptr;
+            pool->channel_chunks_used -= channel_count;
+        }
+    }
+}
+
+// asks the prefetch pool for count chunks starting at chunk_index. never
+// blocks; requests which do not fit are dropped and made again by the next
+// reader which misses.
+static void stream_request_chunks(AudioFileStreamCache *cache, long chunk_index, int count) {
+    bool requested_any = false;
+    long end_chunk_index = (cache->frame_count + AUDIO_FILE_CHUNK_FRAMES - 1) / AUDIO_FILE_CHUNK_FRAMES;
+    for (long wanted = chunk_index; wanted < chunk_index + count && wanted < end_chunk_index; wanted += 1) {
+        if (stream_find_chunk(cache, wanted))
+            continue;
+        int free_index = -1;
+        bool already_requested = false;
+        for (int i = 0; i < AUDIO_FILE_REQUEST_COUNT; i += 1) {
+            long requested = cache->requests[i].load(std::memory_order_relaxed);
+            if (requested == wanted) {
+                already_requested = true;
+                break;
+            }
+            if (requested == -1 && free_index == -1)
+                free_index = i;
+        }
+        if (already_requested || free_index == -1)
+            continue;
+        long expected = -1;
+        if (cache->requests[free_index].compare_exchange_strong(expected, wanted))
+            requested_any = true;
+    }
+    if (requested_any) {
+        AudioFileStreamPool *pool = cache->pool;
+        cache->pending.store(true);
+        pool->wake_seq += 1;
+        os_futex_wake(reinterpret_cast<int*>(&pool->wake_seq), 1);
+    }
+}
+
+static GenesisAudioFileChunk *stream_pin_chunk(AudioFileStreamCache *cache, long chunk_index) {
+    for (int i = 0; i < cache->chunk_count; i += 1) {
+        GenesisAudioFileChunk *chunk = &cache->chunks[i];
+        if (chunk->chunk_index.load(std::memory_order_relaxed) != chunk_index)
+            continue;
+        chunk->pin_count += 1;
+        if (chunk->chunk_index.load() == chunk_index) {
+            chunk->last_used.store(cache->pool->use_clock.fetch_add(1) + 1);
+            return chunk;
+        }
+        chunk->pin_count -= 1;
     }
-    for (int i = 0; i < audio_file->channels.length(); i += 1) {
-        audio_file->channels.at(i).samples.clear();
+    return nullptr;
+}
+
+static void stream_iterator_seek(GenesisAudioFileIterator *it, long frame_index) {
+    AudioFileStreamCache *cache = it->audio_file->stream_cache;
+    it->start = frame_index;
+    it->ptr = nullptr;
+    it->chunk = nullptr;
+    if (frame_index >= cache->frame_count) {
+        it->start = cache->frame_count;
+        it->end = cache->frame_count;
+        return;
     }
 
-    audio_file->in_frame = av_frame_alloc();
-    if (!audio_file->in_frame) {
+    long chunk_index = frame_index / AUDIO_FILE_CHUNK_FRAMES;
+    long chunk_start = chunk_index * AUDIO_FILE_CHUNK_FRAMES;
+    it->end = min(chunk_start + AUDIO_FILE_CHUNK_FRAMES, cache->frame_count);
+    it->chunk = stream_pin_chunk(cache, chunk_index);
+    if (it->chunk) {
+        it->ptr = it->chunk->samples + it->channel_index * AUDIO_FILE_CHUNK_FRAMES +
+            (frame_index - chunk_start);
+        stream_request_chunks(cache, chunk_index + 1, STREAM_READAHEAD_CHUNKS);
+    } else {
+        cache->miss_count += 1;
+        stream_request_chunks(cache, chunk_index, STREAM_READAHEAD_CHUNKS + 1);
+    }
+}
+
+static long stream_frame_count(GenesisAudioFile *audio_file, int audio_stream_index) {
+    AVStream *st = audio_file->ic->streams[audio_stream_index];
+    AVRational sample_time_base = {1, audio_file->sample_rate};
+    if (st->duration != AV_NOPTS_VALUE && st->duration > 0)
+        return av_rescale_q(st->duration, st->time_base, sample_time_base);
+    if (audio_file->ic->duration != AV_NOPTS_VALUE && audio_file->ic->duration > 0)
+        return av_rescale(audio_file->ic->duration, audio_file->sample_rate, AV_TIME_BASE);
+    return -1;
+}
+
+int genesis_audio_file_load_streaming(struct GenesisContext *context,
+        const char *input_filename, struct GenesisAudioFile **out_audio_file)
+{
+    *out_audio_file = nullptr;
+    GenesisAudioFile *audio_file = create_zero<GenesisAudioFile>();
+    if (!audio_file) {
         genesis_audio_file_destroy(audio_file);
         return GenesisErrorNoMem;
     }
 
-    AVPacket pkt;
-    memset(&pkt, 0, sizeof(AVPacket));
+    int err;
+    int audio_stream_index;
+    if ((err = open_audio_file(context, input_filename, audio_file, &audio_stream_index))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
 
-    for (;;) {
-        av_err = av_read_frame(audio_file->ic, &pkt);
-        if (av_err == AVERROR_EOF) {
-            break;
-        } else if (av_err < 0) {
-            genesis_audio_file_destroy(audio_file);
-            return GenesisErrorDecodingAudio;
-        }
-        int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx, audio_file->in_frame, import_frame);
-        av_packet_unref(&pkt);
-        if (negative_err == -GenesisErrorDecodingAudio) {
-            // ignore decoding errors and try the next frame
-            continue;
-        } else if (negative_err < 0) {
+    long frame_count = stream_frame_count(audio_file, audio_stream_index);
+    if (frame_count < 0) {
+        // no way to know the length without decoding everything
+        if ((err = decode_all(audio_file, audio_stream_index))) {
             genesis_audio_file_destroy(audio_file);
-            return -negative_err;
+            return err;
         }
+        *out_audio_file = audio_file;
+        return 0;
     }
 
-    // flush
-    for (;;) {
-        av_init_packet(&pkt);
-        pkt.data = NULL;
-        pkt.size = 0;
-        pkt.stream_index = audio_stream_index;
-        int negative_err = decode_frame(audio_file, &pkt, audio_file->codec_ctx, audio_file->in_frame, import_frame);
-        if (negative_err == -GenesisErrorDecodingAudio) {
-            // treat decoding errors as EOFs
-            break;
-        } else if (negative_err < 0) {
-            genesis_audio_file_destroy(audio_file);
-            return -negative_err;
-        } else if (negative_err == 0) {
-            break;
-        }
+    AudioFileStreamCache *cache = create_zero<AudioFileStreamCache>();
+    audio_file->stream_cache = cache;
+    if (!cache) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorNoMem;
+    }
+    cache->frame_count = frame_count;
+    cache->stream_index = audio_stream_index;
+    // chunk memory comes from the pool as chunks are filled
+    cache->chunk_count = STREAM_CHUNK_COUNT;
+    cache->chunks = allocate_zero<GenesisAudioFileChunk>(cache->chunk_count);
+    if (!cache->chunks) {
+        genesis_audio_file_destroy(audio_file);
+        return GenesisErrorNoMem;
     }
+    for (int i = 0; i < cache->chunk_count; i += 1)
+        cache->chunks[i].chunk_index.store(-1);
+    for (int i = 0; i < AUDIO_FILE_REQUEST_COUNT; i += 1)
+        cache->requests[i].store(-1);
 
-    av_frame_free(&audio_file->in_frame); audio_file->in_frame = nullptr;
-    avcodec_close(audio_file->codec_ctx); audio_file->codec_ctx = nullptr;
-    avformat_close_input(&audio_file->ic); audio_file->ic = nullptr;
+    if ((err = stream_pool_add_file(context->stream_pool, audio_file))) {
+        genesis_audio_file_destroy(audio_file);
+        return err;
+    }
+
+    // most playback starts at the beginning
+    stream_request_chunks(cache, 0, STREAM_READAHEAD_CHUNKS + 1);
 
     *out_audio_file = audio_file;
     return 0;
 }
 
+bool genesis_audio_file_is_streaming(const struct GenesisAudioFile *audio_file) {
+    return audio_file->stream_cache != nullptr;
+}
+
+long genesis_audio_file_cache_miss_count(const struct GenesisAudioFile *audio_file) {
+    return audio_file->stream_cache ? audio_file->stream_cache->miss_count.load() : 0;
+}
+
 void genesis_audio_file_destroy(struct GenesisAudioFile *audio_file) {
     if (audio_file) {
+        AudioFileStreamCache *cache = audio_file->stream_cache;
+        if (cache) {
+            if (cache->pool)
+                stream_pool_remove_file(cache->pool, audio_file);
+            destroy(cache->chunks, cache->chunk_count);
+            destroy(cache, 1);
+        }
+        os_unmap_file(&audio_file->mapped_file);
         av_frame_free(&audio_file->in_frame);
         if (audio_file->codec_ctx)
             avcodec_close(audio_file->codec_ctx);
@@ -672,172 +1424,100 @@ static void set_codec_ctx_format(AVCodecContext *codec_ctx, GenesisExportFormat
     }
 }
 
-static void write_frames_uint8_planar(const float *frames, int channel_count,
-        int offset, int end, uint8_t *buffer, AVFrame *frame)
+// Number of samples of one channel gathered at a time from interleaved frames
+// before they are converted into a plane.
+static const int EXPORT_BLOCK_SAMPLES = 1024;
+
+static void write_frames_planar(const float *frames, int channel_count, int offset,
+        int end, AVFrame *frame, SampleConvertFromFloatFn *from_float, int bytes_per_sample)
 {
     for (int ch = 0; ch < channel_count; ch += 1) {
         uint8_t *ch_buf = frame->extended_data[ch] + offset;
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            *ch_buf = (uint8_t)clamp(0.0f, (sample * 127.5f) + 127.5f, (float)UINT8_MAX);
-            ch_buf += 1;
+        float block[EXPORT_BLOCK_SAMPLES];
+        for (int start = 0; start < end; start += EXPORT_BLOCK_SAMPLES) {
+            int count = min(EXPORT_BLOCK_SAMPLES, end - start);
+            // float planes take the samples directly
+            float *dest = from_float ? block : reinterpret_cast<float*>(ch_buf) + start;
+            const float *src = frames + start * channel_count + ch;
+            for (int i = 0; i < count; i += 1, src += channel_count)
+                dest[i] = *src;
+            if (from_float)
+                from_float(ch_buf + start * bytes_per_sample, block, count);
         }
     }
 }
 
+static void write_frames_uint8_planar(const float *frames, int channel_count,
+        int offset, int end, uint8_t *buffer, AVFrame *frame)
+{
+    write_frames_planar(frames, channel_count, offset, end, frame, sample_convert_float_to_u8, 1);
+}
+
 static void write_frames_int16_planar(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *frame)
 {
-    for (int ch = 0; ch < channel_count; ch += 1) {
-        int16_t *ch_buf = reinterpret_cast<int16_t*>(frame->extended_data[ch] + offset);
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            *ch_buf = (int16_t)clamp((float)INT16_MIN, sample * 32767.0f, (float)INT16_MAX);
-            ch_buf += 1;
-        }
-    }
+    write_frames_planar(frames, channel_count, offset, end, frame, sample_convert_float_to_s16, 2);
 }
 
 static void write_frames_int32_planar(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *frame)
 {
-    for (int ch = 0; ch < channel_count; ch += 1) {
-        int32_t *ch_buf = reinterpret_cast<int32_t*>(frame->extended_data[ch] + offset);
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            *ch_buf = (int32_t)clamp((double)INT32_MIN, sample * 2147483647.0, (double)INT32_MAX);
-            ch_buf += 1;
-        }
-    }
+    write_frames_planar(frames, channel_count, offset, end, frame, sample_convert_float_to_s32, 4);
 }
 
 static void write_frames_int24_planar(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *frame)
 {
-
-    for (int ch = 0; ch < channel_count; ch += 1) {
-        int32_t *ch_buf = reinterpret_cast<int32_t*>(frame->extended_data[ch] + offset);
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            // ffmpeg looks at the most significant bytes
-            *ch_buf = ((int32_t)clamp(int24_min, sample * 8388607.0f, int24_max)) << 8;
-            ch_buf += 1;
-        }
-    }
+    write_frames_planar(frames, channel_count, offset, end, frame, sample_convert_float_to_s24, 4);
 }
 
 static void write_frames_float_planar(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *frame)
 {
-    for (int ch = 0; ch < channel_count; ch += 1) {
-        float *ch_buf = reinterpret_cast<float*>(frame->extended_data[ch] + offset);
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            *ch_buf = (float)sample;
-            ch_buf += 1;
-        }
-    }
+    write_frames_planar(frames, channel_count, offset, end, frame, nullptr, 4);
 }
 
 static void write_frames_double_planar(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *frame)
 {
-    for (int ch = 0; ch < channel_count; ch += 1) {
-        double *ch_buf = reinterpret_cast<double*>(frame->extended_data[ch] + offset);
-        for (int i = 0; i < end; i += 1) {
-            float sample = frames[i * channel_count + ch];
-            *ch_buf = sample;
-            ch_buf += 1;
-        }
-    }
+    write_frames_planar(frames, channel_count, offset, end, frame, sample_convert_float_to_double, 8);
 }
 
+// interleaved samples convert as one flat run
 static void write_frames_uint8(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-
-            *buffer = (uint8_t)clamp(0.0f, (sample * 127.5f) + 127.5f, (float)UINT8_MAX);
-
-            buffer += 1;
-        }
-    }
+    sample_convert_float_to_u8(buffer, frames, end * channel_count);
 }
 
 static void write_frames_int16(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-
-            int16_t *int_ptr = reinterpret_cast<int16_t*>(buffer);
-            *int_ptr = (int16_t)clamp((float)INT16_MIN, sample * 32767.0f, (float)INT16_MAX);
-
-            buffer += 2;
-        }
-    }
+    sample_convert_float_to_s16(buffer, frames, end * channel_count);
 }
 
 static void write_frames_int32(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-
-            int32_t *int_ptr = reinterpret_cast<int32_t*>(buffer);
-            *int_ptr = (int32_t)clamp((double)INT32_MIN, sample * 2147483647.0, (double)INT32_MAX);
-
-            buffer += 4;
-        }
-    }
+    sample_convert_float_to_s32(buffer, frames, end * channel_count);
 }
 
 static void write_frames_int24(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-
-            int32_t *int_ptr = reinterpret_cast<int32_t*>(buffer);
-            // ffmpeg looks at the most significant bytes
-            *int_ptr = ((int32_t)clamp(int24_min, sample * 8388607.0f, int24_max) << 8);
-
-            buffer += 4;
-        }
-    }
+    sample_convert_float_to_s24(buffer, frames, end * channel_count);
 }
 
 static void write_frames_float(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-
-            float *float_ptr = reinterpret_cast<float*>(buffer);
-            *float_ptr = (float)sample;
-
-            buffer += 4;
-        }
-    }
+    memcpy(buffer, frames, end * channel_count * sizeof(float));
 }
 
 static void write_frames_double(const float *frames, int channel_count,
         int offset, int end, uint8_t *buffer, AVFrame *)
 {
-    for (int i = 0; i < end; i += 1) {
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            float sample = frames[i * channel_count + ch];
-            double *double_ptr = reinterpret_cast<double*>(buffer);
-            *double_ptr = sample;
-            buffer += 8;
-        }
-    }
+    sample_convert_float_to_double(buffer, frames, end * channel_count);
 }
 
 static uint64_t to_ffmpeg_channel_id(enum SoundIoChannelId channel_id) {
@@ -879,6 +1559,9 @@ int genesis_audio_file_export(struct GenesisAudioFile *audio_file,
         const char *output_filename, int output_filename_len,
         struct GenesisExportFormat *export_format)
 {
+    if (audio_file->stream_cache)
+        return GenesisErrorInvalidState;
+
     GenesisAudioFileStream *afs = genesis_audio_file_stream_create(audio_file->genesis_context);
     if (!afs) {
         genesis_audio_file_stream_destroy(afs);
@@ -907,11 +1590,16 @@ int genesis_audio_file_export(struct GenesisAudioFile *audio_file,
     }
 
     float frame[GENESIS_MAX_CHANNELS];
+    GenesisAudioFileIterator iters[GENESIS_MAX_CHANNELS];
+    for (int ch = 0; ch < audio_file->channels.length(); ch += 1)
+        iters[ch] = genesis_audio_file_iterator(audio_file, ch, 0);
     long frame_count = genesis_audio_file_frame_count(audio_file);
     for (long frame_i = 0; frame_i < frame_count; frame_i += 1) {
         for (int ch = 0; ch < audio_file->channels.length(); ch += 1) {
-            Channel *channel = &audio_file->channels.at(ch);
-            frame[ch] = channel->samples.at(frame_i);
+            GenesisAudioFileIterator *it = &iters[ch];
+            if (frame_i >= it->end)
+                genesis_audio_file_iterator_next(it);
+            frame[ch] = it->ptr[frame_i - it->start];
         }
         genesis_audio_file_stream_write(afs, frame, 1);
     }
@@ -960,6 +1648,7 @@ int audio_file_init(void) {
     av_log_set_level(AV_LOG_QUIET);
     avcodec_register_all();
     av_register_all();
+    sample_convert_init();
     return 0;
 }
 
@@ -1102,6 +1791,10 @@ const struct SoundIoChannelLayout *genesis_audio_file_channel_layout(const struc
 }
 
 long genesis_audio_file_frame_count(const struct GenesisAudioFile *audio_file) {
+    if (audio_file->stream_cache)
+        return audio_file->stream_cache->frame_count;
+    if (audio_file->mapped_samples)
+        return audio_file->mapped_frame_count;
     return audio_file->channels.at(0).samples.length();
 }
 
@@ -1109,25 +1802,97 @@ int genesis_audio_file_sample_rate(const struct GenesisAudioFile *audio_file) {
     return audio_file->sample_rate;
 }
 
+static void mapped_iterator_seek(GenesisAudioFileIterator *it, long frame_index) {
+    GenesisAudioFile *audio_file = it->audio_file;
+    long frame_count = audio_file->mapped_frame_count;
+    if (frame_index >= frame_count) {
+        it->start = frame_count;
+        it->end = frame_count;
+        it->ptr = nullptr;
+        return;
+    }
+    long block_index = frame_index / AUDIO_FILE_CHUNK_FRAMES;
+    long block_start = block_index * AUDIO_FILE_CHUNK_FRAMES;
+    long block_offset = (block_index * audio_file->channel_layout.channel_count + it->channel_index) *
+        AUDIO_FILE_CHUNK_FRAMES;
+    it->start = frame_index;
+    it->end = min(block_start + AUDIO_FILE_CHUNK_FRAMES, frame_count);
+    it->ptr = const_cast<float *>(audio_file->mapped_samples) + block_offset + (frame_index - block_start);
+}
+
 struct GenesisAudioFileIterator genesis_audio_file_iterator(
         struct GenesisAudioFile *audio_file, int channel_index, long start_frame_index)
 {
-    long frame_count = genesis_audio_file_frame_count(audio_file);
-    return {
-        audio_file,
-        start_frame_index,
-        frame_count,
-        audio_file->channels.at(channel_index).samples.raw() + start_frame_index,
-    };
+    GenesisAudioFileIterator it = {};
+    it.audio_file = audio_file;
+    it.channel_index = channel_index;
+    if (audio_file->stream_cache) {
+        stream_iterator_seek(&it, start_frame_index);
+        return it;
+    }
+    if (audio_file->mapped_samples) {
+        mapped_iterator_seek(&it, start_frame_index);
+        return it;
+    }
+    it.start = start_frame_index;
+    it.end = genesis_audio_file_frame_count(audio_file);
+    it.ptr = audio_file->channels.at(channel_index).samples.raw() + start_frame_index;
+    return it;
 }
 
 void genesis_audio_file_iterator_next(struct GenesisAudioFileIterator *it) {
+    genesis_audio_file_iterator_release(it);
+    if (it->audio_file->stream_cache) {
+        stream_iterator_seek(it, it->end);
+        return;
+    }
+    if (it->audio_file->mapped_samples) {
+        mapped_iterator_seek(it, it->end);
+        return;
+    }
     long frame_count = genesis_audio_file_frame_count(it->audio_file);
     it->start = frame_count;
     it->end = frame_count;
     it->ptr = nullptr;
 }
 
+void genesis_audio_file_iterator_wait(struct GenesisAudioFileIterator *it) {
+    GenesisAudioFile *audio_file = it->audio_file;
+    AudioFileStreamCache *cache = audio_file->stream_cache;
+    if (it->ptr || it->start >= it->end || !cache)
+        return;
+    AudioFileStreamPool *pool = cache->pool;
+    long frame_index = it->start;
+    long chunk_index = frame_index / AUDIO_FILE_CHUNK_FRAMES;
+    for (;;) {
+        // take the decoder from the prefetch threads and decode the chunk here
+        {
+            OsMutexLocker locker(pool->mutex);
+            while (cache->busy)
+                os_cond_wait(pool->cond, pool->mutex);
+            cache->busy = true;
+        }
+        bool loaded = stream_load_chunk(audio_file, chunk_index);
+        {
+            OsMutexLocker locker(pool->mutex);
+            cache->busy = false;
+            os_cond_broadcast(pool->cond, pool->mutex);
+        }
+        // another file may have evicted the chunk before it is pinned here
+        stream_iterator_seek(it, frame_index);
+        if (it->ptr || !loaded)
+            return;
+    }
+}
+
+void genesis_audio_file_iterator_release(struct GenesisAudioFileIterator *it) {
+    if (it->chunk) {
+        it->chunk->pin_count -= 1;
+        it->chunk = nullptr;
+        it->ptr = nullptr;
+    }
+}
+
 bool genesis_audio_file_codec_supports_sample_format(
         const struct GenesisAudioFileCodec *audio_file_codec,
         enum SoundIoFormat sample_format)
@@ -1298,6 +2063,7 @@ struct GenesisAudioFileStream *genesis_audio_file_stream_create(struct GenesisCo
     if (!afs)
         return nullptr;
 
+    afs->context = context;
     return afs;
 }
 
@@ -1327,6 +2093,16 @@ void genesis_audio_file_stream_set_export_format(struct GenesisAudioFileStream *
     afs->export_format = *export_format;
 }
 
+// Seconds of audio genesis_audio_file_stream_write can queue ahead of the
+// encoder before it blocks.
+static const double ENCODE_QUEUE_DURATION = 2.0;
+
+// Output frames the encoder thread resamples at a time.
+static const int RESAMPLE_BUF_FRAME_COUNT = 4096;
+
+static void encoder_thread_run(void *arg);
+static void flush_resampler(GenesisAudioFileStream *afs);
+
 static int afs_avio_write_packet(void *opaque, uint8_t *buf, int buf_size) {
     struct GenesisAudioFileStream *afs = (GenesisAudioFileStream *)opaque;
     return fwrite(buf, 1, buf_size, afs->file);
@@ -1362,6 +2138,51 @@ static int64_t afs_avio_seek(void *opaque, int64_t offset, int whence) {
 }
 
 
+// Encodes the pkt_offset frames in the frame buffer and writes the packet,
+// if the encoder has one ready.
+static void encode_frame_buffer(GenesisAudioFileStream *afs) {
+    afs->frame->nb_samples = afs->pkt_offset;
+    int got_packet = 0;
+    int err = avcodec_encode_audio2(afs->stream->codec, &afs->pkt, afs->frame, &got_packet);
+    if (err < 0) {
+        char buf[256];
+        av_strerror(err, buf, sizeof(buf));
+        panic("error encoding audio frame: %s", buf);
+    }
+    if (got_packet) {
+        err = av_write_frame(afs->fmt_ctx, &afs->pkt);
+        if (err < 0)
+            panic("error writing frame");
+        av_packet_unref(&afs->pkt);
+    }
+
+    afs->frame->pts += afs->pkt_offset;
+    av_init_packet(&afs->pkt);
+    afs->pkt.data = NULL; // packet data will be allocated by the encoder
+    afs->pkt.size = 0;
+    afs->pkt_offset = 0;
+}
+
+// Encodes the frames left over from the last full codec frame. Codecs which
+// take only whole frames get the rest of the frame as silence.
+static void encode_last_frame(GenesisAudioFileStream *afs) {
+    if (afs->pcm_passthrough || afs->pkt_offset == 0)
+        return;
+    const AVCodec *codec = afs->stream->codec->codec;
+    if (!(codec->capabilities & (CODEC_CAP_SMALL_LAST_FRAME|CODEC_CAP_VARIABLE_FRAME_SIZE))) {
+        int silence_frame_count = afs->buffer_frame_count - afs->pkt_offset;
+        float *silence = ok_mem(allocate_zero<float>(
+                    silence_frame_count * afs->channel_layout.channel_count));
+        afs->write_frames(silence, afs->channel_layout.channel_count,
+                afs->pkt_offset * afs->bytes_per_sample, silence_frame_count,
+                afs->frame_buffer + afs->pkt_offset * afs->bytes_per_frame, afs->frame);
+        destroy(silence, silence_frame_count * afs->channel_layout.channel_count);
+        afs->pkt_offset = afs->buffer_frame_count;
+    }
+    encode_frame_buffer(afs);
+    afs->frame->nb_samples = afs->buffer_frame_count;
+}
+
 int genesis_audio_file_stream_open(struct GenesisAudioFileStream *afs,
         const char *file_path, int file_path_len)
 {
@@ -1537,17 +2358,81 @@ int genesis_audio_file_stream_open(struct GenesisAudioFileStream *afs,
     afs->bytes_per_sample = soundio_get_bytes_per_sample(afs->export_format.sample_format);
     afs->bytes_per_frame = afs->bytes_per_sample * afs->channel_layout.channel_count;
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    afs->pcm_passthrough = codec_ctx->codec_id == AV_CODEC_ID_PCM_F32LE &&
+        codec_ctx->sample_fmt == AV_SAMPLE_FMT_FLT;
+#else
+    afs->pcm_passthrough = false;
+#endif
+
     av_init_packet(&afs->pkt);
     afs->pkt.data = NULL; // packet data will be allocated by the encoder
     afs->pkt.size = 0;
     afs->pkt_offset = 0;
 
+    afs->resample_in_frame_count = 0;
+    afs->resample_out_frame_count = 0;
+    if (afs->sample_rate != codec_ctx->sample_rate) {
+        if ((err = resample_stream_create(afs->context, afs->sample_rate, codec_ctx->sample_rate,
+                        afs->channel_layout.channel_count, GenesisResampleQualityBest, &afs->resampler)))
+        {
+            genesis_audio_file_stream_close(afs);
+            return err;
+        }
+        afs->resample_buf_frame_count = RESAMPLE_BUF_FRAME_COUNT;
+        afs->resample_buf = allocate_nonzero<float>(
+                afs->resample_buf_frame_count * afs->channel_layout.channel_count);
+        if (!afs->resample_buf) {
+            genesis_audio_file_stream_close(afs);
+            return GenesisErrorNoMem;
+        }
+    }
+
+    afs->queue_bytes_per_frame = sizeof(float) * afs->channel_layout.channel_count;
+    int queue_frame_count = ENCODE_QUEUE_DURATION * afs->sample_rate;
+    if ((err = ring_buffer_init(&afs->encode_queue, queue_frame_count * afs->queue_bytes_per_frame))) {
+        genesis_audio_file_stream_close(afs);
+        return err;
+    }
+    afs->encode_queue_init = true;
+    // wake the encoder once per codec frame, but never wait for more than
+    // half the queue or the writer could block on a sleeping encoder
+    afs->encode_block_bytes = min(afs->buffer_frame_count * afs->queue_bytes_per_frame,
+            afs->encode_queue.capacity / 2);
+
+    afs->stall_count.store(0);
+    afs->stall_seconds.store(0.0);
+    afs->encoder_closing.store(false);
+    afs->encoder_sleeping.store(false);
+    afs->writer_sleeping.store(false);
+    if ((err = os_thread_create(encoder_thread_run, afs, false, &afs->encoder_thread))) {
+        genesis_audio_file_stream_close(afs);
+        return err;
+    }
+
     return 0;
 }
 
 int genesis_audio_file_stream_close(struct GenesisAudioFileStream *afs) {
+    if (afs->encoder_thread) {
+        afs->encoder_closing.store(true);
+        afs->encoder_wake_seq += 1;
+        os_futex_wake(reinterpret_cast<int*>(&afs->encoder_wake_seq), 1);
+        os_thread_destroy(afs->encoder_thread);
+        afs->encoder_thread = nullptr;
+    }
+    if (afs->encode_queue_init) {
+        ring_buffer_deinit(&afs->encode_queue);
+        afs->encode_queue_init = false;
+    }
+
     int err;
     if (afs->fmt_ctx) {
+        if (afs->frame) {
+            if (afs->resampler)
+                flush_resampler(afs);
+            encode_last_frame(afs);
+        }
         // flush the encoder
         for (;;) {
             int got_packet = 0;
@@ -1601,18 +2486,41 @@ int genesis_audio_file_stream_close(struct GenesisAudioFileStream *afs) {
     destroy(afs->frame_buffer, afs->frame_buffer_size);
     afs->frame_buffer = nullptr;
 
+    resample_stream_destroy(afs->resampler);
+    afs->resampler = nullptr;
+    destroy(afs->resample_buf, afs->resample_buf_frame_count * afs->channel_layout.channel_count);
+    afs->resample_buf = nullptr;
+
     av_frame_free(&afs->frame);
     afs->frame = nullptr;
 
     return 0;
 }
 
-int genesis_audio_file_stream_write(struct GenesisAudioFileStream *afs,
-        const float *frames, int source_frame_count)
-{
-    int channel_count = afs->channel_layout.channel_count;
-    int err;
+// The frames are already in the byte layout of the codec, so they become the
+// packet as they are, with no copy into the frame or through the encoder.
+static void write_pcm_packet(GenesisAudioFileStream *afs, const float *frames, int frame_count) {
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = (uint8_t *)frames;
+    pkt.size = frame_count * afs->queue_bytes_per_frame;
+    pkt.pts = afs->frame->pts;
+    pkt.dts = pkt.pts;
+    pkt.duration = frame_count;
+    pkt.stream_index = afs->stream->index;
+    if (av_write_frame(afs->fmt_ctx, &pkt) < 0)
+        panic("error writing frame");
+    afs->frame->pts += frame_count;
+}
+
+// Runs on the encoder thread.
+static void encode_frames(GenesisAudioFileStream *afs, const float *frames, int source_frame_count) {
+    if (afs->pcm_passthrough) {
+        write_pcm_packet(afs, frames, source_frame_count);
+        return;
+    }
 
+    int channel_count = afs->channel_layout.channel_count;
     int pkt_frames_left = afs->buffer_frame_count - afs->pkt_offset;
 
     while (source_frame_count > 0) {
@@ -1629,28 +2537,142 @@ int genesis_audio_file_stream_write(struct GenesisAudioFileStream *afs,
 
 
         if (pkt_frames_left <= 0) {
-            int got_packet = 0;
-            err = avcodec_encode_audio2(afs->stream->codec, &afs->pkt, afs->frame, &got_packet);
-            if (err < 0) {
-                char buf[256];
-                av_strerror(err, buf, sizeof(buf));
-                panic("error encoding audio frame: %s", buf);
-            }
-            if (got_packet) {
-                err = av_write_frame(afs->fmt_ctx, &afs->pkt);
-                if (err < 0)
-                    panic("error writing frame");
-                av_packet_unref(&afs->pkt);
-            }
-
-            afs->frame->pts += afs->buffer_frame_count;
-            av_init_packet(&afs->pkt);
-            afs->pkt.data = NULL; // packet data will be allocated by the encoder
-            afs->pkt.size = 0;
-            afs->pkt_offset = 0;
+            encode_frame_buffer(afs);
             pkt_frames_left = afs->buffer_frame_count - afs->pkt_offset;
         }
     }
+}
+
+// Runs on the encoder thread. Resamples the frames, if needed, and encodes them.
+static void encode_queued_frames(GenesisAudioFileStream *afs, const float *frames, int frame_count) {
+    if (!afs->resampler) {
+        encode_frames(afs, frames, frame_count);
+        return;
+    }
+    int channel_count = afs->channel_layout.channel_count;
+    afs->resample_in_frame_count += frame_count;
+    for (;;) {
+        int read_count;
+        int written_count;
+        resample_stream_process(afs->resampler, frames, frame_count,
+                afs->resample_buf, afs->resample_buf_frame_count, &read_count, &written_count);
+        encode_frames(afs, afs->resample_buf, written_count);
+        afs->resample_out_frame_count += written_count;
+        frames += read_count * channel_count;
+        frame_count -= read_count;
+        if (frame_count == 0 && written_count < afs->resample_buf_frame_count)
+            break;
+    }
+}
+
+// The resampler holds back the frames whose filter window reaches past the
+// end of the input. Feeds it silence until the output covers the input.
+static void flush_resampler(GenesisAudioFileStream *afs) {
+    long out_sample_rate = afs->stream->codec->sample_rate;
+    long target_frame_count = (afs->resample_in_frame_count * out_sample_rate +
+            afs->sample_rate - 1) / afs->sample_rate;
+    int channel_count = afs->channel_layout.channel_count;
+    int silence_frame_count = afs->resample_buf_frame_count;
+    float *silence = ok_mem(allocate_zero<float>(silence_frame_count * channel_count));
+    while (afs->resample_out_frame_count < target_frame_count) {
+        int out_count = min((long)afs->resample_buf_frame_count,
+                target_frame_count - afs->resample_out_frame_count);
+        int read_count;
+        int written_count;
+        resample_stream_process(afs->resampler, silence, silence_frame_count,
+                afs->resample_buf, out_count, &read_count, &written_count);
+        encode_frames(afs, afs->resample_buf, written_count);
+        afs->resample_out_frame_count += written_count;
+    }
+    destroy(silence, silence_frame_count * channel_count);
+}
+
+static void encoder_thread_run(void *arg) {
+    GenesisAudioFileStream *afs = (GenesisAudioFileStream *)arg;
+    RingBuffer *queue = &afs->encode_queue;
+    for (;;) {
+        int wake_seq = afs->encoder_wake_seq.load();
+        // load closing before the fill count so that no write made before
+        // closing is missed
+        bool closing = afs->encoder_closing.load();
+        int fill_count = ring_buffer_fill_count(queue);
+        if (fill_count >= afs->encode_block_bytes || (closing && fill_count > 0)) {
+            const float *frames = (const float *)ring_buffer_read_ptr(queue);
+            encode_queued_frames(afs, frames, fill_count / afs->queue_bytes_per_frame);
+            ring_buffer_advance_read_ptr(queue, fill_count);
+            if (afs->writer_sleeping.load()) {
+                afs->writer_wake_seq += 1;
+                os_futex_wake(reinterpret_cast<int*>(&afs->writer_wake_seq), 1);
+            }
+            continue;
+        }
+        if (closing)
+            break;
+
+        afs->encoder_sleeping.store(true);
+        if (ring_buffer_fill_count(queue) < afs->encode_block_bytes && !afs->encoder_closing.load())
+            os_futex_wait(reinterpret_cast<int*>(&afs->encoder_wake_seq), wake_seq);
+        afs->encoder_sleeping.store(false);
+    }
+}
+
+// Blocks until the encoder has made room for at least one frame.
+static void wait_for_encode_queue_space(GenesisAudioFileStream *afs) {
+    double start_time = os_get_time();
+    afs->stall_count += 1;
+    for (;;) {
+        int wake_seq = afs->writer_wake_seq.load();
+        afs->writer_sleeping.store(true);
+        if (ring_buffer_free_count(&afs->encode_queue) >= afs->queue_bytes_per_frame)
+            break;
+        os_futex_wait(reinterpret_cast<int*>(&afs->writer_wake_seq), wake_seq);
+    }
+    afs->writer_sleeping.store(false);
+    afs->stall_seconds.add(os_get_time() - start_time);
+}
+
+int genesis_audio_file_stream_write(struct GenesisAudioFileStream *afs,
+        const float *frames, int frame_count)
+{
+    RingBuffer *queue = &afs->encode_queue;
+    int channel_count = afs->channel_layout.channel_count;
+    while (frame_count > 0) {
+        int free_frames = ring_buffer_free_count(queue) / afs->queue_bytes_per_frame;
+        if (free_frames == 0) {
+            wait_for_encode_queue_space(afs);
+            continue;
+        }
+        int write_count = min(free_frames, frame_count);
+        int write_bytes = write_count * afs->queue_bytes_per_frame;
+        memcpy(ring_buffer_write_ptr(queue), frames, write_bytes);
+        ring_buffer_advance_write_ptr(queue, write_bytes);
+        frames += write_count * channel_count;
+        frame_count -= write_count;
 
+        if (afs->encoder_sleeping.load() && ring_buffer_fill_count(queue) >= afs->encode_block_bytes) {
+            afs->encoder_wake_seq += 1;
+            os_futex_wake(reinterpret_cast<int*>(&afs->encoder_wake_seq), 1);
+        }
+    }
     return 0;
 }
+
+int genesis_audio_file_stream_queue_depth(struct GenesisAudioFileStream *afs) {
+    if (!afs->encode_queue_init)
+        return 0;
+    return ring_buffer_fill_count(&afs->encode_queue) / afs->queue_bytes_per_frame;
+}
+
+int genesis_audio_file_stream_queue_capacity(struct GenesisAudioFileStream *afs) {
+    if (!afs->encode_queue_init)
+        return 0;
+    return afs->encode_queue.capacity / afs->queue_bytes_per_frame;
+}
+
+long genesis_audio_file_stream_stall_count(struct GenesisAudioFileStream *afs) {
+    return afs->stall_count.load();
+}
+
+double genesis_audio_file_stream_stall_seconds(struct GenesisAudioFileStream *afs) {
+    return afs->stall_seconds.load();
+}
@@ -6,11 +6,90 @@
 #include "hash_map.hpp"
 #include "byte_buffer.hpp"
 #include "ffmpeg.hpp"
+#include "atomics.hpp"
+#include "os.hpp"
+#include "ring_buffer.hpp"
+#include "atomic_double.hpp"
+
+static const int AUDIO_FILE_CHUNK_FRAMES = 16384;
+static const int AUDIO_FILE_REQUEST_COUNT = 32;
 
 struct Channel {
     List<float> samples;
 };
 
+struct ResampleContext;
+
+// A decoded span of AUDIO_FILE_CHUNK_FRAMES frames of a streaming audio file,
+// stored planar: one run of AUDIO_FILE_CHUNK_FRAMES samples per channel.
+// Readers pin a chunk and then check chunk_index again; prefetch threads
+// clear chunk_index and then check pin_count before evicting. Both sides
+// use sequentially consistent operations, so a pinned chunk is never evicted.
+struct GenesisAudioFileChunk {
+    atomic_long chunk_index; // -1 if empty or being decoded
+    atomic_int pin_count;
+    atomic_long last_used;
+    // nullptr until the slot is first filled, and after the pool takes the
+    // memory back. only read by readers which pinned the chunk.
+    float *samples;
+};
+
+// Prefetch threads and chunk memory shared by every streaming audio file of
+// a GenesisContext. A thread decodes for one file at a time. Chunk memory is
+// allocated as chunks are filled, up to channel_chunk_budget for all files
+// together; past that, filling a chunk evicts the least recently used
+// unpinned chunk of any file.
+struct AudioFileStreamPool {
+    OsMutex *mutex;
+    // broadcast when a prefetch thread lets go of a file
+    OsCond *cond;
+    // guarded by mutex
+    List<GenesisAudioFile *> files;
+    int next_file_index;
+    // memory counted in channels of one chunk. guarded by mutex
+    long channel_chunks_used;
+    long channel_chunk_budget;
+
+    OsThread **threads;
+    int thread_count;
+    atomic_bool running;
+    atomic_int wake_seq;
+    atomic_long use_clock;
+};
+
+int audio_file_stream_pool_create(AudioFileStreamPool **out_pool);
+// every streaming audio file of the pool must be destroyed first
+void audio_file_stream_pool_destroy(AudioFileStreamPool *pool);
+// the default is 64 MiB. lowering it does not free memory right away.
+void audio_file_stream_pool_set_budget(AudioFileStreamPool *pool, long channel_chunk_count);
+
+struct AudioFileStreamCache {
+    AudioFileStreamPool *pool;
+    long frame_count;
+    // slots, at most STREAM_CHUNK_COUNT per file
+    GenesisAudioFileChunk *chunks;
+    int chunk_count;
+
+    // chunk indexes wanted by readers, -1 for a free entry. a reader which
+    // finds no free entry drops its request and asks again later.
+    atomic_long requests[AUDIO_FILE_REQUEST_COUNT];
+    // set by readers after making requests, cleared by the prefetch thread
+    // which takes them
+    atomic_bool pending;
+    atomic_bool closing;
+    atomic_long miss_count;
+    // a prefetch thread is decoding for this file. guarded by pool->mutex
+    bool busy;
+
+    // owned by the prefetch thread which is busy with the file. the channels
+    // of the audio file hold decoded samples starting at staging_start which
+    // are not yet copied into a chunk.
+    int stream_index;
+    long staging_start;
+    bool staging_start_unknown;
+    bool eof;
+};
+
 struct GenesisAudioFile {
     List<Channel> channels;
     SoundIoChannelLayout channel_layout;
@@ -19,11 +98,21 @@ struct GenesisAudioFile {
     AVFormatContext *ic;
     AVCodecContext *codec_ctx;
     AVFrame *in_frame;
+    int (*import_frame)(const AVFrame *, GenesisAudioFile *);
     GenesisContext *genesis_context;
+    // null unless loaded with genesis_audio_file_load_streaming
+    AudioFileStreamCache *stream_cache;
+    // set when loaded with genesis_audio_file_load_decoded. samples are read
+    // straight out of the mapping, in blocks laid out like stream cache chunks.
+    OsMappedFile mapped_file;
+    const float *mapped_samples;
+    long mapped_frame_count;
 };
 
 struct GenesisAudioFileStream {
+    GenesisContext *context;
     SoundIoChannelLayout channel_layout;
+    // rate of the frames passed to genesis_audio_file_stream_write
     int sample_rate;
     HashMap<ByteBuffer, ByteBuffer, ByteBuffer::hash> tags;
     GenesisExportFormat export_format;
@@ -43,6 +132,34 @@ struct GenesisAudioFileStream {
     int avio_buffer_size;
     int bytes_per_frame;
     int bytes_per_sample;
+    // queued frames are written to the muxer as they are, without the encoder
+    bool pcm_passthrough;
+
+    // Converts queued frames to the export sample rate on the encoder thread.
+    // nullptr when sample_rate is already the export sample rate.
+    ResampleContext *resampler;
+    float *resample_buf;
+    int resample_buf_frame_count;
+    long resample_in_frame_count;
+    long resample_out_frame_count;
+
+    // Interleaved float frames written by the caller, waiting for the encoder
+    // thread. Single producer, single consumer.
+    RingBuffer encode_queue;
+    bool encode_queue_init;
+    int queue_bytes_per_frame;
+    // the encoder sleeps until at least this many bytes are queued
+    int encode_block_bytes;
+    OsThread *encoder_thread;
+    atomic_bool encoder_closing;
+    // futex words, bumped to wake a sleeping encoder or writer
+    atomic_int encoder_wake_seq;
+    atomic_bool encoder_sleeping;
+    atomic_int writer_wake_seq;
+    atomic_bool writer_sleeping;
+    // only written by the writer
+    atomic_long stall_count;
+    AtomicDouble stall_seconds;
 };
 
 struct GenesisAudioFileCodec {
@@ -23,6 +23,7 @@ struct AudioClipNodeContext {
     AudioGraphClip *clip;
     GenesisAudioFile *audio_file;
     int frame_pos;
+    GenesisTempoCursor tempo_cursor;
 
     AudioClipVoice voices[AUDIO_CLIP_POLYPHONY];
     int next_note_index;
@@ -30,21 +31,68 @@ struct AudioClipNodeContext {
 
 struct AudioClipEventNodeContext {
     AudioGraphClip *clip;
-    double pos;
-    bool detect_ongoing_notes;
+    AudioGraphEventCursor cursor;
 };
 
+static void release_voice(AudioClipVoice *voice) {
+    voice->active = false;
+    for (int ch = 0; ch < GENESIS_MAX_CHANNELS; ch += 1)
+        genesis_audio_file_iterator_release(&voice->channels[ch].iter);
+}
+
 static AudioClipVoice *find_next_voice(AudioClipNodeContext *context) {
     for (int i = 0;; i += 1) {
         AudioClipVoice *voice = &context->voices[context->next_note_index];
         context->next_note_index = (context->next_note_index + 1) % AUDIO_CLIP_POLYPHONY;
-        if (!voice->active || i == AUDIO_CLIP_POLYPHONY)
+        if (!voice->active || i == AUDIO_CLIP_POLYPHONY) {
+            release_voice(voice);
             return voice;
+        }
+    }
+}
+
+// Adds frame_count frames of one channel into out, which has the given
+// stride. Unless wait is set it never blocks: a window that is not decoded
+// yet is silence, and is asked for again on the next call so that a late
+// chunk is picked up as soon as it arrives. Offline renders wait instead, so
+// that what they write does not depend on how fast the chunks are decoded.
+static void add_iterator_frames(GenesisAudioFileIterator *iter, long *offset,
+        float *out, int stride, int frame_count, bool wait)
+{
+    if (!iter->ptr && iter->start + *offset < iter->end) {
+        *iter = genesis_audio_file_iterator(iter->audio_file, iter->channel_index,
+                iter->start + *offset);
+        *offset = 0;
+        if (wait)
+            genesis_audio_file_iterator_wait(iter);
+    }
+    while (frame_count > 0) {
+        if (iter->start + *offset >= iter->end) {
+            genesis_audio_file_iterator_next(iter);
+            *offset = 0;
+            if (iter->start >= iter->end)
+                break;
+            if (wait)
+                genesis_audio_file_iterator_wait(iter);
+        }
+        int count = min((long)frame_count, iter->end - iter->start - *offset);
+        if (iter->ptr) {
+            const float *in = iter->ptr + *offset;
+            for (int i = 0; i < count; i += 1)
+                out[i * stride] += in[i];
+        }
+        out += count * stride;
+        *offset += count;
+        frame_count -= count;
     }
 }
 
 static void audio_clip_node_destroy(struct GenesisNode *node) {
     AudioClipNodeContext *audio_clip_context = (AudioClipNodeContext*)node->userdata;
+    if (audio_clip_context) {
+        for (int voice_i = 0; voice_i < AUDIO_CLIP_POLYPHONY; voice_i += 1)
+            release_voice(&audio_clip_context->voices[voice_i]);
+    }
     destroy(audio_clip_context, 1);
 }
 
@@ -67,8 +115,9 @@ static void audio_clip_node_seek(struct GenesisNode *node) {
     struct GenesisPort *audio_out_port = genesis_node_port(node, 0);
     int frame_rate = genesis_audio_port_sample_rate(audio_out_port);
     context->frame_pos = genesis_whole_notes_to_frames(pipeline, node->timestamp, frame_rate);
+    context->tempo_cursor.segment_index = 0;
     for (int voice_i = 0; voice_i < AUDIO_CLIP_POLYPHONY; voice_i += 1) {
-        context->voices[voice_i].active = false;
+        release_voice(&context->voices[voice_i]);
     }
 }
 
@@ -93,10 +142,14 @@ static void audio_clip_node_run(struct GenesisNode *node) {
         return;
     }
 
+    // the conversions below are near each other and near the previous block's
+    GenesisTempoCursor *cursor = &context->tempo_cursor;
     int frame_at_start = context->frame_pos;
-    double whole_note_at_start = genesis_frames_to_whole_notes(pipeline, frame_at_start, frame_rate);
+    double whole_note_at_start = genesis_frames_to_whole_notes_cursor(pipeline, cursor,
+            frame_at_start, frame_rate);
     int wanted_frame_at_end = frame_at_start + output_frame_count;
-    double wanted_whole_note_at_end = genesis_frames_to_whole_notes(pipeline, wanted_frame_at_end, frame_rate);
+    double wanted_whole_note_at_end = genesis_frames_to_whole_notes_cursor(pipeline, cursor,
+            wanted_frame_at_end, frame_rate);
     double event_time_requested = wanted_whole_note_at_end - whole_note_at_start;
     assert(event_time_requested >= 0.0);
 
@@ -105,17 +158,20 @@ static void audio_clip_node_run(struct GenesisNode *node) {
     genesis_events_in_port_fill_count(events_in_port, event_time_requested, &event_count, &event_buf_size);
 
     double whole_note_at_end = whole_note_at_start + event_buf_size;
-    int frame_at_event_end = genesis_whole_notes_to_frames(pipeline, whole_note_at_end, frame_rate);
+    int frame_at_event_end = genesis_whole_notes_to_frames_cursor(pipeline, cursor,
+            whole_note_at_end, frame_rate);
     int input_frame_count = max(0, frame_at_event_end - frame_at_start);
     int frame_count = min(output_frame_count, input_frame_count);
     int frame_at_consume_end = frame_at_start + frame_count;
-    double whole_note_at_consume_end = genesis_frames_to_whole_notes(pipeline, frame_at_consume_end, frame_rate);
+    double whole_note_at_consume_end = genesis_frames_to_whole_notes_cursor(pipeline, cursor,
+            frame_at_consume_end, frame_rate);
     double event_whole_notes_consumed = whole_note_at_consume_end - whole_note_at_start;
 
     GenesisMidiEvent *event = genesis_events_in_port_read_ptr(events_in_port);
     int event_index;
     for (event_index = 0; event_index < event_count; event_index += 1, event += 1) {
-        int frame_at_this_event_start = genesis_whole_notes_to_frames(pipeline, event->start, frame_rate);
+        int frame_at_this_event_start = genesis_whole_notes_to_frames_cursor(pipeline, cursor,
+                event->start, frame_rate);
         int frames_until_start = frame_at_this_event_start - frame_at_start;
         int frame_index_offset = 0;
         if (frames_until_start < 0) {
@@ -132,12 +188,12 @@ static void audio_clip_node_run(struct GenesisNode *node) {
 
             voice->active = true;
             voice->frames_until_start = frames_until_start;
-            voice->frame_index = event->data.segment_data.start;
+            voice->frame_index = event->data.segment_data.start + frame_index_offset;
             voice->frame_end = event->data.segment_data.end;
             for (int ch = 0; ch < channel_count; ch += 1) {
                 struct AudioClipNodeChannel *channel = &voice->channels[ch];
                 channel->iter = genesis_audio_file_iterator(context->audio_file, ch,
-                        frame_index_offset);
+                        voice->frame_index);
                 channel->offset = 0;
             }
         }
@@ -146,6 +202,7 @@ static void audio_clip_node_run(struct GenesisNode *node) {
 
     // set everything to silence and then we'll add samples in
     memset(out_buf, 0, frame_count * bytes_per_frame);
+    bool wait = genesis_pipeline_is_offline(pipeline);
 
     for (int voice_i = 0; voice_i < AUDIO_CLIP_POLYPHONY; voice_i += 1) {
         AudioClipVoice *voice = &context->voices[voice_i];
@@ -157,22 +214,14 @@ static void audio_clip_node_run(struct GenesisNode *node) {
         int frames_to_advance = min(out_frame_count, audio_file_frames_left);
         for (int ch = 0; ch < channel_count; ch += 1) {
             struct AudioClipNodeChannel *channel = &voice->channels[ch];
-            for (int frame_offset = 0; frame_offset < frames_to_advance; frame_offset += 1) {
-                if (channel->offset >= channel->iter.end) {
-                    genesis_audio_file_iterator_next(&channel->iter);
-                    channel->offset = 0;
-                }
-
-                int out_frame_index = voice->frames_until_start + frame_offset;
-                int out_sample_index = out_frame_index * channel_count + ch;
-                out_buf[out_sample_index] += channel->iter.ptr[channel->offset];
-                channel->offset += 1;
-            }
+            add_iterator_frames(&channel->iter, &channel->offset,
+                    &out_buf[voice->frames_until_start * channel_count + ch], channel_count,
+                    frames_to_advance, wait);
         }
         voice->frame_index += frames_to_advance;
         voice->frames_until_start = 0;
         if (frames_to_advance == audio_file_frames_left)
-            voice->active = false;
+            release_voice(voice);
     }
 
     context->frame_pos += frame_count;
@@ -199,42 +248,179 @@ static int audio_clip_event_node_create(struct GenesisNode *node) {
 
 static void audio_clip_event_node_seek(struct GenesisNode *node) {
     AudioClipEventNodeContext *audio_clip_event_node_context = (AudioClipEventNodeContext*)node->userdata;
-    audio_clip_event_node_context->pos = node->timestamp;
-    audio_clip_event_node_context->detect_ongoing_notes = true;
+    audio_graph_event_cursor_seek(&audio_clip_event_node_context->cursor, node->timestamp);
 }
 
-static void audio_clip_event_node_run(struct GenesisNode *node) {
-    AudioClipEventNodeContext *context = (AudioClipEventNodeContext*)node->userdata;
-    AudioGraphClip *clip = context->clip;
-    struct GenesisPort *events_out_port = genesis_node_port(node, 0);
+// orders events by start, and events which start together by segment, so
+// that a cursor can find the last event it sent in a new version
+static int compare_events(GenesisMidiEvent a, GenesisMidiEvent b) {
+    if (a.start < b.start)
+        return -1;
+    else if (a.start > b.start)
+        return 1;
+    else if (a.data.segment_data.start < b.data.segment_data.start)
+        return -1;
+    else if (a.data.segment_data.start > b.data.segment_data.start)
+        return 1;
+    else if (a.data.segment_data.end < b.data.segment_data.end)
+        return -1;
+    else if (a.data.segment_data.end > b.data.segment_data.end)
+        return 1;
+    else
+        return 0;
+}
 
-    int event_count;
-    double event_time_requested;
-    genesis_events_out_port_free_count(events_out_port, &event_count, &event_time_requested);
-    GenesisMidiEvent *event_buf = genesis_events_out_port_write_ptr(events_out_port);
+// index of the first event which starts at or after pos
+static int find_event_starting_at(const AudioGraphClipEvents *clip_events, double pos) {
+    int low = 0;
+    int high = clip_events->events.length();
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (clip_events->events.at(mid).start < pos)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// index of the first event at or after from which is still playing at pos,
+// or the event count if there is none
+static int find_event_reaching(const AudioGraphClipEvents *clip_events, int from, double pos) {
+    int event_count = clip_events->events.length();
+    if (from >= event_count)
+        return event_count;
+    const List<double> *tree = &clip_events->end_tree;
+    int node = clip_events->leaf_count + from;
+    // climb until a node covering events after from reaches past pos
+    while (tree->at(node) <= pos) {
+        while (node & 1) {
+            node >>= 1;
+            if (node == 0)
+                return event_count;
+        }
+        node += 1;
+    }
+    // then descend to its first leaf which does
+    while (node < clip_events->leaf_count) {
+        node *= 2;
+        if (tree->at(node) <= pos)
+            node += 1;
+    }
+    return node - clip_events->leaf_count;
+}
+
+// index of the first event not sent yet in a new version of the events
+static int find_event_resuming(const AudioGraphClipEvents *clip_events,
+        const AudioGraphEventCursor *cursor)
+{
+    int index = find_event_starting_at(clip_events, cursor->pos);
+    if (!cursor->has_last_sent || cursor->last_sent.start < cursor->pos)
+        return index;
+    // some events at pos were sent already. skip the events up to the last
+    // one sent, and as many equal to it as were sent.
+    const List<GenesisMidiEvent> *event_list = &clip_events->events;
+    int low = index;
+    int high = event_list->length();
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (compare_events(event_list->at(mid), cursor->last_sent) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (int i = 0; i < cursor->last_sent_count && low < event_list->length() &&
+            compare_events(event_list->at(low), cursor->last_sent) == 0; i += 1)
+    {
+        low += 1;
+    }
+    return low;
+}
+
+void audio_graph_clip_events_build_end_tree(AudioGraphClipEvents *clip_events) {
+    int event_count = clip_events->ends.length();
+    int leaf_count = 1;
+    while (leaf_count < event_count)
+        leaf_count *= 2;
+    List<double> *tree = &clip_events->end_tree;
+    ok_or_panic(tree->resize(leaf_count * 2));
+    for (int i = 0; i < leaf_count; i += 1)
+        tree->at(leaf_count + i) = (i < event_count) ? clip_events->ends.at(i) : -HUGE_VAL;
+    for (int node = leaf_count - 1; node >= 1; node -= 1)
+        tree->at(node) = max(tree->at(node * 2), tree->at(node * 2 + 1));
+    clip_events->leaf_count = leaf_count;
+}
 
-    double end_pos = context->pos + event_time_requested;
+void audio_graph_event_cursor_seek(AudioGraphEventCursor *cursor, double pos) {
+    cursor->pos = pos;
+    cursor->detect_ongoing_notes = true;
+    cursor->has_last_sent = false;
+}
+
+int audio_graph_event_cursor_run(AudioGraphEventCursor *cursor,
+        const AudioGraphClipEvents *clip_events, GenesisMidiEvent *out, int out_capacity,
+        double *time_requested)
+{
+    double event_time_requested = *time_requested;
+    double end_pos = cursor->pos + event_time_requested;
 
     int event_index = 0;
-    List<GenesisMidiEvent> *event_list = clip->events.get_read_ptr();
-    for (int i = 0; i < event_list->length(); i += 1) {
-        GenesisMidiEvent *event = &event_list->at(i);
-        if ((event->start >= context->pos || context->detect_ongoing_notes) &&
-                event->start < end_pos)
+    const List<GenesisMidiEvent> *event_list = &clip_events->events;
+    if (cursor->detect_ongoing_notes) {
+        // after a seek, send the events which started earlier and are still
+        // playing, as far as they fit
+        int first_at_pos = find_event_starting_at(clip_events, cursor->pos);
+        for (int i = find_event_reaching(clip_events, 0, cursor->pos);
+                i < first_at_pos && event_index < out_capacity;
+                i = find_event_reaching(clip_events, i + 1, cursor->pos))
         {
-            *event_buf = *event;
-            event_buf += 1;
+            out[event_index] = event_list->at(i);
             event_index += 1;
+        }
+        cursor->next_event_index = first_at_pos;
+    } else if (cursor->events_version != clip_events->version) {
+        cursor->next_event_index = find_event_resuming(clip_events, cursor);
+    }
+    cursor->events_version = clip_events->version;
 
-            if (event_index >= event_count) {
-                event_time_requested = event->start - context->pos;
-                break;
-            }
+    while (cursor->next_event_index < event_list->length()) {
+        const GenesisMidiEvent *event = &event_list->at(cursor->next_event_index);
+        if (event->start >= end_pos)
+            break;
+        if (event_index >= out_capacity) {
+            event_time_requested = event->start - cursor->pos;
+            break;
+        }
+        out[event_index] = *event;
+        event_index += 1;
+        cursor->next_event_index += 1;
+        if (cursor->has_last_sent && compare_events(*event, cursor->last_sent) == 0) {
+            cursor->last_sent_count += 1;
+        } else {
+            cursor->has_last_sent = true;
+            cursor->last_sent = *event;
+            cursor->last_sent_count = 1;
         }
     }
-    context->detect_ongoing_notes = false;
-    context->pos += event_time_requested;
-    genesis_events_out_port_advance_write_ptr(events_out_port, event_index, event_time_requested);
+    cursor->detect_ongoing_notes = false;
+    cursor->pos += event_time_requested;
+    *time_requested = event_time_requested;
+    return event_index;
+}
+
+static void audio_clip_event_node_run(struct GenesisNode *node) {
+    AudioClipEventNodeContext *context = (AudioClipEventNodeContext*)node->userdata;
+    struct GenesisPort *events_out_port = genesis_node_port(node, 0);
+
+    int event_count;
+    double event_time_requested;
+    genesis_events_out_port_free_count(events_out_port, &event_count, &event_time_requested);
+    GenesisMidiEvent *event_buf = genesis_events_out_port_write_ptr(events_out_port);
+
+    AudioGraphClipEvents *clip_events = context->clip->events.get_read_ptr();
+    int written_count = audio_graph_event_cursor_run(&context->cursor, clip_events,
+            event_buf, event_count, &event_time_requested);
+    genesis_events_out_port_advance_write_ptr(events_out_port, written_count, event_time_requested);
 }
 
 static void audio_file_node_run(struct GenesisNode *node) {
@@ -251,21 +437,12 @@ static void audio_file_node_run(struct GenesisNode *node) {
     int frames_to_advance = min(output_frame_count, audio_file_frames_left);
     assert(frames_to_advance >= 0);
 
+    memset(out_samples, 0, output_frame_count * 4 * channel_count);
     for (int ch = 0; ch < channel_count; ch += 1) {
         struct PlayChannelContext *channel_context = &ag->audio_file_channel_context[ch];
-        for (int frame_offset = 0; frame_offset < frames_to_advance; frame_offset += 1) {
-            if (channel_context->offset >= channel_context->iter.end) {
-                genesis_audio_file_iterator_next(&channel_context->iter);
-                channel_context->offset = 0;
-            }
-
-            out_samples[channel_count * frame_offset + ch] = channel_context->iter.ptr[channel_context->offset];
-
-            channel_context->offset += 1;
-        }
+        add_iterator_frames(&channel_context->iter, &channel_context->offset,
+                &out_samples[ch], channel_count, frames_to_advance, false);
     }
-    int silent_frames = output_frame_count - frames_to_advance;
-    memset(&out_samples[channel_count * frames_to_advance], 0, silent_frames * 4 * channel_count);
 
     ag->audio_file_frame_index += frames_to_advance;
     genesis_audio_out_port_advance_write_ptr(audio_out_port, output_frame_count);
@@ -278,7 +455,6 @@ static void render_node_run(struct GenesisNode *node) {
 
     int input_frame_count = genesis_audio_in_port_fill_count(audio_in_port);
     float *in_buf = genesis_audio_in_port_read_ptr(audio_in_port);
-    GenesisAudioFileStream *afs = ag->render_stream;
 
 
     int frames_left = ag->render_frame_count - ag->render_frame_index;
@@ -286,8 +462,10 @@ static void render_node_run(struct GenesisNode *node) {
 
     if (write_count > 0) {
         int err;
-        if ((err = genesis_audio_file_stream_write(afs, in_buf, write_count))) {
-            panic("TODO handle this error");
+        for (int i = 0; i < ag->render_streams.length(); i += 1) {
+            if ((err = genesis_audio_file_stream_write(ag->render_streams.at(i), in_buf, write_count))) {
+                panic("TODO handle this error");
+            }
         }
 
         long new_index = ag->render_frame_index.load() + write_count;
@@ -295,8 +473,10 @@ static void render_node_run(struct GenesisNode *node) {
         bool done = new_index == ag->render_frame_count;
 
         if (done) {
-            if ((err = genesis_audio_file_stream_close(afs))) {
-                panic("TODO handle this error");
+            for (int i = 0; i < ag->render_streams.length(); i += 1) {
+                if ((err = genesis_audio_file_stream_close(ag->render_streams.at(i)))) {
+                    panic("TODO handle this error");
+                }
             }
         }
 
@@ -326,59 +506,113 @@ static void stop_pipeline(AudioGraph *ag) {
 
     for (int i = 0; i < ag->audio_clip_list.length(); i += 1) {
         AudioGraphClip *clip = ag->audio_clip_list.at(i);
-        genesis_node_disconnect_all_ports(clip->node);
+        if (clip->node)
+            genesis_node_disconnect_all_ports(clip->node);
 
         genesis_node_destroy(clip->resample_node);
         clip->resample_node = nullptr;
     }
 }
 
-void audio_graph_start_pipeline(AudioGraph *ag) {
-    int err;
+// The preview node's port format follows the file being previewed, so the
+// node is re-created whenever the file changes.
+static void create_audio_file_node(AudioGraph *ag) {
+    if (ag->audio_file_node) {
+        genesis_node_destroy(ag->audio_file_node);
+        ag->audio_file_node = nullptr;
+    }
 
-    ag->start_play_head_pos = ag->play_head_pos;
+    if (ag->preview_audio_file) {
+        // Set channel layout
+        const struct SoundIoChannelLayout *channel_layout =
+            genesis_audio_file_channel_layout(ag->preview_audio_file);
+        genesis_audio_port_descriptor_set_channel_layout(
+                ag->audio_file_port_descr, channel_layout, true, -1);
+
+        // Set sample rate
+        int sample_rate = genesis_audio_file_sample_rate(ag->preview_audio_file);
+        genesis_audio_port_descriptor_set_sample_rate(ag->audio_file_port_descr, sample_rate, true, -1);
+
+    } else {
+        int target_sample_rate = genesis_pipeline_get_sample_rate(ag->pipeline);
+        SoundIoChannelLayout *target_channel_layout = genesis_pipeline_get_channel_layout(ag->pipeline);
+        genesis_audio_port_descriptor_set_channel_layout(
+                ag->audio_file_port_descr, target_channel_layout, true, -1);
+        genesis_audio_port_descriptor_set_sample_rate(
+                ag->audio_file_port_descr, target_sample_rate, true, -1);
+    }
+    ag->audio_file_node = ok_mem(genesis_node_descriptor_create_node(ag->audio_file_descr));
+}
 
-    if (genesis_pipeline_is_running(ag->pipeline))
-        return;
+static void connect_audio_file_node(AudioGraph *ag, int mixer_port_index) {
+    int err;
+    int audio_out_port_index = genesis_node_descriptor_find_port_index(ag->audio_file_descr, "audio_out");
+    if (audio_out_port_index < 0)
+        panic("port not found");
 
-    int target_sample_rate = genesis_pipeline_get_sample_rate(ag->pipeline);
-    SoundIoChannelLayout *target_channel_layout = genesis_pipeline_get_channel_layout(ag->pipeline);
+    GenesisPort *audio_out_port = genesis_node_port(ag->audio_file_node, audio_out_port_index);
+    GenesisPort *audio_in_port = genesis_node_port(ag->mixer_node, mixer_port_index);
 
-    int audio_file_node_count = ag->audio_file_port_descr ? 1 : 0;
+    if ((err = genesis_connect_ports(audio_out_port, audio_in_port))) {
+        if (err == GenesisErrorIncompatibleChannelLayouts ||
+            err == GenesisErrorIncompatibleSampleRates)
+        {
+            int resample_audio_out_index = genesis_node_descriptor_find_port_index(
+                    ag->resample_descr, "audio_out");
+            assert(resample_audio_out_index >= 0);
 
-    if (audio_file_node_count >= 1) {
+            ag->resample_node = ok_mem(genesis_node_descriptor_create_node(ag->resample_descr));
+            ok_or_panic(genesis_connect_audio_nodes(ag->audio_file_node, ag->resample_node));
 
-        if (ag->audio_file_node) {
-            genesis_node_destroy(ag->audio_file_node);
-            ag->audio_file_node = nullptr;
+            GenesisPort *audio_out_port = genesis_node_port(ag->resample_node, resample_audio_out_index);
+            ok_or_panic(genesis_connect_ports(audio_out_port, audio_in_port));
+        } else {
+            ok_or_panic(err);
         }
+    }
+}
 
-        if (ag->preview_audio_file) {
-            // Set channel layout
-            const struct SoundIoChannelLayout *channel_layout =
-                genesis_audio_file_channel_layout(ag->preview_audio_file);
-            genesis_audio_port_descriptor_set_channel_layout(
-                    ag->audio_file_port_descr, channel_layout, true, -1);
+// Clips whose asset has not loaded yet have no audio node and no mixer input.
+static int connected_clip_count(AudioGraph *ag) {
+    int count = 0;
+    for (int i = 0; i < ag->audio_clip_list.length(); i += 1) {
+        if (ag->audio_clip_list.at(i)->node)
+            count += 1;
+    }
+    return count;
+}
 
-            // Set sample rate
-            int sample_rate = genesis_audio_file_sample_rate(ag->preview_audio_file);
-            genesis_audio_port_descriptor_set_sample_rate(ag->audio_file_port_descr, sample_rate, true, -1);
+// Every clip plays through the master mixer line, so its volume is the gain
+// of each clip input. The preview input stays at unity gain.
+static void refresh_mixer_gains(AudioGraph *ag) {
+    if (!ag->mixer_node)
+        return;
+    MixerLine *master_mixer_line = ag->project->mixer_line_list.at(0);
+    int first_clip_input = ag->audio_file_port_descr ? 1 : 0;
+    int clip_count = connected_clip_count(ag);
+    for (int i = 0; i < clip_count; i += 1)
+        mixer_node_set_gain(ag->mixer_node, first_clip_input + i, master_mixer_line->volume);
+}
 
-        } else {
-            genesis_audio_port_descriptor_set_channel_layout(
-                    ag->audio_file_port_descr, target_channel_layout, true, -1);
-            genesis_audio_port_descriptor_set_sample_rate(
-                    ag->audio_file_port_descr, target_sample_rate, true, -1);
-        }
-        ag->audio_file_node = ok_mem(genesis_node_descriptor_create_node(ag->audio_file_descr));
-    }
+void audio_graph_start_pipeline(AudioGraph *ag) {
+    int err;
+
+    ag->start_play_head_pos = ag->play_head_pos;
+
+    if (genesis_pipeline_is_running(ag->pipeline))
+        return;
+
+    int audio_file_node_count = ag->audio_file_port_descr ? 1 : 0;
+
+    if (audio_file_node_count >= 1)
+        create_audio_file_node(ag);
 
 
     int resample_audio_out_index = genesis_node_descriptor_find_port_index(ag->resample_descr, "audio_out");
     assert(resample_audio_out_index >= 0);
 
     // one for each of the audio clips and one for the sample file preview node
-    int mix_port_count = audio_file_node_count + ag->audio_clip_list.length();
+    int mix_port_count = audio_file_node_count + connected_clip_count(ag);
 
     ok_or_panic(create_mixer_descriptor(ag->pipeline, mix_port_count, &ag->mixer_descr));
     ag->mixer_node = ok_mem(genesis_node_descriptor_create_node(ag->mixer_descr));
@@ -388,31 +622,13 @@ void audio_graph_start_pipeline(AudioGraph *ag) {
     // We start on mixer port index 1 because index 0 is the audio out. Index 1 is
     // the first audio in.
     int next_mixer_port = 1;
-    if (audio_file_node_count >= 1) {
-        int audio_out_port_index = genesis_node_descriptor_find_port_index(ag->audio_file_descr, "audio_out");
-        if (audio_out_port_index < 0)
-            panic("port not found");
-
-        GenesisPort *audio_out_port = genesis_node_port(ag->audio_file_node, audio_out_port_index);
-        GenesisPort *audio_in_port = genesis_node_port(ag->mixer_node, next_mixer_port++);
-
-        if ((err = genesis_connect_ports(audio_out_port, audio_in_port))) {
-            if (err == GenesisErrorIncompatibleChannelLayouts ||
-                err == GenesisErrorIncompatibleSampleRates)
-            {
-                ag->resample_node = ok_mem(genesis_node_descriptor_create_node(ag->resample_descr));
-                ok_or_panic(genesis_connect_audio_nodes(ag->audio_file_node, ag->resample_node));
-
-                GenesisPort *audio_out_port = genesis_node_port(ag->resample_node, resample_audio_out_index);
-                ok_or_panic(genesis_connect_ports(audio_out_port, audio_in_port));
-            } else {
-                ok_or_panic(err);
-            }
-        }
-    }
+    if (audio_file_node_count >= 1)
+        connect_audio_file_node(ag, next_mixer_port++);
 
     for (int i = 0; i < ag->audio_clip_list.length(); i += 1) {
         AudioGraphClip *clip = ag->audio_clip_list.at(i);
+        if (!clip->node)
+            continue;
 
         int audio_out_port_index = genesis_node_descriptor_find_port_index(clip->node_descr, "audio_out");
         if (audio_out_port_index < 0)
@@ -442,6 +658,7 @@ void audio_graph_start_pipeline(AudioGraph *ag) {
         ok_or_panic(genesis_connect_ports(events_out_port, events_in_port));
     }
 
+    refresh_mixer_gains(ag);
 
     fprintf(stderr, "\nStarting pipeline...\n");
     genesis_debug_print_pipeline(ag->pipeline);
@@ -453,9 +670,9 @@ void audio_graph_start_pipeline(AudioGraph *ag) {
         panic("unable to start pipeline: %s", genesis_strerror(err));
 }
 
-static void play_audio_file(AudioGraph *ag, GenesisAudioFile *audio_file, bool is_asset) {
-    // TODO atomically modify the pipeline instead of stopping and starting
-    stop_pipeline(ag);
+static void set_preview_audio_file(AudioGraph *ag, GenesisAudioFile *audio_file, bool is_asset) {
+    for (int ch = 0; ch < GENESIS_MAX_CHANNELS; ch += 1)
+        genesis_audio_file_iterator_release(&ag->audio_file_channel_context[ch].iter);
 
     if (ag->preview_audio_file && !ag->preview_audio_file_is_asset) {
         genesis_audio_file_destroy(ag->preview_audio_file);
@@ -481,8 +698,32 @@ static void play_audio_file(AudioGraph *ag, GenesisAudioFile *audio_file, bool i
             channel_context->iter = genesis_audio_file_iterator(ag->preview_audio_file, ch, 0);
         }
     }
+}
 
-    audio_graph_start_pipeline(ag);
+static void play_audio_file(AudioGraph *ag, GenesisAudioFile *audio_file, bool is_asset) {
+    if (!genesis_pipeline_is_running(ag->pipeline) || !ag->mixer_node) {
+        stop_pipeline(ag);
+        set_preview_audio_file(ag, audio_file, is_asset);
+        audio_graph_start_pipeline(ag);
+        return;
+    }
+
+    // Swap the preview node while the rest of the graph keeps playing.
+    genesis_pipeline_begin_edit(ag->pipeline);
+
+    genesis_node_destroy(ag->resample_node);
+    ag->resample_node = nullptr;
+
+    set_preview_audio_file(ag, audio_file, is_asset);
+
+    if (ag->audio_file_port_descr) {
+        create_audio_file_node(ag);
+        connect_audio_file_node(ag, 1);
+    }
+
+    int err;
+    if ((err = genesis_pipeline_commit_edit(ag->pipeline, audio_graph_play_head_pos(ag))))
+        panic("unable to update pipeline: %s", genesis_strerror(err));
 }
 
 static SoundIoDevice *get_device_for_id(AudioGraph *ag, DeviceId device_id) {
@@ -543,13 +784,12 @@ static void underrun_callback(void *userdata) {
     ag->events.trigger(EventBufferUnderrun);
 }
 
-static void add_audio_node_to_audio_clip(AudioGraph *ag, AudioGraphClip *clip) {
+static void add_audio_node_to_audio_clip(AudioGraph *ag, AudioGraphClip *clip,
+        GenesisAudioFile *audio_file)
+{
     assert(!clip->node_descr);
     assert(!clip->node);
 
-    ok_or_panic(project_ensure_audio_asset_loaded(ag->project, clip->audio_clip->audio_asset));
-    GenesisAudioFile *audio_file = clip->audio_clip->audio_asset->audio_file;
-
     const struct SoundIoChannelLayout *channel_layout =
         genesis_audio_file_channel_layout(audio_file);
     int sample_rate = genesis_audio_file_sample_rate(audio_file);
@@ -613,10 +853,42 @@ static void add_event_node_to_audio_clip(AudioGraph *ag, AudioGraphClip *clip) {
 }
 
 static void add_nodes_to_audio_clip(AudioGraph *ag, AudioGraphClip *clip) {
-    add_audio_node_to_audio_clip(ag, clip);
+    GenesisAudioFile *audio_file = project_audio_asset_file(ag->project, clip->audio_clip->audio_asset);
+    if (audio_file)
+        add_audio_node_to_audio_clip(ag, clip, audio_file);
     add_event_node_to_audio_clip(ag, clip);
 }
 
+// Gives an audio node to each clip whose asset was still loading when the
+// clip was added. With wait, blocks until the assets are loaded, so that a
+// render does not leave any clips out. Returns whether any nodes were added.
+static bool add_missing_audio_nodes(AudioGraph *ag, bool wait) {
+    bool any_added = false;
+    for (int i = 0; i < ag->audio_clip_list.length(); i += 1) {
+        AudioGraphClip *clip = ag->audio_clip_list.at(i);
+        if (clip->node)
+            continue;
+        AudioAsset *audio_asset = clip->audio_clip->audio_asset;
+        GenesisAudioFile *audio_file;
+        if (wait) {
+            int err;
+            if ((err = project_ensure_audio_asset_loaded(ag->project, audio_asset))) {
+                fprintf(stderr, "unable to load audio asset %s: %s\n",
+                        audio_asset->path.raw(), genesis_strerror(err));
+                continue;
+            }
+            audio_file = audio_asset->audio_file;
+        } else {
+            audio_file = project_audio_asset_file(ag->project, audio_asset);
+            if (!audio_file)
+                continue;
+        }
+        add_audio_node_to_audio_clip(ag, clip, audio_file);
+        any_added = true;
+    }
+    return any_added;
+}
+
 static void refresh_audio_clips(AudioGraph *ag) {
     Project *project = ag->project;
     int ag_i = 0;
@@ -650,12 +922,35 @@ static void refresh_audio_clips(AudioGraph *ag) {
     }
 }
 
+static void index_clip_events(AudioGraph *ag, AudioGraphClip *clip) {
+    AudioGraphClipEvents *clip_events = clip->events_write_ptr;
+    List<GenesisMidiEvent> *event_list = &clip_events->events;
+    event_list->sort<compare_events>();
+
+    // until the asset loads its events are indexed at the pipeline rate, and
+    // they are indexed again once it has
+    int frame_rate = project_audio_clip_sample_rate(ag->project, clip->audio_clip);
+    if (frame_rate < 0)
+        frame_rate = genesis_pipeline_get_sample_rate(ag->pipeline);
+    ok_or_panic(clip_events->ends.resize(event_list->length()));
+    for (int i = 0; i < event_list->length(); i += 1) {
+        GenesisMidiEvent *event = &event_list->at(i);
+        int frame_count = event->data.segment_data.end - event->data.segment_data.start;
+        int start_frame = genesis_whole_notes_to_frames(ag->pipeline, event->start, frame_rate);
+        double end = genesis_frames_to_whole_notes(ag->pipeline, start_frame + frame_count, frame_rate);
+        clip_events->ends.at(i) = end;
+    }
+    audio_graph_clip_events_build_end_tree(clip_events);
+    clip->events_version += 1;
+    clip_events->version = clip->events_version;
+}
+
 static void refresh_audio_clip_segments(AudioGraph *ag) {
     for (int clip_i = 0; clip_i < ag->audio_clip_list.length(); clip_i += 1) {
         AudioGraphClip *clip = ag->audio_clip_list.at(clip_i);
         clip->audio_clip->userdata = clip;
         clip->events_write_ptr = clip->events.write_begin();
-        clip->events_write_ptr->clear();
+        clip->events_write_ptr->events.clear();
     }
 
     auto it = ag->project->audio_clip_segments.entry_iterator();
@@ -668,8 +963,8 @@ static void refresh_audio_clip_segments(AudioGraph *ag) {
         AudioClip *audio_clip = segment->audio_clip;
         AudioGraphClip *clip = (AudioGraphClip *)audio_clip->userdata;
         assert(clip);
-        ok_or_panic(clip->events_write_ptr->add_one());
-        GenesisMidiEvent *event = &clip->events_write_ptr->last();
+        ok_or_panic(clip->events_write_ptr->events.add_one());
+        GenesisMidiEvent *event = &clip->events_write_ptr->events.last();
         event->event_type = GenesisMidiEventTypeSegment;
         event->start = segment->pos;
         event->data.segment_data.start = segment->start;
@@ -678,6 +973,7 @@ static void refresh_audio_clip_segments(AudioGraph *ag) {
 
     for (int i = 0; i < ag->audio_clip_list.length(); i += 1) {
         AudioGraphClip *clip = ag->audio_clip_list.at(i);
+        index_clip_events(ag, clip);
         clip->events.write_end();
         clip->events_write_ptr = nullptr;
     }
@@ -693,6 +989,26 @@ static void on_project_audio_clip_segments_changed(Event, void *userdata) {
     refresh_audio_clip_segments(ag);
 }
 
+static void on_project_mixer_lines_changed(Event, void *userdata) {
+    AudioGraph *ag = (AudioGraph *) userdata;
+    refresh_mixer_gains(ag);
+}
+
+static void on_project_audio_assets_load_progress(Event, void *userdata) {
+    AudioGraph *ag = (AudioGraph *) userdata;
+    // a render waited for its assets when it was created
+    if (ag->render_descr)
+        return;
+    if (!add_missing_audio_nodes(ag, false))
+        return;
+    refresh_audio_clip_segments(ag);
+    if (genesis_pipeline_is_running(ag->pipeline)) {
+        ag->play_head_pos = audio_graph_play_head_pos(ag);
+        stop_pipeline(ag);
+        audio_graph_start_pipeline(ag);
+    }
+}
+
 static AudioGraph *audio_graph_create_common(Project *project, GenesisContext *genesis_context,
         double latency)
 {
@@ -702,6 +1018,8 @@ static AudioGraph *audio_graph_create_common(Project *project, GenesisContext *g
     genesis_pipeline_set_latency(pipeline, latency);
     genesis_pipeline_set_sample_rate(pipeline, project->sample_rate);
     genesis_pipeline_set_channel_layout(pipeline, &project->channel_layout);
+    ok_or_panic(genesis_pipeline_set_tempo_map(pipeline, project->tempo_map.segments.raw(),
+                project->tempo_map.segments.length()));
 
     AudioGraph *ag = ok_mem(create_zero<AudioGraph>());
     ag->project = project;
@@ -720,6 +1038,10 @@ static AudioGraph *audio_graph_create_common(Project *project, GenesisContext *g
             on_project_audio_clips_changed, ag);
     project->events.attach_handler(EventProjectAudioClipSegmentsChanged,
             on_project_audio_clip_segments_changed, ag);
+    project->events.attach_handler(EventProjectMixerLinesChanged,
+            on_project_mixer_lines_changed, ag);
+    project->events.attach_handler(EventProjectAudioAssetsLoadProgress,
+            on_project_audio_assets_load_progress, ag);
 
 
     refresh_audio_clips(ag);
@@ -759,14 +1081,64 @@ int audio_graph_create_playback(Project *project, GenesisContext *genesis_contex
     return 0;
 }
 
+static int create_render_stream(AudioGraph *ag, const RenderOutput *output,
+        GenesisAudioFileStream **out_stream)
+{
+    Project *project = ag->project;
+    GenesisExportFormat export_format = output->export_format;
+    GenesisAudioFileStream *stream = genesis_audio_file_stream_create(ag->pipeline->context);
+    if (!stream)
+        return GenesisErrorNoMem;
+
+    export_format.sample_rate = genesis_audio_file_codec_best_sample_rate(export_format.codec,
+            export_format.sample_rate);
+
+    // the stream resamples from the project rate on its encoder thread
+    genesis_audio_file_stream_set_sample_rate(stream, project->sample_rate);
+    genesis_audio_file_stream_set_channel_layout(stream, &project->channel_layout);
+
+    ByteBuffer encoded;
+    encoded = project->tag_title.encode();
+    genesis_audio_file_stream_set_tag(stream, "title", -1, encoded.raw(), encoded.length());
+
+    encoded = project->tag_artist.encode();
+    genesis_audio_file_stream_set_tag(stream, "artist", -1, encoded.raw(), encoded.length());
+
+    encoded = project->tag_album_artist.encode();
+    genesis_audio_file_stream_set_tag(stream, "album_artist", -1, encoded.raw(), encoded.length());
+
+    encoded = project->tag_album.encode();
+    genesis_audio_file_stream_set_tag(stream, "album", -1, encoded.raw(), encoded.length());
+
+    // TODO looks like I messed up the year tag; it should actually be ISO 8601 "date"
+    // TODO so we need to write the date tag here, not year.
+
+    genesis_audio_file_stream_set_export_format(stream, &export_format);
+
+    int err;
+    if ((err = genesis_audio_file_stream_open(stream, output->out_path.raw(),
+                    output->out_path.length())))
+    {
+        genesis_audio_file_stream_destroy(stream);
+        return err;
+    }
+
+    *out_stream = stream;
+    return 0;
+}
+
 int audio_graph_create_render(Project *project, GenesisContext *genesis_context,
-        const GenesisExportFormat *export_format, const ByteBuffer &out_path,
-        AudioGraph **out_audio_graph)
+        const RenderOutput *outputs, int output_count, AudioGraph **out_audio_graph)
 {
+    if (output_count < 1)
+        return GenesisErrorInvalidParam;
+
     AudioGraph *ag = audio_graph_create_common(project, genesis_context, 0.10);
+    genesis_pipeline_set_resample_quality(ag->pipeline, GenesisResampleQualityBest);
+    ok_or_panic(genesis_pipeline_set_offline(ag->pipeline, true));
 
-    ag->render_export_format = *export_format;
-    ag->render_out_path = out_path;
+    if (add_missing_audio_nodes(ag, true))
+        refresh_audio_clip_segments(ag);
 
     ag->render_frame_index = 0;
     ag->render_frame_count = project_get_duration_frames(project);
@@ -787,43 +1159,23 @@ int audio_graph_create_render(Project *project, GenesisContext *genesis_context,
     genesis_audio_port_descriptor_set_channel_layout(ag->render_port_descr,
             &project->channel_layout, true, -1);
     genesis_audio_port_descriptor_set_sample_rate(ag->render_port_descr,
-            export_format->sample_rate, true, -1);
+            project->sample_rate, true, -1);
     genesis_audio_port_descriptor_set_is_sink(ag->render_port_descr, true);
 
     ag->master_node = ok_mem(genesis_node_descriptor_create_node(ag->render_descr));
 
-    ag->render_stream = ok_mem(genesis_audio_file_stream_create(ag->pipeline->context));
-
-    int render_sample_rate = genesis_audio_file_codec_best_sample_rate(export_format->codec,
-            export_format->sample_rate);
-
-    genesis_audio_file_stream_set_sample_rate(ag->render_stream, render_sample_rate);
-    genesis_audio_file_stream_set_channel_layout(ag->render_stream, &project->channel_layout);
-
-    ByteBuffer encoded;
-    encoded = project->tag_title.encode();
-    genesis_audio_file_stream_set_tag(ag->render_stream, "title", -1, encoded.raw(), encoded.length());
-
-    encoded = project->tag_artist.encode();
-    genesis_audio_file_stream_set_tag(ag->render_stream, "artist", -1, encoded.raw(), encoded.length());
-
-    encoded = project->tag_album_artist.encode();
-    genesis_audio_file_stream_set_tag(ag->render_stream, "album_artist", -1, encoded.raw(), encoded.length());
-
-    encoded = project->tag_album.encode();
-    genesis_audio_file_stream_set_tag(ag->render_stream, "album", -1, encoded.raw(), encoded.length());
-
-    // TODO looks like I messed up the year tag; it should actually be ISO 8601 "date"
-    // TODO so we need to write the date tag here, not year.
-
-    genesis_audio_file_stream_set_export_format(ag->render_stream, export_format);
-
     int err;
-    if ((err = genesis_audio_file_stream_open(ag->render_stream, out_path.raw(),
-                    out_path.length())))
-    {
-        audio_graph_destroy(ag);
-        return err;
+    for (int i = 0; i < output_count; i += 1) {
+        GenesisAudioFileStream *stream;
+        if ((err = create_render_stream(ag, &outputs[i], &stream))) {
+            audio_graph_destroy(ag);
+            return err;
+        }
+        if ((err = ag->render_streams.append(stream))) {
+            genesis_audio_file_stream_destroy(stream);
+            audio_graph_destroy(ag);
+            return err;
+        }
     }
 
     *out_audio_graph = ag;
@@ -863,19 +1215,26 @@ void audio_graph_destroy(AudioGraph *ag) {
             on_project_audio_clips_changed);
     ag->project->events.detach_handler(EventProjectAudioClipSegmentsChanged,
             on_project_audio_clip_segments_changed);
+    ag->project->events.detach_handler(EventProjectMixerLinesChanged,
+            on_project_mixer_lines_changed);
+    ag->project->events.detach_handler(EventProjectAudioAssetsLoadProgress,
+            on_project_audio_assets_load_progress);
 
     while (ag->audio_clip_list.length()) {
         AudioGraphClip *clip = ag->audio_clip_list.pop();
         audio_graph_clip_destroy(clip);
     }
 
+    for (int i = 0; i < ag->render_streams.length(); i += 1)
+        genesis_audio_file_stream_destroy(ag->render_streams.at(i));
+
     os_cond_destroy(ag->render_cond);
 }
 
 void audio_graph_play_sample_file(AudioGraph *ag, const ByteBuffer &path) {
     GenesisAudioFile *audio_file;
     int err;
-    if ((err = genesis_audio_file_load(ag->pipeline->context, path.raw(), &audio_file))) {
+    if ((err = genesis_audio_file_load_streaming(ag->pipeline->context, path.raw(), &audio_file))) {
         fprintf(stderr, "unable to load audio file: %s\n", genesis_strerror(err));
         return;
     }
@@ -946,7 +1305,7 @@ void audio_graph_pause(AudioGraph *ag) {
 void audio_graph_play(AudioGraph *ag) {
     if (ag->is_playing.exchange(true))
         return;
-    assert(!ag->render_stream);
+    assert(!ag->render_descr);
     genesis_node_playback_reset_offset(ag->master_node);
     audio_graph_start_pipeline(ag);
     ag->events.trigger(EventAudioGraphPlayingChanged);
@@ -1016,13 +1375,13 @@ void audio_graph_stop_playback(AudioGraph *ag) {
 }
 
 void audio_graph_flush_events(AudioGraph *ag) {
-    if ((!ag->render_stream && ag->is_playing) || !ag->play_head_changed_flag.test_and_set()) {
+    if ((!ag->render_descr && ag->is_playing) || !ag->play_head_changed_flag.test_and_set()) {
         ag->events.trigger(EventAudioGraphPlayHeadChanged);
     }
 }
 
 double audio_graph_play_head_pos(AudioGraph *ag) {
-    assert(!ag->render_stream);
+    assert(!ag->render_descr);
 
     bool is_playing = ag->is_playing.load();
 
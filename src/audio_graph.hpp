@@ -15,6 +15,42 @@ struct EventList {
 
 struct AudioGraph;
 
+// One file written by a render.
+struct RenderOutput {
+    GenesisExportFormat export_format;
+    ByteBuffer out_path;
+};
+
+// The segment events of a clip, sorted by start and then by segment.
+struct AudioGraphClipEvents {
+    List<GenesisMidiEvent> events;
+    // where each event ends, in whole notes
+    List<double> ends;
+    // max tree over ends. node 1 is the root, the children of node i are
+    // 2i and 2i + 1, and event i is leaf leaf_count + i. leaves past the
+    // last event hold -HUGE_VAL. the next event still playing at a position
+    // is found in O(log n) however many earlier events have ended.
+    List<double> end_tree;
+    int leaf_count;
+    // changes each time the events are rewritten
+    int version;
+};
+
+// How far an event node has sent the events of its clip.
+struct AudioGraphEventCursor {
+    double pos;
+    bool detect_ongoing_notes;
+    // the first event not sent yet, in the events of events_version
+    int next_event_index;
+    int events_version;
+    // the last event sent and how many events equal to it were sent in a
+    // row, so that a new version of the events resumes after them instead
+    // of sending the events at pos again
+    bool has_last_sent;
+    GenesisMidiEvent last_sent;
+    int last_sent_count;
+};
+
 struct AudioGraphClip {
     AudioGraph *audio_graph;
     AudioClip *audio_clip;
@@ -23,8 +59,9 @@ struct AudioGraphClip {
     GenesisNodeDescriptor *event_node_descr;
     GenesisNode *event_node;
     GenesisNode *resample_node;
-    AtomicValue<List<GenesisMidiEvent>> events;
-    List<GenesisMidiEvent> *events_write_ptr;
+    AtomicValue<AudioGraphClipEvents> events;
+    AudioGraphClipEvents *events_write_ptr;
+    int events_version;
 };
 
 struct AudioGraph {
@@ -53,9 +90,9 @@ struct AudioGraph {
 
     GenesisNodeDescriptor *render_descr;
     GenesisPortDescriptor *render_port_descr;
-    ByteBuffer render_out_path;
-    GenesisExportFormat render_export_format;
-    GenesisAudioFileStream *render_stream;
+    // one per output, each encoding on its own thread. the render node
+    // writes the same rendered frames to all of them.
+    List<GenesisAudioFileStream *> render_streams;
     atomic_long render_frame_index;
     long render_frame_count;
     OsCond *render_cond;
@@ -68,9 +105,10 @@ struct AudioGraph {
 
 int audio_graph_create_playback(Project *project, GenesisContext *genesis_context,
         SettingsFile *settings_file, AudioGraph **out_audio_graph);
+// Renders the project once at the project sample rate and encodes it to
+// every output. Each output stream resamples to its own sample rate.
 int audio_graph_create_render(Project *project, GenesisContext *genesis_context,
-        const GenesisExportFormat *export_format, const ByteBuffer &out_path,
-        AudioGraph **out_audio_graph);
+        const RenderOutput *outputs, int output_count, AudioGraph **out_audio_graph);
 void audio_graph_destroy(AudioGraph *audio_graph);
 
 void audio_graph_start_pipeline(AudioGraph *audio_graph);
@@ -95,4 +133,18 @@ void audio_graph_change_sample_rate(AudioGraph *audio_graph, int new_sample_rate
 void audio_graph_flush_events(AudioGraph *audio_graph);
 double audio_graph_play_head_pos(AudioGraph *audio_graph);
 
+// Builds end_tree from ends.
+void audio_graph_clip_events_build_end_tree(AudioGraphClipEvents *clip_events);
+
+// The next run first sends the events which started before pos and are
+// still playing there.
+void audio_graph_event_cursor_seek(AudioGraphEventCursor *cursor, double pos);
+// Writes to out the events starting in the next *time_requested whole notes,
+// at most out_capacity of them. When they do not fit, *time_requested is cut
+// short at the first event left out. Returns how many events were written.
+// Real-time safe.
+int audio_graph_event_cursor_run(AudioGraphEventCursor *cursor,
+        const AudioGraphClipEvents *clip_events, GenesisMidiEvent *out, int out_capacity,
+        double *time_requested);
+
 #endif
@@ -193,4 +193,25 @@ private:
     List<char> _buffer;
 };
 
+// Borrowed read-only bytes, such as a value in a memory-mapped file. Valid as
+// long as the memory it points into. Has the read accessors of ByteBuffer, and
+// a ByteBuffer converts to one, so deserializers can take either.
+class ByteView {
+public:
+    ByteView() : _ptr(nullptr), _length(0) {}
+    ByteView(const char *ptr, int length) : _ptr(ptr), _length(length) {}
+    ByteView(const ByteBuffer &buffer) : _ptr(buffer.raw()), _length(buffer.length()) {}
+
+    int length() const {
+        return _length;
+    }
+
+    const char *raw() const {
+        return _ptr;
+    }
+private:
+    const char *_ptr;
+    int _length;
+};
+
 #endif
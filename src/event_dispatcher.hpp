@@ -34,6 +34,7 @@ enum Event {
     EventRenderJobsUpdated,
     EventAudioGraphPlayHeadChanged,
     EventAudioGraphPlayingChanged,
+    EventProjectAudioAssetsLoadProgress,
 };
 
 struct EventHandler {
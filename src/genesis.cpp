@@ -4,15 +4,12 @@
 #include "synth.hpp"
 #include "delay.hpp"
 #include "resample.hpp"
+#include "sample_convert.hpp"
 #include "config.h"
 
 static const int BYTES_PER_SAMPLE = 4; // assuming float samples
 static const int EVENTS_PER_SECOND_CAPACITY = 16000;
 
-// When you finally get around to genericizing this code, take a peek at
-// project_whole_notes_to_frames and project_frames_to_whole_notes
-static const double whole_notes_per_second = 140.0 / 60.0;
-
 static int (*plugin_create_list[])(GenesisPipeline *pipeline) = {
     create_synth_descriptor,
     create_delay_descriptor,
@@ -21,9 +18,18 @@ static int (*plugin_create_list[])(GenesisPipeline *pipeline) = {
 
 static_assert(GENESIS_NOTES_COUNT == array_length(midi_note_to_pitch), "");
 
+// Converts count samples of one channel. src_stride and dest_stride are in
+// samples, step is in bytes, as in SoundIoChannelArea.
+typedef void WriteAreaFn(char *dest, int step, const float *src, int src_stride, int count);
+typedef void ReadAreaFn(float *dest, int dest_stride, char *src, int step, int count);
+// Converts count samples laid out the same way on both sides.
+typedef void WriteInterleavedFn(char *dest, const float *src, int count);
+typedef void ReadInterleavedFn(float *dest, const char *src, int count);
+
 struct PlaybackNodeContext {
     SoundIoOutStream *outstream;
-    void (*write_sample)(char *ptr, float sample);
+    WriteAreaFn *write_area;
+    WriteInterleavedFn *write_interleaved;
     atomic_bool ongoing_recovery;
     bool stream_started;
     AtomicDouble latency;
@@ -34,13 +40,18 @@ struct PlaybackNodeContext {
 
 struct RecordingNodeContext {
     SoundIoInStream *instream;
-    void (*read_sample)(char *ptr, float *sample);
+    ReadAreaFn *read_area;
+    ReadInterleavedFn *read_interleaved;
 };
 
+// write_interleaved and read_interleaved are null for formats which only have
+// the per-area path.
 struct SampleFormatInfo {
     SoundIoFormat format;
-    void (*write_sample)(char *ptr, float sample);
-    void (*read_sample)(char *ptr, float *sample);
+    WriteAreaFn *write_area;
+    ReadAreaFn *read_area;
+    WriteInterleavedFn *write_interleaved;
+    ReadInterleavedFn *read_interleaved;
 };
 
 template<int byte_count>
@@ -136,7 +147,7 @@ static void read_sample_float32fe(char *ptr, float *sample) {
 }
 
 static void write_sample_float64ne(char *ptr, float sample) {
-    float *buf = (float *)ptr;
+    double *buf = (double *)ptr;
     *buf = sample;
 }
 
@@ -243,96 +254,170 @@ static void read_sample_u8(char *ptr, float *sample) {
     *sample = (float)(*buf) / (1.0f + (float)UINT8_MAX);
 }
 
+// the per-sample functions are template arguments so that they inline into
+// the loop instead of being called through a pointer for every sample
+template<void (*write_sample)(char *ptr, float sample)>
+static void write_area(char *dest, int step, const float *src, int src_stride, int count) {
+    for (int i = 0; i < count; i += 1, dest += step, src += src_stride)
+        write_sample(dest, *src);
+}
+
+template<void (*read_sample)(char *ptr, float *sample)>
+static void read_area(float *dest, int dest_stride, char *src, int step, int count) {
+    for (int i = 0; i < count; i += 1, dest += dest_stride, src += step)
+        read_sample(src, dest);
+}
+
+static void write_interleaved_float32ne(char *dest, const float *src, int count) {
+    memcpy(dest, src, count * sizeof(float));
+}
+
+static void read_interleaved_float32ne(float *dest, const char *src, int count) {
+    memcpy(dest, src, count * sizeof(float));
+}
+
+static void write_interleaved_float64ne(char *dest, const float *src, int count) {
+    sample_convert_float_to_double(dest, src, count);
+}
+
+static void write_interleaved_s32ne(char *dest, const float *src, int count) {
+    sample_convert_float_to_s32(dest, src, count);
+}
+
+static void write_interleaved_s16ne(char *dest, const float *src, int count) {
+    sample_convert_float_to_s16(dest, src, count);
+}
+
+static void write_interleaved_u8(char *dest, const float *src, int count) {
+    sample_convert_float_to_u8(dest, src, count);
+}
+
 static SampleFormatInfo prioritized_sample_format_infos[] = {
     {
         SoundIoFormatFloat32NE,
-        write_sample_float32ne,
-        read_sample_float32ne
+        write_area<write_sample_float32ne>,
+        read_area<read_sample_float32ne>,
+        write_interleaved_float32ne,
+        read_interleaved_float32ne,
     },
     {
         SoundIoFormatFloat32FE,
-        write_sample_float32fe,
-        read_sample_float32fe
+        write_area<write_sample_float32fe>,
+        read_area<read_sample_float32fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatFloat64NE,
-        write_sample_float64ne,
-        read_sample_float64ne,
+        write_area<write_sample_float64ne>,
+        read_area<read_sample_float64ne>,
+        write_interleaved_float64ne,
+        nullptr,
     },
     {
         SoundIoFormatFloat64FE,
-        write_sample_float64fe,
-        read_sample_float64fe,
+        write_area<write_sample_float64fe>,
+        read_area<read_sample_float64fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatS32NE,
-        write_sample_s32ne,
-        read_sample_s32ne,
+        write_area<write_sample_s32ne>,
+        read_area<read_sample_s32ne>,
+        write_interleaved_s32ne,
+        nullptr,
     },
     {
         SoundIoFormatS32FE,
-        write_sample_s32fe,
-        read_sample_s32fe,
+        write_area<write_sample_s32fe>,
+        read_area<read_sample_s32fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU32NE,
-        write_sample_u32ne,
-        read_sample_u32ne,
+        write_area<write_sample_u32ne>,
+        read_area<read_sample_u32ne>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU32FE,
-        write_sample_u32fe,
-        read_sample_u32fe,
+        write_area<write_sample_u32fe>,
+        read_area<read_sample_u32fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatS24NE,
-        write_sample_s24ne,
-        read_sample_s24ne,
+        write_area<write_sample_s24ne>,
+        read_area<read_sample_s24ne>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatS24FE,
-        write_sample_s24fe,
-        read_sample_s24fe,
+        write_area<write_sample_s24fe>,
+        read_area<read_sample_s24fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU24NE,
-        write_sample_u24ne,
-        read_sample_u24ne,
+        write_area<write_sample_u24ne>,
+        read_area<read_sample_u24ne>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU24FE,
-        write_sample_u24fe,
-        read_sample_u24fe,
+        write_area<write_sample_u24fe>,
+        read_area<read_sample_u24fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatS16NE,
-        write_sample_s16ne,
-        read_sample_s16ne,
+        write_area<write_sample_s16ne>,
+        read_area<read_sample_s16ne>,
+        write_interleaved_s16ne,
+        nullptr,
     },
     {
         SoundIoFormatS16FE,
-        write_sample_s16fe,
-        read_sample_s16fe,
+        write_area<write_sample_s16fe>,
+        read_area<read_sample_s16fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU16NE,
-        write_sample_u16ne,
-        read_sample_u16ne,
+        write_area<write_sample_u16ne>,
+        read_area<read_sample_u16ne>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU16FE,
-        write_sample_u16fe,
-        read_sample_u16fe,
+        write_area<write_sample_u16fe>,
+        read_area<read_sample_u16fe>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatS8,
-        write_sample_s8,
-        read_sample_s8,
+        write_area<write_sample_s8>,
+        read_area<read_sample_s8>,
+        nullptr,
+        nullptr,
     },
     {
         SoundIoFormatU8,
-        write_sample_u8,
-        read_sample_u8,
+        write_area<write_sample_u8>,
+        read_area<read_sample_u8>,
+        write_interleaved_u8,
+        nullptr,
     },
 };
 
@@ -388,7 +473,7 @@ static void on_devices_change(SoundIo *soundio) {
 
 double genesis_frames_to_whole_notes(GenesisPipeline *pipeline, int frames, int frame_rate) {
     double seconds = frames / (double)frame_rate;
-    return whole_notes_per_second * seconds;
+    return tempo_map_seconds_to_whole_notes(&pipeline->tempo_map, seconds, nullptr);
 }
 
 int genesis_whole_notes_to_frames(GenesisPipeline *pipeline, double whole_notes, int frame_rate) {
@@ -396,7 +481,29 @@ int genesis_whole_notes_to_frames(GenesisPipeline *pipeline, double whole_notes,
 }
 
 double genesis_whole_notes_to_seconds(GenesisPipeline *pipeline, double whole_notes, int frame_rate) {
-    return whole_notes / whole_notes_per_second;
+    return tempo_map_whole_notes_to_seconds(&pipeline->tempo_map, whole_notes, nullptr);
+}
+
+double genesis_frames_to_whole_notes_cursor(GenesisPipeline *pipeline, GenesisTempoCursor *cursor,
+        int frames, int frame_rate)
+{
+    double seconds = frames / (double)frame_rate;
+    return tempo_map_seconds_to_whole_notes(&pipeline->tempo_map, seconds, &cursor->segment_index);
+}
+
+int genesis_whole_notes_to_frames_cursor(GenesisPipeline *pipeline, GenesisTempoCursor *cursor,
+        double whole_notes, int frame_rate)
+{
+    return frame_rate * tempo_map_whole_notes_to_seconds(&pipeline->tempo_map, whole_notes,
+            &cursor->segment_index);
+}
+
+int genesis_pipeline_set_tempo_map(GenesisPipeline *pipeline, const GenesisTempoSegment *segments,
+        int segment_count)
+{
+    if (pipeline->running)
+        return GenesisErrorInvalidState;
+    return tempo_map_set(&pipeline->tempo_map, segments, segment_count);
 }
 
 static void on_backend_disconnect(struct SoundIo *soundio, int err) {
@@ -431,11 +538,41 @@ void genesis_pipeline_destroy(struct GenesisPipeline *pipeline) {
         genesis_node_descriptor_destroy(pipeline->node_descriptors.at(last_index));
     }
     destroy(pipeline->thread_pool, pipeline->thread_pool_size);
+    destroy(pipeline->worker_list, pipeline->thread_pool_size);
 
 
     destroy(pipeline, 1);
 }
 
+// Allocates one worker per core for offline pipelines. Real-time pipelines
+// leave one core for the GUI thread, OS, and other miscellaneous interruptions.
+static int pipeline_init_thread_pool(GenesisPipeline *pipeline) {
+    int concurrency = os_concurrency();
+    int thread_pool_size = pipeline->offline ? max(1, concurrency) : max(1, concurrency - 1);
+    if (pipeline->worker_count > 0)
+        thread_pool_size = pipeline->worker_count;
+
+    OsThread **thread_pool = allocate_zero<OsThread *>(thread_pool_size);
+    GenesisPipelineWorker *worker_list = allocate_zero<GenesisPipelineWorker>(thread_pool_size);
+    if (!thread_pool || !worker_list) {
+        destroy(thread_pool, thread_pool_size);
+        destroy(worker_list, thread_pool_size);
+        return GenesisErrorNoMem;
+    }
+
+    destroy(pipeline->thread_pool, pipeline->thread_pool_size);
+    destroy(pipeline->worker_list, pipeline->thread_pool_size);
+    pipeline->thread_pool_size = thread_pool_size;
+    pipeline->thread_pool = thread_pool;
+    pipeline->worker_list = worker_list;
+    for (int i = 0; i < thread_pool_size; i += 1) {
+        GenesisPipelineWorker *worker = &pipeline->worker_list[i];
+        worker->pipeline = pipeline;
+        worker->index = i;
+    }
+    return 0;
+}
+
 int genesis_pipeline_create(struct GenesisContext *context,
         struct GenesisPipeline **out_pipeline)
 {
@@ -450,21 +587,22 @@ int genesis_pipeline_create(struct GenesisContext *context,
     pipeline->latency = 0.020; // 20ms
     pipeline->target_sample_rate = 44100;
     pipeline->channel_layout = *soundio_channel_layout_get_builtin(SoundIoChannelLayoutIdStereo);
+    pipeline->resample_quality = GenesisResampleQualityNormal;
 
     pipeline->running.store(false);
     pipeline->paused.store(0);
     pipeline->stream_fail_flag.test_and_set();
     pipeline->threads_paused.store(0);
 
-    int concurrency = os_concurrency();
-    // subtract one to make room for GUI thread, OS, and other miscellaneous
-    // interruptions.
-    pipeline->thread_pool_size = max(1, concurrency - 1);
-    pipeline->thread_pool_size = 1; // TODO remove this debug
-    pipeline->thread_pool = allocate_zero<OsThread *>(pipeline->thread_pool_size);
-    if (!pipeline->thread_pool) {
+    int err;
+    if ((err = tempo_map_set_default(&pipeline->tempo_map))) {
         genesis_pipeline_destroy(pipeline);
-        return GenesisErrorNoMem;
+        return err;
+    }
+
+    if ((err = pipeline_init_thread_pool(pipeline))) {
+        genesis_pipeline_destroy(pipeline);
+        return err;
     }
 
     for (int i = 0; i < array_length(plugin_create_list); i += 1) {
@@ -476,7 +614,6 @@ int genesis_pipeline_create(struct GenesisContext *context,
         }
     }
 
-    int err;
     if ((err = context->pipelines.append(pipeline))) {
         genesis_pipeline_destroy(pipeline);
         return err;
@@ -508,8 +645,19 @@ int genesis_context_create(struct GenesisContext **out_context) {
         return GenesisErrorNoMem;
     }
 
+    if (!(context->resample_filters_mutex = os_mutex_create())) {
+        genesis_context_destroy(context);
+        return GenesisErrorNoMem;
+    }
 
-    int err = create_midi_hardware(context, "genesis", midi_events_signal, on_midi_devices_change,
+    int err;
+    if ((err = audio_file_stream_pool_create(&context->stream_pool))) {
+        genesis_context_destroy(context);
+        return err;
+    }
+
+
+    err = create_midi_hardware(context, "genesis", midi_events_signal, on_midi_devices_change,
             context, &context->midi_hardware);
     if (err) {
         genesis_context_destroy(context);
@@ -587,6 +735,11 @@ void genesis_context_destroy(struct GenesisContext *context) {
         destroy(context->sound_backend_list, 1);
     }
 
+    resample_filter_cache_clear(context);
+    os_mutex_destroy(context->resample_filters_mutex);
+
+    audio_file_stream_pool_destroy(context->stream_pool);
+
     os_mutex_destroy(context->events_mutex);
     os_cond_destroy(context->events_cond);
 
@@ -772,6 +925,10 @@ void genesis_node_destroy(struct GenesisNode *node) {
         genesis_node_disconnect_all_ports(node);
     }
 
+    // removed from a running pipeline during a live edit
+    if (node->activated && node->descriptor->deactivate)
+        node->descriptor->deactivate(node);
+
     // call destructor on node
     if (node->constructed && node->descriptor->destroy)
         node->descriptor->destroy(node);
@@ -841,73 +998,208 @@ int genesis_audio_file_codec_sample_rate_index(
     return codec->sample_rate_list.at(index);
 }
 
-static void get_audio_port_status(GenesisAudioPort *audio_out_port, bool *empty, bool *full) {
-    int fill_count = ring_buffer_fill_count(&audio_out_port->sample_buffer);
-    *empty = (fill_count == 0);
-    *full = (fill_count == audio_out_port->sample_buffer_size);
-}
+enum ScheduleState {
+    ScheduleStateUnvisited,
+    ScheduleStateVisiting,
+    ScheduleStateDone,
+};
+
+// When a cycle makes progress only on event time, with no audio frames or
+// events moving, allow this many more cycles before going idle. This lets an
+// events consumer's request reach its producer and the answer come back.
+static const int MAX_EVENT_ONLY_CYCLES = 2;
+
+// Seconds of audio each audio out port buffers in an offline pipeline, which
+// is how much every node processes per cycle. Large enough that the cost of
+// a cycle is in the nodes rather than in scheduling, small enough that a
+// port's buffer stays in cache between its producer and its consumers.
+static const double OFFLINE_BUFFER_DURATION = 0.25;
+
+static void pipeline_dispatch_node(GenesisPipeline *pipeline, GenesisNode *node);
 
-static void get_events_port_status(GenesisEventsPort *events_out_port, bool *empty, bool *full) {
-    *full = (events_out_port->time_requested.load() == 0.0);
-    *empty = (*full) ? false : (events_out_port->time_available.load() == 0.0);
+// Give up ownership of the schedule. If the control thread is waiting to
+// edit the graph, wake it up.
+static void pipeline_release_cycle(GenesisPipeline *pipeline) {
+    pipeline->cycle_running.store(0);
+    if (pipeline->cycle_hold.load())
+        os_futex_wake(reinterpret_cast<int*>(&pipeline->cycle_running), 1);
 }
 
-static void get_port_status(GenesisPort *port, bool *empty, bool *full) {
-    switch (port->descriptor->port_type) {
-        case GenesisPortTypeAudioOut:
-            get_audio_port_status((GenesisAudioPort *)port, empty, full);
-            return;
-        case GenesisPortTypeEventsOut:
-            get_events_port_status((GenesisEventsPort *)port, empty, full);
-            return;
-        case GenesisPortTypeAudioIn:
-        case GenesisPortTypeEventsIn:
-            panic("expected out port");
+static void pipeline_start_cycle(GenesisPipeline *pipeline) {
+    pipeline->cycle_requested.store(false);
+    pipeline->cycle_audio_progress.store(false);
+    pipeline->cycle_event_progress.store(false);
+
+    int node_count = pipeline->schedule.length();
+    if (node_count == 0) {
+        pipeline_release_cycle(pipeline);
+        return;
     }
-    panic("invalid port type");
+    pipeline->cycle_nodes_remaining.store(node_count);
+    for (int i = 0; i < pipeline->schedule_sources.length(); i += 1)
+        pipeline_dispatch_node(pipeline, pipeline->schedule_sources.at(i));
 }
 
-static void queue_node_if_ready(GenesisPipeline *pipeline, GenesisNode *node, bool recursive) {
-    if (node->being_processed) {
-        // this node is already being processed; no point in queueing it again
+static void pipeline_end_cycle(GenesisPipeline *pipeline) {
+    if (pipeline->cycle_hold.load() || !pipeline->running.load()) {
+        pipeline_release_cycle(pipeline);
         return;
     }
-    if (!node->descriptor->run) {
-        // this node has no run function; no point in queuing it
+
+    if (pipeline->cycle_requested.load() || pipeline->cycle_audio_progress.load()) {
+        pipeline->event_only_cycles_left = MAX_EVENT_ONLY_CYCLES;
+    } else if (pipeline->cycle_event_progress.load() && pipeline->event_only_cycles_left > 0) {
+        pipeline->event_only_cycles_left -= 1;
+    } else {
+        pipeline_release_cycle(pipeline);
+        // a request may have come in after we checked the flag
+        if (pipeline->cycle_requested.load() && pipeline->running.load() &&
+            !pipeline->cycle_hold.load() && !pipeline->cycle_running.exchange(1))
+        {
+            pipeline_start_cycle(pipeline);
+        }
         return;
     }
-    // make sure all the children of this node are ready
-    bool waiting_for_any_children = false;
-    bool any_output_has_room = false;
-    bool has_any_output = false;
-    for (int parent_port_i = 0; parent_port_i < node->port_count; parent_port_i += 1) {
-        GenesisPort *port = node->ports[parent_port_i];
-
-        if (port->output_to) {
-            has_any_output = true;
-            bool empty, full;
-            get_port_status(port, &empty, &full);
-            if (!full)
-                any_output_has_room = true;
-        } else {
-            GenesisPort *child_port = port->input_from;
-            if (child_port && child_port != port) {
-                bool empty, full;
-                get_port_status(child_port, &empty, &full);
-                waiting_for_any_children = waiting_for_any_children || empty;
-                if (!full) {
-                    GenesisNode *child_node = child_port->node;
-                    if (recursive)
-                        queue_node_if_ready(pipeline, child_node, true);
-                }
-            }
+
+    pipeline_start_cycle(pipeline);
+}
+
+static void pipeline_finish_node(GenesisPipeline *pipeline, GenesisNode *node) {
+    for (int i = 0; i < node->consumers.length(); i += 1) {
+        GenesisNode *consumer = node->consumers.at(i);
+        if (consumer->producers_remaining.fetch_sub(1) == 1)
+            pipeline_dispatch_node(pipeline, consumer);
+    }
+    if (pipeline->cycle_nodes_remaining.fetch_sub(1) == 1)
+        pipeline_end_cycle(pipeline);
+}
+
+static void pipeline_dispatch_node(GenesisPipeline *pipeline, GenesisNode *node) {
+    // All producers are done for this cycle and none can decrement the
+    // counter again until the next one, so re-arm it now.
+    node->producers_remaining.store(node->producer_count);
+    if (node->descriptor->run)
+        pipeline->task_queue.enqueue(node);
+    else
+        pipeline_finish_node(pipeline, node);
+}
+
+// Ask for a cycle to run. If one is already running, another one runs after it.
+static void pipeline_request_cycle(GenesisPipeline *pipeline) {
+    if (!pipeline->running.load())
+        return;
+    pipeline->cycle_requested.store(true);
+    if (pipeline->cycle_hold.load())
+        return;
+    if (!pipeline->cycle_running.exchange(1))
+        pipeline_start_cycle(pipeline);
+}
+
+// Called whenever data moves through a port. Inside a cycle this only notes
+// that the cycle did something; from any other thread it requests a cycle.
+static void pipeline_port_progress(GenesisPipeline *pipeline, bool audio_progress) {
+    if (!pipeline->task_queue.is_worker_thread()) {
+        pipeline_request_cycle(pipeline);
+    } else if (audio_progress) {
+        pipeline->cycle_audio_progress.store(true);
+    } else {
+        pipeline->cycle_event_progress.store(true);
+    }
+}
+
+static int compare_critical_path_asc(GenesisNode *a, GenesisNode *b) {
+    return a->critical_path_length - b->critical_path_length;
+}
+
+static int compare_critical_path_desc(GenesisNode *a, GenesisNode *b) {
+    return b->critical_path_length - a->critical_path_length;
+}
+
+// Depth-first from a sink toward its producers. Appending in post-order puts
+// every producer before its consumers, which is a topological order.
+static int schedule_visit(GenesisPipeline *pipeline, GenesisNode *node) {
+    if (node->schedule_state == ScheduleStateDone)
+        return 0;
+    if (node->schedule_state == ScheduleStateVisiting)
+        return GenesisErrorInvalidState; // the graph has a feedback loop
+
+    node->schedule_state = ScheduleStateVisiting;
+    int err;
+    for (int port_i = 0; port_i < node->port_count; port_i += 1) {
+        GenesisPort *producer_port = node->ports[port_i]->input_from;
+        if (!producer_port || producer_port->node == node)
+            continue;
+        GenesisNode *producer = producer_port->node;
+        if ((err = schedule_visit(pipeline, producer)))
+            return err;
+        if ((err = producer->consumers.append(node)))
+            return err;
+        node->producer_count += 1;
+    }
+    node->schedule_state = ScheduleStateDone;
+
+    if ((err = pipeline->schedule.append(node)))
+        return err;
+    if (node->producer_count == 0) {
+        if ((err = pipeline->schedule_sources.append(node)))
+            return err;
+    }
+    return 0;
+}
+
+static bool node_is_sink(GenesisNode *node) {
+    for (int port_i = 0; port_i < node->port_count; port_i += 1) {
+        GenesisPort *port = node->ports[port_i];
+        if (port->descriptor->port_type != GenesisPortTypeAudioIn || !port->input_from)
+            continue;
+        GenesisAudioPortDescriptor *audio_port_descr = (GenesisAudioPortDescriptor *)port->descriptor;
+        if (audio_port_descr->is_sink)
+            return true;
+    }
+    return false;
+}
+
+static int pipeline_compile_schedule(GenesisPipeline *pipeline) {
+    pipeline->schedule.clear();
+    pipeline->schedule_sources.clear();
+    for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
+        GenesisNode *node = pipeline->nodes.at(node_index);
+        node->consumers.clear();
+        node->producer_count = 0;
+        node->critical_path_length = 0;
+        node->schedule_state = ScheduleStateUnvisited;
+    }
+
+    // Nodes which do not feed a sink are left out of the schedule and never run.
+    int err;
+    for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
+        GenesisNode *node = pipeline->nodes.at(node_index);
+        if (node_is_sink(node)) {
+            if ((err = schedule_visit(pipeline, node)))
+                return err;
         }
     }
-    if (!waiting_for_any_children && (!has_any_output || any_output_has_room)) {
-        // we know that we want it enqueued. now make sure it only happens once.
-        if (!node->being_processed.exchange(true))
-            pipeline->task_queue.enqueue(node);
+
+    for (int i = pipeline->schedule.length() - 1; i >= 0; i -= 1) {
+        GenesisNode *node = pipeline->schedule.at(i);
+        int longest_consumer_path = 0;
+        for (int consumer_i = 0; consumer_i < node->consumers.length(); consumer_i += 1) {
+            GenesisNode *consumer = node->consumers.at(consumer_i);
+            longest_consumer_path = max(longest_consumer_path, consumer->critical_path_length);
+        }
+        node->critical_path_length = longest_consumer_path + 1;
+        node->producers_remaining.store(node->producer_count);
+    }
+
+    // Workers pop their own deque last-in first-out, so push the consumer
+    // with the longest remaining path last. Sources are dispatched in order.
+    for (int i = 0; i < pipeline->schedule.length(); i += 1) {
+        GenesisNode *node = pipeline->schedule.at(i);
+        node->consumers.sort<compare_critical_path_asc>();
     }
+    pipeline->schedule_sources.sort<compare_critical_path_desc>();
+
+    return 0;
 }
 
 double genesis_node_playback_latency(struct GenesisNode *node) {
@@ -951,6 +1243,19 @@ static void playback_node_error_callback(SoundIoOutStream *outstream, int err) {
     }
 }
 
+// true if the areas are the channels of one run of interleaved frames, which
+// is how most backends hand them out
+static bool areas_are_interleaved(const struct SoundIoChannelArea *areas,
+        int channel_count, int bytes_per_sample)
+{
+    int frame_size = channel_count * bytes_per_sample;
+    for (int ch = 0; ch < channel_count; ch += 1) {
+        if (areas[ch].ptr != areas[0].ptr + ch * bytes_per_sample || areas[ch].step != frame_size)
+            return false;
+    }
+    return true;
+}
+
 static void playback_node_fill_silence(SoundIoOutStream *outstream, int frame_count_min) {
     struct SoundIoChannelArea *areas;
     int channel_count = outstream->layout.channel_count;
@@ -1033,13 +1338,18 @@ static void playback_node_callback(SoundIoOutStream *outstream,
         if (!frame_count)
             break;
 
-        for (int frame = 0; frame < frame_count; frame += 1) {
+        if (playback_node_context->write_interleaved &&
+            areas_are_interleaved(areas, layout->channel_count, outstream->bytes_per_sample))
+        {
+            playback_node_context->write_interleaved(areas[0].ptr, in_buf,
+                    frame_count * layout->channel_count);
+        } else {
             for (int channel = 0; channel < layout->channel_count; channel += 1) {
-                playback_node_context->write_sample(areas[channel].ptr, *in_buf);
-                areas[channel].ptr += areas[channel].step;
-                in_buf += 1;
+                playback_node_context->write_area(areas[channel].ptr, areas[channel].step,
+                        in_buf + channel, layout->channel_count, frame_count);
             }
         }
+        in_buf += frame_count * layout->channel_count;
 
         if ((err = soundio_outstream_end_write(outstream))) {
             playback_node_error_callback(outstream, err);
@@ -1080,7 +1390,8 @@ static int playback_choose_best_format(PlaybackNodeContext *playback_node_contex
     for (int i = 0; i < array_length(prioritized_sample_format_infos); i += 1) {
         struct SampleFormatInfo *sample_format_info = &prioritized_sample_format_infos[i];
         if (soundio_device_supports_format(device, sample_format_info->format)) {
-            playback_node_context->write_sample = sample_format_info->write_sample;
+            playback_node_context->write_area = sample_format_info->write_area;
+            playback_node_context->write_interleaved = sample_format_info->write_interleaved;
             playback_node_context->outstream->format = sample_format_info->format;
             return 0;
         }
@@ -1093,6 +1404,9 @@ static int playback_node_activate(struct GenesisNode *node) {
     GenesisPipeline *pipeline = node->descriptor->pipeline;
     SoundIoDevice *device = (SoundIoDevice*)node->descriptor->userdata;
 
+    if (pipeline->offline)
+        return GenesisErrorInvalidState;
+
     playback_node_context->ongoing_recovery.store(true);
 
     assert(!playback_node_context->outstream);
@@ -1225,13 +1539,19 @@ static void recording_node_callback(SoundIoInStream *instream, int frame_count_m
         if (!areas) {
             panic("TODO handle data dropped; hole");
         } else {
-            for (int frame = 0; frame < write_frame_count; frame += 1) {
-                for (int ch = 0; ch < instream->layout.channel_count; ch += 1) {
-                    recording_node_context->read_sample(areas[ch].ptr, out_buf);
-                    areas[ch].ptr += areas[ch].step;
-                    out_buf += 1;
+            int channel_count = instream->layout.channel_count;
+            if (recording_node_context->read_interleaved &&
+                areas_are_interleaved(areas, channel_count, instream->bytes_per_sample))
+            {
+                recording_node_context->read_interleaved(out_buf, areas[0].ptr,
+                        write_frame_count * channel_count);
+            } else {
+                for (int ch = 0; ch < channel_count; ch += 1) {
+                    recording_node_context->read_area(out_buf + ch, channel_count,
+                            areas[ch].ptr, areas[ch].step, write_frame_count);
                 }
             }
+            out_buf += write_frame_count * channel_count;
         }
 
         if ((err = soundio_instream_end_read(instream))) {
@@ -1274,7 +1594,8 @@ static int recording_choose_best_format(RecordingNodeContext *recording_node_con
     for (int i = 0; i < array_length(prioritized_sample_format_infos); i += 1) {
         struct SampleFormatInfo *sample_format_info = &prioritized_sample_format_infos[i];
         if (soundio_device_supports_format(device, sample_format_info->format)) {
-            recording_node_context->read_sample = sample_format_info->read_sample;
+            recording_node_context->read_area = sample_format_info->read_area;
+            recording_node_context->read_interleaved = sample_format_info->read_interleaved;
             recording_node_context->instream->format = sample_format_info->format;
             return 0;
         }
@@ -1887,10 +2208,11 @@ void genesis_debug_print_port_config(struct GenesisPort *port) {
 }
 
 static void pipeline_thread_run(void *userdata) {
-    GenesisPipeline *pipeline = reinterpret_cast<GenesisPipeline*>(userdata);
+    GenesisPipelineWorker *worker = reinterpret_cast<GenesisPipelineWorker*>(userdata);
+    GenesisPipeline *pipeline = worker->pipeline;
     for (;;) {
-        GenesisNode *node = pipeline->task_queue.dequeue();
-        if (!pipeline->running) {
+        GenesisNode *node = pipeline->task_queue.dequeue(worker->index);
+        if (!node || !pipeline->running) {
             // Note: node is not valid inside this block.
             if (pipeline->paused.load() != 1)
                 break;
@@ -1908,7 +2230,7 @@ static void pipeline_thread_run(void *userdata) {
 
         const GenesisNodeDescriptor *node_descriptor = node->descriptor;
         node_descriptor->run(node);
-        node->being_processed.store(false);
+        pipeline_finish_node(pipeline, node);
     }
 }
 
@@ -1931,10 +2253,17 @@ int genesis_pipeline_start(struct GenesisPipeline *pipeline, double time) {
                 return err;
             }
         }
+        node->activated = true;
     }
 
+    // offline workers run flat out, so real-time priority would starve the
+    // rest of the system.
+    bool high_priority = !pipeline->offline;
     for (int i = 0; i < pipeline->thread_pool_size; i += 1) {
-        if ((err = os_thread_create(pipeline_thread_run, pipeline, true, &pipeline->thread_pool[i]))) {
+        GenesisPipelineWorker *worker = &pipeline->worker_list[i];
+        if ((err = os_thread_create(pipeline_thread_run, worker, high_priority,
+                        &pipeline->thread_pool[i])))
+        {
             genesis_pipeline_stop(pipeline);
             return err;
         }
@@ -2006,66 +2335,95 @@ void genesis_pipeline_stop(struct GenesisPipeline *pipeline) {
         assert(node->descriptor->pipeline);
         if (node->descriptor->deactivate)
             node->descriptor->deactivate(node);
+        node->activated = false;
+    }
+}
+
+// Size the ring buffers of the node's ports for the pipeline's buffer duration.
+static int prepare_node_ports(GenesisPipeline *pipeline, GenesisNode *node) {
+    double buffer_duration = pipeline->buffer_duration;
+    for (int port_i = 0; port_i < node->port_count; port_i += 1) {
+        GenesisPort *port = node->ports[port_i];
+        if (port->descriptor->port_type == GenesisPortTypeAudioIn) {
+            GenesisAudioPort *audio_port = reinterpret_cast<GenesisAudioPort*>(port);
+            audio_port->bytes_per_frame = BYTES_PER_SAMPLE * audio_port->channel_layout.channel_count;
+        } else if (port->descriptor->port_type == GenesisPortTypeAudioOut) {
+            GenesisAudioPort *audio_port = reinterpret_cast<GenesisAudioPort*>(port);
+            int sample_buffer_frame_count = ceil(buffer_duration * audio_port->sample_rate);
+            audio_port->bytes_per_frame = BYTES_PER_SAMPLE * audio_port->channel_layout.channel_count;
+            int new_sample_buffer_size = sample_buffer_frame_count * audio_port->bytes_per_frame;
+            bool different = new_sample_buffer_size != audio_port->sample_buffer_size;
+            audio_port->sample_buffer_size = new_sample_buffer_size;
+
+            if (audio_port->sample_buffer_err || different) {
+                if (!audio_port->sample_buffer_err)
+                    ring_buffer_deinit(&audio_port->sample_buffer);
+                if ((audio_port->sample_buffer_err =
+                        ring_buffer_init(&audio_port->sample_buffer, audio_port->sample_buffer_size)))
+                {
+                    return audio_port->sample_buffer_err;
+                }
+            }
+        } else if (port->descriptor->port_type == GenesisPortTypeEventsOut) {
+            GenesisEventsPort *events_port = reinterpret_cast<GenesisEventsPort*>(port);
+            int min_event_buffer_size = EVENTS_PER_SECOND_CAPACITY * buffer_duration;
+            if (events_port->event_buffer_err ||
+                events_port->event_buffer.capacity != min_event_buffer_size)
+            {
+                if (!events_port->event_buffer_err)
+                    ring_buffer_deinit(&events_port->event_buffer);
+                if ((events_port->event_buffer_err = ring_buffer_init(&events_port->event_buffer,
+                                min_event_buffer_size)))
+                {
+                    return events_port->event_buffer_err;
+                }
+            }
+        }
     }
+    return 0;
 }
 
 int genesis_pipeline_resume(struct GenesisPipeline *pipeline) {
-    int err = pipeline->task_queue.resize(pipeline->nodes.length() + pipeline->thread_pool_size);
+    // leave room for nodes added by live edits
+    int node_count = pipeline->nodes.length();
+    pipeline->task_queue_capacity = max(node_count * 2, node_count + 64);
+    int err = pipeline->task_queue.resize(pipeline->thread_pool_size,
+            pipeline->task_queue_capacity + pipeline->thread_pool_size);
     if (err) {
         genesis_pipeline_stop(pipeline);
         return err;
     }
 
-    // the 0.75 is because the outstream software_latency is pipeline->latency * 0.25
-    double desired_buffer_duration = pipeline->latency * 0.75;
-    for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
-        GenesisNode *node = pipeline->nodes.at(node_index);
-        desired_buffer_duration = max(node->descriptor->min_software_latency, desired_buffer_duration);
+    if (pipeline->offline) {
+        pipeline->actual_latency = 0.0;
+        pipeline->buffer_duration = OFFLINE_BUFFER_DURATION;
+    } else {
+        // the 0.75 is because the outstream software_latency is pipeline->latency * 0.25
+        double desired_buffer_duration = pipeline->latency * 0.75;
+        for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
+            GenesisNode *node = pipeline->nodes.at(node_index);
+            desired_buffer_duration = max(node->descriptor->min_software_latency, desired_buffer_duration);
+        }
+        pipeline->actual_latency = desired_buffer_duration / 0.75;
+        pipeline->buffer_duration = desired_buffer_duration;
+    }
+
+    if ((err = pipeline_compile_schedule(pipeline))) {
+        genesis_pipeline_stop(pipeline);
+        return err;
     }
-    pipeline->actual_latency = desired_buffer_duration / 0.75;
+    // workers are stopped or paused, so any cycle they were in the middle
+    // of is abandoned.
+    pipeline->cycle_running.store(0);
+    pipeline->cycle_hold.store(false);
+    pipeline->cycle_requested.store(false);
+    pipeline->event_only_cycles_left = MAX_EVENT_ONLY_CYCLES;
 
     for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
         GenesisNode *node = pipeline->nodes.at(node_index);
-        node->being_processed = false;
-        for (int port_i = 0; port_i < node->port_count; port_i += 1) {
-            GenesisPort *port = node->ports[port_i];
-            if (port->descriptor->port_type == GenesisPortTypeAudioIn) {
-                GenesisAudioPort *audio_port = reinterpret_cast<GenesisAudioPort*>(port);
-                audio_port->bytes_per_frame = BYTES_PER_SAMPLE * audio_port->channel_layout.channel_count;
-            } else if (port->descriptor->port_type == GenesisPortTypeAudioOut) {
-                GenesisAudioPort *audio_port = reinterpret_cast<GenesisAudioPort*>(port);
-                int sample_buffer_frame_count = ceil(desired_buffer_duration * audio_port->sample_rate);
-                audio_port->bytes_per_frame = BYTES_PER_SAMPLE * audio_port->channel_layout.channel_count;
-                int new_sample_buffer_size = sample_buffer_frame_count * audio_port->bytes_per_frame;
-                bool different = new_sample_buffer_size != audio_port->sample_buffer_size;
-                audio_port->sample_buffer_size = new_sample_buffer_size;
-
-                if (audio_port->sample_buffer_err || different) {
-                    if (!audio_port->sample_buffer_err)
-                        ring_buffer_deinit(&audio_port->sample_buffer);
-                    if ((audio_port->sample_buffer_err =
-                            ring_buffer_init(&audio_port->sample_buffer, audio_port->sample_buffer_size)))
-                    {
-                        genesis_pipeline_stop(pipeline);
-                        return audio_port->sample_buffer_err;
-                    }
-                }
-            } else if (port->descriptor->port_type == GenesisPortTypeEventsOut) {
-                GenesisEventsPort *events_port = reinterpret_cast<GenesisEventsPort*>(port);
-                int min_event_buffer_size = EVENTS_PER_SECOND_CAPACITY * desired_buffer_duration;
-                if (events_port->event_buffer_err ||
-                    events_port->event_buffer.capacity != min_event_buffer_size)
-                {
-                    if (!events_port->event_buffer_err)
-                        ring_buffer_deinit(&events_port->event_buffer);
-                    if ((events_port->event_buffer_err = ring_buffer_init(&events_port->event_buffer,
-                                    min_event_buffer_size)))
-                    {
-                        genesis_pipeline_stop(pipeline);
-                        return events_port->event_buffer_err;
-                    }
-                }
-            }
+        if ((err = prepare_node_ports(pipeline, node))) {
+            genesis_pipeline_stop(pipeline);
+            return err;
         }
     }
 
@@ -2077,22 +2435,67 @@ int genesis_pipeline_resume(struct GenesisPipeline *pipeline) {
         os_futex_wake(reinterpret_cast<int*>(&pipeline->paused), threads_paused);
     }
 
-    // Iterate over the ports which are sinks and ask for frames.
+    // Kick off the first cycle to start filling the sinks.
+    pipeline_request_cycle(pipeline);
+
+    return 0;
+}
+
+void genesis_pipeline_begin_edit(struct GenesisPipeline *pipeline) {
+    assert(!pipeline->editing);
+    pipeline->editing = true;
+    if (!pipeline->running.load())
+        return;
+
+    // Take ownership of the schedule. The cycle in flight, if any, finishes
+    // and then hands it over instead of starting another.
+    pipeline->cycle_hold.store(true);
+    while (pipeline->cycle_running.exchange(1))
+        os_futex_wait(reinterpret_cast<int*>(&pipeline->cycle_running), 1);
+}
+
+int genesis_pipeline_commit_edit(struct GenesisPipeline *pipeline, double time) {
+    assert(pipeline->editing);
+    pipeline->editing = false;
+    if (!pipeline->running.load())
+        return 0;
+
+    int err;
     for (int node_index = 0; node_index < pipeline->nodes.length(); node_index += 1) {
         GenesisNode *node = pipeline->nodes.at(node_index);
-        for (int port_i = 0; port_i < node->port_count; port_i += 1) {
-            GenesisPort *port = node->ports[port_i];
-            if (port->descriptor->port_type == GenesisPortTypeAudioIn) {
-                GenesisAudioPort *audio_port = reinterpret_cast<GenesisAudioPort*>(port);
-                GenesisAudioPortDescriptor *audio_port_descr =
-                    (GenesisAudioPortDescriptor *)port->descriptor;
-                if (audio_port_descr->is_sink) {
-                    genesis_audio_in_port_advance_read_ptr(&audio_port->port, 0);
-                }
+        if (node->activated)
+            continue;
+        if ((err = prepare_node_ports(pipeline, node))) {
+            genesis_pipeline_stop(pipeline);
+            return err;
+        }
+        node->timestamp = time;
+        if (node->descriptor->seek)
+            node->descriptor->seek(node);
+        if (node->descriptor->activate) {
+            if ((err = node->descriptor->activate(node))) {
+                genesis_pipeline_stop(pipeline);
+                return err;
             }
         }
+        node->activated = true;
     }
 
+    if ((err = pipeline_compile_schedule(pipeline))) {
+        genesis_pipeline_stop(pipeline);
+        return err;
+    }
+
+    if (pipeline->schedule.length() > pipeline->task_queue_capacity) {
+        // The deques cannot grow while workers may be stealing from them.
+        // This is rare, so fall back to restarting the workers.
+        genesis_pipeline_pause(pipeline);
+        return genesis_pipeline_resume(pipeline);
+    }
+
+    pipeline->cycle_hold.store(false);
+    pipeline->cycle_running.store(0);
+    pipeline_request_cycle(pipeline);
     return 0;
 }
 
@@ -2117,6 +2520,44 @@ double genesis_pipeline_get_latency(struct GenesisPipeline *pipeline) {
     return pipeline->latency;
 }
 
+int genesis_pipeline_set_offline(struct GenesisPipeline *pipeline, bool offline) {
+    // a paused pipeline still has its workers
+    if (pipeline->running || pipeline->thread_pool[0])
+        return GenesisErrorInvalidState;
+    if (offline == pipeline->offline)
+        return 0;
+
+    pipeline->offline = offline;
+    int err;
+    if ((err = pipeline_init_thread_pool(pipeline))) {
+        pipeline->offline = !offline;
+        return err;
+    }
+    return 0;
+}
+
+bool genesis_pipeline_is_offline(struct GenesisPipeline *pipeline) {
+    return pipeline->offline;
+}
+
+int genesis_pipeline_set_worker_count(struct GenesisPipeline *pipeline, int worker_count) {
+    if (worker_count < 0)
+        return GenesisErrorInvalidParam;
+    if (pipeline->running || pipeline->thread_pool[0])
+        return GenesisErrorInvalidState;
+    if (worker_count == pipeline->worker_count)
+        return 0;
+
+    int old_worker_count = pipeline->worker_count;
+    pipeline->worker_count = worker_count;
+    int err;
+    if ((err = pipeline_init_thread_pool(pipeline))) {
+        pipeline->worker_count = old_worker_count;
+        return err;
+    }
+    return 0;
+}
+
 int genesis_pipeline_set_sample_rate(struct GenesisPipeline *pipeline, int sample_rate) {
     if (sample_rate <= 0)
         return GenesisErrorInvalidParam;
@@ -2141,6 +2582,16 @@ struct SoundIoChannelLayout *genesis_pipeline_get_channel_layout(struct GenesisP
     return &pipeline->channel_layout;
 }
 
+void genesis_pipeline_set_resample_quality(struct GenesisPipeline *pipeline,
+        enum GenesisResampleQuality quality)
+{
+    pipeline->resample_quality = quality;
+}
+
+enum GenesisResampleQuality genesis_pipeline_get_resample_quality(struct GenesisPipeline *pipeline) {
+    return pipeline->resample_quality;
+}
+
 struct GenesisNodeDescriptor *genesis_node_descriptor(struct GenesisNode *node) {
     return node->descriptor;
 }
@@ -2174,8 +2625,8 @@ void genesis_audio_in_port_advance_read_ptr(GenesisPort *port, int frame_count)
     assert(byte_count >= 0);
     assert(byte_count <= audio_out_port->sample_buffer_size);
     ring_buffer_advance_read_ptr(&audio_out_port->sample_buffer, byte_count);
-    struct GenesisNode *child_node = audio_out_port->port.node;
-    queue_node_if_ready(child_node->descriptor->pipeline, child_node, true);
+    if (frame_count > 0)
+        pipeline_port_progress(port->node->descriptor->pipeline, true);
 }
 
 int genesis_audio_out_port_free_count(GenesisPort *port) {
@@ -2198,10 +2649,8 @@ void genesis_audio_out_port_advance_write_ptr(GenesisPort *port, int frame_count
     assert(byte_count >= 0);
     assert(byte_count <= (audio_out_port->sample_buffer_size - ring_buffer_fill_count(&audio_out_port->sample_buffer)));
     ring_buffer_advance_write_ptr(&audio_out_port->sample_buffer, byte_count);
-    GenesisAudioPort *audio_in_port = (GenesisAudioPort *)audio_out_port->port.output_to;
-    GenesisNode *other_node = audio_in_port->port.node;
-    GenesisPipeline *pipeline = port->node->descriptor->pipeline;
-    queue_node_if_ready(pipeline, other_node, false);
+    if (frame_count > 0)
+        pipeline_port_progress(port->node->descriptor->pipeline, true);
 }
 
 int genesis_audio_port_bytes_per_frame(struct GenesisPort *port) {
@@ -2228,6 +2677,8 @@ void genesis_events_in_port_fill_count(struct GenesisPort *port,
     *event_count = ring_buffer_fill_count(&events_out_port->event_buffer) / sizeof(GenesisMidiEvent);
     *time_available = events_out_port->time_available.load();
     events_out_port->time_requested.add(time_requested);
+    if (time_requested > 0.0)
+        pipeline_port_progress(port->node->descriptor->pipeline, false);
 }
 
 void genesis_events_in_port_advance_read_ptr(struct GenesisPort *port, int event_count, double buf_size) {
@@ -2236,9 +2687,8 @@ void genesis_events_in_port_advance_read_ptr(struct GenesisPort *port, int event
     assert(events_out_port); // assume it is connected
     ring_buffer_advance_read_ptr(&events_out_port->event_buffer, event_count * sizeof(GenesisMidiEvent));
     events_out_port->time_available.add(-buf_size);
-
-    struct GenesisNode *child_node = events_out_port->port.node;
-    queue_node_if_ready(child_node->descriptor->pipeline, child_node, true);
+    if (event_count > 0 || buf_size > 0.0)
+        pipeline_port_progress(port->node->descriptor->pipeline, event_count > 0);
 }
 
 GenesisMidiEvent *genesis_events_in_port_read_ptr(GenesisPort *port) {
@@ -2265,12 +2715,8 @@ void genesis_events_out_port_advance_write_ptr(struct GenesisPort *port, int eve
     ring_buffer_advance_write_ptr(&events_out_port->event_buffer, event_count * sizeof(GenesisMidiEvent));
     events_out_port->time_requested.add(-buf_size);
     events_out_port->time_available.add(buf_size);
-
-    GenesisEventsPort *events_in_port = (GenesisEventsPort *)events_out_port->port.output_to;
-    assert(events_in_port);
-    GenesisNode *other_node = events_in_port->port.node;
-    GenesisPipeline *pipeline = port->node->descriptor->pipeline;
-    queue_node_if_ready(pipeline, other_node, false);
+    if (event_count > 0 || buf_size > 0.0)
+        pipeline_port_progress(port->node->descriptor->pipeline, event_count > 0);
 }
 
 struct GenesisMidiEvent *genesis_events_out_port_write_ptr(struct GenesisPort *port) {
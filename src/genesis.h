@@ -69,6 +69,14 @@ enum GenesisPortType {
     GenesisPortTypeEventsOut,
 };
 
+enum GenesisResampleQuality {
+    // short filters for cheap previews
+    GenesisResampleQualityDraft,
+    GenesisResampleQualityNormal,
+    // long filters for final renders
+    GenesisResampleQualityBest,
+};
+
 struct GenesisContext;
 struct GenesisPipeline;
 
@@ -79,11 +87,20 @@ struct GenesisExportFormat {
     int sample_rate;
 };
 
+struct GenesisAudioFileChunk;
+
+// A window [start, end) of one channel of an audio file. ptr points to the
+// sample at start, or is NULL if the window is not decoded yet, in which case
+// the window should be treated as silence.
 struct GenesisAudioFileIterator {
     struct GenesisAudioFile *audio_file;
     long start; // absolute frame index
     long end; // absolute frame index
     float *ptr;
+    int channel_index;
+    // streaming mode: the cache chunk this window is in, kept resident until
+    // the iterator moves on or is released.
+    struct GenesisAudioFileChunk *chunk;
 };
 
 struct GenesisSoundBackend {
@@ -214,10 +231,36 @@ GENESIS_EXPORT void genesis_pipeline_set_underrun_callback(struct GenesisPipelin
         void (*callback)(void *userdata), void *userdata);
 
 
+// A tempo which lasts from start_whole_notes until the next segment starts.
+struct GenesisTempoSegment {
+    double start_whole_notes;
+    double whole_notes_per_second;
+};
+
+// segments must be sorted by start_whole_notes, and the first one must start
+// at 0. Only while the pipeline is not running. Until this is called the
+// tempo is 140 / 60 whole notes per second.
+GENESIS_EXPORT int genesis_pipeline_set_tempo_map(struct GenesisPipeline *pipeline,
+        const struct GenesisTempoSegment *segments, int segment_count);
+
+// These convert positions on the timeline through the tempo map, in
+// logarithmic time in the number of tempo changes.
 GENESIS_EXPORT double genesis_frames_to_whole_notes(struct GenesisPipeline *pipeline, int frames, int frame_rate);
 GENESIS_EXPORT int genesis_whole_notes_to_frames(struct GenesisPipeline *pipeline, double whole_notes, int frame_rate);
 GENESIS_EXPORT double genesis_whole_notes_to_seconds(struct GenesisPipeline *pipeline, double whole_notes, int frame_rate);
 
+// Remembers which tempo segment the last conversion landed in. A node which
+// keeps one and converts positions near each other, block after block,
+// converts in constant time. Zero-initialize.
+struct GenesisTempoCursor {
+    int segment_index;
+};
+
+GENESIS_EXPORT double genesis_frames_to_whole_notes_cursor(struct GenesisPipeline *pipeline,
+        struct GenesisTempoCursor *cursor, int frames, int frame_rate);
+GENESIS_EXPORT int genesis_whole_notes_to_frames_cursor(struct GenesisPipeline *pipeline,
+        struct GenesisTempoCursor *cursor, double whole_notes, int frame_rate);
+
 
 GENESIS_EXPORT struct GenesisNodeDescriptor *genesis_node_descriptor_find(
         struct GenesisPipeline *pipeline, const char *name);
@@ -329,6 +372,19 @@ GENESIS_EXPORT int genesis_pipeline_resume(struct GenesisPipeline *pipeline);
 /// Must be called only when pipeline is paused or stopped.
 GENESIS_EXPORT void genesis_pipeline_seek(struct GenesisPipeline *pipeline, double time);
 
+/// Modify the node graph of a running pipeline. Call this from the control
+/// thread, then create, connect, disconnect and destroy nodes as usual, then
+/// call ::genesis_pipeline_commit_edit. The cycle in progress is allowed to
+/// finish and no new one starts until the commit, so nodes can be destroyed
+/// safely. Device streams keep playing from their buffers in the meantime.
+/// Do not disconnect or destroy a node which feeds a device node directly.
+/// If the pipeline is not running this only marks the start of the edit.
+GENESIS_EXPORT void genesis_pipeline_begin_edit(struct GenesisPipeline *pipeline);
+/// Nodes created during the edit are seeked to `time` in whole notes and
+/// activated, the schedule is recompiled, and processing continues.
+/// If this returns an error the pipeline has been stopped.
+GENESIS_EXPORT int genesis_pipeline_commit_edit(struct GenesisPipeline *pipeline, double time);
+
 GENESIS_EXPORT bool genesis_pipeline_is_running(struct GenesisPipeline *pipeline);
 
 // can only set this when the pipeline is stopped.
@@ -337,6 +393,21 @@ GENESIS_EXPORT bool genesis_pipeline_is_running(struct GenesisPipeline *pipeline
 GENESIS_EXPORT int genesis_pipeline_set_latency(struct GenesisPipeline *pipeline, double latency);
 GENESIS_EXPORT double genesis_pipeline_get_latency(struct GenesisPipeline *pipeline);
 
+// Offline pipelines render to sinks such as files instead of audio devices,
+// as fast as the workers can go. Latency is ignored and ports buffer large
+// blocks; there is one worker per core, at normal priority. Cycles run one
+// after another, so the output does not depend on the number of workers.
+// Device nodes fail to activate with GenesisErrorInvalidState.
+// can only set this when the pipeline is stopped.
+GENESIS_EXPORT int genesis_pipeline_set_offline(struct GenesisPipeline *pipeline, bool offline);
+GENESIS_EXPORT bool genesis_pipeline_is_offline(struct GenesisPipeline *pipeline);
+
+// Overrides the number of worker threads, or with 0 goes back to choosing it
+// from the number of cores.
+// can only set this when the pipeline is stopped.
+GENESIS_EXPORT int genesis_pipeline_set_worker_count(struct GenesisPipeline *pipeline,
+        int worker_count);
+
 // can only set this when the pipeline is stopped.
 // also if you change this, you must destroy and re-create all nodes and node
 // descriptors
@@ -352,6 +423,13 @@ GENESIS_EXPORT void genesis_pipeline_set_channel_layout(struct GenesisPipeline *
 GENESIS_EXPORT struct SoundIoChannelLayout *genesis_pipeline_get_channel_layout(
         struct GenesisPipeline *pipeline);
 
+// Filter length used by resample nodes. Takes effect for resample nodes
+// whose ports are connected afterwards. Defaults to GenesisResampleQualityNormal.
+GENESIS_EXPORT void genesis_pipeline_set_resample_quality(struct GenesisPipeline *pipeline,
+        enum GenesisResampleQuality quality);
+GENESIS_EXPORT enum GenesisResampleQuality genesis_pipeline_get_resample_quality(
+        struct GenesisPipeline *pipeline);
+
 // returns the number of frames available to read
 GENESIS_EXPORT int genesis_audio_in_port_fill_count(struct GenesisPort *port);
 GENESIS_EXPORT float *genesis_audio_in_port_read_ptr(struct GenesisPort *port);
@@ -469,6 +547,33 @@ GENESIS_EXPORT int genesis_audio_file_sample_rate_index(int index);
 GENESIS_EXPORT int genesis_audio_file_load(struct GenesisContext *context,
         const char *input_filename, struct GenesisAudioFile **audio_file);
 
+// Like genesis_audio_file_load but only reads the header. Audio is decoded on
+// demand by background threads shared by every streaming file of the context,
+// into a cache with one memory budget for the whole context, so memory use does
+// not depend on the length or number of files. Streaming files must be
+// destroyed before their context. Iterators never block on a streaming file;
+// windows which are not decoded yet come back with a NULL ptr and count as a
+// cache miss. The frame count comes from the container. If the container does
+// not report a duration, this falls back to decoding the whole file.
+// genesis_audio_file_export is not supported on a streaming file.
+GENESIS_EXPORT int genesis_audio_file_load_streaming(struct GenesisContext *context,
+        const char *input_filename, struct GenesisAudioFile **audio_file);
+GENESIS_EXPORT bool genesis_audio_file_is_streaming(const struct GenesisAudioFile *audio_file);
+
+// Decodes input_filename into a file at output_path which
+// genesis_audio_file_load_decoded can memory-map later instead of running the
+// decoder again. The file is only valid on the machine which wrote it. key is
+// stored in the file and must be passed again to load it, so that callers can
+// tie the file to the state of its source. key_len is at most 1024.
+GENESIS_EXPORT int genesis_audio_file_write_decoded(struct GenesisContext *context,
+        const char *input_filename, const char *output_path, const void *key, int key_len);
+// Returns GenesisErrorInvalidFormat if the file is damaged or the key does
+// not match.
+GENESIS_EXPORT int genesis_audio_file_load_decoded(struct GenesisContext *context,
+        const char *path, const void *key, int key_len, struct GenesisAudioFile **audio_file);
+// Number of times an iterator asked for a window that was not decoded yet.
+GENESIS_EXPORT long genesis_audio_file_cache_miss_count(const struct GenesisAudioFile *audio_file);
+
 GENESIS_EXPORT struct GenesisAudioFile *genesis_audio_file_create(
         struct GenesisContext *context, int sample_rate);
 GENESIS_EXPORT void genesis_audio_file_set_sample_rate(struct GenesisAudioFile *audio_file,
@@ -489,11 +594,22 @@ GENESIS_EXPORT int genesis_audio_file_sample_rate(const struct GenesisAudioFile
 
 GENESIS_EXPORT struct GenesisAudioFileIterator genesis_audio_file_iterator(
         struct GenesisAudioFile *audio_file, int channel_index, long start_frame_index);
+// Moves to the window starting at it->end. Real-time safe.
 GENESIS_EXPORT void genesis_audio_file_iterator_next(struct GenesisAudioFileIterator *it);
+// If the window is not decoded yet, decodes it on the calling thread, so that
+// ptr is only NULL afterwards when there is no memory for it. For offline
+// rendering; not real-time safe.
+GENESIS_EXPORT void genesis_audio_file_iterator_wait(struct GenesisAudioFileIterator *it);
+// Call when done with an iterator so that its window may be evicted from the
+// cache. Safe to call more than once. Real-time safe.
+GENESIS_EXPORT void genesis_audio_file_iterator_release(struct GenesisAudioFileIterator *it);
 
 
 GENESIS_EXPORT struct GenesisAudioFileStream *genesis_audio_file_stream_create(struct GenesisContext *context);
 GENESIS_EXPORT void genesis_audio_file_stream_destroy(struct GenesisAudioFileStream *stream);
+// The sample rate of the frames passed to genesis_audio_file_stream_write.
+// If it differs from the sample rate of the export format, the encoder
+// thread resamples.
 GENESIS_EXPORT void genesis_audio_file_stream_set_sample_rate(struct GenesisAudioFileStream *stream,
         int sample_rate);
 GENESIS_EXPORT void genesis_audio_file_stream_set_channel_layout(struct GenesisAudioFileStream *stream,
@@ -503,13 +619,28 @@ GENESIS_EXPORT void genesis_audio_file_stream_set_tag(struct GenesisAudioFileStr
 GENESIS_EXPORT void genesis_audio_file_stream_set_export_format(struct GenesisAudioFileStream *stream,
         const struct GenesisExportFormat *export_format);
 
+// Starts a thread which encodes and writes everything passed to
+// genesis_audio_file_stream_write.
 GENESIS_EXPORT int genesis_audio_file_stream_open(struct GenesisAudioFileStream *stream,
         const char *file_path, int file_path_len);
+// Waits for the encoder thread to finish the queued frames, then finishes
+// the file.
 GENESIS_EXPORT int genesis_audio_file_stream_close(struct GenesisAudioFileStream *stream);
 
-/// interleaved
+/// interleaved. Copies the frames into a queue and returns; encoding and file
+/// I/O happen on the stream's encoder thread. Blocks while the queue is full.
+/// Only one thread may write to a stream.
 GENESIS_EXPORT int genesis_audio_file_stream_write(struct GenesisAudioFileStream *stream,
         const float *frames, int frame_count);
 
+// Diagnostics for the encoder queue. Thread-safe.
+// Frames written but not yet encoded.
+GENESIS_EXPORT int genesis_audio_file_stream_queue_depth(struct GenesisAudioFileStream *stream);
+GENESIS_EXPORT int genesis_audio_file_stream_queue_capacity(struct GenesisAudioFileStream *stream);
+// How many times genesis_audio_file_stream_write blocked on a full queue,
+// and for how long in total.
+GENESIS_EXPORT long genesis_audio_file_stream_stall_count(struct GenesisAudioFileStream *stream);
+GENESIS_EXPORT double genesis_audio_file_stream_stall_seconds(struct GenesisAudioFileStream *stream);
+
 
 #endif
@@ -5,12 +5,20 @@
 #include "list.hpp"
 #include "midi_hardware.hpp"
 #include "os.hpp"
-#include "thread_safe_queue.hpp"
+#include "work_stealing_queue.hpp"
 #include "ring_buffer.hpp"
 #include "atomic_double.hpp"
 #include "atomics.hpp"
+#include "tempo_map.hpp"
 
 struct GenesisPipeline;
+struct ResampleFilter;
+struct AudioFileStreamPool;
+
+struct GenesisPipelineWorker {
+    struct GenesisPipeline *pipeline;
+    int index; // index into pipeline->thread_pool
+};
 
 struct GenesisContext {
     GenesisSoundBackend *sound_backend_list;
@@ -33,13 +41,23 @@ struct GenesisContext {
     List<GenesisAudioFileFormat*> in_formats;
 
     List<GenesisPipeline*> pipelines;
+
+    // filter tables shared read-only by every resample node in the context
+    List<ResampleFilter*> resample_filters;
+    OsMutex *resample_filters_mutex;
+
+    // prefetch threads and chunk memory of every streaming audio file
+    AudioFileStreamPool *stream_pool;
 };
 
 struct GenesisPipeline {
     GenesisContext *context;
 
     OsThread **thread_pool;
+    GenesisPipelineWorker *worker_list;
     int thread_pool_size;
+    // 0 to size the pool from the core count
+    int worker_count;
     atomic_int threads_paused;
 
     void (*underrun_callback)(void *userdata);
@@ -50,7 +68,34 @@ struct GenesisPipeline {
     List<GenesisNode*> nodes;
     atomic_bool running;
     atomic_int paused;
-    ThreadSafeQueue<GenesisNode *> task_queue;
+    WorkStealingQueue<GenesisNode *> task_queue;
+
+    // Static topological order of every node which feeds a sink, compiled
+    // at genesis_pipeline_resume. A cycle runs each scheduled node once,
+    // after all of its producers.
+    List<GenesisNode *> schedule;
+    // scheduled nodes with no producers, sorted by descending critical path
+    List<GenesisNode *> schedule_sources;
+    atomic_int cycle_nodes_remaining;
+    // 1 while a cycle is in flight or while a live edit holds off cycles.
+    // whoever swaps it from 0 to 1 owns the schedule until storing 0.
+    atomic_int cycle_running;
+    // set during a live edit so that the thread ending a cycle hands the
+    // schedule over to the control thread instead of starting another
+    atomic_bool cycle_hold;
+    // set by threads outside the pipeline (device callbacks, control thread)
+    // to ask for another cycle
+    atomic_bool cycle_requested;
+    atomic_bool cycle_audio_progress;
+    atomic_bool cycle_event_progress;
+    // only touched by the thread which ends a cycle
+    int event_only_cycles_left;
+    // capacity task_queue was sized for at genesis_pipeline_resume
+    int task_queue_capacity;
+    // seconds of audio each audio out port buffers, chosen at genesis_pipeline_resume
+    double buffer_duration;
+    bool editing;
+    bool offline;
     double latency;
     double actual_latency;
 
@@ -60,6 +105,9 @@ struct GenesisPipeline {
     int target_sample_rate;
 
     SoundIoChannelLayout channel_layout;
+    GenesisResampleQuality resample_quality;
+    // only changed while the pipeline is not running
+    TempoMap tempo_map;
 };
 
 struct GenesisPortDescriptor {
@@ -145,10 +193,24 @@ struct GenesisNode {
     int port_count;
     struct GenesisPort **ports;
     int set_index; // index into context->nodes
-    atomic_bool being_processed;
+
+    // The fields below are compiled from the port connections by
+    // genesis_pipeline_resume and are only valid while the pipeline runs.
+    // nodes which read from this node, sorted by ascending critical path
+    List<GenesisNode *> consumers;
+    int producer_count;
+    // counts down as producers finish in the current cycle; the node is
+    // dispatched when this reaches 0
+    atomic_int producers_remaining;
+    // number of nodes on the longest path from this node to a sink,
+    // including this node
+    int critical_path_length;
+    int schedule_state;
     double timestamp; // in whole notes
     void *userdata;
     bool constructed;
+    // activate has been called and deactivate has not
+    bool activated;
 };
 
 #endif
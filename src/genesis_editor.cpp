@@ -92,6 +92,7 @@ static void on_flush_events(Event, void *userdata) {
         editor_window->fps_widget->set_text(fps_text);
     }
 
+    project_flush_events(genesis_editor->project);
     audio_graph_flush_events(genesis_editor->audio_graph);
 
     for (int i = 0; i < genesis_editor->gui->render_jobs.length(); i += 1) {
@@ -484,21 +485,30 @@ void GenesisEditor::exec() {
 void GenesisEditor::refresh_menu_state() {
     bool undo_enabled = (project->undo_stack_index > 0);
     bool redo_enabled = (project->undo_stack_index < project->undo_stack.length());
-    String undo_caption;
-    String redo_caption;
+    // the commands may still be loading, in which case the captions get
+    // their descriptions once they are in
+    String undo_caption = "&Undo";
+    String redo_caption = "&Redo";
+    int err;
     if (undo_enabled) {
-        Command *cmd = project->undo_stack.at(project->undo_stack_index - 1);
-        undo_caption = "&Undo ";
-        undo_caption.append(cmd->description());
-    } else {
-        undo_caption = "&Undo";
+        Command *cmd;
+        if ((err = project_peek_undo_command(project, project->undo_stack_index - 1, &cmd))) {
+            fprintf(stderr, "Unable to load undo command: %s\n", genesis_strerror(err));
+            undo_enabled = false;
+        } else if (cmd) {
+            undo_caption.append(" ");
+            undo_caption.append(cmd->description());
+        }
     }
     if (redo_enabled) {
-        Command *cmd = project->undo_stack.at(project->undo_stack_index);
-        redo_caption = "&Redo ";
-        redo_caption.append(cmd->description());
-    } else {
-        redo_caption = "&Redo";
+        Command *cmd;
+        if ((err = project_peek_undo_command(project, project->undo_stack_index, &cmd))) {
+            fprintf(stderr, "Unable to load redo command: %s\n", genesis_strerror(err));
+            redo_enabled = false;
+        } else if (cmd) {
+            redo_caption.append(" ");
+            redo_caption.append(cmd->description());
+        }
     }
 
     bool is_playing = audio_graph_is_playing(audio_graph);
@@ -521,11 +531,15 @@ void GenesisEditor::refresh_menu_state() {
 }
 
 void GenesisEditor::do_undo() {
-    project_undo(project);
+    int err;
+    if ((err = project_undo(project)))
+        fprintf(stderr, "Unable to undo: %s\n", genesis_strerror(err));
 }
 
 void GenesisEditor::do_redo() {
-    project_redo(project);
+    int err;
+    if ((err = project_redo(project)))
+        fprintf(stderr, "Unable to redo: %s\n", genesis_strerror(err));
 }
 
 void GenesisEditor::load_perspective(EditorWindow *editor_window, SettingsFilePerspective *perspective) {
@@ -67,6 +67,18 @@ public:
         }
     }
 
+    // like shift, but returns false instead of waiting when the queue is empty
+    bool try_shift(T *result) {
+        OsMutexLocker locker(_mutex);
+
+        if (_shutdown || _length <= 0)
+            return false;
+        _length -= 1;
+        *result = _items[_start];
+        _start = (_start + 1) % _capacity;
+        return true;
+    }
+
     void wakeup_all() {
         OsMutexLocker locker(_mutex);
         _shutdown = true;
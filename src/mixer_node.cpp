@@ -1,5 +1,18 @@
 #include "mixer_node.hpp"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MIXER_X86
+#include <immintrin.h>
+#define TARGET_SSE __attribute__((target("sse")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+using std::atomic;
+
+// Number of samples mixed at a time. Small enough that the output block
+// stays in L1 cache while every input is added to it.
+static const int MIX_BLOCK_SIZE = 1024;
+
 struct DescriptorContext {
     int input_port_count;
 };
@@ -7,13 +20,180 @@ struct DescriptorContext {
 struct MixerContext {
     int input_port_count;
     float **read_ptrs;
+    atomic<float> *gains;
+    // gains as of the start of the current run
+    float *run_gains;
+};
+
+typedef void MixFn(float *out, const float *in, float gain, int count);
+
+struct MixerKernels {
+    // out = gain * in
+    MixFn *scale;
+    // out += gain * in
+    MixFn *accumulate;
+};
+
+static void mix_scale_scalar(float *out, const float *in, float gain, int count) {
+    for (int i = 0; i < count; i += 1)
+        out[i] = gain * in[i];
+}
+
+static void mix_accumulate_scalar(float *out, const float *in, float gain, int count) {
+    for (int i = 0; i < count; i += 1)
+        out[i] += gain * in[i];
+}
+
+static const MixerKernels scalar_kernels = {
+    mix_scale_scalar,
+    mix_accumulate_scalar,
+};
+
+#if defined(MIXER_X86)
+
+// Each vector loop handles whole vectors and leaves the tail to the scalar
+// implementation.
+
+TARGET_SSE static void mix_scale_sse(float *out, const float *in, float gain, int count) {
+    __m128 gain_v = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_mul_ps(gain_v, _mm_loadu_ps(in + i)));
+    mix_scale_scalar(out + i, in + i, gain, count - i);
+}
+
+TARGET_SSE static void mix_accumulate_sse(float *out, const float *in, float gain, int count) {
+    __m128 gain_v = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(gain_v, _mm_loadu_ps(in + i)));
+        _mm_storeu_ps(out + i, sum);
+    }
+    mix_accumulate_scalar(out + i, in + i, gain, count - i);
+}
+
+TARGET_AVX static void mix_scale_avx(float *out, const float *in, float gain, int count) {
+    __m256 gain_v = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(gain_v, _mm256_loadu_ps(in + i)));
+    mix_scale_scalar(out + i, in + i, gain, count - i);
+}
+
+TARGET_AVX static void mix_accumulate_avx(float *out, const float *in, float gain, int count) {
+    __m256 gain_v = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(gain_v, _mm256_loadu_ps(in + i)));
+        _mm256_storeu_ps(out + i, sum);
+    }
+    mix_accumulate_scalar(out + i, in + i, gain, count - i);
+}
+
+static const MixerKernels sse_kernels = {
+    mix_scale_sse,
+    mix_accumulate_sse,
+};
+
+static const MixerKernels avx_kernels = {
+    mix_scale_avx,
+    mix_accumulate_avx,
 };
 
+#endif
+
+static const MixerKernels *current_kernels = &scalar_kernels;
+static MixerIsa current_isa = MixerIsaScalar;
+static bool mixer_initialized = false;
+
+static bool cpu_supports(MixerIsa isa) {
+    switch (isa) {
+        case MixerIsaScalar:
+            return true;
+#if defined(MIXER_X86)
+        case MixerIsaSse:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse");
+        case MixerIsaAvx:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx");
+#else
+        case MixerIsaSse:
+        case MixerIsaAvx:
+            return false;
+#endif
+    }
+    panic("invalid isa");
+}
+
+bool mixer_select(MixerIsa isa) {
+    if (!cpu_supports(isa))
+        return false;
+
+    const MixerKernels *kernels = &scalar_kernels;
+#if defined(MIXER_X86)
+    if (isa == MixerIsaSse)
+        kernels = &sse_kernels;
+    else if (isa == MixerIsaAvx)
+        kernels = &avx_kernels;
+#endif
+
+    current_kernels = kernels;
+    current_isa = isa;
+    mixer_initialized = true;
+    return true;
+}
+
+void mixer_init(void) {
+    if (mixer_initialized)
+        return;
+    if (mixer_select(MixerIsaAvx))
+        return;
+    if (mixer_select(MixerIsaSse))
+        return;
+    mixer_select(MixerIsaScalar);
+}
+
+MixerIsa mixer_isa(void) {
+    return current_isa;
+}
+
+void mixer_mix(float *out, float *const *inputs, const float *gains,
+        int input_count, int sample_count)
+{
+    if (input_count == 0) {
+        memset(out, 0, sample_count * sizeof(float));
+        return;
+    }
+    const MixerKernels *kernels = current_kernels;
+    for (int offset = 0; offset < sample_count; offset += MIX_BLOCK_SIZE) {
+        int count = min(MIX_BLOCK_SIZE, sample_count - offset);
+        kernels->scale(out + offset, inputs[0] + offset, gains[0], count);
+        for (int i = 1; i < input_count; i += 1)
+            kernels->accumulate(out + offset, inputs[i] + offset, gains[i], count);
+    }
+}
+
+void mixer_mix_scalar(float *out, float *const *inputs, const float *gains,
+        int input_count, int sample_count)
+{
+    for (int sample = 0; sample < sample_count; sample += 1) {
+        float total = 0.0f;
+        for (int i = 0; i < input_count; i += 1)
+            total += gains[i] * inputs[i][sample];
+        out[sample] = total;
+    }
+}
+
 static void mixer_destroy(struct GenesisNode *node) {
     struct MixerContext *mixer_context = (struct MixerContext *)node->userdata;
     if (mixer_context) {
         if (mixer_context->read_ptrs)
             destroy(mixer_context->read_ptrs, mixer_context->input_port_count);
+        if (mixer_context->gains)
+            destroy(mixer_context->gains, mixer_context->input_port_count);
+        if (mixer_context->run_gains)
+            destroy(mixer_context->run_gains, mixer_context->input_port_count);
         destroy(mixer_context, 1);
     }
 }
@@ -41,6 +221,18 @@ static int mixer_create(struct GenesisNode *node) {
         mixer_destroy(node);
         return GenesisErrorNoMem;
     }
+    mixer_context->gains = allocate_zero<atomic<float>>(mixer_context->input_port_count);
+    if (!mixer_context->gains) {
+        mixer_destroy(node);
+        return GenesisErrorNoMem;
+    }
+    mixer_context->run_gains = allocate_zero<float>(mixer_context->input_port_count);
+    if (!mixer_context->run_gains) {
+        mixer_destroy(node);
+        return GenesisErrorNoMem;
+    }
+    for (int i = 0; i < mixer_context->input_port_count; i += 1)
+        mixer_context->gains[i].store(1.0f);
 
     return 0;
 }
@@ -61,21 +253,14 @@ static void mixer_run(struct GenesisNode *node) {
         min_frame_count = min(min_frame_count, input_frame_count);
     }
 
-    float *out_ptr = genesis_audio_out_port_write_ptr(audio_out_port);
-    for (int frame = 0; frame < min_frame_count; frame += 1) {
-        float total[GENESIS_MAX_CHANNELS] = {0.0f};
-        for (int port_i = 0; port_i < mixer_context->input_port_count; port_i += 1) {
-            for (int ch = 0; ch < channel_count; ch += 1) {
-                total[ch] += mixer_context->read_ptrs[port_i][0];
-                mixer_context->read_ptrs[port_i] += 1;
-            }
-        }
+    for (int i = 0; i < mixer_context->input_port_count; i += 1)
+        mixer_context->run_gains[i] = mixer_context->gains[i].load(std::memory_order_relaxed);
 
-        for (int ch = 0; ch < channel_count; ch += 1) {
-            out_ptr[0] = total[ch];
-            out_ptr += 1;
-        }
-    }
+    // Channels are interleaved the same way on every port, so the frames
+    // can be mixed as one flat run of samples.
+    float *out_ptr = genesis_audio_out_port_write_ptr(audio_out_port);
+    mixer_mix(out_ptr, mixer_context->read_ptrs, mixer_context->run_gains,
+            mixer_context->input_port_count, min_frame_count * channel_count);
 
     genesis_audio_out_port_advance_write_ptr(audio_out_port, min_frame_count);
     for (int i = 0; i < mixer_context->input_port_count; i += 1) {
@@ -84,9 +269,17 @@ static void mixer_run(struct GenesisNode *node) {
     }
 }
 
+void mixer_node_set_gain(GenesisNode *node, int input_index, float gain) {
+    struct MixerContext *mixer_context = (struct MixerContext *)node->userdata;
+    assert(input_index >= 0 && input_index < mixer_context->input_port_count);
+    mixer_context->gains[input_index].store(gain, std::memory_order_relaxed);
+}
+
 int create_mixer_descriptor(GenesisPipeline *pipeline, int input_port_count, GenesisNodeDescriptor **out) {
     *out = nullptr;
 
+    mixer_init();
+
     GenesisNodeDescriptor *node_descr = genesis_create_node_descriptor(
             pipeline, input_port_count + 1, "mixer", "Audio mixer.");
     if (!node_descr) {
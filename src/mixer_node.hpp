@@ -6,5 +6,34 @@
 int create_mixer_descriptor(GenesisPipeline *pipeline, int input_port_count,
         GenesisNodeDescriptor **out);
 
+// input_index 0 is the first audio in port. gain defaults to 1.0.
+// thread-safe; takes effect on the next run of the node.
+void mixer_node_set_gain(GenesisNode *node, int input_index, float gain);
+
+enum MixerIsa {
+    MixerIsaScalar,
+    MixerIsaSse,
+    MixerIsaAvx,
+};
+
+// out[i] is the sum of gains[j] * inputs[j][i] for each input j.
+// uses SSE or AVX when mixer_init finds that the CPU supports them.
+void mixer_mix(float *out, float *const *inputs, const float *gains,
+        int input_count, int sample_count);
+
+// Selects the fastest implementation the CPU supports, the first time it is
+// called. Not thread-safe; create_mixer_descriptor calls it on the GUI thread
+// before any mixer node runs.
+void mixer_init(void);
+
+// Selects the given implementation. Returns false and changes nothing if the
+// CPU does not support it. Not thread-safe; for tests and benchmarks.
+bool mixer_select(MixerIsa isa);
+
+MixerIsa mixer_isa(void);
+// reference implementation of mixer_mix
+void mixer_mix_scalar(float *out, float *const *inputs, const float *gains,
+        int input_count, int sample_count);
+
 #endif
 
@@ -5,7 +5,29 @@ static const int UUID_SIZE = 16;
 static const char *UUID = "\xca\x2f\x5e\xf5\x00\xd8\xef\x0b\x80\x74\x18\xd0\xe4\x0b\x7a\x4f";
 
 static const int TRANSACTION_METADATA_SIZE = 16;
+
+// A compacted file starts with an index: a transaction with no puts and no
+// dels, which older versions skip, whose payload is INDEX_UUID, the entry
+// count, and the size of the compacted file, followed by every key in sorted
+// order with the size and offset of its value. Opening such a file reads the
+// index and then only the transactions appended after the compacted part.
+static const char *INDEX_UUID = "\x5d\x0e\x3a\x91\x47\xc2\x4b\x6e\x9f\x18\xa4\x2d\x77\xe0\x61\xb3";
+static const int INDEX_METADATA_SIZE = UUID_SIZE + 4 + 8;
+static const int INDEX_ENTRY_SIZE = 16;
 static const int MAX_TRANSACTION_SIZE = 2147483640;
+// The write thread stops adding queued batches to a group commit once their
+// transactions add up to this many bytes.
+static const int GROUP_COMMIT_MAX_SIZE = 4 * 1024 * 1024;
+
+// Compact once the transaction log is this many times the size of a
+// compacted file, and at least COMPACT_MIN_SIZE bytes, so that small
+// projects are left alone.
+static const int COMPACT_GROWTH_FACTOR = 4;
+static const long COMPACT_MIN_SIZE = 1024 * 1024;
+// A compacted file groups its puts into transactions of about this size.
+static const int SNAPSHOT_TRANSACTION_SIZE = 1024 * 1024;
+
+int ordered_map_file_compact_kill_step = -1;
 
 static int get_transaction_size(OrderedMapFileBatch *batch) {
     int total = TRANSACTION_METADATA_SIZE;
@@ -21,6 +43,178 @@ static int get_transaction_size(OrderedMapFileBatch *batch) {
     return total;
 }
 
+static void finish_transaction(uint8_t *transaction_ptr, int transaction_size,
+        int put_count, int del_count)
+{
+    write_uint32be(&transaction_ptr[4], transaction_size);
+    write_uint32be(&transaction_ptr[8], put_count);
+    write_uint32be(&transaction_ptr[12], del_count);
+    write_uint32be(&transaction_ptr[0], crc32(0, &transaction_ptr[4], transaction_size - 4));
+}
+
+// space a put of this key and value takes up in a transaction
+static long entry_live_size(int key_size, int value_size) {
+    return 8 + key_size + value_size;
+}
+
+static int map_put(OrderedMapFile *omf, const ByteBuffer &key, long value_offset, int value_size) {
+    auto hash_entry = omf->map->maybe_get(key);
+    if (hash_entry) {
+        OrderedMapFileEntry *entry = hash_entry->value;
+        omf->live_size -= entry_live_size(entry->key.length(), entry->size);
+        entry->offset = value_offset;
+        entry->size = value_size;
+        omf->live_size += entry_live_size(entry->key.length(), entry->size);
+        return 0;
+    }
+
+    OrderedMapFileEntry *entry = create_zero<OrderedMapFileEntry>();
+    if (!entry)
+        return GenesisErrorNoMem;
+    entry->key = key;
+    entry->offset = value_offset;
+    entry->size = value_size;
+    omf->map->put(entry->key, entry);
+    omf->live_size += entry_live_size(entry->key.length(), entry->size);
+    return 0;
+}
+
+// A retired entry stays allocated until ordered_map_file_done_reading.
+static void map_del(OrderedMapFile *omf, const ByteBuffer &key, bool retire) {
+    auto hash_entry = omf->map->maybe_get(key);
+    if (!hash_entry)
+        return;
+    OrderedMapFileEntry *entry = hash_entry->value;
+    omf->live_size -= entry_live_size(entry->key.length(), entry->size);
+    omf->map->remove(key);
+    if (retire)
+        ok_or_panic(omf->retired_entries.append(entry));
+    else
+        destroy(entry, 1);
+}
+
+static int compact(OrderedMapFile *omf);
+
+static bool should_compact(OrderedMapFile *omf) {
+    long transaction_count = omf->live_size / SNAPSHOT_TRANSACTION_SIZE + 1;
+    long compacted_size = UUID_SIZE + transaction_count * TRANSACTION_METADATA_SIZE + omf->live_size;
+    return !omf->reading && omf->transaction_offset >= COMPACT_MIN_SIZE &&
+        omf->transaction_offset >= COMPACT_GROWTH_FACTOR * compacted_size &&
+        omf->transaction_offset >= COMPACT_GROWTH_FACTOR * omf->compact_failed_offset;
+}
+
+// Writes the transaction for batch to transaction_ptr.
+static void serialize_batch(OrderedMapFileBatch *batch,
+        uint8_t *transaction_ptr, int transaction_size)
+{
+    int offset = TRANSACTION_METADATA_SIZE;
+    for (int i = 0; i < batch->puts.length(); i += 1) {
+        OrderedMapFilePut *put = &batch->puts.at(i);
+        write_uint32be(&transaction_ptr[offset], put->key->size); offset += 4;
+        write_uint32be(&transaction_ptr[offset], put->value->size); offset += 4;
+        memcpy(&transaction_ptr[offset], put->key->data, put->key->size); offset += put->key->size;
+        memcpy(&transaction_ptr[offset], put->value->data, put->value->size); offset += put->value->size;
+    }
+    for (int i = 0; i < batch->dels.length(); i += 1) {
+        OrderedMapFileDel *del = &batch->dels.at(i);
+        write_uint32be(&transaction_ptr[offset], del->key->size); offset += 4;
+        memcpy(&transaction_ptr[offset], del->key->data, del->key->size); offset += del->key->size;
+    }
+    assert(offset == transaction_size);
+
+    finish_transaction(transaction_ptr, transaction_size, batch->puts.length(), batch->dels.length());
+}
+
+// Applies the transaction for batch, written at file_offset, to the map.
+// The bytes must be flushed to the file first so that a reader never sees
+// an offset past the end of the file. Until ordered_map_file_done_reading
+// the caller holds omf->mutex.
+static void apply_batch(OrderedMapFile *omf, OrderedMapFileBatch *batch, long file_offset) {
+    long offset = file_offset + TRANSACTION_METADATA_SIZE;
+    for (int i = 0; i < batch->puts.length(); i += 1) {
+        OrderedMapFilePut *put = &batch->puts.at(i);
+        offset += 8 + put->key->size;
+        ok_or_panic(map_put(omf, ByteBuffer(put->key->data, put->key->size), offset, put->value->size));
+        offset += put->value->size;
+    }
+    for (int i = 0; i < batch->dels.length(); i += 1) {
+        OrderedMapFileDel *del = &batch->dels.at(i);
+        // the reader's list may point to the entry
+        map_del(omf, ByteBuffer(del->key->data, del->key->size), omf->reading);
+    }
+}
+
+static int latency_bucket(double seconds) {
+    long microseconds = seconds * 1000000.0;
+    int bucket = 0;
+    while (microseconds >= 2 && bucket < ORDERED_MAP_FILE_LATENCY_BUCKET_COUNT - 1) {
+        microseconds /= 2;
+        bucket += 1;
+    }
+    return bucket;
+}
+
+// Records the commit group in the stats, destroys it, and wakes anyone
+// waiting for the queue to drain.
+static void finish_commit_group(OrderedMapFile *omf, double commit_time) {
+    os_mutex_lock(omf->mutex);
+    OrderedMapFileCommitStats *stats = &omf->commit_stats;
+    for (int i = 0; i < omf->commit_group.length(); i += 1) {
+        OrderedMapFileBatch *batch = omf->commit_group.at(i);
+        if (batch->read_result)
+            batch->read_result->done = true;
+        if (!batch->compact && !batch->read_result) {
+            stats->batch_count += 1;
+            stats->latency_buckets[batch->durability][latency_bucket(commit_time - batch->exec_time)] += 1;
+        }
+        ordered_map_file_batch_destroy(batch);
+    }
+    omf->pending_batches -= omf->commit_group.length();
+    os_cond_broadcast(omf->cond, omf->mutex);
+    os_mutex_unlock(omf->mutex);
+    omf->commit_group.clear();
+}
+
+static int read_value(OrderedMapFile *omf, const ByteBuffer &key, ByteBuffer &out_value) {
+    auto hash_entry = omf->map->maybe_get(key);
+    if (!hash_entry)
+        return GenesisErrorKeyNotFound;
+    OrderedMapFileEntry *entry = hash_entry->value;
+
+    // switching the stream from writing to reading requires a flush
+    if (fflush(omf->file))
+        return GenesisErrorFileAccess;
+    out_value.resize(entry->size);
+    int err = 0;
+    if (fseek(omf->file, entry->offset, SEEK_SET) ||
+        fread(out_value.raw(), 1, entry->size, omf->file) != (size_t)entry->size)
+    {
+        err = GenesisErrorFileAccess;
+    }
+    if (fseek(omf->file, omf->transaction_offset, SEEK_SET))
+        panic("unable to seek in file");
+    return err;
+}
+
+// Compaction and read requests are not part of a group commit; they run
+// between groups.
+static void run_barrier_batch(OrderedMapFile *omf, OrderedMapFileBatch *batch) {
+    if (batch->compact) {
+        int err;
+        if ((err = compact(omf)) && err != GenesisErrorAborted)
+            fprintf(stderr, "Warning: unable to compact project file: %s\n", genesis_strerror(err));
+    } else {
+        OrderedMapFileReadResult *result = batch->read_result;
+        result->err = read_value(omf, batch->read_key, *result->value);
+    }
+    ok_or_panic(omf->commit_group.append(batch));
+    finish_commit_group(omf, os_get_time());
+}
+
+static bool is_barrier_batch(OrderedMapFileBatch *batch) {
+    return batch->compact || batch->read_result;
+}
+
 static void run_write(void *userdata) {
     OrderedMapFile *omf = (OrderedMapFile *)userdata;
 
@@ -30,48 +224,86 @@ static void run_write(void *userdata) {
         if (!batch || !omf->running)
             break;
 
-        // compute transaction size
-        int transaction_size = get_transaction_size(batch);
-        omf->write_buffer.resize(transaction_size);
+        if (is_barrier_batch(batch)) {
+            run_barrier_batch(omf, batch);
+            continue;
+        }
 
-        uint8_t *transaction_ptr = (uint8_t*)omf->write_buffer.raw();
-        write_uint32be(&transaction_ptr[4], transaction_size);
-        write_uint32be(&transaction_ptr[8], batch->puts.length());
-        write_uint32be(&transaction_ptr[12], batch->dels.length());
+        // group commit: take the batches queued behind this one, up to a
+        // compaction or read request or GROUP_COMMIT_MAX_SIZE bytes
+        OrderedMapFileBatch *barrier_batch = nullptr;
+        ok_or_panic(omf->commit_group.append(batch));
+        int group_size = get_transaction_size(batch);
+        while (group_size < GROUP_COMMIT_MAX_SIZE && omf->queue.try_shift(&batch)) {
+            if (is_barrier_batch(batch)) {
+                barrier_batch = batch;
+                break;
+            }
+            ok_or_panic(omf->commit_group.append(batch));
+            group_size += get_transaction_size(batch);
+        }
 
-        int offset = TRANSACTION_METADATA_SIZE;
-        for (int i = 0; i < batch->puts.length(); i += 1) {
-            OrderedMapFilePut *put = &batch->puts.at(i);
-            write_uint32be(&transaction_ptr[offset], put->key->size); offset += 4;
-            write_uint32be(&transaction_ptr[offset], put->value->size); offset += 4;
-            memcpy(&transaction_ptr[offset], put->key->data, put->key->size); offset += put->key->size;
-            memcpy(&transaction_ptr[offset], put->value->data, put->value->size); offset += put->value->size;
+        omf->write_buffer.resize(group_size);
+        uint8_t *group_ptr = (uint8_t*)omf->write_buffer.raw();
+        OrderedMapFileDurability durability = OrderedMapFileDurabilityBuffered;
+        int offset = 0;
+        for (int i = 0; i < omf->commit_group.length(); i += 1) {
+            OrderedMapFileBatch *batch = omf->commit_group.at(i);
+            int transaction_size = get_transaction_size(batch);
+            serialize_batch(batch, &group_ptr[offset], transaction_size);
+            offset += transaction_size;
+            durability = max(durability, batch->durability);
         }
-        for (int i = 0; i < batch->dels.length(); i += 1) {
-            OrderedMapFileDel *del = &batch->dels.at(i);
-            write_uint32be(&transaction_ptr[offset], del->key->size); offset += 4;
-            memcpy(&transaction_ptr[offset], del->key->data, del->key->size); offset += del->key->size;
+        assert(offset == group_size);
+
+        // append to file. reading stays false once it is, so only a reader
+        // can be racing, and it maps the file, so it needs the bytes
+        // flushed before it sees their offsets.
+        bool lock_map = omf->reading;
+        size_t amt_written = fwrite(group_ptr, 1, group_size, omf->file);
+        if (amt_written != (size_t)group_size)
+            panic("write to disk failed");
+        if ((lock_map || durability >= OrderedMapFileDurabilityFlushed) && fflush(omf->file))
+            panic("write to disk failed");
+        int err;
+        if (durability >= OrderedMapFileDurabilitySynced && (err = os_file_sync_data(omf->file)))
+            panic("sync to disk failed: %s", genesis_strerror(err));
+
+        if (lock_map)
+            os_mutex_lock(omf->mutex);
+        offset = 0;
+        for (int i = 0; i < omf->commit_group.length(); i += 1) {
+            OrderedMapFileBatch *batch = omf->commit_group.at(i);
+            apply_batch(omf, batch, omf->transaction_offset + offset);
+            offset += get_transaction_size(batch);
         }
-        assert(offset == transaction_size);
+        if (lock_map)
+            os_mutex_unlock(omf->mutex);
+        omf->transaction_offset += group_size;
 
-        ordered_map_file_batch_destroy(batch);
+        double commit_time = os_get_time();
+        os_mutex_lock(omf->mutex);
+        omf->commit_stats.write_count += 1;
+        os_mutex_unlock(omf->mutex);
 
-        // compute crc32
-        write_uint32be(&transaction_ptr[0], crc32(0, &transaction_ptr[4], transaction_size - 4));
+        if (should_compact(omf)) {
+            // back off after a failure rather than rewriting the whole
+            // snapshot behind every commit group
+            if ((err = compact(omf)) && err != GenesisErrorAborted) {
+                omf->compact_failed_offset = omf->transaction_offset;
+                fprintf(stderr, "Warning: unable to compact project file: %s\n", genesis_strerror(err));
+            }
+        }
 
-        // append to file
-        size_t amt_written = fwrite(transaction_ptr, 1, transaction_size, omf->file);
-        if (amt_written != (size_t)transaction_size)
-            panic("write to disk failed");
+        finish_commit_group(omf, commit_time);
 
-        os_mutex_lock(omf->mutex);
-        os_cond_signal(omf->cond, omf->mutex);
-        os_mutex_unlock(omf->mutex);
+        if (barrier_batch)
+            run_barrier_batch(omf, barrier_batch);
     }
 }
 
-static int write_header(OrderedMapFile *omf) {
-    size_t amt_written = fwrite(UUID, 1, UUID_SIZE, omf->file);
+static int write_header(FILE *file) {
+    size_t amt_written = fwrite(UUID, 1, UUID_SIZE, file);
     if (amt_written != UUID_SIZE)
         return GenesisErrorFileAccess;
     return 0;
@@ -113,6 +345,276 @@ static void destroy_map(OrderedMapFile *omf) {
     }
 }
 
+static bool killed_at_step(void) {
+    if (ordered_map_file_compact_kill_step < 0)
+        return false;
+    if (ordered_map_file_compact_kill_step == 0) {
+        ordered_map_file_compact_kill_step = -1;
+        return true;
+    }
+    ordered_map_file_compact_kill_step -= 1;
+    return false;
+}
+
+static int get_index_transaction_size(const List<OrderedMapFileEntry *> &entries) {
+    int total = TRANSACTION_METADATA_SIZE + INDEX_METADATA_SIZE;
+    for (int i = 0; i < entries.length(); i += 1)
+        total += INDEX_ENTRY_SIZE + entries.at(i)->key.length();
+    return total;
+}
+
+// Writes the entries, sorted by key, into file as a header, an index
+// transaction, and transactions of puts only, reading the values from the
+// current file. Stores where each value ends up in new_offsets.
+static int write_snapshot(OrderedMapFile *omf, FILE *file,
+        const List<OrderedMapFileEntry *> &entries, List<long> &new_offsets, long *out_size)
+{
+    int err;
+    if ((err = write_header(file)))
+        return err;
+    if (killed_at_step())
+        return GenesisErrorAborted;
+
+    // the index comes first, so lay out the put transactions before
+    // writing anything
+    int index_transaction_size = get_index_transaction_size(entries);
+    List<int> transaction_ends;
+    long file_offset = UUID_SIZE + index_transaction_size;
+    int start = 0;
+    while (start < entries.length()) {
+        int transaction_size = TRANSACTION_METADATA_SIZE;
+        int end = start;
+        do {
+            OrderedMapFileEntry *entry = entries.at(end);
+            transaction_size += 8 + entry->key.length();
+            new_offsets.at(end) = file_offset + transaction_size;
+            transaction_size += entry->size;
+            end += 1;
+        } while (end < entries.length() && transaction_size +
+                entry_live_size(entries.at(end)->key.length(), entries.at(end)->size) <=
+                SNAPSHOT_TRANSACTION_SIZE);
+        if ((err = transaction_ends.append(end)))
+            return err;
+        file_offset += transaction_size;
+        start = end;
+    }
+    long snapshot_size = file_offset;
+
+    omf->write_buffer.resize(index_transaction_size);
+    uint8_t *transaction_ptr = (uint8_t*)omf->write_buffer.raw();
+    int offset = TRANSACTION_METADATA_SIZE;
+    memcpy(&transaction_ptr[offset], INDEX_UUID, UUID_SIZE); offset += UUID_SIZE;
+    write_uint32be(&transaction_ptr[offset], entries.length()); offset += 4;
+    write_uint64be(&transaction_ptr[offset], snapshot_size); offset += 8;
+    for (int i = 0; i < entries.length(); i += 1) {
+        OrderedMapFileEntry *entry = entries.at(i);
+        write_uint32be(&transaction_ptr[offset], entry->key.length()); offset += 4;
+        write_uint32be(&transaction_ptr[offset], entry->size); offset += 4;
+        write_uint64be(&transaction_ptr[offset], new_offsets.at(i)); offset += 8;
+        memcpy(&transaction_ptr[offset], entry->key.raw(), entry->key.length());
+        offset += entry->key.length();
+    }
+    assert(offset == index_transaction_size);
+    finish_transaction(transaction_ptr, index_transaction_size, 0, 0);
+    if (fwrite(transaction_ptr, 1, index_transaction_size, file) != (size_t)index_transaction_size)
+        return GenesisErrorFileAccess;
+    if (killed_at_step())
+        return GenesisErrorAborted;
+
+    start = 0;
+    for (int transaction_i = 0; transaction_i < transaction_ends.length(); transaction_i += 1) {
+        int end = transaction_ends.at(transaction_i);
+        int transaction_size = TRANSACTION_METADATA_SIZE;
+        for (int i = start; i < end; i += 1)
+            transaction_size += entry_live_size(entries.at(i)->key.length(), entries.at(i)->size);
+
+        omf->write_buffer.resize(transaction_size);
+        transaction_ptr = (uint8_t*)omf->write_buffer.raw();
+        offset = TRANSACTION_METADATA_SIZE;
+        for (int i = start; i < end; i += 1) {
+            OrderedMapFileEntry *entry = entries.at(i);
+            write_uint32be(&transaction_ptr[offset], entry->key.length()); offset += 4;
+            write_uint32be(&transaction_ptr[offset], entry->size); offset += 4;
+            memcpy(&transaction_ptr[offset], entry->key.raw(), entry->key.length());
+            offset += entry->key.length();
+            if (fseek(omf->file, entry->offset, SEEK_SET))
+                return GenesisErrorFileAccess;
+            if (fread(&transaction_ptr[offset], 1, entry->size, omf->file) != (size_t)entry->size)
+                return GenesisErrorFileAccess;
+            offset += entry->size;
+        }
+        assert(offset == transaction_size);
+        finish_transaction(transaction_ptr, transaction_size, end - start, 0);
+
+        if (fwrite(transaction_ptr, 1, transaction_size, file) != (size_t)transaction_size)
+            return GenesisErrorFileAccess;
+        if (killed_at_step())
+            return GenesisErrorAborted;
+
+        start = end;
+    }
+
+    if (fflush(file))
+        return GenesisErrorFileAccess;
+    if ((err = os_file_flush(file)))
+        return err;
+    if (killed_at_step())
+        return GenesisErrorAborted;
+
+    *out_size = snapshot_size;
+    return 0;
+}
+
+// Rewrites the live keys into path.compact and renames it over path. The
+// old file is not modified, the new one is synced before the rename, and the
+// directory is synced after it, so whenever the process or the machine dies
+// path holds one complete file, and nothing is appended to the new file
+// before its rename is durable. Runs on the write thread.
+static int compact(OrderedMapFile *omf) {
+    // readers hold views into mappings of the old file and look up offsets
+    // in the map, which compaction rewrites
+    if (omf->reading)
+        return GenesisErrorInvalidState;
+
+    int err;
+    List<OrderedMapFileEntry *> entries;
+    List<long> new_offsets;
+    if ((err = entries.ensure_capacity(omf->map->size())))
+        return err;
+    if ((err = new_offsets.resize(omf->map->size())))
+        return err;
+    auto it = omf->map->entry_iterator();
+    for (;;) {
+        auto *map_entry = it.next();
+        if (!map_entry)
+            break;
+        ok_or_panic(entries.append(map_entry->value));
+    }
+    entries.sort<compare_entries>();
+
+    ByteBuffer compact_path = omf->path;
+    compact_path.append(".compact");
+    FILE *compact_file = fopen(compact_path.raw(), "wb");
+    if (!compact_file)
+        return GenesisErrorFileAccess;
+
+    long compact_size;
+    if (killed_at_step()) {
+        err = GenesisErrorAborted;
+    } else {
+        err = write_snapshot(omf, compact_file, entries, new_offsets, &compact_size);
+    }
+    if (fclose(compact_file) && !err)
+        err = GenesisErrorFileAccess;
+    if (!err && killed_at_step())
+        err = GenesisErrorAborted;
+    if (!err)
+        err = os_rename_clobber(compact_path.raw(), omf->path.raw());
+    if (!err && killed_at_step())
+        err = GenesisErrorAborted;
+
+    if (err) {
+        // a killed process leaves its files behind
+        if (err != GenesisErrorAborted)
+            os_delete(compact_path.raw());
+        if (fseek(omf->file, omf->transaction_offset, SEEK_SET))
+            panic("unable to seek in file");
+        return err;
+    }
+
+    // The old file is gone, so the only way forward is the new one. Appending
+    // to it before the rename is durable could lose the appended transactions
+    // along with the rename.
+    if (os_sync_parent_dir(omf->path.raw()))
+        panic("unable to sync project file directory");
+    FILE *file = fopen(omf->path.raw(), "rb+");
+    if (!file)
+        panic("unable to open compacted project file");
+    fclose(omf->file);
+    omf->file = file;
+    if (fseek(omf->file, compact_size, SEEK_SET))
+        panic("unable to seek in file");
+    omf->transaction_offset = compact_size;
+    omf->compact_failed_offset = 0;
+    for (int i = 0; i < entries.length(); i += 1)
+        entries.at(i)->offset = new_offsets.at(i);
+
+    return 0;
+}
+
+// Fills the map and the sorted list from the index transaction at the start
+// of the file and sets snapshot_size to where the transactions after the
+// compacted part begin.
+// Sets it to 0 and leaves the map alone if the transaction is not a valid
+// index; the puts which follow it have the same keys anyway.
+static int load_index(OrderedMapFile *omf, const uint8_t *transaction_ptr, int transaction_size,
+        long *snapshot_size)
+{
+    *snapshot_size = 0;
+    if (transaction_size < TRANSACTION_METADATA_SIZE + INDEX_METADATA_SIZE)
+        return 0;
+    int offset = TRANSACTION_METADATA_SIZE;
+    if (memcmp(&transaction_ptr[offset], INDEX_UUID, UUID_SIZE) != 0)
+        return 0;
+    offset += UUID_SIZE;
+    uint32_t entry_count = read_uint32be(&transaction_ptr[offset]); offset += 4;
+    uint64_t index_snapshot_size = read_uint64be(&transaction_ptr[offset]); offset += 8;
+
+    long file_size;
+    int err;
+    if ((err = os_file_size(omf->file, &file_size)))
+        return err;
+    if (index_snapshot_size > (uint64_t)file_size)
+        return 0;
+
+    int entries_offset = offset;
+    for (uint32_t i = 0; i < entry_count; i += 1) {
+        if (transaction_size - offset < INDEX_ENTRY_SIZE)
+            return 0;
+        uint32_t key_size = read_uint32be(&transaction_ptr[offset]);
+        uint32_t value_size = read_uint32be(&transaction_ptr[offset + 4]);
+        uint64_t value_offset = read_uint64be(&transaction_ptr[offset + 8]);
+        offset += INDEX_ENTRY_SIZE;
+        if ((uint32_t)(transaction_size - offset) < key_size ||
+            value_offset > index_snapshot_size || value_size > index_snapshot_size - value_offset)
+        {
+            return 0;
+        }
+        offset += key_size;
+    }
+    if (offset != transaction_size)
+        return 0;
+
+    // the index is the first transaction, so the map and list are empty.
+    // size the map so that it never grows while loading, and fill the list
+    // in index order so that it needs no sorting.
+    destroy(omf->map, 1);
+    omf->map = create_zero<HashMap<ByteBuffer, OrderedMapFileEntry *, ByteBuffer::hash>>(
+            max(32, (int)entry_count * 2));
+    if (!omf->map)
+        return GenesisErrorNoMem;
+    if ((err = omf->list->ensure_capacity(entry_count)))
+        return err;
+
+    offset = entries_offset;
+    for (uint32_t i = 0; i < entry_count; i += 1) {
+        int key_size = read_uint32be(&transaction_ptr[offset]);
+        OrderedMapFileEntry *entry = create_zero<OrderedMapFileEntry>();
+        if (!entry)
+            return GenesisErrorNoMem;
+        entry->size = read_uint32be(&transaction_ptr[offset + 4]);
+        entry->offset = read_uint64be(&transaction_ptr[offset + 8]);
+        offset += INDEX_ENTRY_SIZE;
+        entry->key.append((const char *)&transaction_ptr[offset], key_size); offset += key_size;
+        omf->map->put(entry->key, entry);
+        omf->live_size += entry_live_size(key_size, entry->size);
+        ok_or_panic(omf->list->append(entry));
+    }
+
+    *snapshot_size = index_snapshot_size;
+    return 0;
+}
+
 int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
     *out_omf = nullptr;
     OrderedMapFile *omf = create_zero<OrderedMapFile>();
@@ -145,12 +647,19 @@ int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
     }
 
     omf->running = true;
+    omf->reading = true;
     int err;
     if ((err = os_thread_create(run_write, omf, false, &omf->write_thread))) {
         ordered_map_file_close(omf);
         return err;
     }
 
+    omf->path = path;
+    // left behind if the process died while compacting
+    ByteBuffer compact_path = omf->path;
+    compact_path.append(".compact");
+    os_delete(compact_path.raw());
+
     bool open_for_writing = false;
     omf->file = fopen(path, "rb+");
     if (omf->file) {
@@ -170,7 +679,7 @@ int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
             ordered_map_file_close(omf);
             return GenesisErrorFileAccess;
         }
-        int err = write_header(omf);
+        int err = write_header(omf->file);
         if (err) {
             ordered_map_file_close(omf);
             return err;
@@ -179,6 +688,7 @@ int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
 
     // read everything into list
     bool partial_transaction = false;
+    bool list_sorted = false;
     omf->write_buffer.resize(TRANSACTION_METADATA_SIZE);
     omf->transaction_offset = UUID_SIZE;
     for (;;) {
@@ -220,40 +730,42 @@ int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
         int put_count = read_uint32be(&transaction_ptr[8]);
         int del_count = read_uint32be(&transaction_ptr[12]);
 
+        if (put_count == 0 && del_count == 0 && omf->transaction_offset == UUID_SIZE) {
+            long snapshot_size;
+            if ((err = load_index(omf, transaction_ptr, transaction_size, &snapshot_size))) {
+                ordered_map_file_close(omf);
+                return err;
+            }
+            if (snapshot_size > 0) {
+                list_sorted = true;
+                if (fseek(omf->file, snapshot_size, SEEK_SET)) {
+                    ordered_map_file_close(omf);
+                    return GenesisErrorFileAccess;
+                }
+                omf->transaction_offset = snapshot_size;
+                continue;
+            }
+        }
+
+        if (put_count > 0 || del_count > 0)
+            list_sorted = false;
+
         int offset = TRANSACTION_METADATA_SIZE;
         for (int i = 0; i < put_count; i += 1) {
             int key_size = read_uint32be(&transaction_ptr[offset]); offset += 4;
             int val_size = read_uint32be(&transaction_ptr[offset]); offset += 4;
 
-            OrderedMapFileEntry *entry = create_zero<OrderedMapFileEntry>();
-            if (!entry) {
+            ByteBuffer key((char*)&transaction_ptr[offset], key_size); offset += key_size;
+            if ((err = map_put(omf, key, omf->transaction_offset + offset, val_size))) {
                 ordered_map_file_close(omf);
-                return GenesisErrorNoMem;
+                return err;
             }
-
-            entry->key = ByteBuffer((char*)&transaction_ptr[offset], key_size); offset += key_size;
-            entry->offset = omf->transaction_offset + offset;
-            entry->size = val_size;
             offset += val_size;
-
-            auto old_hash_entry = omf->map->maybe_get(entry->key);
-            if (old_hash_entry) {
-                OrderedMapFileEntry *old_entry = old_hash_entry->value;
-                destroy(old_entry, 1);
-            }
-
-            omf->map->put(entry->key, entry);
         }
         for (int i = 0; i < del_count; i += 1) {
             int key_size = read_uint32be(&transaction_ptr[offset]); offset += 4;
             ByteBuffer key((char*)&transaction_ptr[offset], key_size); offset += key_size;
-
-            auto hash_entry = omf->map->maybe_get(key);
-            if (hash_entry) {
-                OrderedMapFileEntry *entry = hash_entry->value;
-                omf->map->remove(key);
-                destroy(entry, 1);
-            }
+            map_del(omf, key, false);
         }
 
         omf->transaction_offset += transaction_size;
@@ -263,39 +775,57 @@ int ordered_map_file_open(const char *path, OrderedMapFile **out_omf) {
     if (partial_transaction)
         fprintf(stderr, "Warning: Partial transaction found in project file.\n");
 
-    // transfer map to list and sort
-    auto it = omf->map->entry_iterator();
-    if (omf->list->ensure_capacity(omf->map->size())) {
-        ordered_map_file_close(omf);
-        return GenesisErrorNoMem;
-    }
-    for (;;) {
-        auto *map_entry = it.next();
-        if (!map_entry)
-            break;
+    // transfer map to list and sort, unless the index already did and
+    // nothing came after it
+    if (!list_sorted) {
+        omf->list->clear();
+        auto it = omf->map->entry_iterator();
+        if (omf->list->ensure_capacity(omf->map->size())) {
+            ordered_map_file_close(omf);
+            return GenesisErrorNoMem;
+        }
+        for (;;) {
+            auto *map_entry = it.next();
+            if (!map_entry)
+                break;
+
+            ok_or_panic(omf->list->append(map_entry->value));
+        }
 
-        ok_or_panic(omf->list->append(map_entry->value));
+        omf->list->sort<compare_entries>();
     }
-    omf->map->clear();
-    destroy_map(omf);
 
-    omf->list->sort<compare_entries>();
+    // values are read from mappings from now on, so the write thread can
+    // append even before ordered_map_file_done_reading
+    if (fseek(omf->file, omf->transaction_offset, SEEK_SET)) {
+        ordered_map_file_close(omf);
+        return GenesisErrorFileAccess;
+    }
 
     *out_omf = omf;
     return 0;
 }
 
+static void unmap_all(OrderedMapFile *omf) {
+    for (int i = 0; i < omf->mappings.length(); i += 1)
+        os_unmap_file(&omf->mappings.at(i));
+    omf->mappings.clear();
+}
+
+// the entries belong to map
 static void destroy_list(OrderedMapFile *omf) {
     if (omf->list) {
-        for (int i = 0; i < omf->list->length(); i += 1) {
-            OrderedMapFileEntry *entry = omf->list->at(i);
-            destroy(entry, 1);
-        }
         destroy(omf->list, 1);
         omf->list = nullptr;
     }
 }
 
+static void destroy_retired_entries(OrderedMapFile *omf) {
+    for (int i = 0; i < omf->retired_entries.length(); i += 1)
+        destroy(omf->retired_entries.at(i), 1);
+    omf->retired_entries.clear();
+}
+
 void ordered_map_file_close(OrderedMapFile *omf) {
     if (!omf)
         return;
@@ -309,7 +839,9 @@ void ordered_map_file_close(OrderedMapFile *omf) {
     if (omf->file)
         fclose(omf->file);
     destroy_list(omf);
+    unmap_all(omf);
     destroy_map(omf);
+    destroy_retired_entries(omf);
 
     os_mutex_destroy(omf->mutex);
     os_cond_destroy(omf->cond);
@@ -343,7 +875,20 @@ void ordered_map_file_batch_destroy(OrderedMapFileBatch *batch) {
 }
 
 int ordered_map_file_batch_exec(OrderedMapFileBatch *batch) {
-    return batch->omf->queue.push(batch);
+    OrderedMapFile *omf = batch->omf;
+    batch->exec_time = os_get_time();
+    os_mutex_lock(omf->mutex);
+    omf->pending_batches += 1;
+    os_mutex_unlock(omf->mutex);
+
+    int err;
+    if ((err = omf->queue.push(batch))) {
+        os_mutex_lock(omf->mutex);
+        omf->pending_batches -= 1;
+        os_mutex_unlock(omf->mutex);
+        return err;
+    }
+    return 0;
 }
 
 OrderedMapFileBuffer *ordered_map_file_buffer_create(int size) {
@@ -394,9 +939,12 @@ int ordered_map_file_batch_del(OrderedMapFileBatch *batch,
 }
 
 void ordered_map_file_done_reading(OrderedMapFile *omf) {
+    os_mutex_lock(omf->mutex);
+    omf->reading = false;
+    destroy_retired_entries(omf);
+    os_mutex_unlock(omf->mutex);
     destroy_list(omf);
-    if (fseek(omf->file, omf->transaction_offset, SEEK_SET))
-        panic("unable to seek in file");
+    unmap_all(omf);
 }
 
 template <bool prefix>
@@ -436,16 +984,48 @@ int ordered_map_file_find_key(OrderedMapFile *omf, const ByteBuffer &key) {
     return ordered_map_file_find_key_tpl<false>(omf, key);
 }
 
-int ordered_map_file_get(OrderedMapFile *omf, int index, ByteBuffer **out_key, ByteBuffer &out_value) {
+static int map_file_again(OrderedMapFile *omf) {
+    OsMappedFile mapping;
+    int err;
+    if ((err = os_map_file_read_only(omf->path.raw(), &mapping)))
+        return err;
+    if (omf->mappings.append(mapping)) {
+        os_unmap_file(&mapping);
+        return GenesisErrorNoMem;
+    }
+    return 0;
+}
+
+int ordered_map_file_get_view(OrderedMapFile *omf, int index, ByteBuffer **out_key, ByteView *out_value) {
     OrderedMapFileEntry *entry = omf->list->at(index);
     if (out_key)
         *out_key = &entry->key;
-    out_value.resize(entry->size);
-    if (fseek(omf->file, entry->offset, SEEK_SET))
-        return GenesisErrorFileAccess;
-    size_t amt_read = fread(out_value.raw(), 1, out_value.length(), omf->file);
-    if (amt_read != (size_t)out_value.length())
-        return GenesisErrorFileAccess;
+
+    // the write thread may be committing a new value for this key
+    os_mutex_lock(omf->mutex);
+    long value_offset = entry->offset;
+    int value_size = entry->size;
+    os_mutex_unlock(omf->mutex);
+
+    size_t end = (size_t)value_offset + (size_t)value_size;
+    if (omf->mappings.length() == 0 || end > omf->mappings.last().size) {
+        int err;
+        if ((err = map_file_again(omf)))
+            return err;
+        if (end > omf->mappings.last().size)
+            return GenesisErrorFileAccess;
+    }
+    *out_value = ByteView(omf->mappings.last().address + value_offset, value_size);
+    return 0;
+}
+
+int ordered_map_file_get(OrderedMapFile *omf, int index, ByteBuffer **out_key, ByteBuffer &out_value) {
+    ByteView view;
+    int err;
+    if ((err = ordered_map_file_get_view(omf, index, out_key, &view)))
+        return err;
+    out_value.resize(view.length());
+    memcpy(out_value.raw(), view.raw(), view.length());
     return 0;
 }
 
@@ -453,17 +1033,72 @@ int ordered_map_file_count(OrderedMapFile *omf) {
     return omf->list->length();
 }
 
-void ordered_map_file_flush(OrderedMapFile *omf) {
-    {
-        OsMutexLocker locker(omf->mutex);
-        while (omf->queue.length())
-            os_cond_wait(omf->cond, omf->mutex);
+int ordered_map_file_read_async(OrderedMapFile *omf, const ByteBuffer &key,
+        OrderedMapFileReadResult *result)
+{
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    if (!batch)
+        return GenesisErrorNoMem;
+    result->err = 0;
+    result->done = false;
+    batch->read_key = key;
+    batch->read_result = result;
+    int err;
+    if ((err = ordered_map_file_batch_exec(batch))) {
+        ordered_map_file_batch_destroy(batch);
+        return err;
     }
+    return 0;
+}
+
+bool ordered_map_file_read_done(OrderedMapFile *omf, OrderedMapFileReadResult *result) {
+    OsMutexLocker locker(omf->mutex);
+    return result->done;
+}
+
+int ordered_map_file_read_wait(OrderedMapFile *omf, OrderedMapFileReadResult *result) {
+    OsMutexLocker locker(omf->mutex);
+    while (!result->done)
+        os_cond_wait(omf->cond, omf->mutex);
+    return result->err;
+}
+
+int ordered_map_file_read(OrderedMapFile *omf, const ByteBuffer &key, ByteBuffer &out_value) {
+    OrderedMapFileReadResult result = {&out_value, 0, false};
+    int err;
+    if ((err = ordered_map_file_read_async(omf, key, &result)))
+        return err;
+    return ordered_map_file_read_wait(omf, &result);
+}
+
+int ordered_map_file_compact(OrderedMapFile *omf) {
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    if (!batch)
+        return GenesisErrorNoMem;
+    batch->compact = true;
+    return ordered_map_file_batch_exec(batch);
+}
+
+void ordered_map_file_wait(OrderedMapFile *omf) {
+    OsMutexLocker locker(omf->mutex);
+    while (omf->pending_batches)
+        os_cond_wait(omf->cond, omf->mutex);
+}
+
+void ordered_map_file_flush(OrderedMapFile *omf) {
+    ordered_map_file_wait(omf);
 
     int err;
     if (omf->file) {
+        if (fflush(omf->file))
+            panic("flush file fail");
         if ((err = os_file_flush(omf->file))) {
             panic("flush file fail: %s", genesis_strerror(err));
         }
     }
 }
+
+void ordered_map_file_get_commit_stats(OrderedMapFile *omf, OrderedMapFileCommitStats *out_stats) {
+    OsMutexLocker locker(omf->mutex);
+    *out_stats = omf->commit_stats;
+}
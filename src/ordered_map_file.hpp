@@ -13,7 +13,7 @@ struct OrderedMapFile;
 
 struct OrderedMapFileEntry {
     ByteBuffer key;
-    int offset;
+    long offset;
     int size;
 };
 
@@ -31,10 +31,52 @@ struct OrderedMapFileDel {
     OrderedMapFileBuffer *key;
 };
 
+// How far a batch gets before it counts as committed. Batches are written in
+// order, so a batch also makes every batch before it at least as durable.
+enum OrderedMapFileDurability {
+    // left in the stdio buffer until it fills up or a later batch is
+    // flushed. lost if the process dies first.
+    OrderedMapFileDurabilityBuffered,
+    // handed to the operating system. survives the process dying.
+    OrderedMapFileDurabilityFlushed,
+    // synced to the disk. survives the system losing power.
+    OrderedMapFileDurabilitySynced,
+};
+static const int ORDERED_MAP_FILE_DURABILITY_COUNT = 3;
+
+static const int ORDERED_MAP_FILE_LATENCY_BUCKET_COUNT = 24;
+
+struct OrderedMapFileCommitStats {
+    // batches committed, and the writes they were grouped into
+    long batch_count;
+    long write_count;
+    // for each durability, latency_buckets[i] counts the batches which were
+    // committed between 2^i and 2^(i+1) microseconds after
+    // ordered_map_file_batch_exec. the first bucket also counts faster ones
+    // and the last one slower ones.
+    long latency_buckets[ORDERED_MAP_FILE_DURABILITY_COUNT][ORDERED_MAP_FILE_LATENCY_BUCKET_COUNT];
+};
+
+struct OrderedMapFileReadResult {
+    ByteBuffer *value;
+    int err;
+    // protected by OrderedMapFile::mutex
+    bool done;
+};
+
 struct OrderedMapFileBatch {
     OrderedMapFile *omf;
     List<OrderedMapFilePut> puts;
     List<OrderedMapFileDel> dels;
+    // an empty batch which asks the write thread to compact the file
+    bool compact;
+    // an empty batch which asks the write thread to read the value of
+    // read_key into read_result
+    OrderedMapFileReadResult *read_result;
+    ByteBuffer read_key;
+    // defaults to OrderedMapFileDurabilityBuffered
+    OrderedMapFileDurability durability;
+    double exec_time;
 };
 
 struct OrderedMapFile {
@@ -44,10 +86,38 @@ struct OrderedMapFile {
     ByteBuffer write_buffer;
     atomic_bool running;
     LockedQueue<OrderedMapFileBatch *> queue;
+    // batches queued or being written; protected by mutex
+    int pending_batches;
+    // protected by mutex
+    OrderedMapFileCommitStats commit_stats;
+    // the batches the write thread is committing together
+    List<OrderedMapFileBatch *> commit_group;
+    ByteBuffer path;
     FILE *file;
     long transaction_offset;
+    // sorted view of map, only until ordered_map_file_done_reading
     List<OrderedMapFileEntry *> *list;
+    // every live key and where its value is in the file. owns the entries.
+    // after ordered_map_file_done_reading only the write thread touches it.
+    // until then the write thread changes entries only while holding mutex,
+    // and the reading functions read offset and size under it.
     HashMap<ByteBuffer, OrderedMapFileEntry *, ByteBuffer::hash> *map;
+    // entries deleted while reading, which list may still point to. freed by
+    // ordered_map_file_done_reading. protected by mutex
+    List<OrderedMapFileEntry *> retired_entries;
+    // bytes the live keys and values would take up in a compacted file
+    long live_size;
+    // transaction_offset when compaction last failed, or 0. it is not tried
+    // again until the file grows COMPACT_GROWTH_FACTOR times past it
+    long compact_failed_offset;
+    // read-only mappings of the file which values are read from. the last one
+    // is current; when a value is past its end the file is mapped again, and
+    // the older mappings stay until ordered_map_file_done_reading so that
+    // views into them remain valid.
+    List<OsMappedFile> mappings;
+    // until ordered_map_file_done_reading the write thread flushes each
+    // transaction so that a new mapping sees it
+    atomic_bool reading;
 };
 
 int ordered_map_file_open(const char *path, OrderedMapFile **omf);
@@ -56,7 +126,9 @@ void ordered_map_file_close(OrderedMapFile *omf);
 
 OrderedMapFileBatch *ordered_map_file_batch_create(OrderedMapFile *omf);
 void ordered_map_file_batch_destroy(OrderedMapFileBatch *batch);
-// transfers ownership of the batch
+// transfers ownership of the batch. the write thread commits every batch
+// queued by the time it gets to this one with a single write, and at most
+// one flush and one sync.
 int ordered_map_file_batch_exec(OrderedMapFileBatch *batch);
 
 OrderedMapFileBuffer *ordered_map_file_buffer_create(int size);
@@ -71,11 +143,45 @@ int ordered_map_file_count(OrderedMapFile *omf);
 int ordered_map_file_find_key(OrderedMapFile *omf, const ByteBuffer &key);
 int ordered_map_file_find_prefix(OrderedMapFile *omf, const ByteBuffer &prefix);
 int ordered_map_file_get(OrderedMapFile *omf, int index, ByteBuffer **out_key, ByteBuffer &out_value);
-
-
-// blocks until all queued writes finish
+// like ordered_map_file_get but points out_value into a mapping of the file
+// instead of copying. the view is valid until ordered_map_file_done_reading.
+int ordered_map_file_get_view(OrderedMapFile *omf, int index, ByteBuffer **out_key, ByteView *out_value);
+
+// Reads the current value of key. Unlike the functions above it works at any
+// time, also after ordered_map_file_done_reading. Runs on the write thread
+// after every batch queued before it, and blocks until done. Returns
+// GenesisErrorKeyNotFound if there is no such key.
+int ordered_map_file_read(OrderedMapFile *omf, const ByteBuffer &key, ByteBuffer &out_value);
+// Like ordered_map_file_read but returns as soon as the read is queued.
+// result->value must point to the buffer to fill; result and that buffer
+// must stay valid until the read is done, which ordered_map_file_close
+// waits for.
+int ordered_map_file_read_async(OrderedMapFile *omf, const ByteBuffer &key,
+        OrderedMapFileReadResult *result);
+bool ordered_map_file_read_done(OrderedMapFile *omf, OrderedMapFileReadResult *result);
+// Blocks until the read is done and returns its error.
+int ordered_map_file_read_wait(OrderedMapFile *omf, OrderedMapFileReadResult *result);
+
+// blocks until all queued batches are committed, each at its own durability
+void ordered_map_file_wait(OrderedMapFile *omf);
+// blocks until all queued writes finish and syncs them to the disk
 // automatically called by ordered_map_file_close
 void ordered_map_file_flush(OrderedMapFile *omf);
 
+void ordered_map_file_get_commit_stats(OrderedMapFile *omf, OrderedMapFileCommitStats *out_stats);
+
+// Queues a rewrite of the live keys into a fresh file which replaces the
+// transaction log. The write thread also does this by itself whenever the
+// log grows to several times the size of the live data. Crash-safe: the new
+// file is complete and synced before it is renamed over the old one. Neither
+// happens before ordered_map_file_done_reading. The new file starts with a
+// sorted index of the keys, so opening it reads only the index and the
+// transactions appended after it, not every value.
+int ordered_map_file_compact(OrderedMapFile *omf);
+
+// For tests. When not negative, the next compaction stops as if the process
+// were killed after this many of its write steps, and this is set to -1.
+extern int ordered_map_file_compact_kill_step;
+
 
 #endif
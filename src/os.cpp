@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <time.h>
+#include <utime.h>
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
@@ -170,6 +171,13 @@ void os_get_samples_dir(ByteBuffer &out) {
     os_path_join(out, app_dir, "samples");
 }
 
+void os_get_cache_dir(ByteBuffer &out) {
+    ByteBuffer app_dir;
+    os_get_app_dir(app_dir);
+
+    os_path_join(out, app_dir, "cache");
+}
+
 void os_get_app_config_dir(ByteBuffer &out) {
     os_get_app_dir(out);
 }
@@ -256,6 +264,18 @@ int os_rename_clobber(const char *source, const char *dest) {
     return rename(source, dest) ? GenesisErrorFileAccess : 0;
 }
 
+int os_sync_parent_dir(const char *path) {
+    ByteBuffer dir = os_path_dirname(path);
+    if (dir.length() == 0)
+        dir.append(".");
+    int fd = open(dir.raw(), O_RDONLY|O_DIRECTORY);
+    if (fd == -1)
+        return GenesisErrorFileAccess;
+    int err = fsync(fd) ? GenesisErrorFileAccess : 0;
+    close(fd);
+    return err;
+}
+
 int os_create_temp_file(const char *dir, OsTempFile *out_tmp_file) {
     os_path_join(out_tmp_file->path, dir, "XXXXXX");
     int fd = mkstemp(out_tmp_file->path.raw());
@@ -1191,6 +1211,17 @@ int os_file_flush(FILE *file) {
     return 0;
 }
 
+int os_file_sync_data(FILE *file) {
+#if defined(__MACH__)
+    if (fsync(fileno(file))) {
+#else
+    if (fdatasync(fileno(file))) {
+#endif
+        return GenesisErrorFileAccess;
+    }
+    return 0;
+}
+
 int os_file_size(FILE *file, long *size) {
     int err;
     struct stat st;
@@ -1201,6 +1232,86 @@ int os_file_size(FILE *file, long *size) {
     return 0;
 }
 
+int os_file_stat(const char *path, int64_t *out_size, long *out_mtime) {
+    struct stat st;
+    if (stat(path, &st)) {
+        switch (errno) {
+            case EACCES:
+                return GenesisErrorPermissionDenied;
+            case ENOENT:
+                return GenesisErrorFileNotFound;
+            default:
+                return GenesisErrorFileAccess;
+        }
+    }
+    *out_size = st.st_size;
+    *out_mtime = st.st_mtime;
+    return 0;
+}
+
+int os_file_touch(const char *path) {
+    if (utime(path, nullptr))
+        return GenesisErrorFileAccess;
+    return 0;
+}
+
+int os_file_set_mtime(const char *path, long mtime) {
+    struct utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+    if (utime(path, &times))
+        return GenesisErrorFileAccess;
+    return 0;
+}
+
+int os_map_file_read_only(const char *path, OsMappedFile *out_mapped_file) {
+    out_mapped_file->address = nullptr;
+    out_mapped_file->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        switch (errno) {
+            case EACCES:
+                return GenesisErrorPermissionDenied;
+            case ENOENT:
+                return GenesisErrorFileNotFound;
+            case EMFILE: // fall through
+            case ENFILE:
+                return GenesisErrorSystemResources;
+            default:
+                return GenesisErrorFileAccess;
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return GenesisErrorFileAccess;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return GenesisErrorEmptyFile;
+    }
+
+    char *address = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+        return (errno == ENOMEM) ? GenesisErrorNoMem : GenesisErrorFileAccess;
+
+    out_mapped_file->address = address;
+    out_mapped_file->size = st.st_size;
+    return 0;
+}
+
+void os_unmap_file(OsMappedFile *mapped_file) {
+    if (mapped_file->address) {
+        int err = munmap(mapped_file->address, mapped_file->size);
+        assert(!err);
+        mapped_file->address = nullptr;
+        mapped_file->size = 0;
+    }
+}
+
 int os_get_current_year(void) {
     time_t t = time(nullptr);
     struct tm *gmt = gmtime(&t);
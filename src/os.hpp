@@ -26,6 +26,7 @@ void os_get_projects_dir(ByteBuffer &out);
 void os_get_app_config_dir(ByteBuffer &out);
 void os_get_app_config_path(ByteBuffer &out);
 void os_get_samples_dir(ByteBuffer &out);
+void os_get_cache_dir(ByteBuffer &out);
 
 uint32_t os_random_uint32(void); // 32 bits of entropy
 uint64_t os_random_uint64(void); // 64 bits of entropy
@@ -36,6 +37,9 @@ String os_get_user_name(void);
 
 int os_delete(const char *path);
 int os_rename_clobber(const char *source, const char *dest);
+// fsyncs the directory containing path, so that a rename or create of path
+// survives a crash
+int os_sync_parent_dir(const char *path);
 
 struct OsTempFile {
     ByteBuffer path;
@@ -44,7 +48,24 @@ struct OsTempFile {
 int os_create_temp_file(const char *dir, OsTempFile *out_tmp_file);
 
 int os_file_flush(FILE *file);
+// like os_file_flush, but may leave metadata such as the modification time
+// unsynced
+int os_file_sync_data(FILE *file);
 int os_file_size(FILE *file, long *out_size);
+int os_file_stat(const char *path, int64_t *out_size, long *out_mtime);
+// sets the modification time of path to now
+int os_file_touch(const char *path);
+// sets the modification time of path, in seconds since the epoch
+int os_file_set_mtime(const char *path, long mtime);
+
+struct OsMappedFile {
+    char *address;
+    size_t size;
+};
+// maps the whole file read-only. the mapping stays valid if the file is
+// deleted.
+int os_map_file_read_only(const char *path, OsMappedFile *out_mapped_file);
+void os_unmap_file(OsMappedFile *mapped_file);
 
 int os_mkdirp(ByteBuffer path);
 ByteBuffer os_path_dirname(ByteBuffer path);
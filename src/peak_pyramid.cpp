@@ -0,0 +1,293 @@
+#include "peak_pyramid.hpp"
+#include "util.hpp"
+
+#include <math.h>
+
+// header: magic, channel count, frame count, base frames, factor, level
+// count, key length, key. all integers big endian. the peaks follow, level by
+// level and channel by channel, as native floats.
+static const char peak_pyramid_magic[8] = {'G', 'N', 'S', 'P', 'E', 'A', 'K', '1'};
+static const int PEAK_PYRAMID_HEADER_SIZE = 4096;
+static const int PEAK_PYRAMID_MAX_KEY_SIZE = 1024;
+
+static_assert(8 + 4 + 8 + 4 + 4 + 4 + 4 + PEAK_PYRAMID_MAX_KEY_SIZE <= PEAK_PYRAMID_HEADER_SIZE,
+        "peak pyramid header does not fit");
+
+static int compute_peak_counts(long frame_count, long *peak_counts) {
+    if (frame_count <= 0)
+        return 0;
+    int level_count = 0;
+    long count = (frame_count + PEAK_PYRAMID_BASE_FRAMES - 1) / PEAK_PYRAMID_BASE_FRAMES;
+    for (;;) {
+        assert(level_count < PEAK_PYRAMID_MAX_LEVELS);
+        peak_counts[level_count] = count;
+        level_count += 1;
+        if (count == 1)
+            return level_count;
+        count = (count + PEAK_PYRAMID_FACTOR - 1) / PEAK_PYRAMID_FACTOR;
+    }
+}
+
+// combines peaks [first, last] of a level. the last peak of a level may cover
+// fewer frames than the others, so RMS is weighted by frame count.
+static WaveformPeak combine_peaks(const WaveformPeak *peaks, long first, long last,
+        long frames_per_peak, long frame_count)
+{
+    WaveformPeak result = peaks[first];
+    double sum_sq = 0.0;
+    long total_frames = 0;
+    for (long i = first; i <= last; i += 1) {
+        const WaveformPeak *peak = &peaks[i];
+        result.min = min(result.min, peak->min);
+        result.max = max(result.max, peak->max);
+        long frames = min(frames_per_peak, frame_count - i * frames_per_peak);
+        sum_sq += (double)peak->rms * (double)peak->rms * frames;
+        total_frames += frames;
+    }
+    result.rms = (total_frames > 0) ? (float)sqrt(sum_sq / total_frames) : 0.0f;
+    return result;
+}
+
+static void scan_channel(GenesisAudioFile *audio_file, int channel_index, long frame_count,
+        WaveformPeak *out)
+{
+    GenesisAudioFileIterator it = genesis_audio_file_iterator(audio_file, channel_index, 0);
+    long frame = 0;
+    long peak_index = 0;
+    long peak_frames = 0;
+    float peak_min = 0.0f;
+    float peak_max = 0.0f;
+    double sum_sq = 0.0;
+    while (frame < frame_count) {
+        long end = min(it.end, frame_count);
+        while (frame < end) {
+            long count = min(end - frame, (long)PEAK_PYRAMID_BASE_FRAMES - peak_frames);
+            // non-streaming iterators always have samples; treat a gap as silence anyway
+            const float *samples = it.ptr ? it.ptr + (frame - it.start) : nullptr;
+            if (peak_frames == 0) {
+                peak_min = samples ? samples[0] : 0.0f;
+                peak_max = peak_min;
+            }
+            if (samples) {
+                float run_sum_sq = 0.0f;
+                for (long i = 0; i < count; i += 1) {
+                    float sample = samples[i];
+                    peak_min = (sample < peak_min) ? sample : peak_min;
+                    peak_max = (sample > peak_max) ? sample : peak_max;
+                    run_sum_sq += sample * sample;
+                }
+                sum_sq += run_sum_sq;
+            } else {
+                peak_min = min(peak_min, 0.0f);
+                peak_max = max(peak_max, 0.0f);
+            }
+            peak_frames += count;
+            frame += count;
+
+            if (peak_frames == PEAK_PYRAMID_BASE_FRAMES || frame == frame_count) {
+                WaveformPeak *peak = &out[peak_index];
+                peak->min = peak_min;
+                peak->max = peak_max;
+                peak->rms = (float)sqrt(sum_sq / peak_frames);
+                peak_index += 1;
+                peak_frames = 0;
+                sum_sq = 0.0;
+            }
+        }
+        genesis_audio_file_iterator_next(&it);
+    }
+    genesis_audio_file_iterator_release(&it);
+}
+
+static void write_header(uint8_t *header, int channel_count, long frame_count,
+        int level_count, const ByteBuffer &key)
+{
+    memset(header, 0, PEAK_PYRAMID_HEADER_SIZE);
+    memcpy(header, peak_pyramid_magic, 8);
+    int offset = 8;
+    write_uint32be(&header[offset], channel_count); offset += 4;
+    write_uint64be(&header[offset], frame_count); offset += 8;
+    write_uint32be(&header[offset], PEAK_PYRAMID_BASE_FRAMES); offset += 4;
+    write_uint32be(&header[offset], PEAK_PYRAMID_FACTOR); offset += 4;
+    write_uint32be(&header[offset], level_count); offset += 4;
+    write_uint32be(&header[offset], key.length()); offset += 4;
+    memcpy(&header[offset], key.raw(), key.length());
+}
+
+int peak_pyramid_write(GenesisAudioFile *audio_file, const char *path, const ByteBuffer &key) {
+    if (key.length() > PEAK_PYRAMID_MAX_KEY_SIZE)
+        return GenesisErrorInvalidParam;
+    if (genesis_audio_file_is_streaming(audio_file))
+        return GenesisErrorInvalidState;
+
+    int channel_count = genesis_audio_file_channel_layout(audio_file)->channel_count;
+    long frame_count = genesis_audio_file_frame_count(audio_file);
+    long peak_counts[PEAK_PYRAMID_MAX_LEVELS];
+    int level_count = compute_peak_counts(frame_count, peak_counts);
+
+    size_t total_peaks = 0;
+    for (int level = 0; level < level_count; level += 1)
+        total_peaks += peak_counts[level] * channel_count;
+    WaveformPeak *peaks = allocate_zero<WaveformPeak>(total_peaks);
+    if (total_peaks > 0 && !peaks)
+        return GenesisErrorNoMem;
+
+    if (level_count > 0) {
+        for (int ch = 0; ch < channel_count; ch += 1)
+            scan_channel(audio_file, ch, frame_count, peaks + ch * peak_counts[0]);
+    }
+
+    WaveformPeak *prev_level = peaks;
+    long frames_per_peak = PEAK_PYRAMID_BASE_FRAMES;
+    for (int level = 1; level < level_count; level += 1) {
+        long prev_count = peak_counts[level - 1];
+        long count = peak_counts[level];
+        WaveformPeak *this_level = prev_level + prev_count * channel_count;
+        for (int ch = 0; ch < channel_count; ch += 1) {
+            const WaveformPeak *prev_peaks = prev_level + ch * prev_count;
+            WaveformPeak *this_peaks = this_level + ch * count;
+            for (long i = 0; i < count; i += 1) {
+                long first = i * PEAK_PYRAMID_FACTOR;
+                long last = min(first + PEAK_PYRAMID_FACTOR, prev_count) - 1;
+                this_peaks[i] = combine_peaks(prev_peaks, first, last, frames_per_peak, frame_count);
+            }
+        }
+        prev_level = this_level;
+        frames_per_peak *= PEAK_PYRAMID_FACTOR;
+    }
+
+    // write to a temporary file and rename it into place, as the decoded
+    // sample files are
+    int err;
+    ByteBuffer output_dir = os_path_dirname(path);
+    OsTempFile tmp_file;
+    if ((err = os_create_temp_file(output_dir.raw(), &tmp_file))) {
+        destroy(peaks, total_peaks);
+        return err;
+    }
+
+    uint8_t header[PEAK_PYRAMID_HEADER_SIZE];
+    write_header(header, channel_count, frame_count, level_count, key);
+    if (fwrite(header, 1, PEAK_PYRAMID_HEADER_SIZE, tmp_file.file) != PEAK_PYRAMID_HEADER_SIZE ||
+        fwrite(peaks, sizeof(WaveformPeak), total_peaks, tmp_file.file) != total_peaks)
+    {
+        err = GenesisErrorFileAccess;
+    }
+    if (fclose(tmp_file.file) && !err)
+        err = GenesisErrorFileAccess;
+    destroy(peaks, total_peaks);
+
+    if (!err)
+        err = os_rename_clobber(tmp_file.path.raw(), path);
+    if (err)
+        os_delete(tmp_file.path.raw());
+    return err;
+}
+
+int peak_pyramid_open(const char *path, const ByteBuffer &key, PeakPyramid **out_pyramid) {
+    *out_pyramid = nullptr;
+    PeakPyramid *pyramid = create_zero<PeakPyramid>();
+    if (!pyramid)
+        return GenesisErrorNoMem;
+
+    int err;
+    if ((err = os_map_file_read_only(path, &pyramid->mapped_file))) {
+        peak_pyramid_destroy(pyramid);
+        return (err == GenesisErrorEmptyFile) ? GenesisErrorInvalidFormat : err;
+    }
+
+    size_t size = pyramid->mapped_file.size;
+    const uint8_t *header = (const uint8_t *)pyramid->mapped_file.address;
+    if (size < (size_t)PEAK_PYRAMID_HEADER_SIZE || memcmp(header, peak_pyramid_magic, 8) != 0) {
+        peak_pyramid_destroy(pyramid);
+        return GenesisErrorInvalidFormat;
+    }
+
+    int offset = 8;
+    int channel_count = read_uint32be(&header[offset]); offset += 4;
+    long frame_count = read_uint64be(&header[offset]); offset += 8;
+    int base_frames = read_uint32be(&header[offset]); offset += 4;
+    int factor = read_uint32be(&header[offset]); offset += 4;
+    int level_count = read_uint32be(&header[offset]); offset += 4;
+    int key_len = read_uint32be(&header[offset]); offset += 4;
+    if (channel_count <= 0 || channel_count > GENESIS_MAX_CHANNELS || frame_count < 0 ||
+        base_frames != PEAK_PYRAMID_BASE_FRAMES || factor != PEAK_PYRAMID_FACTOR ||
+        key_len != key.length() || memcmp(&header[offset], key.raw(), key_len) != 0)
+    {
+        peak_pyramid_destroy(pyramid);
+        return GenesisErrorInvalidFormat;
+    }
+
+    long peak_counts[PEAK_PYRAMID_MAX_LEVELS];
+    if (compute_peak_counts(frame_count, peak_counts) != level_count) {
+        peak_pyramid_destroy(pyramid);
+        return GenesisErrorInvalidFormat;
+    }
+    size_t total_peaks = 0;
+    for (int level = 0; level < level_count; level += 1)
+        total_peaks += peak_counts[level] * channel_count;
+    if (size != PEAK_PYRAMID_HEADER_SIZE + total_peaks * sizeof(WaveformPeak)) {
+        peak_pyramid_destroy(pyramid);
+        return GenesisErrorInvalidFormat;
+    }
+
+    pyramid->channel_count = channel_count;
+    pyramid->frame_count = frame_count;
+    pyramid->level_count = level_count;
+    const WaveformPeak *peaks = (const WaveformPeak *)(pyramid->mapped_file.address + PEAK_PYRAMID_HEADER_SIZE);
+    long frames_per_peak = PEAK_PYRAMID_BASE_FRAMES;
+    for (int level = 0; level < level_count; level += 1) {
+        PeakPyramidLevel *pyramid_level = &pyramid->levels[level];
+        pyramid_level->frames_per_peak = frames_per_peak;
+        pyramid_level->peak_count = peak_counts[level];
+        for (int ch = 0; ch < channel_count; ch += 1) {
+            pyramid_level->peaks[ch] = peaks;
+            peaks += peak_counts[level];
+        }
+        frames_per_peak *= PEAK_PYRAMID_FACTOR;
+    }
+
+    *out_pyramid = pyramid;
+    return 0;
+}
+
+void peak_pyramid_destroy(PeakPyramid *pyramid) {
+    if (!pyramid)
+        return;
+    os_unmap_file(&pyramid->mapped_file);
+    destroy(pyramid, 1);
+}
+
+void peak_pyramid_get_peaks(const PeakPyramid *pyramid, int channel_index,
+        double start_frame, double end_frame, int pixel_count, WaveformPeak *out)
+{
+    assert(channel_index >= 0 && channel_index < pyramid->channel_count);
+    if (pixel_count <= 0)
+        return;
+
+    double frames_per_pixel = (end_frame - start_frame) / pixel_count;
+    int level_index = 0;
+    while (level_index + 1 < pyramid->level_count &&
+            pyramid->levels[level_index + 1].frames_per_peak <= frames_per_pixel)
+    {
+        level_index += 1;
+    }
+
+    for (int pixel = 0; pixel < pixel_count; pixel += 1) {
+        double pixel_start = start_frame + pixel * frames_per_pixel;
+        double pixel_end = pixel_start + frames_per_pixel;
+        if (pyramid->level_count == 0 || pixel_end <= 0.0 || pixel_start >= pyramid->frame_count) {
+            out[pixel].min = 0.0f;
+            out[pixel].max = 0.0f;
+            out[pixel].rms = 0.0f;
+            continue;
+        }
+        const PeakPyramidLevel *level = &pyramid->levels[level_index];
+        long first = (long)floor(pixel_start / level->frames_per_peak);
+        long last = (long)ceil(pixel_end / level->frames_per_peak) - 1;
+        first = clamp(0L, first, level->peak_count - 1);
+        last = clamp(first, last, level->peak_count - 1);
+        out[pixel] = combine_peaks(level->peaks[channel_index], first, last,
+                level->frames_per_peak, pyramid->frame_count);
+    }
+}
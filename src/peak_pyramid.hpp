@@ -0,0 +1,58 @@
+#ifndef PEAK_PYRAMID_HPP
+#define PEAK_PYRAMID_HPP
+
+#include "genesis.h"
+#include "byte_buffer.hpp"
+#include "os.hpp"
+
+// Multi-resolution min/max/RMS summary of an audio file, used to draw
+// waveforms at any zoom level without reading samples. Level 0 has one peak
+// per PEAK_PYRAMID_BASE_FRAMES frames; each level above it has one peak per
+// PEAK_PYRAMID_FACTOR peaks of the level below, up to a single peak for the
+// whole file. Stored in a file and memory-mapped.
+
+static const int PEAK_PYRAMID_BASE_FRAMES = 256;
+static const int PEAK_PYRAMID_FACTOR = 4;
+static const int PEAK_PYRAMID_MAX_LEVELS = 32;
+
+struct WaveformPeak {
+    float min;
+    float max;
+    float rms;
+};
+
+struct PeakPyramidLevel {
+    long frames_per_peak;
+    long peak_count;
+    // peak_count peaks for each channel
+    const WaveformPeak *peaks[GENESIS_MAX_CHANNELS];
+};
+
+struct PeakPyramid {
+    OsMappedFile mapped_file;
+    int channel_count;
+    long frame_count;
+    int level_count;
+    PeakPyramidLevel levels[PEAK_PYRAMID_MAX_LEVELS];
+};
+
+// Scans every sample of audio_file and writes its pyramid to path. key is
+// stored in the file and must match when it is opened. Returns
+// GenesisErrorInvalidState for streaming audio files, which can not be read
+// from start to end without blocking on the decoder.
+int peak_pyramid_write(GenesisAudioFile *audio_file, const char *path, const ByteBuffer &key);
+
+// Returns GenesisErrorInvalidFormat if the file at path is not a complete
+// pyramid written with the same key.
+int peak_pyramid_open(const char *path, const ByteBuffer &key, PeakPyramid **out_pyramid);
+void peak_pyramid_destroy(PeakPyramid *pyramid);
+
+// Fills out with pixel_count peaks of one channel, evenly dividing the frames
+// from start_frame to end_frame. Uses the coarsest level which still has a
+// peak per pixel, so each output peak combines only a few stored ones. When
+// zoomed in past level 0, neighbouring pixels repeat the same peak. Frames
+// outside the file are silence.
+void peak_pyramid_get_peaks(const PeakPyramid *pyramid, int channel_index,
+        double start_frame, double end_frame, int pixel_count, WaveformPeak *out);
+
+#endif
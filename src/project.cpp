@@ -1,8 +1,11 @@
 #include "project.hpp"
 #include "audio_graph.hpp"
+#include "sample_cache.hpp"
 
 #include <limits.h>
 
+static const int ASSET_LOADER_MAX_THREADS = 4;
+
 // modifying this structure affects project file backward compatibility
 enum PropKey {
     PropKeyInvalid,
@@ -25,10 +28,15 @@ enum PropKey {
     PropKeyTagAlbumArtist,
     PropKeyTagAlbum,
     PropKeyTagYear,
+    PropKeyNextRevision,
+    PropKeyTempoMap,
 };
 
 static const int PROP_KEY_SIZE = 4;
 static const int UINT256_SIZE = 32;
+// Edits survive the application crashing. Rapid edits, such as dragging,
+// share flushes through group commit.
+static const OrderedMapFileDurability EDIT_DURABILITY = OrderedMapFileDurabilityFlushed;
 
 // modifying this structure affects project file backward compatibility
 enum SerializableFieldKey {
@@ -93,7 +101,7 @@ struct SerializableField {
     void (*set_default_value)(T *);
 };
 
-static int deserialize_from_enum(void *ptr, SerializableFieldType type, const ByteBuffer &buffer, int *offset);
+static int deserialize_from_enum(void *ptr, SerializableFieldType type, const ByteView &buffer, int *offset);
 static void serialize_effect(Effect *effect, ByteBuffer &buffer);
 static void serialize_effect_send(EffectSend *effect_send, ByteBuffer &buffer);
 
@@ -859,7 +867,7 @@ static void serialize_effect_send(EffectSend *effect_send, ByteBuffer &buffer) {
 }
 
 
-static int deserialize_double(double *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_double(double *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 8)
         return GenesisErrorInvalidFormat;
 
@@ -869,7 +877,7 @@ static int deserialize_double(double *x, const ByteBuffer &buffer, int *offset)
     return 0;
 }
 
-static int deserialize_float(float *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_float(float *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 4)
         return GenesisErrorInvalidFormat;
 
@@ -879,7 +887,7 @@ static int deserialize_float(float *x, const ByteBuffer &buffer, int *offset) {
     return 0;
 }
 
-static int deserialize_uint32be(uint32_t *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint32be(uint32_t *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 4)
         return GenesisErrorInvalidFormat;
 
@@ -888,7 +896,7 @@ static int deserialize_uint32be(uint32_t *x, const ByteBuffer &buffer, int *offs
     return 0;
 }
 
-static int deserialize_uint8(uint8_t *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint8(uint8_t *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 1)
         return GenesisErrorInvalidFormat;
 
@@ -897,7 +905,7 @@ static int deserialize_uint8(uint8_t *x, const ByteBuffer &buffer, int *offset)
     return 0;
 }
 
-static int deserialize_uint64be(uint64_t *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint64be(uint64_t *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 8)
         return GenesisErrorInvalidFormat;
 
@@ -906,7 +914,7 @@ static int deserialize_uint64be(uint64_t *x, const ByteBuffer &buffer, int *offs
     return 0;
 }
 
-static int deserialize_uint32be_as_int(int *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint32be_as_int(int *x, const ByteView &buffer, int *offset) {
     uint32_t unsigned_x;
     int err;
     if ((err = deserialize_uint32be(&unsigned_x, buffer, offset))) return err;
@@ -915,7 +923,7 @@ static int deserialize_uint32be_as_int(int *x, const ByteBuffer &buffer, int *of
     return 0;
 }
 
-static int deserialize_uint64be_as_long(long *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint64be_as_long(long *x, const ByteView &buffer, int *offset) {
     uint64_t unsigned_x;
     int err;
     if ((err = deserialize_uint64be(&unsigned_x, buffer, offset))) return err;
@@ -924,7 +932,7 @@ static int deserialize_uint64be_as_long(long *x, const ByteBuffer &buffer, int *
     return 0;
 }
 
-static int deserialize_byte_buffer(ByteBuffer &out, const ByteBuffer &buffer, int *offset) {
+static int deserialize_byte_buffer(ByteBuffer &out, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 4)
         return GenesisErrorInvalidFormat;
 
@@ -940,7 +948,7 @@ static int deserialize_byte_buffer(ByteBuffer &out, const ByteBuffer &buffer, in
     return 0;
 }
 
-static int deserialize_string(String &out, const ByteBuffer &buffer, int *offset) {
+static int deserialize_string(String &out, const ByteView &buffer, int *offset) {
     ByteBuffer encoded;
     int err;
     if ((err = deserialize_byte_buffer(encoded, buffer, offset))) return err;
@@ -953,7 +961,7 @@ static int deserialize_string(String &out, const ByteBuffer &buffer, int *offset
     return 0;
 }
 
-static int deserialize_uint256(uint256 *x, const ByteBuffer &buffer, int *offset) {
+static int deserialize_uint256(uint256 *x, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < UINT256_SIZE)
         return GenesisErrorInvalidFormat;
 
@@ -962,7 +970,7 @@ static int deserialize_uint256(uint256 *x, const ByteBuffer &buffer, int *offset
     return 0;
 }
 
-static int deserialize_channel_layout(SoundIoChannelLayout *layout, const ByteBuffer &buffer, int *offset) {
+static int deserialize_channel_layout(SoundIoChannelLayout *layout, const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 4)
         return GenesisErrorInvalidFormat;
 
@@ -990,7 +998,7 @@ static int deserialize_channel_layout(SoundIoChannelLayout *layout, const ByteBu
 }
 
 template<typename T>
-static int deserialize_object(T *obj, const ByteBuffer &buffer, int *offset) {
+static int deserialize_object(T *obj, const ByteView &buffer, int *offset) {
     const SerializableField<T> *serializable_fields = get_serializable_fields(obj);
 
     int err;
@@ -1048,7 +1056,7 @@ static int deserialize_object(T *obj, const ByteBuffer &buffer, int *offset) {
     return 0;
 }
 
-static int deserialize_from_enum(void *ptr, SerializableFieldType type, const ByteBuffer &buffer, int *offset) {
+static int deserialize_from_enum(void *ptr, SerializableFieldType type, const ByteView &buffer, int *offset) {
     switch (type) {
     case SerializableFieldTypeInvalid:
         panic("invalid serialize field type");
@@ -1186,6 +1194,17 @@ static OrderedMapFileBuffer *omf_buf_channel_layout(const SoundIoChannelLayout *
     return buf;
 }
 
+static OrderedMapFileBuffer *omf_buf_tempo_map(const TempoMap *tempo_map) {
+    ByteBuffer buffer;
+    buffer.append_uint32be(tempo_map->segments.length());
+    for (int i = 0; i < tempo_map->segments.length(); i += 1) {
+        const GenesisTempoSegment *segment = &tempo_map->segments.at(i);
+        buffer.append_double(segment->start_whole_notes);
+        buffer.append_double(segment->whole_notes_per_second);
+    }
+    return omf_buf_byte_buffer(buffer);
+}
+
 static OrderedMapFileBuffer *omf_buf_string(const String &string) {
     ByteBuffer encoded = string.encode();
     return omf_buf_byte_buffer(encoded);
@@ -1261,6 +1280,36 @@ static void project_sort_item(List<T> &list, IdMap<T> &id_map) {
     quick_sort<T, compare>(list.raw(), list.length());
 }
 
+// Edits keep the lists sorted with these instead of sorting again. Finding
+// the spot is a binary search; making room is a memmove of the tail.
+template<typename T, int (*compare)(T, T)>
+static int sorted_list_find(const List<T> &list, T item) {
+    int start = 0;
+    int end = list.length();
+    while (start < end) {
+        int middle = (start + end) / 2;
+        if (compare(list.at(middle), item) < 0)
+            start = middle + 1;
+        else
+            end = middle;
+    }
+    return start;
+}
+
+template<typename T, int (*compare)(T, T)>
+static void sorted_list_insert(List<T> &list, T item) {
+    int index = sorted_list_find<T, compare>(list, item);
+    ok_or_panic(list.insert_space(index, 1));
+    list.at(index) = item;
+}
+
+template<typename T, int (*compare)(T, T)>
+static void sorted_list_remove(List<T> &list, T item) {
+    int index = sorted_list_find<T, compare>(list, item);
+    assert(index < list.length() && list.at(index) == item);
+    list.remove_range(index, index + 1);
+}
+
 static void project_sort_tracks(Project *project) {
     project_sort_item<Track *, compare_tracks>(project->track_list, project->tracks);
 }
@@ -1333,18 +1382,22 @@ static void trigger_event(Project *project, Event event) {
     project->events.trigger(event);
 }
 
-static void project_compute_indexes(Project *project) {
-    if (project->track_list_dirty) project_sort_tracks(project);
-    if (project->user_list_dirty) project_sort_users(project);
-    if (project->command_list_dirty) project_sort_commands(project);
-    if (project->audio_asset_list_dirty) project_sort_audio_assets(project);
-    if (project->audio_clip_list_dirty) project_sort_audio_clips(project);
-    if (project->mixer_line_list_dirty) project_sort_mixer_lines(project);
+// Rebuilds every sorted list from the id maps, after loading a project.
+static void project_sort_all(Project *project) {
+    project_sort_tracks(project);
+    project_sort_users(project);
+    project_sort_commands(project);
+    project_sort_audio_assets(project);
+    project_sort_audio_clips(project);
+    project_sort_mixer_lines(project);
     // depends on tracks being sorted
-    if (project->audio_clip_segments_dirty) project_sort_audio_clip_segments(project);
+    project_sort_audio_clip_segments(project);
     // depends on mixer lines being sorted
-    if (project->effects_dirty) project_sort_effects(project);
+    project_sort_effects(project);
+}
 
+// The lists are already sorted; tells listeners which ones changed.
+static void project_trigger_list_events(Project *project) {
     if (project->track_list_dirty) {
         project->track_list_dirty = false;
         trigger_event(project, EventProjectTracksChanged);
@@ -1380,13 +1433,7 @@ static void project_compute_indexes(Project *project) {
 }
 
 int project_get_next_revision(Project *project) {
-    project_compute_indexes(project);
-
-    if (project->command_list.length() == 0)
-        return 0;
-
-    Command *last_command = project->command_list.at(project->command_list.length() - 1);
-    return last_command->revision + 1;
+    return project->next_revision;
 }
 
 static OrderedMapFileBuffer *create_undo_stack_key(int index) {
@@ -1454,7 +1501,7 @@ static int list_key_to_index(const ByteBuffer &key, int *out_index) {
     return 0;
 }
 
-static int deserialize_track_decoded_key(Project *project, const uint256 &id, const ByteBuffer &value) {
+static int deserialize_track_decoded_key(Project *project, const uint256 &id, const ByteView &value) {
     Track *track = create_zero<Track>();
     if (!track)
         return GenesisErrorNoMem;
@@ -1475,7 +1522,7 @@ static int deserialize_track_decoded_key(Project *project, const uint256 &id, co
 
 }
 
-static int deserialize_track(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_track(Project *project, const ByteBuffer &key, const ByteView &value) {
     uint256 track_id;
     int err = object_key_to_id(key, &track_id);
     if (err)
@@ -1483,7 +1530,7 @@ static int deserialize_track(Project *project, const ByteBuffer &key, const Byte
     return deserialize_track_decoded_key(project, track_id, value);
 }
 
-static int deserialize_user(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_user(Project *project, const ByteBuffer &key, const ByteView &value) {
     User *user = create_zero<User>();
     if (!user)
         return GenesisErrorNoMem;
@@ -1512,7 +1559,7 @@ static void project_put_audio_asset(Project *project, AudioAsset *audio_asset) {
     project->audio_asset_list_dirty = true;
 }
 
-static int deserialize_audio_asset(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_audio_asset(Project *project, const ByteBuffer &key, const ByteView &value) {
     AudioAsset *audio_asset = create_zero<AudioAsset>();
     if (!audio_asset)
         return GenesisErrorNoMem;
@@ -1538,7 +1585,7 @@ static void destroy_audio_clip(Project *project, AudioClip *audio_clip) {
     destroy(audio_clip, 1);
 }
 
-static int deserialize_audio_clip(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_audio_clip(Project *project, const ByteBuffer &key, const ByteView &value) {
     AudioClip *audio_clip = create_zero<AudioClip>();
     if (!audio_clip)
         return GenesisErrorNoMem;
@@ -1568,7 +1615,7 @@ static int deserialize_audio_clip(Project *project, const ByteBuffer &key, const
     return 0;
 }
 
-static int deserialize_audio_clip_segment(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_audio_clip_segment(Project *project, const ByteBuffer &key, const ByteView &value) {
     AudioClipSegment *segment = create_zero<AudioClipSegment>();
     if (!segment)
         return GenesisErrorNoMem;
@@ -1605,7 +1652,7 @@ static int deserialize_audio_clip_segment(Project *project, const ByteBuffer &ke
     return 0;
 }
 
-static int deserialize_mixer_line(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_mixer_line(Project *project, const ByteBuffer &key, const ByteView &value) {
     MixerLine *mixer_line = create_zero<MixerLine>();
     if (!mixer_line)
         return GenesisErrorNoMem;
@@ -1628,7 +1675,7 @@ static int deserialize_mixer_line(Project *project, const ByteBuffer &key, const
     return 0;
 }
 
-static int deserialize_effect(Project *project, const ByteBuffer &key, const ByteBuffer &value) {
+static int deserialize_effect(Project *project, const ByteBuffer &key, const ByteView &value) {
     Effect *effect = create_zero<Effect>();
     if (!effect)
         return GenesisErrorNoMem;
@@ -1658,7 +1705,9 @@ static int deserialize_effect(Project *project, const ByteBuffer &key, const Byt
     return 0;
 }
 
-static int deserialize_command(Project *project, const ByteBuffer &key, const ByteBuffer &buffer) {
+static int deserialize_command_object(Project *project, const ByteBuffer &key, const ByteView &buffer,
+        Command **out_command)
+{
     int offset_data = 0;
     int *offset = &offset_data;
     int err;
@@ -1736,17 +1785,35 @@ static int deserialize_command(Project *project, const ByteBuffer &key, const By
     }
 
     auto entry = project->users.maybe_get(command->user_id);
-    if (!entry)
+    if (!entry) {
+        destroy(command, 1);
         return GenesisErrorInvalidFormat;
+    }
     command->user = entry->value;
 
+    *out_command = command;
+    return 0;
+}
+
+// for files written before PropKeyNextRevision, which are read entirely
+static int deserialize_command(Project *project, const ByteBuffer &key, const ByteView &buffer) {
+    uint256 id;
+    int err;
+    if ((err = object_key_to_id(key, &id))) return err;
+    // undo and redo commands load the command they refer to
+    if (project->commands.maybe_get(id))
+        return 0;
+
+    Command *command;
+    if ((err = deserialize_command_object(project, key, buffer, &command))) return err;
+
     project->commands.put(command->id, command);
     project->command_list_dirty = true;
 
     return 0;
 }
 
-static int deserialize_undo_stack_item(Project *project, const ByteBuffer &key, const ByteBuffer &buffer) {
+static int deserialize_undo_stack_item(Project *project, const ByteBuffer &key, const ByteView &buffer) {
     int index;
     int err;
     if ((err = list_key_to_index(key, &index))) return err;
@@ -1756,17 +1823,9 @@ static int deserialize_undo_stack_item(Project *project, const ByteBuffer &key,
     uint256 cmd_id;
     if ((err = deserialize_uint256(&cmd_id, buffer, &offset))) return err;
 
-    auto entry = project->commands.maybe_get(cmd_id);
-    if (!entry)
-        return GenesisErrorInvalidFormat;
-
-    Command *command = entry->value;
-
-    if (project->undo_stack.resize(project->undo_stack.length() + 1))
+    if (project->undo_stack.append(cmd_id))
         return GenesisErrorNoMem;
 
-    project->undo_stack.at(project->undo_stack.length() - 1) = command;
-
     return 0;
 }
 
@@ -1818,6 +1877,31 @@ static int read_scalar_channel_layout(Project *project, PropKey prop_key, SoundI
     return 0;
 }
 
+static int read_scalar_tempo_map(Project *project, PropKey prop_key, TempoMap *tempo_map) {
+    ByteBuffer buf;
+    int err;
+    if ((err = read_scalar_byte_buffer(project, prop_key, buf)))
+        return err;
+    int offset = 0;
+    int segment_count;
+    if ((err = deserialize_uint32be_as_int(&segment_count, buf, &offset))) return err;
+    if ((buf.length() - offset) / 16 < segment_count)
+        return GenesisErrorInvalidFormat;
+
+    List<GenesisTempoSegment> segments;
+    if (segments.resize(segment_count))
+        return GenesisErrorNoMem;
+    for (int i = 0; i < segment_count; i += 1) {
+        GenesisTempoSegment *segment = &segments.at(i);
+        if ((err = deserialize_double(&segment->start_whole_notes, buf, &offset))) return err;
+        if ((err = deserialize_double(&segment->whole_notes_per_second, buf, &offset))) return err;
+    }
+    err = tempo_map_set(tempo_map, segments.raw(), segment_count);
+    if (err == GenesisErrorInvalidParam)
+        return GenesisErrorInvalidFormat;
+    return err;
+}
+
 static int read_scalar_uint256(Project *project, PropKey prop_key, uint256 *out_value) {
     ByteBuffer buf;
     int err = read_scalar_byte_buffer(project, prop_key, buf);
@@ -1852,7 +1936,7 @@ static int read_scalar_uint32be_as_int(Project *project, PropKey prop_key, int *
 }
 
 static int iterate_prefix(Project *project, PropKey prop_key,
-        int (*got_one)(Project *, const ByteBuffer &, const ByteBuffer &))
+        int (*got_one)(Project *, const ByteBuffer &, const ByteView &))
 {
     ByteBuffer key_buf;
     key_buf.append_uint32be(prop_key);
@@ -1861,9 +1945,9 @@ static int iterate_prefix(Project *project, PropKey prop_key,
     int key_count = ordered_map_file_count(project->omf);
 
     ByteBuffer *key;
-    ByteBuffer value;
+    ByteView value;
     while (index >= 0 && index < key_count) {
-        int err = ordered_map_file_get(project->omf, index, &key, value);
+        int err = ordered_map_file_get_view(project->omf, index, &key, &value);
         if (err)
             return err;
 
@@ -1880,9 +1964,274 @@ static int iterate_prefix(Project *project, PropKey prop_key,
     return 0;
 }
 
-static void project_push_command(Project *project, Command *command) {
-    ok_or_panic(project->command_list.append(command));
+static int project_init_asset_loader(Project *project) {
+    if (!(project->asset_loader_mutex = os_mutex_create()))
+        return GenesisErrorNoMem;
+    if (!(project->asset_loader_cond = os_cond_create()))
+        return GenesisErrorNoMem;
+    // no progress to report until the loader threads start
+    project->asset_loader_progress_flag.test_and_set();
+    return 0;
+}
+
+static int open_audio_asset(Project *project, AudioAsset *audio_asset, GenesisAudioFile **out_audio_file) {
+    ByteBuffer project_dir = os_path_dirname(project->path);
+    ByteBuffer full_path;
+    os_path_join(full_path, project_dir, audio_asset->path);
+    ByteBuffer cache_dir;
+    os_get_cache_dir(cache_dir);
+    return sample_cache_open(project->genesis_context, cache_dir, audio_asset->sha256sum,
+            full_path.raw(), out_audio_file);
+}
+
+// called with asset_loader_mutex held. on failure the asset keeps the error
+// until project_ensure_audio_asset_loaded tries again.
+static void finish_loading_audio_asset(Project *project, AudioAsset *audio_asset,
+        GenesisAudioFile *audio_file, int err)
+{
+    audio_asset->audio_file = err ? nullptr : audio_file;
+    audio_asset->load_state = err ? AudioAssetLoadStateFailed : AudioAssetLoadStateLoaded;
+    audio_asset->load_err = err;
+    os_cond_broadcast(project->asset_loader_cond, project->asset_loader_mutex);
+}
+
+static void open_audio_asset_peaks(Project *project, AudioAsset *audio_asset,
+        GenesisAudioFile *audio_file)
+{
+    ByteBuffer project_dir = os_path_dirname(project->path);
+    ByteBuffer full_path;
+    os_path_join(full_path, project_dir, audio_asset->path);
+    ByteBuffer cache_dir;
+    os_get_cache_dir(cache_dir);
+    PeakPyramid *peaks;
+    if (!sample_cache_open_peaks(cache_dir, audio_asset->sha256sum, full_path.raw(), audio_file, &peaks))
+        audio_asset->peaks.store(peaks);
+}
+
+static void asset_loader_thread_run(void *arg) {
+    Project *project = (Project *)arg;
+    for (;;) {
+        os_mutex_lock(project->asset_loader_mutex);
+        while (!project->asset_loader_stop &&
+                project->asset_loader_next_index >= project->asset_loader_queue.length())
+        {
+            os_cond_wait(project->asset_loader_cond, project->asset_loader_mutex);
+        }
+        if (project->asset_loader_stop) {
+            os_mutex_unlock(project->asset_loader_mutex);
+            return;
+        }
+        AudioAsset *audio_asset = project->asset_loader_queue.at(project->asset_loader_next_index);
+        project->asset_loader_next_index += 1;
+        // another thread may have loaded it or be loading it already. an
+        // asset queued again after failing is tried again.
+        bool load = (audio_asset->load_state == AudioAssetLoadStateUnloaded ||
+                audio_asset->load_state == AudioAssetLoadStateFailed);
+        if (load)
+            audio_asset->load_state = AudioAssetLoadStateLoading;
+        os_mutex_unlock(project->asset_loader_mutex);
+
+        if (load) {
+            GenesisAudioFile *audio_file = nullptr;
+            int err = open_audio_asset(project, audio_asset, &audio_file);
+            if (err) {
+                fprintf(stderr, "unable to load audio asset %s: %s\n",
+                        audio_asset->path.raw(), genesis_strerror(err));
+            }
+
+            os_mutex_lock(project->asset_loader_mutex);
+            finish_loading_audio_asset(project, audio_asset, audio_file, err);
+            os_mutex_unlock(project->asset_loader_mutex);
+            // let the audio graph add the clip nodes without waiting for peaks
+            project->asset_loader_progress_flag.clear();
+        }
+
+        os_mutex_lock(project->asset_loader_mutex);
+        while (audio_asset->load_state == AudioAssetLoadStateLoading)
+            os_cond_wait(project->asset_loader_cond, project->asset_loader_mutex);
+        GenesisAudioFile *audio_file = audio_asset->audio_file;
+        os_mutex_unlock(project->asset_loader_mutex);
+
+        if (audio_file && !audio_asset->peaks.load())
+            open_audio_asset_peaks(project, audio_asset, audio_file);
+
+        if (!audio_file)
+            project->asset_loader_failed_count += 1;
+        project->asset_loader_done_count += 1;
+        project->asset_loader_progress_flag.clear();
+    }
+}
+
+static void project_stop_asset_loader(Project *project) {
+    if (!project->asset_loader_mutex)
+        return;
+
+    os_mutex_lock(project->asset_loader_mutex);
+    project->asset_loader_stop = true;
+    os_cond_broadcast(project->asset_loader_cond, project->asset_loader_mutex);
+    os_mutex_unlock(project->asset_loader_mutex);
+
+    for (int i = 0; i < project->asset_loader_threads.length(); i += 1)
+        os_thread_destroy(project->asset_loader_threads.at(i));
+    project->asset_loader_threads.clear();
+}
+
+// Queues an asset to be decoded and to have its waveform peaks computed on
+// the loader threads. If the threads could not be started, assets still load
+// lazily through project_audio_asset_file.
+static void project_queue_audio_asset(Project *project, AudioAsset *audio_asset) {
+    OsMutexLocker locker(project->asset_loader_mutex);
+    if (project->asset_loader_queue.append(audio_asset))
+        return;
+    os_cond_broadcast(project->asset_loader_cond, project->asset_loader_mutex);
+}
+
+// Decodes audio assets on a pool of threads so that opening a project takes
+// about as long as its longest asset instead of the sum of all of them. Each
+// decode holds a decoder and one block of samples per channel while it writes
+// into the sample cache, so the thread count bounds the memory the pool uses.
+static void project_start_asset_loader(Project *project) {
+    int thread_count = min(os_concurrency(), ASSET_LOADER_MAX_THREADS);
+    for (int i = 0; i < thread_count; i += 1) {
+        OsThread *thread;
+        if (project->asset_loader_threads.add_one())
+            break;
+        if (os_thread_create(asset_loader_thread_run, project, false, &thread)) {
+            project->asset_loader_threads.pop();
+            break;
+        }
+        project->asset_loader_threads.last() = thread;
+    }
+
+    for (int i = 0; i < project->audio_asset_list.length(); i += 1)
+        project_queue_audio_asset(project, project->audio_asset_list.at(i));
+}
+
+static void project_push_command(Project *project, OrderedMapFileBatch *batch, Command *command) {
+    sorted_list_insert<Command *, compare_commands>(project->command_list, command);
     project->commands.put(command->id, command);
+    project->next_revision = command->revision + 1;
+    ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyNextRevision),
+            omf_buf_uint32(project->next_revision)));
+}
+
+static int add_loaded_command(Project *project, const ByteBuffer &key, const ByteBuffer &value,
+        Command **out_command)
+{
+    Command *command;
+    int err;
+    if ((err = deserialize_command_object(project, key, value, &command)))
+        return err;
+
+    sorted_list_insert<Command *, compare_commands>(project->command_list, command);
+    project->commands.put(command->id, command);
+    *out_command = command;
+    return 0;
+}
+
+static int find_command_read(Project *project, const uint256 &id) {
+    for (int i = 0; i < project->command_reads.length(); i += 1) {
+        if (project->command_reads.at(i)->id == id)
+            return i;
+    }
+    return -1;
+}
+
+// Takes a finished background read out of the list and adds its command.
+static int finish_command_read(Project *project, int read_index, Command **out_command) {
+    CommandRead *read = project->command_reads.swap_remove(read_index);
+    int err = read->result.err;
+    if (err == GenesisErrorKeyNotFound)
+        err = GenesisErrorInvalidFormat;
+    if (!err)
+        err = add_loaded_command(project, read->key, read->value, out_command);
+    destroy(read, 1);
+    return err;
+}
+
+static void destroy_command_reads(Project *project) {
+    for (int i = 0; i < project->command_reads.length(); i += 1)
+        destroy(project->command_reads.at(i), 1);
+    project->command_reads.clear();
+}
+
+// Starts reading the commands which the next undo and redo need, so that
+// neither the menu captions nor the undo or redo itself wait for the disk.
+static void prefetch_undo_commands(Project *project) {
+    for (int i = project->undo_stack_index - 1; i <= project->undo_stack_index; i += 1) {
+        if (i < 0 || i >= project->undo_stack.length())
+            continue;
+        const uint256 &id = project->undo_stack.at(i);
+        if (project->commands.maybe_get(id) || find_command_read(project, id) >= 0)
+            continue;
+
+        CommandRead *read = create_zero<CommandRead>();
+        if (!read)
+            return;
+        read->id = id;
+        OrderedMapFileBuffer *key_buf = create_command_key(id);
+        read->key = ByteBuffer(key_buf->data, key_buf->size);
+        ordered_map_file_buffer_destroy(key_buf);
+        read->result.value = &read->value;
+        if (project->command_reads.append(read)) {
+            destroy(read, 1);
+            return;
+        }
+        // if this fails, project_load_command reads the command when needed
+        if (ordered_map_file_read_async(project->omf, read->key, &read->result)) {
+            project->command_reads.pop();
+            destroy(read, 1);
+        }
+    }
+}
+
+int project_load_command(Project *project, const uint256 &id, Command **out_command) {
+    auto entry = project->commands.maybe_get(id);
+    if (entry) {
+        *out_command = entry->value;
+        return 0;
+    }
+
+    int read_index = find_command_read(project, id);
+    if (read_index >= 0) {
+        ordered_map_file_read_wait(project->omf, &project->command_reads.at(read_index)->result);
+        return finish_command_read(project, read_index, out_command);
+    }
+
+    OrderedMapFileBuffer *key_buf = create_command_key(id);
+    ByteBuffer key(key_buf->data, key_buf->size);
+    ordered_map_file_buffer_destroy(key_buf);
+
+    ByteBuffer value;
+    int err = ordered_map_file_read(project->omf, key, value);
+    if (err == GenesisErrorKeyNotFound)
+        return GenesisErrorInvalidFormat;
+    else if (err)
+        return err;
+
+    return add_loaded_command(project, key, value, out_command);
+}
+
+int project_get_undo_command(Project *project, int undo_stack_index, Command **out_command) {
+    return project_load_command(project, project->undo_stack.at(undo_stack_index), out_command);
+}
+
+int project_peek_undo_command(Project *project, int undo_stack_index, Command **out_command) {
+    const uint256 &id = project->undo_stack.at(undo_stack_index);
+    auto entry = project->commands.maybe_get(id);
+    if (entry) {
+        *out_command = entry->value;
+        return 0;
+    }
+    *out_command = nullptr;
+    int read_index = find_command_read(project, id);
+    if (read_index < 0) {
+        prefetch_undo_commands(project);
+        return 0;
+    }
+    if (!ordered_map_file_read_done(project->omf, &project->command_reads.at(read_index)->result))
+        return 0;
+    return finish_command_read(project, read_index, out_command);
 }
 
 int project_open(GenesisContext *genesis_context, const char *path, User *user,
@@ -1896,11 +2245,17 @@ int project_open(GenesisContext *genesis_context, const char *path, User *user,
         return GenesisErrorNoMem;
     }
 
+    int err;
+    if ((err = project_init_asset_loader(project))) {
+        project_close(project);
+        return err;
+    }
+
     project->genesis_context = genesis_context;
     project->path = path;
     project->active_user = user;
 
-    int err = ordered_map_file_open(path, &project->omf);
+    err = ordered_map_file_open(path, &project->omf);
     if (err) {
         project_close(project);
         return err;
@@ -1947,6 +2302,15 @@ int project_open(GenesisContext *genesis_context, const char *path, User *user,
         return err;
     }
 
+    // files from before tempo maps play at the default tempo
+    err = read_scalar_tempo_map(project, PropKeyTempoMap, &project->tempo_map);
+    if (err == GenesisErrorKeyNotFound)
+        err = tempo_map_set_default(&project->tempo_map);
+    if (err) {
+        project_close(project);
+        return err;
+    }
+
     // read tracks
     err = iterate_prefix(project, PropKeyTrack, deserialize_track);
     if (err) {
@@ -1994,14 +2358,7 @@ int project_open(GenesisContext *genesis_context, const char *path, User *user,
         return err;
     }
 
-    // read command history (depends on users)
-    err = iterate_prefix(project, PropKeyCommand, deserialize_command);
-    if (err) {
-        project_close(project);
-        return err;
-    }
-
-    // read undo stack (depends on command history)
+    // read undo stack
     err = iterate_prefix(project, PropKeyUndoStack, deserialize_undo_stack_item);
     if (err) {
         project_close(project);
@@ -2019,9 +2376,41 @@ int project_open(GenesisContext *genesis_context, const char *path, User *user,
         return GenesisErrorInvalidFormat;
     }
 
-    project_compute_indexes(project);
+    // the objects above are the current state of the project, so the command
+    // history is only needed for undo and redo. read it all only for files
+    // which do not store the next revision.
+    bool read_all_commands = false;
+    err = read_scalar_uint32be_as_int(project, PropKeyNextRevision, &project->next_revision);
+    if (err == GenesisErrorKeyNotFound) {
+        read_all_commands = true;
+        err = iterate_prefix(project, PropKeyCommand, deserialize_command);
+    }
+    if (err) {
+        project_close(project);
+        return err;
+    }
+
+    project_sort_all(project);
+
+    if (read_all_commands && project->command_list.length() > 0)
+        project->next_revision = project->command_list.last()->revision + 1;
+
+    // the commands for the undo and redo menu items (depends on users)
+    for (int i = project->undo_stack_index - 1; i <= project->undo_stack_index; i += 1) {
+        if (i < 0 || i >= project->undo_stack.length())
+            continue;
+        Command *command;
+        if ((err = project_get_undo_command(project, i, &command))) {
+            project_close(project);
+            return err;
+        }
+    }
+
+    project_trigger_list_events(project);
     ordered_map_file_done_reading(project->omf);
 
+    project_start_asset_loader(project);
+
     *out_project = project;
     return 0;
 }
@@ -2065,9 +2454,15 @@ int project_create(GenesisContext *genesis_context, const char *path, const uint
         return GenesisErrorNoMem;
     }
 
+    int err;
+    if ((err = project_init_asset_loader(project))) {
+        project_close(project);
+        return err;
+    }
+
     project->genesis_context = genesis_context;
 
-    int err = ordered_map_file_open(path, &project->omf);
+    err = ordered_map_file_open(path, &project->omf);
     if (err) {
         project_close(project);
         return err;
@@ -2089,7 +2484,7 @@ int project_create(GenesisContext *genesis_context, const char *path, const uint
             omf_buf_uint32(project->undo_stack_index)));
 
     AddTrackCommand *add_track_cmd = project_insert_track_batch(project, batch, nullptr, nullptr);
-    project_push_command(project, add_track_cmd);
+    project_push_command(project, batch, add_track_cmd);
 
     // Add master mixer line.
     MixerLine *mixer_line = mixer_line_create("Master");
@@ -2130,13 +2525,22 @@ int project_create(GenesisContext *genesis_context, const char *path, const uint
     ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyTagYear),
                 omf_buf_uint32(project->tag_year)));
 
+    // Add default tempo
+    ok_or_panic(tempo_map_set_default(&project->tempo_map));
+    ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyTempoMap),
+                omf_buf_tempo_map(&project->tempo_map)));
 
+    // a new project file is complete on disk before anything refers to it
+    batch->durability = OrderedMapFileDurabilitySynced;
     err = ordered_map_file_batch_exec(batch);
     if (err) {
         project_close(project);
         return err;
     }
-    project_compute_indexes(project);
+    project_sort_all(project);
+    project_trigger_list_events(project);
+
+    project_start_asset_loader(project);
 
     *out_project = project;
     return 0;
@@ -2146,7 +2550,23 @@ void project_close(Project *project) {
     if (!project)
         return;
 
+    project_stop_asset_loader(project);
+    os_cond_destroy(project->asset_loader_cond);
+    os_mutex_destroy(project->asset_loader_mutex);
+    // streaming audio files hold on to the context's prefetch pool
+    auto audio_asset_it = project->audio_assets.entry_iterator();
+    for (;;) {
+        auto *entry = audio_asset_it.next();
+        if (!entry)
+            break;
+        AudioAsset *audio_asset = entry->value;
+        genesis_audio_file_destroy(audio_asset->audio_file);
+        audio_asset->audio_file = nullptr;
+        peak_pyramid_destroy(audio_asset->peaks.exchange(nullptr));
+    }
+    // closing waits for the background reads, which fill command_reads
     ordered_map_file_close(project->omf);
+    destroy_command_reads(project);
     for (int i = 0; i < project->command_list.length(); i += 1) {
         Command *cmd = project->command_list.at(i);
         destroy(cmd, 1);
@@ -2182,7 +2602,7 @@ static void add_undo_for_command(Project *project, OrderedMapFileBatch *batch, C
     int this_undo_index = project->undo_stack_index;
     project->undo_stack_index += 1;
     ok_or_panic(project->undo_stack.resize(project->undo_stack_index));
-    project->undo_stack.at(this_undo_index) = command;
+    project->undo_stack.at(this_undo_index) = command->id;
     ok_or_panic(ordered_map_file_batch_put(batch, create_undo_stack_key(this_undo_index), omf_buf_uint256(command->id)));
     ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyUndoStackIndex),
             omf_buf_uint32(project->undo_stack_index)));
@@ -2195,11 +2615,12 @@ static void project_perform_command(Command *command) {
     add_undo_for_command(project, batch, command);
 
     project_perform_command_batch(project, batch, command);
-    project_push_command(project, command);
+    project_push_command(project, batch, command);
     ok_or_panic(ordered_map_file_batch_put(batch, create_command_key(command->id), omf_buf_obj(command)));
 
+    batch->durability = EDIT_DURABILITY;
     ok_or_panic(ordered_map_file_batch_exec(batch));
-    project_compute_indexes(project);
+    project_trigger_list_events(project);
     trigger_undo_changed(project);
 }
 
@@ -2220,12 +2641,13 @@ void project_insert_track(Project *project, const Track *before, const Track *af
     AddTrackCommand *add_track_cmd = project_insert_track_batch(project, batch, before, after);
     add_undo_for_command(project, batch, add_track_cmd);
 
-    project_push_command(project, add_track_cmd);
+    project_push_command(project, batch, add_track_cmd);
 
     ok_or_panic(ordered_map_file_batch_put(batch, create_command_key(add_track_cmd->id), omf_buf_obj((Command *)add_track_cmd)));
 
+    batch->durability = EDIT_DURABILITY;
     ok_or_panic(ordered_map_file_batch_exec(batch));
-    project_compute_indexes(project);
+    project_trigger_list_events(project);
     trigger_undo_changed(project);
 }
 
@@ -2248,13 +2670,68 @@ void project_delete_track(Project *project, Track *track) {
 }
 
 int project_ensure_audio_asset_loaded(Project *project, AudioAsset *audio_asset) {
-    if (audio_asset->audio_file)
+    os_mutex_lock(project->asset_loader_mutex);
+    while (audio_asset->load_state == AudioAssetLoadStateLoading)
+        os_cond_wait(project->asset_loader_cond, project->asset_loader_mutex);
+    if (audio_asset->load_state == AudioAssetLoadStateLoaded) {
+        os_mutex_unlock(project->asset_loader_mutex);
         return 0;
+    }
+    audio_asset->load_state = AudioAssetLoadStateLoading;
+    os_mutex_unlock(project->asset_loader_mutex);
 
-    ByteBuffer project_dir = os_path_dirname(project->path);
-    ByteBuffer full_path;
-    os_path_join(full_path, project_dir, audio_asset->path);
-    return genesis_audio_file_load(project->genesis_context, full_path.raw(), &audio_asset->audio_file);
+    GenesisAudioFile *audio_file = nullptr;
+    int err = open_audio_asset(project, audio_asset, &audio_file);
+
+    os_mutex_lock(project->asset_loader_mutex);
+    finish_loading_audio_asset(project, audio_asset, audio_file, err);
+    os_mutex_unlock(project->asset_loader_mutex);
+    return err;
+}
+
+GenesisAudioFile *project_audio_asset_file(Project *project, AudioAsset *audio_asset) {
+    if (project->asset_loader_threads.length() == 0) {
+        if (project_ensure_audio_asset_loaded(project, audio_asset))
+            return nullptr;
+        return audio_asset->audio_file;
+    }
+    OsMutexLocker locker(project->asset_loader_mutex);
+    if (audio_asset->load_state != AudioAssetLoadStateLoaded)
+        return nullptr;
+    return audio_asset->audio_file;
+}
+
+int project_audio_asset_load_error(Project *project, AudioAsset *audio_asset) {
+    OsMutexLocker locker(project->asset_loader_mutex);
+    if (audio_asset->load_state != AudioAssetLoadStateFailed)
+        return 0;
+    return audio_asset->load_err;
+}
+
+void project_audio_asset_load_progress(Project *project, int *done_count, int *failed_count,
+        int *total_count)
+{
+    *done_count = project->asset_loader_done_count.load();
+    *failed_count = project->asset_loader_failed_count.load();
+    *total_count = project->asset_loader_queue.length();
+}
+
+void project_flush_events(Project *project) {
+    if (!project->asset_loader_progress_flag.test_and_set())
+        trigger_event(project, EventProjectAudioAssetsLoadProgress);
+
+    bool command_loaded = false;
+    for (int i = project->command_reads.length() - 1; i >= 0; i -= 1) {
+        if (!ordered_map_file_read_done(project->omf, &project->command_reads.at(i)->result))
+            continue;
+        // a failed read is dropped; the undo or redo which needs the command
+        // reads it again and reports the error
+        Command *command;
+        if (!finish_command_read(project, i, &command))
+            command_loaded = true;
+    }
+    if (command_loaded)
+        trigger_undo_changed(project);
 }
 
 int project_add_audio_asset(Project *project, const ByteBuffer &full_path, AudioAsset **out_audio_asset) {
@@ -2296,16 +2773,19 @@ int project_add_audio_asset(Project *project, const ByteBuffer &full_path, Audio
     audio_asset->sha256sum = digest;
 
     project_put_audio_asset(project, audio_asset);
+    sorted_list_insert<AudioAsset *, compare_audio_assets>(project->audio_asset_list, audio_asset);
 
     // add to project file
     OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(project->omf));
     ok_or_panic(ordered_map_file_batch_put(batch, create_id_key(PropKeyAudioAsset, audio_asset->id), omf_buf_obj(audio_asset)));
+    batch->durability = EDIT_DURABILITY;
     if ((err = ordered_map_file_batch_exec(batch))) {
         destroy(audio_asset, 1);
         os_delete(full_dest_asset_path.raw());
         return err;
     }
-    project_compute_indexes(project);
+    project_trigger_list_events(project);
+    project_queue_audio_asset(project, audio_asset);
 
     *out_audio_asset = audio_asset;
     return 0;
@@ -2324,14 +2804,16 @@ void project_add_audio_clip_segment(Project *project, AudioClip *audio_clip, Tra
 }
 
 long project_audio_clip_frame_count(Project *project, AudioClip *audio_clip) {
-    ok_or_panic(project_ensure_audio_asset_loaded(project, audio_clip->audio_asset));
-    GenesisAudioFile *audio_file = audio_clip->audio_asset->audio_file;
+    GenesisAudioFile *audio_file = project_audio_asset_file(project, audio_clip->audio_asset);
+    if (!audio_file)
+        return -1;
     return genesis_audio_file_frame_count(audio_file);
 }
 
 int project_audio_clip_sample_rate(Project *project, AudioClip *audio_clip) {
-    ok_or_panic(project_ensure_audio_asset_loaded(project, audio_clip->audio_asset));
-    GenesisAudioFile *audio_file = audio_clip->audio_asset->audio_file;
+    GenesisAudioFile *audio_file = project_audio_asset_file(project, audio_clip->audio_asset);
+    if (!audio_file)
+        return -1;
     return genesis_audio_file_sample_rate(audio_file);
 }
 
@@ -2348,48 +2830,60 @@ void user_destroy(User *user) {
     destroy(user, 1);
 }
 
-void project_undo(Project *project) {
+int project_undo(Project *project) {
     assert(project->undo_stack_index > 0);
     int this_cmd_index = project->undo_stack_index - 1;
 
-    OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(project->omf));
+    Command *other_command;
+    int err;
+    if ((err = project_get_undo_command(project, this_cmd_index, &other_command)))
+        return err;
 
-    Command *other_command = project->undo_stack.at(this_cmd_index);
+    OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(project->omf));
     UndoCommand *undo = create<UndoCommand>(project, other_command);
     project_perform_command_batch(project, batch, undo);
 
-    project_push_command(project, undo);
+    project_push_command(project, batch, undo);
     ok_or_panic(ordered_map_file_batch_put(batch, create_command_key(undo->id), omf_buf_obj((Command *)undo)));
 
     project->undo_stack_index -= 1;
     ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyUndoStackIndex),
             omf_buf_uint32(project->undo_stack_index)));
 
+    batch->durability = EDIT_DURABILITY;
     ok_or_panic(ordered_map_file_batch_exec(batch));
-    project_compute_indexes(project);
+    prefetch_undo_commands(project);
+    project_trigger_list_events(project);
     trigger_undo_changed(project);
+    return 0;
 }
 
-void project_redo(Project *project) {
+int project_redo(Project *project) {
     assert(project->undo_stack_index < project->undo_stack.length());
     int this_cmd_index = project->undo_stack_index;
 
-    OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(project->omf));
+    Command *other_command;
+    int err;
+    if ((err = project_get_undo_command(project, this_cmd_index, &other_command)))
+        return err;
 
-    Command *other_command = project->undo_stack.at(this_cmd_index);
+    OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(project->omf));
     RedoCommand *redo = create<RedoCommand>(project, other_command);
     project_perform_command_batch(project, batch, redo);
 
-    project_push_command(project, redo);
+    project_push_command(project, batch, redo);
     ok_or_panic(ordered_map_file_batch_put(batch, create_command_key(redo->id), omf_buf_obj((Command *)redo)));
 
     project->undo_stack_index += 1;
     ok_or_panic(ordered_map_file_batch_put(batch, create_basic_key(PropKeyUndoStackIndex),
             omf_buf_uint32(project->undo_stack_index)));
 
+    batch->durability = EDIT_DURABILITY;
     ok_or_panic(ordered_map_file_batch_exec(batch));
-    project_compute_indexes(project);
+    prefetch_undo_commands(project);
+    project_trigger_list_events(project);
     trigger_undo_changed(project);
+    return 0;
 }
 
 void project_get_effect_string(Project *project, Effect *effect, String &out) {
@@ -2423,12 +2917,8 @@ void project_set_channel_layout(Project *project, const SoundIoChannelLayout *la
     project_perform_command(cmd);
 }
 
-// When you finally get around to genericizing this code, take a peek at
-// whole_notes_per_second at the top of genesis.cpp
-static const double whole_notes_per_second = 140.0 / 60.0;
-
 static double project_whole_notes_to_seconds(Project *project, double whole_notes) {
-    return whole_notes / whole_notes_per_second;
+    return tempo_map_whole_notes_to_seconds(&project->tempo_map, whole_notes, nullptr);
 }
 
 static long project_whole_notes_to_frames(Project *project, double whole_notes) {
@@ -2437,7 +2927,7 @@ static long project_whole_notes_to_frames(Project *project, double whole_notes)
 
 static double project_frames_to_whole_notes(Project *project, long frames) {
     double seconds = frames / (double)project->sample_rate;
-    return whole_notes_per_second * seconds;
+    return tempo_map_seconds_to_whole_notes(&project->tempo_map, seconds, nullptr);
 }
 
 double project_get_duration_whole_notes(Project *project) {
@@ -2446,8 +2936,8 @@ double project_get_duration_whole_notes(Project *project) {
         Track *track = project->track_list.at(track_i);
         AudioClipSegment *last_segment = track->audio_clip_segments.last();
         long duration_frames = last_segment->end - last_segment->start;
-        double duration_whole_notes = project_frames_to_whole_notes(project, duration_frames);
-        double end_pos = last_segment->pos + duration_whole_notes;
+        long start_frame = project_whole_notes_to_frames(project, last_segment->pos);
+        double end_pos = project_frames_to_whole_notes(project, start_frame + duration_frames);
         last_pos = max(last_pos, end_pos);
     }
     return last_pos;
@@ -2470,6 +2960,7 @@ void AddTrackCommand::undo(OrderedMapFileBatch *batch) {
 
     assert(track->audio_clip_segments.length() == 0);
 
+    sorted_list_remove<Track *, compare_tracks>(project->track_list, track);
     project->tracks.remove(track_id);
     project->track_list_dirty = true;
 
@@ -2484,6 +2975,7 @@ void AddTrackCommand::redo(OrderedMapFileBatch *batch) {
     track->name = name;
     track->sort_key = sort_key;
     project->tracks.put(track->id, track);
+    sorted_list_insert<Track *, compare_tracks>(project->track_list, track);
     project->track_list_dirty = true;
 
     ok_or_panic(ordered_map_file_batch_put(batch, create_track_key(track_id), omf_buf_obj(track)));
@@ -2493,7 +2985,7 @@ void AddTrackCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int AddTrackCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int AddTrackCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2506,6 +2998,7 @@ DeleteTrackCommand::DeleteTrackCommand(Project *project, Track *track) :
 
 void DeleteTrackCommand::undo(OrderedMapFileBatch *batch) {
     ok_or_panic(deserialize_track_decoded_key(project, track_id, payload));
+    sorted_list_insert<Track *, compare_tracks>(project->track_list, project->tracks.get(track_id));
     ok_or_panic(ordered_map_file_batch_put(batch, create_track_key(track_id), omf_buf_byte_buffer(payload)));
 }
 
@@ -2514,6 +3007,7 @@ void DeleteTrackCommand::redo(OrderedMapFileBatch *batch) {
 
     assert(track->audio_clip_segments.length() == 0);
 
+    sorted_list_remove<Track *, compare_tracks>(project->track_list, track);
     project->tracks.remove(track_id);
     project->track_list_dirty = true;
 
@@ -2525,7 +3019,7 @@ void DeleteTrackCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int DeleteTrackCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int DeleteTrackCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2540,6 +3034,7 @@ AddAudioClipCommand::AddAudioClipCommand(Project *project, AudioAsset *audio_ass
 void AddAudioClipCommand::undo(OrderedMapFileBatch *batch) {
     AudioClip *audio_clip = project->audio_clips.get(audio_clip_id);
 
+    sorted_list_remove<AudioClip *, compare_audio_clips>(project->audio_clip_list, audio_clip);
     project->audio_clips.remove(audio_clip_id);
     project->audio_clip_list_dirty = true;
 
@@ -2550,7 +3045,6 @@ void AddAudioClipCommand::undo(OrderedMapFileBatch *batch) {
 
 void AddAudioClipCommand::redo(OrderedMapFileBatch *batch) {
     AudioAsset *audio_asset = project->audio_assets.get(audio_asset_id);
-    ok_or_panic(project_ensure_audio_asset_loaded(project, audio_asset));
 
     AudioClip *audio_clip = ok_mem(create_zero<AudioClip>());
     audio_clip->id = audio_clip_id;
@@ -2559,6 +3053,7 @@ void AddAudioClipCommand::redo(OrderedMapFileBatch *batch) {
     audio_clip->audio_asset = audio_asset;
 
     project->audio_clips.put(audio_clip->id, audio_clip);
+    sorted_list_insert<AudioClip *, compare_audio_clips>(project->audio_clip_list, audio_clip);
     project->audio_clip_list_dirty = true;
 
     ok_or_panic(ordered_map_file_batch_put(batch,
@@ -2569,7 +3064,7 @@ void AddAudioClipCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int AddAudioClipCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int AddAudioClipCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2588,6 +3083,8 @@ AddAudioClipSegmentCommand::AddAudioClipSegmentCommand(Project *project,
 void AddAudioClipSegmentCommand::undo(OrderedMapFileBatch *batch) {
     AudioClipSegment *audio_clip_segment = project->audio_clip_segments.get(audio_clip_segment_id);
 
+    sorted_list_remove<AudioClipSegment *, compare_audio_clip_segments>(
+            audio_clip_segment->track->audio_clip_segments, audio_clip_segment);
     project->audio_clip_segments.remove(audio_clip_segment_id);
     project->audio_clip_segments_dirty = true;
 
@@ -2608,6 +3105,8 @@ void AddAudioClipSegmentCommand::redo(OrderedMapFileBatch *batch) {
     audio_clip_segment->audio_clip = project->audio_clips.get(audio_clip_id);
 
     project->audio_clip_segments.put(audio_clip_segment->id, audio_clip_segment);
+    sorted_list_insert<AudioClipSegment *, compare_audio_clip_segments>(
+            audio_clip_segment->track->audio_clip_segments, audio_clip_segment);
     project->audio_clip_segments_dirty = true;
 
     ok_or_panic(ordered_map_file_batch_put(batch,
@@ -2618,7 +3117,7 @@ void AddAudioClipSegmentCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int AddAudioClipSegmentCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int AddAudioClipSegmentCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2647,7 +3146,7 @@ void ChangeSampleRateCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int ChangeSampleRateCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int ChangeSampleRateCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2677,7 +3176,7 @@ void ChangeChannelLayoutCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int ChangeChannelLayoutCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int ChangeChannelLayoutCommand::deserialize(const ByteView &buffer, int *offset) {
     return deserialize_object(this, buffer, offset);
 }
 
@@ -2700,17 +3199,11 @@ void UndoCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int UndoCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int UndoCommand::deserialize(const ByteView &buffer, int *offset) {
     int err;
     if ((err = deserialize_object(this, buffer, offset))) return err;
 
-    auto entry = project->commands.maybe_get(other_command_id);
-    if (!entry)
-        return GenesisErrorInvalidFormat;
-
-    other_command = entry->value;
-
-    return 0;
+    return project_load_command(project, other_command_id, &other_command);
 }
 
 
@@ -2733,15 +3226,9 @@ void RedoCommand::serialize(ByteBuffer &buf) {
     serialize_object(this, buf);
 }
 
-int RedoCommand::deserialize(const ByteBuffer &buffer, int *offset) {
+int RedoCommand::deserialize(const ByteView &buffer, int *offset) {
     int err;
     if ((err = deserialize_object(this, buffer, offset))) return err;
 
-    auto entry = project->commands.maybe_get(other_command_id);
-    if (!entry)
-        return GenesisErrorInvalidFormat;
-
-    other_command = entry->value;
-
-    return 0;
+    return project_load_command(project, other_command_id, &other_command);
 }
@@ -8,11 +8,22 @@
 #include "ordered_map_file.hpp"
 #include "event_dispatcher.hpp"
 #include "device_id.hpp"
+#include "os.hpp"
+#include "atomics.hpp"
+#include "peak_pyramid.hpp"
+#include "tempo_map.hpp"
 
 class Command;
 struct AudioClipSegment;
 struct Project;
 
+enum AudioAssetLoadState {
+    AudioAssetLoadStateUnloaded,
+    AudioAssetLoadStateLoading,
+    AudioAssetLoadStateLoaded,
+    AudioAssetLoadStateFailed,
+};
+
 struct AudioAsset {
     // canonical data
     uint256 id;
@@ -21,6 +32,14 @@ struct AudioAsset {
 
     // prepared view of data
     GenesisAudioFile *audio_file;
+
+    // transient data, protected by Project::asset_loader_mutex
+    AudioAssetLoadState load_state;
+    // why the last load failed, while load_state is AudioAssetLoadStateFailed
+    int load_err;
+    // set by the asset loader once the waveform peaks are ready. stays null
+    // if they can not be computed, such as for a streaming audio file.
+    std::atomic<PeakPyramid *> peaks;
 };
 
 struct AudioClip {
@@ -117,6 +136,13 @@ struct PlayChannelContext {
     long offset;
 };
 
+struct CommandRead {
+    uint256 id;
+    ByteBuffer key;
+    ByteBuffer value;
+    OrderedMapFileReadResult result;
+};
+
 struct Project {
     /////////// canonical data, shared among all users
     uint256 id;
@@ -135,18 +161,25 @@ struct Project {
     String tag_album_artist;
     String tag_album;
     int tag_year;
+    TempoMap tempo_map;
     // this represents the true history of the project. you can create the
     // entire project data structure just from this data
     // this grows forever and never shrinks
+    // only the commands loaded so far: opening a project reads the current
+    // state of the objects above and the commands next to undo_stack_index.
+    // project_load_command reads the others from the file when needed.
     IdMap<Command *> commands;
+    int next_revision;
 
     ///////////// state which is specific to this file, not shared among users
-    // this is a subset of command_stack. it points to commands that are in
-    // active_user's undo stack
-    List<Command *> undo_stack;
+    // ids of the commands in active_user's undo stack
+    List<uint256> undo_stack;
     int undo_stack_index;
 
     /////////////// prepared view of the data
+    // sorted when the project is loaded and kept sorted by each edit. the
+    // _dirty flags mean listeners have not been told about a change yet.
+    // command_list holds the loaded commands only.
     List<Track *> track_list;
     bool track_list_dirty;
 
@@ -175,6 +208,24 @@ struct Project {
     OrderedMapFile *omf;
     EventDispatcher events;
     ByteBuffer path; // path to the project file
+    // commands next to undo_stack_index which the ordered map file's write
+    // thread is reading in the background, started after each undo and redo
+    List<CommandRead *> command_reads;
+
+    // decodes audio assets and computes their waveform peaks in the
+    // background. assets are appended to asset_loader_queue when the project
+    // is opened and when they are added; the threads wait for more until the
+    // project is closed. asset_loader_queue is only appended to by the GUI
+    // thread.
+    OsMutex *asset_loader_mutex;
+    OsCond *asset_loader_cond;
+    List<OsThread *> asset_loader_threads;
+    List<AudioAsset *> asset_loader_queue;
+    int asset_loader_next_index;
+    bool asset_loader_stop;
+    atomic_int asset_loader_done_count;
+    atomic_int asset_loader_failed_count;
+    atomic_flag asset_loader_progress_flag;
 };
 
 int project_get_next_revision(Project *project);
@@ -207,7 +258,7 @@ public:
     virtual String description() const = 0;
     virtual int allocated_size() const = 0;
     virtual void serialize(ByteBuffer &buf) = 0;
-    virtual int deserialize(const ByteBuffer &buf, int *offset) = 0;
+    virtual int deserialize(const ByteView &buf, int *offset) = 0;
     virtual CommandType command_type() const = 0;
 
     // serialized
@@ -236,7 +287,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeAddTrack; }
 
     uint256 track_id;
@@ -260,7 +311,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeDeleteTrack; }
 
     uint256 track_id;
@@ -283,7 +334,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeAddAudioClip; }
 
     uint256 audio_clip_id;
@@ -308,7 +359,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeAddAudioClipSegment; }
 
     uint256 audio_clip_segment_id;
@@ -338,7 +389,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeChangeSampleRate; }
 
     int old_sample_rate;
@@ -364,7 +415,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeChangeChannelLayout; }
 
     SoundIoChannelLayout old_layout;
@@ -387,7 +438,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeUndo; }
 
     // serialized state
@@ -413,7 +464,7 @@ public:
     void undo(OrderedMapFileBatch *batch) override;
     void redo(OrderedMapFileBatch *batch) override;
     void serialize(ByteBuffer &buf) override;
-    int deserialize(const ByteBuffer &buf, int *offset) override;
+    int deserialize(const ByteView &buf, int *offset) override;
     CommandType command_type() const override { return CommandTypeRedo; }
 
     // serialized state
@@ -432,8 +483,19 @@ int project_create(GenesisContext *genesis_context, const char *path, const uint
         User *user, Project **out_project);
 void project_close(Project *project);
 
-void project_undo(Project *project);
-void project_redo(Project *project);
+// Both read the command to undo or redo from the project file if the
+// background read started by the previous undo or redo has not finished,
+// and return the error if that fails.
+int project_undo(Project *project);
+int project_redo(Project *project);
+
+// Returns the command with this id, reading it from the project file if it
+// is not loaded yet.
+int project_load_command(Project *project, const uint256 &id, Command **out_command);
+int project_get_undo_command(Project *project, int undo_stack_index, Command **out_command);
+// Like project_get_undo_command but never blocks: sets out_command to nullptr
+// while the command is still being read in the background.
+int project_peek_undo_command(Project *project, int undo_stack_index, Command **out_command);
 
 void project_perform_command(Project *project, Command *command);
 void project_perform_command_batch(Project *project, OrderedMapFileBatch *batch, Command *command);
@@ -449,7 +511,29 @@ void project_add_audio_clip(Project *project, AudioAsset *audio_asset);
 void project_add_audio_clip_segment(Project *project, AudioClip *audio_clip, Track *track,
         long start, long end, double pos);
 
+// Returns immediately if the asset is loaded. If a background loader thread
+// is decoding it, waits for that to finish; otherwise loads it on this thread,
+// which tries again if an earlier load failed.
 int project_ensure_audio_asset_loaded(Project *project, AudioAsset *audio_asset);
+// Returns the asset's audio file without waiting, or nullptr while it is still
+// queued or loading or if it failed to load. When it finishes loading or
+// fails, EventProjectAudioAssetsLoadProgress fires. Without loader threads it
+// loads the asset on this thread instead, trying again on each call.
+GenesisAudioFile *project_audio_asset_file(Project *project, AudioAsset *audio_asset);
+// Why the asset failed to load, or 0 if it has not failed. A failed asset
+// stays failed until project_ensure_audio_asset_loaded loads it.
+int project_audio_asset_load_error(Project *project, AudioAsset *audio_asset);
+// How many of the audio assets queued for background loading are done and
+// how many of those failed to load.
+// EventProjectAudioAssetsLoadProgress fires when this changes and when an
+// asset finishes loading, before its peaks are ready.
+void project_audio_asset_load_progress(Project *project, int *done_count, int *failed_count,
+        int *total_count);
+// Triggers events which were caused by background threads, and
+// EventProjectUndoChanged once a background command read finishes. Call
+// from the GUI thread.
+void project_flush_events(Project *project);
+// Both return -1 until the clip's asset has loaded. See project_audio_asset_file.
 long project_audio_clip_frame_count(Project *project, AudioClip *audio_clip);
 int project_audio_clip_sample_rate(Project *project, AudioClip *audio_clip);
 
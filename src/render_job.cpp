@@ -4,11 +4,20 @@
 #include "audio_graph.hpp"
 #include "gui.hpp"
 
+static bool render_job_all_done(RenderJob *rj) {
+    for (int i = 0; i < rj->audio_graphs.length(); i += 1) {
+        AudioGraph *ag = rj->audio_graphs.at(i);
+        if (ag->render_frame_index != ag->render_frame_count)
+            return false;
+    }
+    return true;
+}
+
 static void on_render_job_updated(Event, void *userdata) {
     RenderJob *rj = (RenderJob *)userdata;
     assert(rj);
 
-    if (rj->audio_graph->render_frame_index == rj->audio_graph->render_frame_count) {
+    if (render_job_all_done(rj)) {
         rj->is_complete = true;
         render_job_stop(rj);
     }
@@ -19,7 +28,6 @@ static void on_render_job_updated(Event, void *userdata) {
 void render_job_init(RenderJob *rj, Project *project, GenesisContext *genesis_context, Gui *gui) {
     assert(rj);
     rj->project = project;
-    rj->audio_graph = nullptr;
     rj->genesis_context = genesis_context;
     rj->gui = gui;
     rj->is_complete = false;
@@ -30,29 +38,42 @@ void render_job_deinit(RenderJob *rj) {
     render_job_stop(rj);
 }
 
-void render_job_start(RenderJob *rj, const GenesisExportFormat *export_format,
-        const ByteBuffer &out_path)
-{
+// Every output shares one render pass.
+int render_job_start(RenderJob *rj, const RenderOutput *outputs, int output_count) {
     assert(rj);
-    audio_graph_create_render(rj->project, rj->genesis_context, export_format, out_path,
-            &rj->audio_graph);
-
-    rj->audio_graph->events.attach_handler(EventAudioGraphPlayHeadChanged, on_render_job_updated, rj);
+    int err;
+    AudioGraph *audio_graph;
+    if ((err = audio_graph_create_render(rj->project, rj->genesis_context,
+                    outputs, output_count, &audio_graph)))
+    {
+        return err;
+    }
+    if ((err = rj->audio_graphs.append(audio_graph))) {
+        audio_graph_destroy(audio_graph);
+        return err;
+    }
+    audio_graph->events.attach_handler(EventAudioGraphPlayHeadChanged, on_render_job_updated, rj);
 
-    audio_graph_start_pipeline(rj->audio_graph);
+    audio_graph_start_pipeline(audio_graph);
+    return 0;
 }
 
 void render_job_stop(RenderJob *rj) {
     assert(rj);
-    audio_graph_destroy(rj->audio_graph);
-    rj->audio_graph = nullptr;
+    while (rj->audio_graphs.length())
+        audio_graph_destroy(rj->audio_graphs.pop());
 }
 
 float render_job_progress(RenderJob *rj) {
     assert(rj);
-    assert(rj->audio_graph);
-    double nominator = rj->audio_graph->render_frame_index;
-    double denominator = rj->audio_graph->render_frame_count;
+    assert(rj->audio_graphs.length());
+    double nominator = 0.0;
+    double denominator = 0.0;
+    for (int i = 0; i < rj->audio_graphs.length(); i += 1) {
+        AudioGraph *ag = rj->audio_graphs.at(i);
+        nominator += ag->render_frame_index;
+        denominator += ag->render_frame_count;
+    }
     return nominator / denominator;
 }
 
@@ -62,6 +83,6 @@ bool render_job_is_complete(RenderJob *rj) {
 }
 
 void render_job_flush_events(RenderJob *rj) {
-    if (rj->audio_graph)
-        audio_graph_flush_events(rj->audio_graph);
+    for (int i = 0; i < rj->audio_graphs.length(); i += 1)
+        audio_graph_flush_events(rj->audio_graphs.at(i));
 }
@@ -1,14 +1,19 @@
 #ifndef GENESIS_RENDER_JOB
 #define GENESIS_RENDER_JOB
 
+#include "list.hpp"
+
 struct Project;
 struct AudioGraph;
 struct GenesisContext;
+struct RenderOutput;
 class Gui;
 
 struct RenderJob {
     Project *project;
-    AudioGraph *audio_graph;
+    // one render pass per distinct output sample rate, running at the same
+    // time. each pass encodes to all of the outputs at its rate.
+    List<AudioGraph *> audio_graphs;
     GenesisContext *genesis_context;
     Gui *gui;
     bool is_complete;
@@ -17,7 +22,7 @@ struct RenderJob {
 void render_job_init(RenderJob *rj, Project *project, GenesisContext *genesis_context, Gui *gui);
 void render_job_deinit(RenderJob *rj);
 
-void render_job_start(RenderJob *rj, const GenesisExportFormat *export_format, const ByteBuffer &out_path);
+int render_job_start(RenderJob *rj, const RenderOutput *outputs, int output_count);
 float render_job_progress(RenderJob *rj);
 
 void render_job_stop(RenderJob *rj);
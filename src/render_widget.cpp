@@ -6,6 +6,7 @@
 #include "button_widget.hpp"
 #include "settings_file.hpp"
 #include "render_job.hpp"
+#include "audio_graph.hpp"
 
 static void on_selected_output_format_change(Event, void *userdata) {
     RenderWidget *render_widget = (RenderWidget*)userdata;
@@ -260,14 +261,18 @@ void RenderWidget::my_on_render_activate() {
         bit_rate = 0;
     }
 
-    GenesisExportFormat export_format;
-    export_format.codec = codec;
-    export_format.sample_format = sample_format;
-    export_format.bit_rate = bit_rate;
-    export_format.sample_rate = project->sample_rate;
-
-    ByteBuffer out_path = output_file_text->text().encode();
-    render_job_start(rj, &export_format, out_path);
+    RenderOutput output;
+    output.export_format.codec = codec;
+    output.export_format.sample_format = sample_format;
+    output.export_format.bit_rate = bit_rate;
+    output.export_format.sample_rate = project->sample_rate;
+    output.out_path = output_file_text->text().encode();
+
+    int err;
+    if ((err = render_job_start(rj, &output, 1))) {
+        fprintf(stderr, "unable to start render: %s\n", genesis_strerror(err));
+        gui->remove_render_job(rj);
+    }
 }
 
 void RenderWidget::refresh_render_jobs() {
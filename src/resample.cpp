@@ -2,27 +2,89 @@
 #include "audio_file.hpp"
 #include "util.hpp"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RESAMPLE_X86
+#include <immintrin.h>
+#define TARGET_SSE __attribute__((target("sse")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
 static const double PI = 3.14159265358979323846;
-static const double transition_band_hz = 800.0;
+// indexed by GenesisResampleQuality. a narrower transition band means
+// a longer filter.
+static const double transition_band_hz[] = {
+    3000.0,
+    800.0,
+    200.0,
+};
 
 static const double lfe_mix_level = 1.0;
 static const double surround_mix_level = 1.0;
 
-struct ResampleContext {
-    bool in_connected;
-    bool out_connected;
+// taps per phase are rounded up to this so the dot product has no tail
+static const int TAP_ALIGNMENT = 8;
+// number of input frames remapped and filtered at a time
+static const int CHUNK_FRAME_COUNT = 1024;
+
+enum RemapMode {
+    RemapModeIdentity,
+    RemapModeMonoToStereo,
+    RemapModeStereoToMono,
+    // any other matrix; only the nonzero entries are stored
+    RemapModeSparse,
+};
+
+struct RemapTerm {
+    int in_channel;
+    float gain;
+};
 
-    long over_offset;
+// Polyphase filter bank built from the windowed-sinc impulse response.
+// Row p holds the taps of phase p in reverse, so that they line up with
+// consecutive input frames. Rows are zero padded at the start.
+// Shared read-only by all resample nodes of a GenesisContext with the same
+// rates and quality; owned by GenesisContext::resample_filters.
+struct ResampleFilter {
+    int in_sample_rate;
+    int out_sample_rate;
+    GenesisResampleQuality quality;
 
     long upsample_factor;
     long downsample_factor;
+    float *phase_table;
+    int phase_table_size;
+    int taps_per_phase;
+    int half_window_size;
+};
 
-    float *impulse_response;
-    int impulse_response_size;
+struct ResampleContext {
+    bool in_connected;
+    bool out_connected;
 
-    long oversampled_rate;
+    // nullptr when the sample rates match
+    const ResampleFilter *filter;
+
+    // Input frames already converted to the output channel layout, one
+    // plane of frame_buf_capacity samples per output channel. Holds the
+    // history the filter still needs plus the frames read ahead.
+    float *frame_buf;
+    int frame_buf_size;
+    int frame_buf_capacity;
+    int frame_buf_count;
+    // Position of the next output frame in oversampled coordinates relative
+    // to frame_buf frame 0, offset by half_window_size so that
+    // filter_pos / upsample_factor is the newest input frame it uses and
+    // filter_pos % upsample_factor is its phase.
+    long filter_pos;
 
     float channel_matrix[GENESIS_CHANNEL_ID_COUNT][GENESIS_CHANNEL_ID_COUNT];
+
+    // channel_matrix compiled for remap_frames
+    int remap_mode; // see enum RemapMode
+    int in_channel_count;
+    int out_channel_count;
+    int remap_term_count[GENESIS_MAX_CHANNELS];
+    RemapTerm remap_terms[GENESIS_MAX_CHANNELS][GENESIS_MAX_CHANNELS];
 };
 
 static double sinc(double x) {
@@ -35,12 +97,98 @@ static double blackman_window(double n, double size) {
         0.08 * cos(4.0 * PI * n / (size - 1.0));
 }
 
+// count is a multiple of TAP_ALIGNMENT
+typedef float DotProductFn(const float *a, const float *b, int count);
+
+static float dot_product_scalar(const float *a, const float *b, int count) {
+    float sum = 0.0f;
+    for (int i = 0; i < count; i += 1)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#if defined(RESAMPLE_X86)
+
+TARGET_SSE static float dot_product_sse(const float *a, const float *b, int count) {
+    __m128 sum_4 = _mm_setzero_ps();
+    for (int i = 0; i < count; i += 4)
+        sum_4 = _mm_add_ps(sum_4, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum_4);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+TARGET_AVX static float dot_product_avx(const float *a, const float *b, int count) {
+    __m256 sum_v = _mm256_setzero_ps();
+    for (int i = 0; i < count; i += 8)
+        sum_v = _mm256_add_ps(sum_v, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    __m128 sum_4 = _mm_add_ps(_mm256_castps256_ps128(sum_v), _mm256_extractf128_ps(sum_v, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum_4);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+#endif
+
+static DotProductFn *dot_product = dot_product_scalar;
+static ResampleIsa current_isa = ResampleIsaScalar;
+static bool resample_initialized = false;
+
+static bool cpu_supports(ResampleIsa isa) {
+    switch (isa) {
+        case ResampleIsaScalar:
+            return true;
+#if defined(RESAMPLE_X86)
+        case ResampleIsaSse:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse");
+        case ResampleIsaAvx:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx");
+#else
+        case ResampleIsaSse:
+        case ResampleIsaAvx:
+            return false;
+#endif
+    }
+    panic("invalid isa");
+}
+
+bool resample_select(ResampleIsa isa) {
+    if (!cpu_supports(isa))
+        return false;
+
+    DotProductFn *fn = dot_product_scalar;
+#if defined(RESAMPLE_X86)
+    if (isa == ResampleIsaSse)
+        fn = dot_product_sse;
+    else if (isa == ResampleIsaAvx)
+        fn = dot_product_avx;
+#endif
+
+    dot_product = fn;
+    current_isa = isa;
+    resample_initialized = true;
+    return true;
+}
+
+void resample_init(void) {
+    if (resample_initialized)
+        return;
+    if (resample_select(ResampleIsaAvx))
+        return;
+    if (resample_select(ResampleIsaSse))
+        return;
+    resample_select(ResampleIsaScalar);
+}
+
+ResampleIsa resample_isa(void) {
+    return current_isa;
+}
+
 static void resample_destroy(struct GenesisNode *node) {
     struct ResampleContext *resample_context = (struct ResampleContext *)node->userdata;
-    if (resample_context) {
-        destroy(resample_context->impulse_response, resample_context->impulse_response_size);
-        destroy(resample_context, 1);
-    }
+    resample_stream_destroy(resample_context);
 }
 
 static int resample_create(struct GenesisNode *node) {
@@ -53,22 +201,193 @@ static int resample_create(struct GenesisNode *node) {
     return 0;
 }
 
+// Start over with silence as the filter history, and the first output frame
+// centered on the next input frame.
+static void reset_filter_state(ResampleContext *resample_context) {
+    const ResampleFilter *filter = resample_context->filter;
+    if (!filter)
+        return;
+    int history_count = filter->taps_per_phase - 1;
+    memset(resample_context->frame_buf, 0, resample_context->frame_buf_size * sizeof(float));
+    resample_context->frame_buf_count = history_count;
+    resample_context->filter_pos = history_count * filter->upsample_factor + filter->half_window_size;
+}
+
 static void resample_seek(struct GenesisNode *node) {
     struct ResampleContext *resample_context = (struct ResampleContext *)node->userdata;
-    resample_context->over_offset = 0;
+    reset_filter_state(resample_context);
 }
 
-static float get_channel_value(float *samples, ResampleContext *resample_context,
-        const struct SoundIoChannelLayout *in_layout,
-        const struct SoundIoChannelLayout *out_layout,
-        int in_frame_index, int out_channel_index)
+// Converts frame_count interleaved input frames to the output channel layout.
+// Output sample ch of frame i goes to out[i * frame_stride + ch * channel_stride],
+// which covers both interleaved and planar output.
+static void remap_frames(const ResampleContext *resample_context, const float *in, int frame_count,
+        float *out, int frame_stride, int channel_stride)
 {
-    float sum = 0.0f;
-    for (int in_ch = 0; in_ch < in_layout->channel_count; in_ch += 1) {
-        float in_sample = samples[in_frame_index * in_layout->channel_count + in_ch];
-        sum += resample_context->channel_matrix[out_channel_index][in_ch] * in_sample;
+    int in_channel_count = resample_context->in_channel_count;
+    int out_channel_count = resample_context->out_channel_count;
+    switch ((RemapMode)resample_context->remap_mode) {
+        case RemapModeIdentity:
+            if (frame_stride == out_channel_count && channel_stride == 1) {
+                memcpy(out, in, frame_count * out_channel_count * sizeof(float));
+                return;
+            }
+            for (int frame = 0; frame < frame_count; frame += 1) {
+                for (int ch = 0; ch < out_channel_count; ch += 1)
+                    out[frame * frame_stride + ch * channel_stride] = in[frame * in_channel_count + ch];
+            }
+            return;
+        case RemapModeMonoToStereo:
+            {
+                float left_gain = resample_context->remap_terms[0][0].gain;
+                float right_gain = resample_context->remap_terms[1][0].gain;
+                for (int frame = 0; frame < frame_count; frame += 1) {
+                    out[frame * frame_stride] = left_gain * in[frame];
+                    out[frame * frame_stride + channel_stride] = right_gain * in[frame];
+                }
+                return;
+            }
+        case RemapModeStereoToMono:
+            {
+                const RemapTerm *terms = resample_context->remap_terms[0];
+                for (int frame = 0; frame < frame_count; frame += 1) {
+                    out[frame * frame_stride] = terms[0].gain * in[frame * 2 + terms[0].in_channel] +
+                        terms[1].gain * in[frame * 2 + terms[1].in_channel];
+                }
+                return;
+            }
+        case RemapModeSparse:
+            for (int frame = 0; frame < frame_count; frame += 1) {
+                const float *in_frame = &in[frame * in_channel_count];
+                for (int ch = 0; ch < out_channel_count; ch += 1) {
+                    const RemapTerm *terms = resample_context->remap_terms[ch];
+                    float sum = 0.0f;
+                    for (int i = 0; i < resample_context->remap_term_count[ch]; i += 1)
+                        sum += terms[i].gain * in_frame[terms[i].in_channel];
+                    out[frame * frame_stride + ch * channel_stride] = sum;
+                }
+            }
+            return;
     }
-    return sum;
+    panic("invalid remap mode");
+}
+
+// Collects the nonzero entries of channel_matrix and picks a fast path.
+static void compile_remap(ResampleContext *resample_context, int in_channel_count, int out_channel_count) {
+    resample_context->in_channel_count = in_channel_count;
+    resample_context->out_channel_count = out_channel_count;
+
+    bool identity = (in_channel_count == out_channel_count);
+    for (int out_ch = 0; out_ch < out_channel_count; out_ch += 1) {
+        int term_count = 0;
+        for (int in_ch = 0; in_ch < in_channel_count; in_ch += 1) {
+            float gain = resample_context->channel_matrix[out_ch][in_ch];
+            if (gain == 0.0f)
+                continue;
+            RemapTerm *term = &resample_context->remap_terms[out_ch][term_count];
+            term->in_channel = in_ch;
+            term->gain = gain;
+            term_count += 1;
+            if (in_ch != out_ch || gain != 1.0f)
+                identity = false;
+        }
+        resample_context->remap_term_count[out_ch] = term_count;
+        if (term_count != 1)
+            identity = false;
+    }
+
+    if (identity) {
+        resample_context->remap_mode = RemapModeIdentity;
+    } else if (in_channel_count == 1 && out_channel_count == 2 &&
+            resample_context->remap_term_count[0] == 1 && resample_context->remap_term_count[1] == 1)
+    {
+        resample_context->remap_mode = RemapModeMonoToStereo;
+    } else if (in_channel_count == 2 && out_channel_count == 1 &&
+            resample_context->remap_term_count[0] == 2)
+    {
+        resample_context->remap_mode = RemapModeStereoToMono;
+    } else {
+        resample_context->remap_mode = RemapModeSparse;
+    }
+}
+
+// Consumes as much of in_buf and fills as much of out_buf as it can, and
+// returns the frame counts in out_in_frames_read and out_out_frames_written.
+static void resample_frames(ResampleContext *resample_context,
+        const float *in_buf, int input_frame_count, float *out_buf, int output_frame_count,
+        int *out_in_frames_read, int *out_out_frames_written)
+{
+    int in_channel_count = resample_context->in_channel_count;
+    int out_channel_count = resample_context->out_channel_count;
+
+    const ResampleFilter *filter = resample_context->filter;
+    if (!filter) {
+        // no resampling; only channel remapping
+        int frame_count = min(input_frame_count, output_frame_count);
+        remap_frames(resample_context, in_buf, frame_count, out_buf, out_channel_count, 1);
+        *out_in_frames_read = frame_count;
+        *out_out_frames_written = frame_count;
+        return;
+    }
+
+    long upsample_factor = filter->upsample_factor;
+    long downsample_factor = filter->downsample_factor;
+    int taps_per_phase = filter->taps_per_phase;
+    int capacity = resample_context->frame_buf_capacity;
+    float *frame_buf = resample_context->frame_buf;
+
+    int in_frames_read = 0;
+    int out_frames_written = 0;
+    for (;;) {
+        // convert the next chunk of input to the output layout, planar
+        int buf_count = resample_context->frame_buf_count;
+        int in_count = min(input_frame_count - in_frames_read, capacity - buf_count);
+        remap_frames(resample_context, &in_buf[in_frames_read * in_channel_count], in_count,
+                &frame_buf[buf_count], 1, capacity);
+        in_frames_read += in_count;
+        buf_count += in_count;
+
+        // each output frame is one dot product per channel with the taps of its phase
+        long filter_pos = resample_context->filter_pos;
+        int out_count = 0;
+        float *out_ptr = &out_buf[out_frames_written * out_channel_count];
+        while (out_frames_written + out_count < output_frame_count) {
+            long newest_frame = filter_pos / upsample_factor;
+            if (newest_frame >= buf_count)
+                break;
+            int phase = filter_pos % upsample_factor;
+            const float *taps = &filter->phase_table[phase * taps_per_phase];
+            long oldest_frame = newest_frame - taps_per_phase + 1;
+            for (int ch = 0; ch < out_channel_count; ch += 1) {
+                out_ptr[ch] = dot_product(taps, &frame_buf[ch * capacity + oldest_frame], taps_per_phase);
+            }
+            out_ptr += out_channel_count;
+            out_count += 1;
+            filter_pos += downsample_factor;
+        }
+        out_frames_written += out_count;
+
+        // drop the frames that no future output frame needs
+        int drop_count = filter_pos / upsample_factor - taps_per_phase + 1;
+        assert(drop_count >= 0);
+        drop_count = min(drop_count, buf_count);
+        if (drop_count > 0) {
+            for (int ch = 0; ch < out_channel_count; ch += 1) {
+                float *plane = &frame_buf[ch * capacity];
+                memmove(plane, plane + drop_count, (buf_count - drop_count) * sizeof(float));
+            }
+            buf_count -= drop_count;
+            filter_pos -= drop_count * upsample_factor;
+        }
+        resample_context->frame_buf_count = buf_count;
+        resample_context->filter_pos = filter_pos;
+
+        if (in_count == 0 && out_count == 0)
+            break;
+    }
+
+    *out_in_frames_read = in_frames_read;
+    *out_out_frames_written = out_frames_written;
 }
 
 static void resample_run(struct GenesisNode *node) {
@@ -76,94 +395,188 @@ static void resample_run(struct GenesisNode *node) {
     struct GenesisPort *audio_in_port = node->ports[0];
     struct GenesisPort *audio_out_port = node->ports[1];
 
-    int input_frame_count = genesis_audio_in_port_fill_count(audio_in_port);
-    int output_frame_count = genesis_audio_out_port_free_count(audio_out_port);
+    int in_frames_read;
+    int out_frames_written;
+    resample_frames(resample_context,
+            genesis_audio_in_port_read_ptr(audio_in_port), genesis_audio_in_port_fill_count(audio_in_port),
+            genesis_audio_out_port_write_ptr(audio_out_port), genesis_audio_out_port_free_count(audio_out_port),
+            &in_frames_read, &out_frames_written);
 
-    const struct SoundIoChannelLayout * in_channel_layout = genesis_audio_port_channel_layout(audio_in_port);
-    const struct SoundIoChannelLayout * out_channel_layout = genesis_audio_port_channel_layout(audio_out_port);
+    genesis_audio_in_port_advance_read_ptr(audio_in_port, in_frames_read);
+    genesis_audio_out_port_advance_write_ptr(audio_out_port, out_frames_written);
+}
 
-    int out_channel_count = out_channel_layout->channel_count;
+static void resample_filter_destroy(ResampleFilter *filter) {
+    if (filter) {
+        destroy(filter->phase_table, filter->phase_table_size);
+        destroy(filter, 1);
+    }
+}
 
-    float *in_buf = genesis_audio_in_port_read_ptr(audio_in_port);
-    float *out_buf = genesis_audio_out_port_write_ptr(audio_out_port);
+static ResampleFilter *resample_filter_create(int in_sample_rate, int out_sample_rate,
+        GenesisResampleQuality quality)
+{
+    ResampleFilter *filter = create_zero<ResampleFilter>();
+    if (!filter)
+        return nullptr;
 
-    if (!resample_context->impulse_response) {
-        // no resampling; only channel remapping
-        int frame_count = min(input_frame_count, output_frame_count);
-        for (int frame = 0; frame < frame_count; frame += 1) {
-            for (int ch = 0; ch < out_channel_count; ch += 1) {
-                out_buf[frame * out_channel_count + ch] = get_channel_value(in_buf,
-                        resample_context, in_channel_layout, out_channel_layout, frame, ch);
+    filter->in_sample_rate = in_sample_rate;
+    filter->out_sample_rate = out_sample_rate;
+    filter->quality = quality;
+
+    int gcd = greatest_common_denominator(in_sample_rate, out_sample_rate);
+    filter->upsample_factor = out_sample_rate / gcd;
+    filter->downsample_factor = in_sample_rate / gcd;
+
+    long oversampled_rate = in_sample_rate * filter->upsample_factor;
+    double cutoff_freq_hz = min(in_sample_rate, out_sample_rate) / 2.0;
+    double cutoff_freq_float = cutoff_freq_hz / (double)oversampled_rate;
+
+    double transition_band = transition_band_hz[quality] / oversampled_rate;
+    int window_size = ceil(4.0 / transition_band);
+    window_size += !(window_size % 2);
+
+    int phase_count = filter->upsample_factor;
+    int taps_per_phase = (window_size + phase_count - 1) / phase_count;
+    taps_per_phase = ((taps_per_phase + TAP_ALIGNMENT - 1) / TAP_ALIGNMENT) * TAP_ALIGNMENT;
+
+    filter->phase_table_size = phase_count * taps_per_phase;
+    filter->phase_table = allocate_zero<float>(filter->phase_table_size);
+    if (!filter->phase_table) {
+        resample_filter_destroy(filter);
+        return nullptr;
+    }
+    filter->taps_per_phase = taps_per_phase;
+    filter->half_window_size = window_size / 2;
+
+    // create impulse response by sampling the sinc function and then
+    // multiplying by the blackman window. tap i of phase p is impulse
+    // response sample p + (taps_per_phase - 1 - i) * phase_count.
+    double sum = 0.0;
+    for (int phase = 0; phase < phase_count; phase += 1) {
+        float *taps = &filter->phase_table[phase * taps_per_phase];
+        for (int i = 0; i < taps_per_phase; i += 1) {
+            long n = phase + (long)(taps_per_phase - 1 - i) * phase_count;
+            double sample = 0.0;
+            if (n < window_size) {
+                double sinc_sample = sinc(2.0 * cutoff_freq_float * (n - (window_size - 1) / 2.0));
+                sample = sinc_sample * blackman_window(n, window_size);
             }
+            taps[i] = sample;
+            sum += sample;
         }
-        genesis_audio_in_port_advance_read_ptr(audio_in_port, frame_count);
-        genesis_audio_out_port_advance_write_ptr(audio_out_port, frame_count);
-        return;
     }
+    // unity gain at DC for every phase, compensating for the zeros that
+    // upsampling implies
+    float scale = phase_count / sum;
+    for (int i = 0; i < filter->phase_table_size; i += 1)
+        filter->phase_table[i] *= scale;
 
-    // pretend that we have upsampled the input to the oversample rate by adding zeroes
-    // now low-pass filter using our impulse response window
+    return filter;
+}
 
-    int window_size = resample_context->impulse_response_size;
-    int half_window_size = window_size / 2;
+// Returns the context's filter for these rates and quality, building it the
+// first time it is asked for. Filters live until the context is destroyed.
+static int get_resample_filter(GenesisContext *context, int in_sample_rate, int out_sample_rate,
+        GenesisResampleQuality quality, const ResampleFilter **out_filter)
+{
+    OsMutexLocker locker(context->resample_filters_mutex);
+    for (int i = 0; i < context->resample_filters.length(); i += 1) {
+        ResampleFilter *filter = context->resample_filters.at(i);
+        if (filter->in_sample_rate == in_sample_rate &&
+            filter->out_sample_rate == out_sample_rate &&
+            filter->quality == quality)
+        {
+            *out_filter = filter;
+            return 0;
+        }
+    }
 
-    // compute available input start and end in oversample coordinates
-    long over_input_start = resample_context->over_offset;
-    long over_input_end = over_input_start + input_frame_count * resample_context->upsample_factor;
+    ResampleFilter *filter = resample_filter_create(in_sample_rate, out_sample_rate, quality);
+    if (!filter)
+        return GenesisErrorNoMem;
+    if (context->resample_filters.append(filter)) {
+        resample_filter_destroy(filter);
+        return GenesisErrorNoMem;
+    }
+    *out_filter = filter;
+    return 0;
+}
 
-    // compute available output start and end in oversample coordinates
-    long over_output_start = resample_context->over_offset;
-    long over_output_end = over_output_start + output_frame_count * resample_context->downsample_factor;
+void resample_filter_cache_clear(GenesisContext *context) {
+    while (context->resample_filters.length())
+        resample_filter_destroy(context->resample_filters.pop());
+}
 
-    long over_actual_input_end = over_input_end - half_window_size;
+// Picks the filter for these rates and sizes the frame buffer for it.
+static int set_sample_rates(ResampleContext *resample_context, GenesisContext *context,
+        int in_sample_rate, int out_sample_rate, GenesisResampleQuality quality, int out_channel_count)
+{
+    if (in_sample_rate == out_sample_rate) {
+        resample_context->filter = nullptr;
+        return 0;
+    }
 
-    if (over_actual_input_end <= over_output_start)
-        return;
+    int err;
+    if ((err = get_resample_filter(context, in_sample_rate, out_sample_rate, quality,
+                    &resample_context->filter)))
+    {
+        return err;
+    }
 
-    long over_actual_output_end = min(over_output_end, over_actual_input_end);
-    long over_out_count = over_actual_output_end - over_output_start;
-    assert(over_out_count > 0);
+    int frame_buf_capacity = resample_context->filter->taps_per_phase + CHUNK_FRAME_COUNT;
+    int frame_buf_size = frame_buf_capacity * out_channel_count;
+    float *new_frame_buf = reallocate_safe(resample_context->frame_buf,
+            resample_context->frame_buf_size, frame_buf_size);
+    if (!new_frame_buf)
+        return GenesisErrorNoMem;
+    resample_context->frame_buf = new_frame_buf;
+    resample_context->frame_buf_size = frame_buf_size;
+    resample_context->frame_buf_capacity = frame_buf_capacity;
 
-    // actual output frame count in output sample rate coordinates
-    int out_frame_count = over_out_count / resample_context->downsample_factor;
-    assert(out_frame_count >= 0);
-    if (out_frame_count == 0)
-        return;
+    reset_filter_state(resample_context);
+    return 0;
+}
 
-    int in_frame_count = over_out_count / resample_context->upsample_factor;
+int resample_stream_create(GenesisContext *context, int in_sample_rate, int out_sample_rate,
+        int channel_count, GenesisResampleQuality quality, ResampleContext **out)
+{
+    *out = nullptr;
+    resample_init();
 
-    for (long frame = 0; frame < out_frame_count; frame += 1) {
-        long over_frame = resample_context->over_offset + (frame * resample_context->downsample_factor);
-        // calculate this oversampled frame
-        float total[GENESIS_MAX_CHANNELS] = {0.0f};
+    ResampleContext *resample_context = create_zero<ResampleContext>();
+    if (!resample_context)
+        return GenesisErrorNoMem;
 
-        int impulse_start = resample_context->upsample_factor - (((over_frame - half_window_size) +
-                (resample_context->upsample_factor * half_window_size)) % resample_context->upsample_factor);
-        for (int impulse_i = impulse_start; impulse_i < window_size;
-                impulse_i += resample_context->upsample_factor)
-        {
-            long over_in_index = over_frame + (impulse_i - half_window_size);
-            int in_index = (over_in_index - resample_context->over_offset) / resample_context->upsample_factor;
-            if (in_index < 0)
-                continue;
-            for (int ch = 0; ch < out_channel_count; ch += 1) {
-                float over_value = get_channel_value(in_buf, resample_context,
-                        in_channel_layout, out_channel_layout, in_index, ch);
-                int impulse_response_index = window_size - impulse_i - 1;
-                total[ch] += resample_context->impulse_response[impulse_response_index] * over_value;
-            }
-        }
-        for (int ch = 0; ch < out_channel_count; ch += 1) {
-            int out_sample_index = frame * out_channel_count + ch;
-            out_buf[out_sample_index] = total[ch];
-        }
+    int err;
+    if ((err = set_sample_rates(resample_context, context, in_sample_rate, out_sample_rate,
+                    quality, channel_count)))
+    {
+        resample_stream_destroy(resample_context);
+        return err;
     }
 
-    genesis_audio_in_port_advance_read_ptr(audio_in_port, in_frame_count);
-    genesis_audio_out_port_advance_write_ptr(audio_out_port, out_frame_count);
+    for (int ch = 0; ch < channel_count; ch += 1)
+        resample_context->channel_matrix[ch][ch] = 1.0f;
+    compile_remap(resample_context, channel_count, channel_count);
 
-    resample_context->over_offset = (resample_context->over_offset +
-            out_frame_count * resample_context->downsample_factor) % resample_context->oversampled_rate;
+    *out = resample_context;
+    return 0;
+}
+
+void resample_stream_destroy(ResampleContext *resample_context) {
+    if (resample_context) {
+        destroy(resample_context->frame_buf, resample_context->frame_buf_size);
+        destroy(resample_context, 1);
+    }
+}
+
+void resample_stream_process(ResampleContext *resample_context,
+        const float *in, int in_frame_count, float *out, int out_frame_count,
+        int *out_in_frames_read, int *out_out_frames_written)
+{
+    resample_frames(resample_context, in, in_frame_count, out, out_frame_count,
+            out_in_frames_read, out_out_frames_written);
 }
 
 static int port_connected(struct GenesisNode *node) {
@@ -177,45 +590,18 @@ static int port_connected(struct GenesisNode *node) {
     int in_sample_rate = genesis_audio_port_sample_rate(audio_in_port);
     int out_sample_rate = genesis_audio_port_sample_rate(audio_out_port);
 
-    int gcd = greatest_common_denominator(in_sample_rate, out_sample_rate);
-    resample_context->upsample_factor = out_sample_rate / gcd;
-    resample_context->downsample_factor = in_sample_rate / gcd;
-
-    resample_context->oversampled_rate = in_sample_rate * resample_context->upsample_factor;
-
-    if (in_sample_rate == out_sample_rate) {
-        destroy(resample_context->impulse_response, resample_context->impulse_response_size);
-        resample_context->impulse_response = nullptr;
-    } else {
-        double cutoff_freq_hz = min(in_sample_rate, out_sample_rate) / 2.0;
-        double cutoff_freq_float = cutoff_freq_hz / (double)resample_context->oversampled_rate;
-
-        double transition_band = transition_band_hz / resample_context->oversampled_rate;
-        int window_size = ceil(4.0 / transition_band);
-        window_size += !(window_size % 2);
-
-        float *new_impulse_response = reallocate_safe(resample_context->impulse_response,
-                resample_context->impulse_response_size, window_size);
-
-        if (!new_impulse_response)
-            return GenesisErrorNoMem;
-
-        resample_context->impulse_response = new_impulse_response;
-        resample_context->impulse_response_size = window_size;
+    const struct SoundIoChannelLayout * in_channel_layout = genesis_audio_port_channel_layout(audio_in_port);
+    const struct SoundIoChannelLayout * out_channel_layout = genesis_audio_port_channel_layout(audio_out_port);
 
-        // create impulse response by sampling the sinc function and then
-        // multiplying by the blackman window
-        for (int i = 0; i < window_size; i += 1) {
-            // sample the sinc function
-            double sinc_sample = sinc(2.0 * cutoff_freq_float * (i - (window_size - 1) / 2.0));
-            double sample = sinc_sample * blackman_window(i, window_size);
-            resample_context->impulse_response[i] = sample;
-        }
+    GenesisPipeline *pipeline = genesis_node_pipeline(node);
+    int err;
+    if ((err = set_sample_rates(resample_context, pipeline->context, in_sample_rate, out_sample_rate,
+                    pipeline->resample_quality, out_channel_layout->channel_count)))
+    {
+        return err;
     }
 
     // set up channel matrix
-    const struct SoundIoChannelLayout * in_channel_layout = genesis_audio_port_channel_layout(audio_in_port);
-    const struct SoundIoChannelLayout * out_channel_layout = genesis_audio_port_channel_layout(audio_out_port);
     memset(resample_context->channel_matrix, 0, sizeof(resample_context->channel_matrix));
 
     int in_contains[GENESIS_CHANNEL_ID_COUNT];
@@ -360,12 +746,24 @@ static int port_connected(struct GenesisNode *node) {
         }
     }
 
-    // make sure all input channels are accounted for
+    // anything left over, such as top or aux channels, goes to front center,
+    // front left/right, or failing that every output channel
     for (int id = 0; id < GENESIS_CHANNEL_ID_COUNT; id += 1) {
-        if (unaccounted[id]) {
-            fprintf(stderr, "unaccounted: %s\n", soundio_get_channel_name((SoundIoChannelId)id));
-            return GenesisErrorUnimplemented;
+        if (!unaccounted[id])
+            continue;
+        float (*matrix)[GENESIS_CHANNEL_ID_COUNT] = resample_context->channel_matrix;
+        if (out_contains[SoundIoChannelIdFrontCenter] >= 0) {
+            matrix[out_contains[SoundIoChannelIdFrontCenter]][in_contains[id]] += 1.0;
+        } else if (out_contains[SoundIoChannelIdFrontLeft] >= 0 &&
+                out_contains[SoundIoChannelIdFrontRight] >= 0)
+        {
+            matrix[out_contains[SoundIoChannelIdFrontLeft]][in_contains[id]] += M_SQRT1_2;
+            matrix[out_contains[SoundIoChannelIdFrontRight]][in_contains[id]] += M_SQRT1_2;
+        } else {
+            for (int out_ch = 0; out_ch < out_channel_layout->channel_count; out_ch += 1)
+                matrix[out_ch][in_contains[id]] += 1.0;
         }
+        unaccounted[id] = false;
     }
 
     // normalize per channel
@@ -381,6 +779,8 @@ static int port_connected(struct GenesisNode *node) {
         }
     }
 
+    compile_remap(resample_context, in_channel_layout->channel_count, out_channel_layout->channel_count);
+
     return 0;
 }
 
@@ -411,6 +811,8 @@ static void out_disconnect(struct GenesisPort *port, struct GenesisPort *other_p
 }
 
 int create_resample_descriptor(GenesisPipeline *pipeline) {
+    resample_init();
+
     GenesisNodeDescriptor *node_descr = genesis_create_node_descriptor(pipeline, 2,
             "resample", "Resample audio and remap channel layouts.");
 
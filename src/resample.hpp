@@ -5,4 +5,36 @@
 
 int create_resample_descriptor(GenesisPipeline *pipeline);
 
+// frees the filter tables shared by the resample nodes of the context.
+// no resample node of the context may be connected.
+void resample_filter_cache_clear(GenesisContext *context);
+
+enum ResampleIsa {
+    ResampleIsaScalar,
+    ResampleIsaSse,
+    ResampleIsaAvx,
+};
+
+// Selects the fastest filter implementation the CPU supports, the first time
+// it is called. Not thread-safe; create_resample_descriptor calls it on the
+// GUI thread before any resample node runs.
+void resample_init(void);
+
+// Selects the given implementation. Returns false and changes nothing if the
+// CPU does not support it. Not thread-safe; for tests and benchmarks.
+bool resample_select(ResampleIsa isa);
+
+ResampleIsa resample_isa(void);
+
+// Resamples interleaved audio outside of a pipeline, with the same filter
+// and code as the resample node. For tests and benchmarks.
+struct ResampleContext;
+int resample_stream_create(GenesisContext *context, int in_sample_rate, int out_sample_rate,
+        int channel_count, GenesisResampleQuality quality, ResampleContext **out);
+void resample_stream_destroy(ResampleContext *resample_context);
+// Consumes as much input and fills as much output as it can.
+void resample_stream_process(ResampleContext *resample_context,
+        const float *in, int in_frame_count, float *out, int out_frame_count,
+        int *out_in_frames_read, int *out_out_frames_written);
+
 #endif
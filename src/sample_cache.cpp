@@ -0,0 +1,161 @@
+#include "sample_cache.hpp"
+#include "os.hpp"
+#include "list.hpp"
+
+static const int64_t SAMPLE_CACHE_MAX_BYTES = 4LL * 1024 * 1024 * 1024;
+static const char *SAMPLE_CACHE_EXTENSION = ".pcm";
+static const char *PEAKS_EXTENSION = ".peaks";
+
+static void get_entry_path(ByteBuffer &out, const ByteBuffer &cache_dir, const ByteBuffer &digest,
+        const char *extension)
+{
+    ByteBuffer name;
+    for (int i = 0; i < digest.length(); i += 1) {
+        ByteBuffer hex_byte;
+        hex_byte.format("%02x", (uint8_t)digest.at(i));
+        name.append(hex_byte);
+    }
+    name.append(extension);
+    os_path_join(out, cache_dir, name);
+}
+
+// ties an entry to the exact source file it was decoded from
+static int get_entry_key(ByteBuffer &out, const ByteBuffer &digest, const char *source_path) {
+    int err;
+    int64_t size;
+    long mtime;
+    if ((err = os_file_stat(source_path, &size, &mtime)))
+        return err;
+    out.clear();
+    out.append(digest);
+    out.append_uint64be(size);
+    out.append_uint64be(mtime);
+    return 0;
+}
+
+int sample_cache_open(GenesisContext *context, const ByteBuffer &cache_dir,
+        const ByteBuffer &digest, const char *source_path, GenesisAudioFile **out_audio_file)
+{
+    ByteBuffer key;
+    if (digest.length() == 0 || get_entry_key(key, digest, source_path))
+        return genesis_audio_file_load_streaming(context, source_path, out_audio_file);
+
+    ByteBuffer entry_path;
+    get_entry_path(entry_path, cache_dir, digest, SAMPLE_CACHE_EXTENSION);
+
+    int err = genesis_audio_file_load_decoded(context, entry_path.raw(),
+            key.raw(), key.length(), out_audio_file);
+    if (!err) {
+        // mark as recently used
+        os_file_touch(entry_path.raw());
+        return 0;
+    }
+
+    if ((err = os_mkdirp(cache_dir)) ||
+        (err = genesis_audio_file_write_decoded(context, source_path, entry_path.raw(),
+                key.raw(), key.length())))
+    {
+        if (err == GenesisErrorDecodingAudio || err == GenesisErrorNoAudioFound ||
+            err == GenesisErrorNoDecoderFound || err == GenesisErrorFileNotFound)
+        {
+            return err;
+        }
+        return genesis_audio_file_load_streaming(context, source_path, out_audio_file);
+    }
+
+    sample_cache_trim(cache_dir, SAMPLE_CACHE_MAX_BYTES, entry_path);
+
+    if ((err = genesis_audio_file_load_decoded(context, entry_path.raw(),
+                    key.raw(), key.length(), out_audio_file)))
+    {
+        return genesis_audio_file_load_streaming(context, source_path, out_audio_file);
+    }
+    return 0;
+}
+
+int sample_cache_open_peaks(const ByteBuffer &cache_dir, const ByteBuffer &digest,
+        const char *source_path, GenesisAudioFile *audio_file, PeakPyramid **out_pyramid)
+{
+    *out_pyramid = nullptr;
+    if (genesis_audio_file_is_streaming(audio_file))
+        return GenesisErrorInvalidState;
+
+    if (digest.length() == 0)
+        return GenesisErrorInvalidParam;
+
+    int err;
+    ByteBuffer key;
+    if ((err = get_entry_key(key, digest, source_path)))
+        return err;
+
+    ByteBuffer peaks_path;
+    get_entry_path(peaks_path, cache_dir, digest, PEAKS_EXTENSION);
+    if (!peak_pyramid_open(peaks_path.raw(), key, out_pyramid))
+        return 0;
+
+    if ((err = os_mkdirp(cache_dir)))
+        return err;
+    if ((err = peak_pyramid_write(audio_file, peaks_path.raw(), key)))
+        return err;
+    return peak_pyramid_open(peaks_path.raw(), key, out_pyramid);
+}
+
+static int compare_entries_by_mtime(OsDirEntry *a, OsDirEntry *b) {
+    if (a->mtime < b->mtime)
+        return -1;
+    if (a->mtime > b->mtime)
+        return 1;
+    return 0;
+}
+
+int sample_cache_trim(const ByteBuffer &cache_dir, int64_t max_bytes, const ByteBuffer &keep_path) {
+    List<OsDirEntry *> entries;
+    int err;
+    if ((err = os_readdir(cache_dir.raw(), entries)))
+        return err;
+
+    List<OsDirEntry *> cache_entries;
+    int64_t total_size = 0;
+    for (int i = 0; i < entries.length(); i += 1) {
+        OsDirEntry *entry = entries.at(i);
+        if (!entry->is_file)
+            continue;
+        if (ByteBuffer::compare(os_path_extension(entry->name), SAMPLE_CACHE_EXTENSION) != 0)
+            continue;
+        // an entry's size includes its peaks file, which goes with it
+        ByteBuffer peaks_path;
+        os_path_join(peaks_path, cache_dir, entry->name);
+        os_path_remove_extension(peaks_path);
+        peaks_path.append(PEAKS_EXTENSION);
+        int64_t peaks_size;
+        long peaks_mtime;
+        if (!os_file_stat(peaks_path.raw(), &peaks_size, &peaks_mtime))
+            entry->size += peaks_size;
+        total_size += entry->size;
+        if (cache_entries.append(entry)) {
+            err = GenesisErrorNoMem;
+            break;
+        }
+    }
+
+    if (!err) {
+        cache_entries.sort<compare_entries_by_mtime>();
+        for (int i = 0; i < cache_entries.length() && total_size > max_bytes; i += 1) {
+            OsDirEntry *entry = cache_entries.at(i);
+            ByteBuffer full_path;
+            os_path_join(full_path, cache_dir, entry->name);
+            if (ByteBuffer::equal(full_path, keep_path))
+                continue;
+            // an open asset keeps its mapping of a deleted entry
+            if (!os_delete(full_path.raw()))
+                total_size -= entry->size;
+            os_path_remove_extension(full_path);
+            full_path.append(PEAKS_EXTENSION);
+            os_delete(full_path.raw());
+        }
+    }
+
+    for (int i = 0; i < entries.length(); i += 1)
+        os_dir_entry_unref(entries.at(i));
+    return err;
+}
@@ -0,0 +1,30 @@
+#ifndef SAMPLE_CACHE_HPP
+#define SAMPLE_CACHE_HPP
+
+#include "byte_buffer.hpp"
+#include "genesis.h"
+#include "peak_pyramid.hpp"
+
+// On-disk cache of decoded audio assets, keyed by the sha256 digest of the
+// source file. Entries are checked against the size and modification time of
+// the source, and the least recently used entries are deleted once the cache
+// grows past a size limit.
+
+// Opens the audio file at source_path. The first open decodes it into
+// cache_dir; later opens memory-map the decoded samples instead of running the
+// decoder. If the cache can not be written, streams from the source instead.
+int sample_cache_open(GenesisContext *context, const ByteBuffer &cache_dir,
+        const ByteBuffer &digest, const char *source_path, GenesisAudioFile **out_audio_file);
+
+// Opens the waveform peaks of an audio file opened with sample_cache_open,
+// computing and storing them next to its decoded samples the first time.
+// Fails with GenesisErrorInvalidState if the audio file is streaming.
+int sample_cache_open_peaks(const ByteBuffer &cache_dir, const ByteBuffer &digest,
+        const char *source_path, GenesisAudioFile *audio_file, PeakPyramid **out_pyramid);
+
+// Deletes least recently used entries, except keep_path, until the entries in
+// cache_dir add up to at most max_bytes. The peaks of an entry count toward
+// its size and are deleted along with it.
+int sample_cache_trim(const ByteBuffer &cache_dir, int64_t max_bytes, const ByteBuffer &keep_path);
+
+#endif
@@ -0,0 +1,495 @@
+#include "sample_convert.hpp"
+#include "util.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SAMPLE_CONVERT_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// (x - min) / half_range - 1.0 for each integer type, as scale and offset
+static const float u8_scale = (float)(1.0 / 127.5);
+static const float u8_offset = -1.0f;
+static const float s16_scale = (float)(1.0 / 32767.5);
+static const float s16_offset = (float)(0.5 / 32767.5);
+static const float s32_scale = (float)(1.0 / 2147483647.5);
+static const float s32_offset = (float)(0.5 / 2147483647.5);
+
+static const float int24_min = -8388608.0f;
+static const float int24_max = 8388607.0f;
+
+struct SampleConvertKernels {
+    SampleConvertToFloatFn *u8_to_float;
+    SampleConvertToFloatFn *s16_to_float;
+    SampleConvertToFloatFn *s32_to_float;
+    SampleConvertToFloatFn *double_to_float;
+    SampleConvertFromFloatFn *float_to_u8;
+    SampleConvertFromFloatFn *float_to_s16;
+    SampleConvertFromFloatFn *float_to_s24;
+    SampleConvertFromFloatFn *float_to_s32;
+    SampleConvertFromFloatFn *float_to_double;
+};
+
+static void u8_to_float_scalar(float *dest, const void *src, int count) {
+    const uint8_t *s = (const uint8_t *)src;
+    for (int i = 0; i < count; i += 1)
+        dest[i] = (float)s[i] * u8_scale + u8_offset;
+}
+
+static void s16_to_float_scalar(float *dest, const void *src, int count) {
+    const int16_t *s = (const int16_t *)src;
+    for (int i = 0; i < count; i += 1)
+        dest[i] = (float)s[i] * s16_scale + s16_offset;
+}
+
+static void s32_to_float_scalar(float *dest, const void *src, int count) {
+    const int32_t *s = (const int32_t *)src;
+    for (int i = 0; i < count; i += 1)
+        dest[i] = (float)s[i] * s32_scale + s32_offset;
+}
+
+static void double_to_float_scalar(float *dest, const void *src, int count) {
+    const double *s = (const double *)src;
+    for (int i = 0; i < count; i += 1)
+        dest[i] = (float)s[i];
+}
+
+static void float_to_u8_scalar(void *dest, const float *src, int count) {
+    uint8_t *d = (uint8_t *)dest;
+    for (int i = 0; i < count; i += 1)
+        d[i] = (uint8_t)clamp(0.0f, src[i] * 127.5f + 127.5f, (float)UINT8_MAX);
+}
+
+static void float_to_s16_scalar(void *dest, const float *src, int count) {
+    int16_t *d = (int16_t *)dest;
+    for (int i = 0; i < count; i += 1)
+        d[i] = (int16_t)clamp((float)INT16_MIN, src[i] * 32767.0f, (float)INT16_MAX);
+}
+
+static void float_to_s24_scalar(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    for (int i = 0; i < count; i += 1) {
+        // ffmpeg looks at the most significant bytes
+        d[i] = (int32_t)clamp(int24_min, src[i] * 8388607.0f, int24_max) * 256;
+    }
+}
+
+static void float_to_s32_scalar(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    for (int i = 0; i < count; i += 1)
+        d[i] = (int32_t)clamp((double)INT32_MIN, src[i] * 2147483647.0, (double)INT32_MAX);
+}
+
+static void float_to_double_scalar(void *dest, const float *src, int count) {
+    double *d = (double *)dest;
+    for (int i = 0; i < count; i += 1)
+        d[i] = src[i];
+}
+
+static const SampleConvertKernels scalar_kernels = {
+    u8_to_float_scalar,
+    s16_to_float_scalar,
+    s32_to_float_scalar,
+    double_to_float_scalar,
+    float_to_u8_scalar,
+    float_to_s16_scalar,
+    float_to_s24_scalar,
+    float_to_s32_scalar,
+    float_to_double_scalar,
+};
+
+#if defined(SAMPLE_CONVERT_X86)
+
+// Each vector loop handles whole vectors and leaves the tail to the scalar
+// implementation, which computes the same values.
+
+TARGET_SSE2 static void u8_to_float_sse2(float *dest, const void *src, int count) {
+    const uint8_t *s = (const uint8_t *)src;
+    __m128 scale = _mm_set1_ps(u8_scale);
+    __m128 offset = _mm_set1_ps(u8_offset);
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i parts[4] = {
+            _mm_unpacklo_epi16(lo, zero),
+            _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero),
+            _mm_unpackhi_epi16(hi, zero),
+        };
+        for (int j = 0; j < 4; j += 1) {
+            __m128 f = _mm_cvtepi32_ps(parts[j]);
+            _mm_storeu_ps(dest + i + j * 4, _mm_add_ps(_mm_mul_ps(f, scale), offset));
+        }
+    }
+    u8_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_SSE2 static void s16_to_float_sse2(float *dest, const void *src, int count) {
+    const int16_t *s = (const int16_t *)src;
+    __m128 scale = _mm_set1_ps(s16_scale);
+    __m128 offset = _mm_set1_ps(s16_offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        // sign extend by putting each sample in the high half and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dest + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), offset));
+        _mm_storeu_ps(dest + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), offset));
+    }
+    s16_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_SSE2 static void s32_to_float_sse2(float *dest, const void *src, int count) {
+    const int32_t *s = (const int32_t *)src;
+    __m128 scale = _mm_set1_ps(s32_scale);
+    __m128 offset = _mm_set1_ps(s32_offset);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 f = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(s + i)));
+        _mm_storeu_ps(dest + i, _mm_add_ps(_mm_mul_ps(f, scale), offset));
+    }
+    s32_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_SSE2 static void double_to_float_sse2(float *dest, const void *src, int count) {
+    const double *s = (const double *)src;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(s + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(s + i + 2));
+        _mm_storeu_ps(dest + i, _mm_movelh_ps(lo, hi));
+    }
+    double_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_SSE2 static void float_to_u8_sse2(void *dest, const float *src, int count) {
+    uint8_t *d = (uint8_t *)dest;
+    __m128 half_range = _mm_set1_ps(127.5f);
+    __m128 min_v = _mm_setzero_ps();
+    __m128 max_v = _mm_set1_ps((float)UINT8_MAX);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i parts[4];
+        for (int j = 0; j < 4; j += 1) {
+            __m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + j * 4), half_range), half_range);
+            parts[j] = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(f, max_v), min_v));
+        }
+        __m128i lo = _mm_packs_epi32(parts[0], parts[1]);
+        __m128i hi = _mm_packs_epi32(parts[2], parts[3]);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(lo, hi));
+    }
+    float_to_u8_scalar(d + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void float_to_s16_sse2(void *dest, const float *src, int count) {
+    int16_t *d = (int16_t *)dest;
+    __m128 scale = _mm_set1_ps(32767.0f);
+    __m128 min_v = _mm_set1_ps((float)INT16_MIN);
+    __m128 max_v = _mm_set1_ps((float)INT16_MAX);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        __m128i ia = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(a, max_v), min_v));
+        __m128i ib = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(b, max_v), min_v));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(ia, ib));
+    }
+    float_to_s16_scalar(d + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void float_to_s24_sse2(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    __m128 scale = _mm_set1_ps(8388607.0f);
+    __m128 min_v = _mm_set1_ps(int24_min);
+    __m128 max_v = _mm_set1_ps(int24_max);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 f = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128i v = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(f, max_v), min_v));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_slli_epi32(v, 8));
+    }
+    float_to_s24_scalar(d + i, src + i, count - i);
+}
+
+// in double precision so that full scale maps to INT32_MAX exactly
+TARGET_SSE2 static void float_to_s32_sse2(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    __m128d scale = _mm_set1_pd(2147483647.0);
+    __m128d min_v = _mm_set1_pd((double)INT32_MIN);
+    __m128d max_v = _mm_set1_pd((double)INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 f = _mm_loadu_ps(src + i);
+        __m128d lo = _mm_mul_pd(_mm_cvtps_pd(f), scale);
+        __m128d hi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(f, f)), scale);
+        __m128i ilo = _mm_cvttpd_epi32(_mm_max_pd(_mm_min_pd(lo, max_v), min_v));
+        __m128i ihi = _mm_cvttpd_epi32(_mm_max_pd(_mm_min_pd(hi, max_v), min_v));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi64(ilo, ihi));
+    }
+    float_to_s32_scalar(d + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void float_to_double_sse2(void *dest, const float *src, int count) {
+    double *d = (double *)dest;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 f = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(d + i, _mm_cvtps_pd(f));
+        _mm_storeu_pd(d + i + 2, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+    }
+    float_to_double_scalar(d + i, src + i, count - i);
+}
+
+static const SampleConvertKernels sse2_kernels = {
+    u8_to_float_sse2,
+    s16_to_float_sse2,
+    s32_to_float_sse2,
+    double_to_float_sse2,
+    float_to_u8_sse2,
+    float_to_s16_sse2,
+    float_to_s24_sse2,
+    float_to_s32_sse2,
+    float_to_double_sse2,
+};
+
+TARGET_AVX2 static void u8_to_float_avx2(float *dest, const void *src, int count) {
+    const uint8_t *s = (const uint8_t *)src;
+    __m256 scale = _mm256_set1_ps(u8_scale);
+    __m256 offset = _mm256_set1_ps(u8_offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + i)));
+        __m256 f = _mm256_cvtepi32_ps(v);
+        _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_mul_ps(f, scale), offset));
+    }
+    u8_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_AVX2 static void s16_to_float_avx2(float *dest, const void *src, int count) {
+    const int16_t *s = (const int16_t *)src;
+    __m256 scale = _mm256_set1_ps(s16_scale);
+    __m256 offset = _mm256_set1_ps(s16_offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + i)));
+        __m256 f = _mm256_cvtepi32_ps(v);
+        _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_mul_ps(f, scale), offset));
+    }
+    s16_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_AVX2 static void s32_to_float_avx2(float *dest, const void *src, int count) {
+    const int32_t *s = (const int32_t *)src;
+    __m256 scale = _mm256_set1_ps(s32_scale);
+    __m256 offset = _mm256_set1_ps(s32_offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 f = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(s + i)));
+        _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_mul_ps(f, scale), offset));
+    }
+    s32_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_AVX2 static void double_to_float_avx2(float *dest, const void *src, int count) {
+    const double *s = (const double *)src;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_ps(dest + i, _mm256_cvtpd_ps(_mm256_loadu_pd(s + i)));
+        _mm_storeu_ps(dest + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(s + i + 4)));
+    }
+    double_to_float_scalar(dest + i, s + i, count - i);
+}
+
+TARGET_AVX2 static void float_to_u8_avx2(void *dest, const float *src, int count) {
+    uint8_t *d = (uint8_t *)dest;
+    __m256 half_range = _mm256_set1_ps(127.5f);
+    __m256 min_v = _mm256_setzero_ps();
+    __m256 max_v = _mm256_set1_ps((float)UINT8_MAX);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 f = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), half_range), half_range);
+        __m256i v = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(f, max_v), min_v));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i *)(d + i), _mm_packus_epi16(packed, packed));
+    }
+    float_to_u8_scalar(d + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void float_to_s16_avx2(void *dest, const float *src, int count) {
+    int16_t *d = (int16_t *)dest;
+    __m256 scale = _mm256_set1_ps(32767.0f);
+    __m256 min_v = _mm256_set1_ps((float)INT16_MIN);
+    __m256 max_v = _mm256_set1_ps((float)INT16_MAX);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 f = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256i v = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(f, max_v), min_v));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i *)(d + i), packed);
+    }
+    float_to_s16_scalar(d + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void float_to_s24_avx2(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    __m256 scale = _mm256_set1_ps(8388607.0f);
+    __m256 min_v = _mm256_set1_ps(int24_min);
+    __m256 max_v = _mm256_set1_ps(int24_max);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 f = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256i v = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(f, max_v), min_v));
+        _mm256_storeu_si256((__m256i *)(d + i), _mm256_slli_epi32(v, 8));
+    }
+    float_to_s24_scalar(d + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void float_to_s32_avx2(void *dest, const float *src, int count) {
+    int32_t *d = (int32_t *)dest;
+    __m256d scale = _mm256_set1_pd(2147483647.0);
+    __m256d min_v = _mm256_set1_pd((double)INT32_MIN);
+    __m256d max_v = _mm256_set1_pd((double)INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d f = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(src + i)), scale);
+        __m128i v = _mm256_cvttpd_epi32(_mm256_max_pd(_mm256_min_pd(f, max_v), min_v));
+        _mm_storeu_si128((__m128i *)(d + i), v);
+    }
+    float_to_s32_scalar(d + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void float_to_double_avx2(void *dest, const float *src, int count) {
+    double *d = (double *)dest;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm256_storeu_pd(d + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+    float_to_double_scalar(d + i, src + i, count - i);
+}
+
+static const SampleConvertKernels avx2_kernels = {
+    u8_to_float_avx2,
+    s16_to_float_avx2,
+    s32_to_float_avx2,
+    double_to_float_avx2,
+    float_to_u8_avx2,
+    float_to_s16_avx2,
+    float_to_s24_avx2,
+    float_to_s32_avx2,
+    float_to_double_avx2,
+};
+
+TARGET_SSE2 static void deinterleave_stereo_sse2(float *left, float *right,
+        const float *src, int frame_count)
+{
+    int i = 0;
+    for (; i + 4 <= frame_count; i += 4) {
+        __m128 a = _mm_loadu_ps(src + i * 2);
+        __m128 b = _mm_loadu_ps(src + i * 2 + 4);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    for (; i < frame_count; i += 1) {
+        left[i] = src[i * 2];
+        right[i] = src[i * 2 + 1];
+    }
+}
+
+#endif
+
+SampleConvertToFloatFn *sample_convert_u8_to_float = u8_to_float_scalar;
+SampleConvertToFloatFn *sample_convert_s16_to_float = s16_to_float_scalar;
+SampleConvertToFloatFn *sample_convert_s32_to_float = s32_to_float_scalar;
+SampleConvertToFloatFn *sample_convert_double_to_float = double_to_float_scalar;
+SampleConvertFromFloatFn *sample_convert_float_to_u8 = float_to_u8_scalar;
+SampleConvertFromFloatFn *sample_convert_float_to_s16 = float_to_s16_scalar;
+SampleConvertFromFloatFn *sample_convert_float_to_s24 = float_to_s24_scalar;
+SampleConvertFromFloatFn *sample_convert_float_to_s32 = float_to_s32_scalar;
+SampleConvertFromFloatFn *sample_convert_float_to_double = float_to_double_scalar;
+
+static SampleConvertIsa current_isa = SampleConvertIsaScalar;
+
+void sample_convert_deinterleave(float *const *dest, int dest_offset,
+        const float *src, int channel_count, int frame_count)
+{
+    if (channel_count == 1) {
+        memcpy(dest[0] + dest_offset, src, frame_count * sizeof(float));
+        return;
+    }
+#if defined(SAMPLE_CONVERT_X86)
+    if (channel_count == 2 && current_isa != SampleConvertIsaScalar) {
+        deinterleave_stereo_sse2(dest[0] + dest_offset, dest[1] + dest_offset, src, frame_count);
+        return;
+    }
+#endif
+    for (int ch = 0; ch < channel_count; ch += 1) {
+        float *d = dest[ch] + dest_offset;
+        const float *s = src + ch;
+        for (int frame = 0; frame < frame_count; frame += 1, s += channel_count)
+            d[frame] = *s;
+    }
+}
+
+static bool cpu_supports(SampleConvertIsa isa) {
+    switch (isa) {
+        case SampleConvertIsaScalar:
+            return true;
+#if defined(SAMPLE_CONVERT_X86)
+        case SampleConvertIsaSse2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case SampleConvertIsaAvx2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#else
+        case SampleConvertIsaSse2:
+        case SampleConvertIsaAvx2:
+            return false;
+#endif
+    }
+    panic("invalid isa");
+}
+
+bool sample_convert_select(SampleConvertIsa isa) {
+    if (!cpu_supports(isa))
+        return false;
+
+    const SampleConvertKernels *kernels = &scalar_kernels;
+#if defined(SAMPLE_CONVERT_X86)
+    if (isa == SampleConvertIsaSse2)
+        kernels = &sse2_kernels;
+    else if (isa == SampleConvertIsaAvx2)
+        kernels = &avx2_kernels;
+#endif
+
+    sample_convert_u8_to_float = kernels->u8_to_float;
+    sample_convert_s16_to_float = kernels->s16_to_float;
+    sample_convert_s32_to_float = kernels->s32_to_float;
+    sample_convert_double_to_float = kernels->double_to_float;
+    sample_convert_float_to_u8 = kernels->float_to_u8;
+    sample_convert_float_to_s16 = kernels->float_to_s16;
+    sample_convert_float_to_s24 = kernels->float_to_s24;
+    sample_convert_float_to_s32 = kernels->float_to_s32;
+    sample_convert_float_to_double = kernels->float_to_double;
+    current_isa = isa;
+    return true;
+}
+
+void sample_convert_init(void) {
+    if (sample_convert_select(SampleConvertIsaAvx2))
+        return;
+    if (sample_convert_select(SampleConvertIsaSse2))
+        return;
+    sample_convert_select(SampleConvertIsaScalar);
+}
+
+SampleConvertIsa sample_convert_isa(void) {
+    return current_isa;
+}
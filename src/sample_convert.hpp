@@ -0,0 +1,48 @@
+#ifndef SAMPLE_CONVERT_HPP
+#define SAMPLE_CONVERT_HPP
+
+// Block converters between float samples and the integer and double sample
+// formats used by ffmpeg. Each converter works on a flat run of count
+// samples, so it serves packed and planar data alike. The function pointers
+// start out at the scalar implementations; sample_convert_init switches them
+// to SSE2 or AVX2 versions when the CPU supports them.
+
+enum SampleConvertIsa {
+    SampleConvertIsaScalar,
+    SampleConvertIsaSse2,
+    SampleConvertIsaAvx2,
+};
+
+typedef void SampleConvertToFloatFn(float *dest, const void *src, int count);
+typedef void SampleConvertFromFloatFn(void *dest, const float *src, int count);
+
+// integer samples map to [-1.0, 1.0] over the full range of the type
+extern SampleConvertToFloatFn *sample_convert_u8_to_float;
+extern SampleConvertToFloatFn *sample_convert_s16_to_float;
+extern SampleConvertToFloatFn *sample_convert_s32_to_float;
+extern SampleConvertToFloatFn *sample_convert_double_to_float;
+
+// float samples are clamped to the range of the destination type. s24 writes
+// int32_t samples with the 24 bits of precision in the most significant bytes.
+extern SampleConvertFromFloatFn *sample_convert_float_to_u8;
+extern SampleConvertFromFloatFn *sample_convert_float_to_s16;
+extern SampleConvertFromFloatFn *sample_convert_float_to_s24;
+extern SampleConvertFromFloatFn *sample_convert_float_to_s32;
+extern SampleConvertFromFloatFn *sample_convert_float_to_double;
+
+// Splits frame_count interleaved frames of src into one run per channel,
+// starting at dest[ch][dest_offset].
+void sample_convert_deinterleave(float *const *dest, int dest_offset,
+        const float *src, int channel_count, int frame_count);
+
+// Selects the fastest implementation the CPU supports. Not thread-safe; called
+// once from audio_file_init.
+void sample_convert_init(void);
+
+// Selects the given implementation. Returns false and changes nothing if the
+// CPU does not support it. Not thread-safe; for tests and benchmarks.
+bool sample_convert_select(SampleConvertIsa isa);
+
+SampleConvertIsa sample_convert_isa(void);
+
+#endif
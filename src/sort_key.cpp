@@ -203,7 +203,7 @@ void SortKey::serialize(ByteBuffer &buf) const {
     }
 }
 
-int SortKey::deserialize(const ByteBuffer &buffer, int *offset) {
+int SortKey::deserialize(const ByteView &buffer, int *offset) {
     if (buffer.length() - *offset < 8)
         return GenesisErrorInvalidFormat;
 
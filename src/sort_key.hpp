@@ -19,7 +19,7 @@ public:
     }
 
     void serialize(ByteBuffer &buf) const;
-    int deserialize(const ByteBuffer &buf, int *offset);
+    int deserialize(const ByteView &buf, int *offset);
 
     // don't use these
     SortKey();
@@ -0,0 +1,97 @@
+#include "tempo_map.hpp"
+
+int tempo_map_set(TempoMap *tempo_map, const GenesisTempoSegment *segments, int segment_count) {
+    if (segment_count < 1 || segments[0].start_whole_notes != 0.0)
+        return GenesisErrorInvalidParam;
+    for (int i = 0; i < segment_count; i += 1) {
+        if (!(segments[i].whole_notes_per_second > 0.0))
+            return GenesisErrorInvalidParam;
+        if (i > 0 && !(segments[i].start_whole_notes > segments[i - 1].start_whole_notes))
+            return GenesisErrorInvalidParam;
+    }
+
+    // reserve both lists before resizing either, so that running out of
+    // memory leaves their lengths matching
+    if (tempo_map->segments.ensure_capacity(segment_count))
+        return GenesisErrorNoMem;
+    if (tempo_map->start_seconds.ensure_capacity(segment_count))
+        return GenesisErrorNoMem;
+    ok_or_panic(tempo_map->segments.resize(segment_count));
+    ok_or_panic(tempo_map->start_seconds.resize(segment_count));
+
+    double seconds = 0.0;
+    for (int i = 0; i < segment_count; i += 1) {
+        const GenesisTempoSegment *segment = &segments[i];
+        if (i > 0) {
+            const GenesisTempoSegment *prev = &segments[i - 1];
+            seconds += (segment->start_whole_notes - prev->start_whole_notes) / prev->whole_notes_per_second;
+        }
+        tempo_map->segments.at(i) = *segment;
+        tempo_map->start_seconds.at(i) = seconds;
+    }
+    return 0;
+}
+
+int tempo_map_set_default(TempoMap *tempo_map) {
+    GenesisTempoSegment segment;
+    segment.start_whole_notes = 0.0;
+    segment.whole_notes_per_second = TEMPO_MAP_DEFAULT_WHOLE_NOTES_PER_SECOND;
+    return tempo_map_set(tempo_map, &segment, 1);
+}
+
+static double segment_start_whole_notes(const TempoMap *tempo_map, int index) {
+    return tempo_map->segments.at(index).start_whole_notes;
+}
+
+static double segment_start_seconds(const TempoMap *tempo_map, int index) {
+    return tempo_map->start_seconds.at(index);
+}
+
+template<double (*start_of)(const TempoMap *, int)>
+static bool segment_contains(const TempoMap *tempo_map, int index, double pos) {
+    return (index == 0 || start_of(tempo_map, index) <= pos) &&
+        (index + 1 == tempo_map->segments.length() || pos < start_of(tempo_map, index + 1));
+}
+
+// index of the last segment which starts at or before pos, or 0
+template<double (*start_of)(const TempoMap *, int)>
+static int find_segment(const TempoMap *tempo_map, double pos, int *cursor) {
+    int count = tempo_map->segments.length();
+    if (cursor) {
+        int index = *cursor;
+        if (index >= 0 && index < count && segment_contains<start_of>(tempo_map, index, pos))
+            return index;
+        index += 1;
+        if (index >= 1 && index < count && segment_contains<start_of>(tempo_map, index, pos)) {
+            *cursor = index;
+            return index;
+        }
+    }
+
+    int low = 0;
+    int high = count;
+    while (high - low > 1) {
+        int mid = low + (high - low) / 2;
+        if (start_of(tempo_map, mid) <= pos)
+            low = mid;
+        else
+            high = mid;
+    }
+    if (cursor)
+        *cursor = low;
+    return low;
+}
+
+double tempo_map_whole_notes_to_seconds(const TempoMap *tempo_map, double whole_notes, int *cursor) {
+    int index = find_segment<segment_start_whole_notes>(tempo_map, whole_notes, cursor);
+    const GenesisTempoSegment *segment = &tempo_map->segments.at(index);
+    return tempo_map->start_seconds.at(index) +
+        (whole_notes - segment->start_whole_notes) / segment->whole_notes_per_second;
+}
+
+double tempo_map_seconds_to_whole_notes(const TempoMap *tempo_map, double seconds, int *cursor) {
+    int index = find_segment<segment_start_seconds>(tempo_map, seconds, cursor);
+    const GenesisTempoSegment *segment = &tempo_map->segments.at(index);
+    return segment->start_whole_notes +
+        (seconds - tempo_map->start_seconds.at(index)) * segment->whole_notes_per_second;
+}
@@ -0,0 +1,32 @@
+#ifndef TEMPO_MAP_HPP
+#define TEMPO_MAP_HPP
+
+#include "genesis.h"
+#include "list.hpp"
+
+// The tempo where no tempo map is set.
+static const double TEMPO_MAP_DEFAULT_WHOLE_NOTES_PER_SECOND = 140.0 / 60.0;
+
+// Tempo changes along the timeline, sorted by position. Each segment lasts
+// until the next one starts. The first starts at whole note 0 and also
+// covers positions before it. start_seconds[i] is the time segment i starts
+// at, summed over the segments before it, so a conversion only has to find
+// its segment.
+struct TempoMap {
+    List<GenesisTempoSegment> segments;
+    List<double> start_seconds;
+};
+
+// Returns GenesisErrorInvalidParam unless there is at least one segment, the
+// first starts at 0, starts increase and every tempo is positive. The map is
+// left unchanged then, and when it returns GenesisErrorNoMem.
+int tempo_map_set(TempoMap *tempo_map, const GenesisTempoSegment *segments, int segment_count);
+int tempo_map_set_default(TempoMap *tempo_map);
+
+// cursor may be null. Otherwise it holds the index of the segment the
+// previous conversion landed in, and is checked along with the one after it
+// before searching the whole map. Start it at 0.
+double tempo_map_whole_notes_to_seconds(const TempoMap *tempo_map, double whole_notes, int *cursor);
+double tempo_map_seconds_to_whole_notes(const TempoMap *tempo_map, double seconds, int *cursor);
+
+#endif
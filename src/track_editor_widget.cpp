@@ -88,6 +88,7 @@ TrackEditorWidget::TrackEditorWidget(GuiWindow *gui_window, AudioGraph *audio_gr
 
     project->events.attach_handler(EventProjectTracksChanged, on_tracks_changed, this);
     project->events.attach_handler(EventProjectAudioClipSegmentsChanged, on_tracks_changed, this);
+    project->events.attach_handler(EventProjectAudioAssetsLoadProgress, on_tracks_changed, this);
     audio_graph->events.attach_handler(EventAudioGraphPlayHeadChanged, on_play_head_changed, this);
     vert_scroll_bar->events.attach_handler(EventScrollValueChange, scroll_callback, this);
     horiz_scroll_bar->events.attach_handler(EventScrollValueChange, scroll_callback, this);
@@ -95,6 +96,7 @@ TrackEditorWidget::TrackEditorWidget(GuiWindow *gui_window, AudioGraph *audio_gr
 
 TrackEditorWidget::~TrackEditorWidget() {
     project->events.detach_handler(EventProjectTracksChanged, on_tracks_changed);
+    project->events.detach_handler(EventProjectAudioAssetsLoadProgress, on_tracks_changed);
     audio_graph->events.detach_handler(EventAudioGraphPlayHeadChanged, on_tracks_changed);
 
     destroy(vert_scroll_bar, 1);
@@ -297,10 +299,17 @@ void TrackEditorWidget::update_model() {
             AudioClipSegment *segment = gui_audio_clip_segment->segment;
 
             int frame_rate = project_audio_clip_sample_rate(project, segment->audio_clip);
-            int frame_count = project_audio_clip_frame_count(project, segment->audio_clip);
-            double whole_note_len = genesis_frames_to_whole_notes(
-                    audio_graph->pipeline, frame_count, frame_rate);
-            double whole_note_end = segment->pos + whole_note_len;
+            long frame_count = project_audio_clip_frame_count(project, segment->audio_clip);
+            if (frame_rate < 0 || frame_count < 0) {
+                // laid out again when the asset finishes loading. an asset
+                // which failed to load keeps the length of its segment.
+                frame_rate = genesis_pipeline_get_sample_rate(audio_graph->pipeline);
+                frame_count = segment->end - segment->start;
+            }
+            int frame_at_start = genesis_whole_notes_to_frames(
+                    audio_graph->pipeline, segment->pos, frame_rate);
+            double whole_note_end = genesis_frames_to_whole_notes(
+                    audio_graph->pipeline, frame_at_start + frame_count, frame_rate);
 
             gui_audio_clip_segment->left = whole_note_to_pixel(segment->pos);
             gui_audio_clip_segment->right = whole_note_to_pixel(whole_note_end);
@@ -586,6 +595,8 @@ void TrackEditorWidget::on_drag_audio_clip(AudioClip *audio_clip, const DragEven
 
         int x_with_scroll = event->mouse_event.x + horiz_scroll_bar->value;
         long end = project_audio_clip_frame_count(project, audio_clip);
+        if (end < 0)
+            return;
         double pos = pixel_to_whole_note(x_with_scroll);
         project_add_audio_clip_segment(project, audio_clip, gui_track->track, 0, end, pos);
     }
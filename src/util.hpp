@@ -207,7 +207,7 @@ static inline void write_uint32be(void *buffer, uint32_t x) {
     buf[0] = x & 0xff;
 }
 
-static inline void write_uint64be(void *buffer, uint32_t x) {
+static inline void write_uint64be(void *buffer, uint64_t x) {
     uint8_t *buf = (uint8_t*) buffer;
 
     buf[7] = x & 0xff;
@@ -0,0 +1,346 @@
+#ifndef WORK_STEALING_QUEUE_HPP
+#define WORK_STEALING_QUEUE_HPP
+
+#include "error.h"
+#include "util.hpp"
+#include "atomics.hpp"
+#include "thread_safe_queue.hpp"
+
+#include <limits.h>
+
+using std::atomic;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+
+// Bounded Chase-Lev deque. Only the owning worker may push and pop at the
+// bottom; any thread may steal from the top. Never grows; the caller must
+// guarantee that no more than capacity items are in the deque at once.
+template<typename T>
+class WorkStealingDeque {
+public:
+    WorkStealingDeque() {
+        _items = nullptr;
+        _capacity = 0;
+        _top = 0;
+        _bottom = 0;
+    }
+    ~WorkStealingDeque() {
+        destroy(_items, _capacity);
+    }
+
+    // this method not thread safe
+    int __attribute__((warn_unused_result)) resize(int capacity) {
+        if (capacity > _capacity) {
+            atomic<T> *new_items = reallocate_safe<atomic<T>>(_items, _capacity, capacity);
+            if (!new_items)
+                return GenesisErrorNoMem;
+            _items = new_items;
+            _capacity = capacity;
+        }
+        _top.store(0);
+        _bottom.store(0);
+        return 0;
+    }
+
+    // owner only
+    void push(T item) {
+        long b = _bottom.load(memory_order_relaxed);
+        long t = _top.load(memory_order_acquire);
+        assert(b - t < _capacity);
+        _items[b % _capacity].store(item, memory_order_relaxed);
+        std::atomic_thread_fence(memory_order_release);
+        _bottom.store(b + 1, memory_order_relaxed);
+    }
+
+    // owner only. returns false if the deque is empty.
+    bool pop(T *item) {
+        long b = _bottom.load(memory_order_relaxed) - 1;
+        _bottom.store(b, memory_order_relaxed);
+        std::atomic_thread_fence(memory_order_seq_cst);
+        long t = _top.load(memory_order_relaxed);
+        if (t > b) {
+            _bottom.store(b + 1, memory_order_relaxed);
+            return false;
+        }
+        *item = _items[b % _capacity].load(memory_order_relaxed);
+        if (t == b) {
+            // last item; race against thieves for it
+            bool won = _top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+            _bottom.store(b + 1, memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // any thread. returns false if the deque is empty or another thread won
+    // the race for the top item.
+    bool steal(T *item) {
+        long t = _top.load(memory_order_acquire);
+        std::atomic_thread_fence(memory_order_seq_cst);
+        long b = _bottom.load(memory_order_acquire);
+        if (t >= b)
+            return false;
+        *item = _items[t % _capacity].load(memory_order_relaxed);
+        return _top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+    }
+
+private:
+    atomic<T> *_items;
+    int _capacity;
+    atomic_long _top;
+    atomic_long _bottom;
+
+    WorkStealingDeque(const WorkStealingDeque &other) = delete;
+    WorkStealingDeque<T>& operator= (const WorkStealingDeque<T> &other) = delete;
+};
+
+// Bounded many writer, many reader lock-free queue. Used for items produced
+// by threads which are not workers, such as device callbacks.
+template<typename T>
+class InjectionQueue {
+public:
+    InjectionQueue() {
+        _cells = nullptr;
+        _capacity = 0;
+        _allocated_capacity = 0;
+    }
+    ~InjectionQueue() {
+        destroy(_cells, _allocated_capacity);
+    }
+
+    // this method not thread safe. capacity is rounded up to a power of 2.
+    int __attribute__((warn_unused_result)) resize(int capacity) {
+        int pow2_capacity = 1;
+        while (pow2_capacity < capacity)
+            pow2_capacity *= 2;
+        if (pow2_capacity > _allocated_capacity) {
+            Cell *new_cells = reallocate_safe<Cell>(_cells, _allocated_capacity, pow2_capacity);
+            if (!new_cells)
+                return GenesisErrorNoMem;
+            _cells = new_cells;
+            _allocated_capacity = pow2_capacity;
+        }
+        _capacity = pow2_capacity;
+        for (int i = 0; i < _capacity; i += 1)
+            _cells[i].sequence.store(i, memory_order_relaxed);
+        _enqueue_pos.store(0);
+        _dequeue_pos.store(0);
+        return 0;
+    }
+
+    // panics if the queue is full
+    void push(T item) {
+        long pos = _enqueue_pos.load(memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &_cells[pos & (_capacity - 1)];
+            long seq = cell->sequence.load(memory_order_acquire);
+            long diff = seq - pos;
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                panic("InjectionQueue full");
+            } else {
+                pos = _enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+        cell->item = item;
+        cell->sequence.store(pos + 1, memory_order_release);
+    }
+
+    // returns false if the queue is empty
+    bool pop(T *item) {
+        long pos = _dequeue_pos.load(memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &_cells[pos & (_capacity - 1)];
+            long seq = cell->sequence.load(memory_order_acquire);
+            long diff = seq - (pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue_pos.load(memory_order_relaxed);
+            }
+        }
+        *item = cell->item;
+        cell->sequence.store(pos + _capacity, memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        atomic_long sequence;
+        T item;
+    };
+
+    Cell *_cells;
+    int _capacity;
+    int _allocated_capacity;
+    atomic_long _enqueue_pos;
+    atomic_long _dequeue_pos;
+
+    InjectionQueue(const InjectionQueue &other) = delete;
+    InjectionQueue<T>& operator= (const InjectionQueue<T> &other) = delete;
+};
+
+// Work-stealing task scheduler for a fixed set of worker threads.
+// Each worker owns a deque. Items enqueued by a worker go onto its own deque
+// and are popped LIFO, which keeps a node's consumers on the same core as the
+// data it just produced. Idle workers steal FIFO from the other deques.
+// Items enqueued by any other thread go into a shared injection queue.
+// T must be a pointer type; dequeue returns nullptr after wakeup_all().
+// lock-free except when a worker finds no work anywhere, then it blocks
+// on a futex until an item is enqueued.
+// must call resize before you can start using it.
+template<typename T>
+class WorkStealingQueue {
+public:
+    WorkStealingQueue() {
+        _deques = nullptr;
+        _worker_count = 0;
+        _allocated_worker_count = 0;
+        _shutdown = false;
+        _pending = 0;
+        _sleeping = 0;
+        _wake_seq = 0;
+    }
+    ~WorkStealingQueue() {
+        destroy(_deques, _allocated_worker_count);
+    }
+
+    // this method not thread safe. capacity is the maximum number of items
+    // which can be in the queue at once.
+    int __attribute__((warn_unused_result)) resize(int worker_count, int capacity) {
+        if (worker_count < 1 || capacity < 0)
+            return GenesisErrorInvalidParam;
+
+        if (worker_count > _allocated_worker_count) {
+            WorkStealingDeque<T> *new_deques = reallocate_safe<WorkStealingDeque<T>>(
+                    _deques, _allocated_worker_count, worker_count);
+            if (!new_deques)
+                return GenesisErrorNoMem;
+            _deques = new_deques;
+            _allocated_worker_count = worker_count;
+        }
+        _worker_count = worker_count;
+
+        int err;
+        for (int i = 0; i < _worker_count; i += 1) {
+            if ((err = _deques[i].resize(capacity)))
+                return err;
+        }
+        if ((err = _injection.resize(capacity)))
+            return err;
+
+        _shutdown.store(false);
+        _pending.store(0);
+        _sleeping.store(0);
+        return 0;
+    }
+
+    // put an item on the queue. if the calling thread is a worker currently
+    // inside dequeue() for this queue, the item goes on its own deque.
+    // thread-safe.
+    void enqueue(T item) {
+        // count the item before it becomes visible so that a worker about to
+        // sleep never sees an empty count while the item is stealable.
+        _pending += 1;
+        if (_current_queue == this)
+            _deques[_current_worker].push(item);
+        else
+            _injection.push(item);
+
+        if (_sleeping.load() > 0) {
+            _wake_seq += 1;
+            futex_wake(reinterpret_cast<int*>(&_wake_seq), 1);
+        }
+    }
+
+    // get an item from the queue. blocks if there is no work available.
+    // worker_index must be unique per thread and less than worker_count.
+    T dequeue(int worker_index) {
+        assert(worker_index >= 0 && worker_index < _worker_count);
+        _current_queue = this;
+        _current_worker = worker_index;
+
+        T item;
+        for (;;) {
+            if (_shutdown.load())
+                return nullptr;
+
+            if (try_take(worker_index, &item)) {
+                _pending -= 1;
+                return item;
+            }
+
+            int wake_seq = _wake_seq.load();
+            _sleeping += 1;
+            if (_pending.load() > 0 || _shutdown.load()) {
+                _sleeping -= 1;
+                continue;
+            }
+            int err = futex_wait(reinterpret_cast<int*>(&_wake_seq), wake_seq);
+            assert(err != EACCES);
+            assert(err != EINVAL);
+            assert(err != ENOSYS);
+            _sleeping -= 1;
+        }
+    }
+
+    // true if the calling thread is a worker of this queue.
+    bool is_worker_thread() const {
+        return _current_queue == this;
+    }
+
+    // wakes up all blocking dequeue() operations, which return nullptr.
+    // thread-safe. after you call wakeup_all, you must call resize() before
+    // using the queue again.
+    void wakeup_all() {
+        _shutdown.store(true);
+        _wake_seq += 1;
+        futex_wake(reinterpret_cast<int*>(&_wake_seq), INT_MAX);
+    }
+
+private:
+    WorkStealingDeque<T> *_deques;
+    int _worker_count;
+    int _allocated_worker_count;
+    InjectionQueue<T> _injection;
+    atomic_bool _shutdown;
+    atomic_int _pending;
+    atomic_int _sleeping;
+    atomic_int _wake_seq;
+
+    static thread_local WorkStealingQueue<T> *_current_queue;
+    static thread_local int _current_worker;
+
+    bool try_take(int worker_index, T *item) {
+        if (_deques[worker_index].pop(item))
+            return true;
+        if (_injection.pop(item))
+            return true;
+        for (int i = 1; i < _worker_count; i += 1) {
+            int victim = (worker_index + i) % _worker_count;
+            if (_deques[victim].steal(item))
+                return true;
+        }
+        return false;
+    }
+
+    WorkStealingQueue(const WorkStealingQueue &other) = delete;
+    WorkStealingQueue<T>& operator= (const WorkStealingQueue<T> &other) = delete;
+};
+
+template<typename T>
+thread_local WorkStealingQueue<T> *WorkStealingQueue<T>::_current_queue = nullptr;
+
+template<typename T>
+thread_local int WorkStealingQueue<T>::_current_worker = 0;
+
+#endif
@@ -0,0 +1,494 @@
+#undef NDEBUG
+
+#include "genesis.h"
+#include "os.hpp"
+#include "mixer_node.hpp"
+#include "resample.hpp"
+#include "sample_convert.hpp"
+#include "ordered_map_file.hpp"
+#include "project.hpp"
+#include "tempo_map.hpp"
+
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+
+// Runs fn until at least min_seconds have passed and returns the average time
+// of one call in nanoseconds.
+static double time_ns(void (*fn)(void *), void *userdata, double min_seconds = 0.2) {
+    fn(userdata); // warm up
+    long iterations = 0;
+    double start = os_get_time();
+    double elapsed;
+    do {
+        fn(userdata);
+        iterations += 1;
+        elapsed = os_get_time() - start;
+    } while (elapsed < min_seconds);
+    return elapsed * 1e9 / iterations;
+}
+
+static const char *mixer_isa_name(MixerIsa isa) {
+    switch (isa) {
+        case MixerIsaScalar: return "scalar";
+        case MixerIsaSse: return "sse";
+        case MixerIsaAvx: return "avx";
+    }
+    panic("invalid isa");
+}
+
+struct MixerBench {
+    float *out;
+    float **inputs;
+    float *gains;
+    int input_count;
+    int sample_count;
+};
+
+static void run_mixer_mix(void *userdata) {
+    MixerBench *b = (MixerBench *)userdata;
+    mixer_mix(b->out, b->inputs, b->gains, b->input_count, b->sample_count);
+}
+
+static void run_mixer_mix_scalar(void *userdata) {
+    MixerBench *b = (MixerBench *)userdata;
+    mixer_mix_scalar(b->out, b->inputs, b->gains, b->input_count, b->sample_count);
+}
+
+static void bench_mixer_mix(void) {
+    static const int max_input_count = 256;
+    static const int sample_count = 1024;
+    MixerBench b;
+    b.sample_count = sample_count;
+    b.inputs = ok_mem(allocate_zero<float *>(max_input_count));
+    b.gains = ok_mem(allocate_zero<float>(max_input_count));
+    b.out = ok_mem(allocate_zero<float>(sample_count));
+    for (int i = 0; i < max_input_count; i += 1) {
+        b.inputs[i] = ok_mem(allocate_zero<float>(sample_count));
+        for (int sample = 0; sample < sample_count; sample += 1)
+            b.inputs[i][sample] = sinf(sample * 0.01f + i);
+        b.gains[i] = 1.0f / (i + 1);
+    }
+
+    MixerIsa original_isa = mixer_isa();
+    MixerIsa isas[] = {MixerIsaScalar, MixerIsaSse, MixerIsaAvx};
+    fprintf(stderr, "%d samples per block, ns per block\n", sample_count);
+    fprintf(stderr, "%8s %12s", "inputs", "reference");
+    for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1)
+        fprintf(stderr, " %12s", mixer_isa_name(isas[isa_i]));
+    fprintf(stderr, "\n");
+    for (int input_count = 2; input_count <= max_input_count; input_count *= 2) {
+        b.input_count = input_count;
+        fprintf(stderr, "%8d %12.0f", input_count, time_ns(run_mixer_mix_scalar, &b));
+        for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+            if (mixer_select(isas[isa_i]))
+                fprintf(stderr, " %12.0f", time_ns(run_mixer_mix, &b));
+            else
+                fprintf(stderr, " %12s", "-");
+        }
+        fprintf(stderr, "\n");
+    }
+    assert(mixer_select(original_isa));
+
+    for (int i = 0; i < max_input_count; i += 1)
+        destroy(b.inputs[i], sample_count);
+    destroy(b.out, sample_count);
+    destroy(b.gains, max_input_count);
+    destroy(b.inputs, max_input_count);
+}
+
+static const char *resample_isa_name(ResampleIsa isa) {
+    switch (isa) {
+        case ResampleIsaScalar: return "scalar";
+        case ResampleIsaSse: return "sse";
+        case ResampleIsaAvx: return "avx";
+    }
+    panic("invalid isa");
+}
+
+struct ResampleBench {
+    GenesisContext *context;
+    GenesisResampleQuality quality;
+    float *in;
+    float *out;
+};
+
+static const int resample_in_rate = 44100;
+static const int resample_out_rate = 48000;
+static const int resample_channel_count = 2;
+static const int resample_seconds = 10;
+static const int resample_chunk_frame_count = 512;
+
+// resamples all of the input in chunks, as the pipeline would
+static void run_resample(void *userdata) {
+    ResampleBench *b = (ResampleBench *)userdata;
+    ResampleContext *stream;
+    ok_or_panic(resample_stream_create(b->context, resample_in_rate, resample_out_rate,
+                resample_channel_count, b->quality, &stream));
+    int in_frame_count = resample_in_rate * resample_seconds;
+    int out_frame_count = resample_out_rate * resample_seconds;
+    int in_frames_read = 0;
+    int out_frames_written = 0;
+    for (;;) {
+        int in_count = min(resample_chunk_frame_count, in_frame_count - in_frames_read);
+        int out_count = min(resample_chunk_frame_count, out_frame_count - out_frames_written);
+        int read_count;
+        int written_count;
+        resample_stream_process(stream,
+                &b->in[in_frames_read * resample_channel_count], in_count,
+                &b->out[out_frames_written * resample_channel_count], out_count,
+                &read_count, &written_count);
+        if (read_count == 0 && written_count == 0)
+            break;
+        in_frames_read += read_count;
+        out_frames_written += written_count;
+    }
+    resample_stream_destroy(stream);
+}
+
+static void bench_resample(void) {
+    ResampleBench b;
+    ok_or_panic(genesis_context_create(&b.context));
+    int in_size = resample_in_rate * resample_seconds * resample_channel_count;
+    int out_size = resample_out_rate * resample_seconds * resample_channel_count;
+    b.in = ok_mem(allocate_zero<float>(in_size));
+    b.out = ok_mem(allocate_zero<float>(out_size));
+    for (int i = 0; i < in_size; i += 1)
+        b.in[i] = 0.5f * sinf(i * 0.01f);
+
+    static const char *quality_names[] = {"draft", "normal", "best"};
+    GenesisResampleQuality qualities[] = {
+        GenesisResampleQualityDraft,
+        GenesisResampleQualityNormal,
+        GenesisResampleQualityBest,
+    };
+    ResampleIsa original_isa = resample_isa();
+    ResampleIsa isas[] = {ResampleIsaScalar, ResampleIsaSse, ResampleIsaAvx};
+    fprintf(stderr, "%d s of stereo from %d Hz to %d Hz in %d frame chunks, times realtime\n",
+            resample_seconds, resample_in_rate, resample_out_rate, resample_chunk_frame_count);
+    fprintf(stderr, "%8s", "quality");
+    for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1)
+        fprintf(stderr, " %8s", resample_isa_name(isas[isa_i]));
+    fprintf(stderr, "\n");
+    for (int quality_i = 0; quality_i < array_length(qualities); quality_i += 1) {
+        b.quality = qualities[quality_i];
+        fprintf(stderr, "%8s", quality_names[quality_i]);
+        for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+            if (!resample_select(isas[isa_i])) {
+                fprintf(stderr, " %8s", "-");
+                continue;
+            }
+            double seconds = time_ns(run_resample, &b, 1.0) / 1e9;
+            fprintf(stderr, " %8.1f", resample_seconds / seconds);
+        }
+        fprintf(stderr, "\n");
+    }
+    assert(resample_select(original_isa));
+
+    destroy(b.in, in_size);
+    destroy(b.out, out_size);
+    genesis_context_destroy(b.context);
+}
+
+static const char *sample_convert_isa_name(SampleConvertIsa isa) {
+    switch (isa) {
+        case SampleConvertIsaScalar: return "scalar";
+        case SampleConvertIsaSse2: return "sse2";
+        case SampleConvertIsaAvx2: return "avx2";
+    }
+    panic("invalid isa");
+}
+
+// The converters are function pointers which sample_convert_select changes,
+// so each format holds the address of its pointer.
+struct SampleFormatBench {
+    const char *name;
+    SampleConvertToFloatFn **to_float;
+    SampleConvertFromFloatFn **from_float;
+    // converts float samples to the source format of to_float
+    SampleConvertFromFloatFn **make_source;
+    bool deinterleave;
+};
+
+static const int sample_convert_count = 64 * 1024;
+static const int sample_convert_channel_count = 2;
+
+struct SampleConvertBench {
+    const SampleFormatBench *format;
+    float *floats;
+    float *float_dest;
+    float *planes[sample_convert_channel_count];
+    char *other;
+};
+
+static void run_sample_convert(void *userdata) {
+    SampleConvertBench *b = (SampleConvertBench *)userdata;
+    const SampleFormatBench *format = b->format;
+    if (format->to_float) {
+        (*format->to_float)(b->float_dest, b->other, sample_convert_count);
+    } else if (format->from_float) {
+        (*format->from_float)(b->other, b->floats, sample_convert_count);
+    } else {
+        sample_convert_deinterleave(b->planes, 0, b->floats, sample_convert_channel_count,
+                sample_convert_count / sample_convert_channel_count);
+    }
+}
+
+static void bench_sample_convert(void) {
+    static const SampleFormatBench formats[] = {
+        {"u8 to float", &sample_convert_u8_to_float, nullptr, &sample_convert_float_to_u8, false},
+        {"s16 to float", &sample_convert_s16_to_float, nullptr, &sample_convert_float_to_s16, false},
+        {"s32 to float", &sample_convert_s32_to_float, nullptr, &sample_convert_float_to_s32, false},
+        {"dbl to float", &sample_convert_double_to_float, nullptr, &sample_convert_float_to_double, false},
+        {"float to u8", nullptr, &sample_convert_float_to_u8, nullptr, false},
+        {"float to s16", nullptr, &sample_convert_float_to_s16, nullptr, false},
+        {"float to s24", nullptr, &sample_convert_float_to_s24, nullptr, false},
+        {"float to s32", nullptr, &sample_convert_float_to_s32, nullptr, false},
+        {"float to dbl", nullptr, &sample_convert_float_to_double, nullptr, false},
+        {"deinterleave", nullptr, nullptr, nullptr, true},
+    };
+
+    SampleConvertBench b;
+    b.floats = ok_mem(allocate_zero<float>(sample_convert_count));
+    b.float_dest = ok_mem(allocate_zero<float>(sample_convert_count));
+    int plane_size = sample_convert_count / sample_convert_channel_count;
+    for (int ch = 0; ch < sample_convert_channel_count; ch += 1)
+        b.planes[ch] = ok_mem(allocate_zero<float>(plane_size));
+    // large enough for double, the widest format
+    b.other = ok_mem(allocate_zero<char>(sample_convert_count * sizeof(double)));
+    for (int i = 0; i < sample_convert_count; i += 1)
+        b.floats[i] = 0.9f * sinf(i * 0.01f);
+
+    SampleConvertIsa original_isa = sample_convert_isa();
+    SampleConvertIsa isas[] = {SampleConvertIsaScalar, SampleConvertIsaSse2, SampleConvertIsaAvx2};
+    fprintf(stderr, "%d samples per call, millions of samples per second\n", sample_convert_count);
+    fprintf(stderr, "%14s", "format");
+    for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1)
+        fprintf(stderr, " %8s", sample_convert_isa_name(isas[isa_i]));
+    fprintf(stderr, "\n");
+    for (int format_i = 0; format_i < array_length(formats); format_i += 1) {
+        b.format = &formats[format_i];
+        fprintf(stderr, "%14s", b.format->name);
+        for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+            if (!sample_convert_select(isas[isa_i])) {
+                fprintf(stderr, " %8s", "-");
+                continue;
+            }
+            if (b.format->make_source)
+                (*b.format->make_source)(b.other, b.floats, sample_convert_count);
+            double ns = time_ns(run_sample_convert, &b);
+            fprintf(stderr, " %8.0f", sample_convert_count * 1e3 / ns);
+        }
+        fprintf(stderr, "\n");
+    }
+    assert(sample_convert_select(original_isa));
+
+    destroy(b.other, sample_convert_count * sizeof(double));
+    for (int ch = 0; ch < sample_convert_channel_count; ch += 1)
+        destroy(b.planes[ch], plane_size);
+    destroy(b.float_dest, sample_convert_count);
+    destroy(b.floats, sample_convert_count);
+}
+
+static const char *omf_bench_path = "/tmp/genesis_benchmark.gdaw";
+
+// Writes key_count keys with 32 byte values, in batches of 1000 puts.
+static void write_omf_bench_file(int key_count, bool compact) {
+    os_delete(omf_bench_path);
+    OrderedMapFile *omf;
+    ok_or_panic(ordered_map_file_open(omf_bench_path, &omf));
+    ordered_map_file_done_reading(omf);
+    for (int start = 0; start < key_count; start += 1000) {
+        OrderedMapFileBatch *batch = ok_mem(ordered_map_file_batch_create(omf));
+        int end = min(start + 1000, key_count);
+        for (int i = start; i < end; i += 1) {
+            OrderedMapFileBuffer *key = ok_mem(ordered_map_file_buffer_create(16));
+            OrderedMapFileBuffer *value = ok_mem(ordered_map_file_buffer_create(32));
+            snprintf(key->data, 16, "key%012d", i);
+            memset(value->data, 'v', 32);
+            ok_or_panic(ordered_map_file_batch_put(batch, key, value));
+        }
+        ok_or_panic(ordered_map_file_batch_exec(batch));
+    }
+    if (compact)
+        ok_or_panic(ordered_map_file_compact(omf));
+    ordered_map_file_close(omf);
+}
+
+static void run_omf_open(void *) {
+    OrderedMapFile *omf;
+    ok_or_panic(ordered_map_file_open(omf_bench_path, &omf));
+    ordered_map_file_done_reading(omf);
+    ordered_map_file_close(omf);
+}
+
+// Opening a compacted file reads its index; opening a log which was never
+// compacted replays every transaction.
+static void bench_omf_open(void) {
+    int key_counts[] = {10000, 100000, 1000000};
+    for (int i = 0; i < array_length(key_counts); i += 1) {
+        int key_count = key_counts[i];
+        write_omf_bench_file(key_count, false);
+        double log_ns = time_ns(run_omf_open, nullptr);
+        write_omf_bench_file(key_count, true);
+        double index_ns = time_ns(run_omf_open, nullptr);
+        fprintf(stderr, "%8d keys: log %8.2f ms  index %8.2f ms\n",
+                key_count, log_ns / 1e6, index_ns / 1e6);
+    }
+    os_delete(omf_bench_path);
+}
+
+// Inserts 100k tracks, one command each, at positions spread over the
+// track list, then undoes and redoes the last 10k. Each command only updates
+// the list items it touches, so the time per command should stay flat as
+// the project grows.
+static void bench_project_commands(void) {
+    static const char *path = "/tmp/genesis_benchmark_project.gdaw";
+    static const int command_count = 100000;
+    static const int report_interval = 10000;
+    os_delete(path);
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+    User *user = ok_mem(user_create(uint256::random(), "benchmark"));
+    Project *project;
+    ok_or_panic(project_create(context, path, uint256::random(), user, &project));
+
+    double start = os_get_time();
+    double interval_start = start;
+    for (int i = 0; i < command_count; i += 1) {
+        int index = (i * 7919L) % project->track_list.length();
+        Track *before = project->track_list.at(index);
+        Track *after = (index + 1 < project->track_list.length()) ?
+            project->track_list.at(index + 1) : nullptr;
+        project_insert_track(project, before, after);
+        if ((i + 1) % report_interval == 0) {
+            double now = os_get_time();
+            fprintf(stderr, "%7d commands: %6.2f us per insert\n", i + 1,
+                    (now - interval_start) * 1e6 / report_interval);
+            interval_start = now;
+        }
+    }
+    double insert_seconds = os_get_time() - start;
+
+    start = os_get_time();
+    for (int i = 0; i < report_interval; i += 1)
+        ok_or_panic(project_undo(project));
+    for (int i = 0; i < report_interval; i += 1)
+        ok_or_panic(project_redo(project));
+    double undo_redo_seconds = os_get_time() - start;
+    assert(project->track_list.length() == command_count + 1);
+
+    fprintf(stderr, "%d inserts: %.3f s, %d undos and redos: %.3f s\n",
+            command_count, insert_seconds, 2 * report_interval, undo_redo_seconds);
+
+    project_close(project);
+    user_destroy(user);
+    genesis_context_destroy(context);
+    os_delete(path);
+}
+
+struct TempoBench {
+    TempoMap tempo_map;
+    List<GenesisTempoSegment> segments;
+    double *positions;
+    int position_count;
+    double sum;
+};
+
+static void run_tempo_set(void *userdata) {
+    TempoBench *b = (TempoBench *)userdata;
+    ok_or_panic(tempo_map_set(&b->tempo_map, b->segments.raw(), b->segments.length()));
+}
+
+// playback converts positions in order, so the cursor almost always hits
+static void run_tempo_sequential(void *userdata) {
+    TempoBench *b = (TempoBench *)userdata;
+    int cursor = 0;
+    double sum = 0.0;
+    for (int i = 0; i < b->position_count; i += 1) {
+        double seconds = tempo_map_whole_notes_to_seconds(&b->tempo_map, b->positions[i], &cursor);
+        sum += tempo_map_seconds_to_whole_notes(&b->tempo_map, seconds, &cursor);
+    }
+    b->sum = sum;
+}
+
+static void run_tempo_random(void *userdata) {
+    TempoBench *b = (TempoBench *)userdata;
+    double sum = 0.0;
+    for (int i = 0; i < b->position_count; i += 1) {
+        int index = (i * 7919L) % b->position_count;
+        double seconds = tempo_map_whole_notes_to_seconds(&b->tempo_map, b->positions[index], nullptr);
+        sum += tempo_map_seconds_to_whole_notes(&b->tempo_map, seconds, nullptr);
+    }
+    b->sum = sum;
+}
+
+// A map of 10k tempo changes, converted both ways at 100k positions spread
+// over it.
+static void bench_tempo_map(void) {
+    static const int segment_count = 10000;
+    static const int position_count = 100000;
+    TempoBench b;
+    for (int i = 0; i < segment_count; i += 1)
+        ok_or_panic(b.segments.append({i * 4.0, 1.0 + (i % 13) * 0.25}));
+    b.position_count = position_count;
+    b.positions = ok_mem(allocate_zero<double>(position_count));
+    double end_whole_notes = segment_count * 4.0;
+    for (int i = 0; i < position_count; i += 1)
+        b.positions[i] = end_whole_notes * i / position_count;
+
+    double set_ns = time_ns(run_tempo_set, &b);
+    double sequential_ns = time_ns(run_tempo_sequential, &b);
+    double random_ns = time_ns(run_tempo_random, &b);
+    fprintf(stderr, "set %d segments: %.1f us\n", segment_count, set_ns / 1000.0);
+    fprintf(stderr, "round trip with cursor: %6.1f ns\n", sequential_ns / position_count);
+    fprintf(stderr, "round trip, random:     %6.1f ns\n", random_ns / position_count);
+
+    destroy(b.positions, position_count);
+}
+
+struct Benchmark {
+    const char *name;
+    void (*fn)(void);
+};
+
+static struct Benchmark benchmarks[] = {
+    {"mixer_mix", bench_mixer_mix},
+    {"resample", bench_resample},
+    {"sample_convert", bench_sample_convert},
+    {"omf_open", bench_omf_open},
+    {"project_commands", bench_project_commands},
+    {"tempo_map", bench_tempo_map},
+    {NULL, NULL},
+};
+
+static void exec_benchmark(struct Benchmark *benchmark) {
+    fprintf(stderr, "benchmark %s\n", benchmark->name);
+    benchmark->fn();
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    // Do all the one-time initialization stuff.
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+    genesis_context_destroy(context);
+    mixer_init();
+    resample_init();
+
+    const char *match = nullptr;
+
+    if (argc == 2)
+        match = argv[1];
+
+    struct Benchmark *benchmark = &benchmarks[0];
+
+    while (benchmark->name) {
+        if (!match || strstr(benchmark->name, match))
+            exec_benchmark(benchmark);
+        benchmark += 1;
+    }
+
+    return 0;
+}
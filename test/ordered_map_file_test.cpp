@@ -138,10 +138,335 @@ static void test_many_data(void) {
     delete_tmp_file();
 }
 
+static void put_number(OrderedMapFileBatch *batch, int key_number, int value_number) {
+    OrderedMapFileBuffer *key = ordered_map_file_buffer_create(4);
+    OrderedMapFileBuffer *value = ordered_map_file_buffer_create(8);
+    sprintf(key->data, "%03d", key_number);
+    sprintf(value->data, "%07d", value_number);
+    ordered_map_file_batch_put(batch, key, value);
+}
+
+// Compaction killed after each of its write steps in turn must leave a file
+// which opens with exactly the live keys, until it runs to completion.
+static void test_compaction_killed(void) {
+    for (int kill_step = 0;; kill_step += 1) {
+        OrderedMapFile *omf;
+        int err = ordered_map_file_open(tmp_file_path, &omf);
+        assert(err == 0);
+        ordered_map_file_done_reading(omf);
+
+        for (int round = 0; round < 3; round += 1) {
+            OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+            for (int i = 0; i < 100; i += 1)
+                put_number(batch, i, round * 1000 + i);
+            err = ordered_map_file_batch_exec(batch);
+            assert(err == 0);
+        }
+        OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+        for (int i = 1; i < 100; i += 2) {
+            OrderedMapFileBuffer *key = ordered_map_file_buffer_create(4);
+            sprintf(key->data, "%03d", i);
+            ordered_map_file_batch_del(batch, key);
+        }
+        err = ordered_map_file_batch_exec(batch);
+        assert(err == 0);
+        ordered_map_file_flush(omf);
+        long size_before = omf->transaction_offset;
+
+        ordered_map_file_compact_kill_step = kill_step;
+        err = ordered_map_file_compact(omf);
+        assert(err == 0);
+        ordered_map_file_flush(omf);
+        bool killed = ordered_map_file_compact_kill_step == -1;
+        ordered_map_file_compact_kill_step = -1;
+        assert(killed || omf->transaction_offset < size_before);
+        ordered_map_file_close(omf);
+
+        err = ordered_map_file_open(tmp_file_path, &omf);
+        assert(err == 0);
+        assert(ordered_map_file_count(omf) == 50);
+        ByteBuffer expected_key;
+        ByteBuffer expected_value;
+        for (int i = 0; i < 50; i += 1) {
+            expected_key.format("%03d", i * 2);
+            expected_key.resize(4);
+            expected_value.format("%07d", 2000 + i * 2);
+            expected_value.resize(8);
+            assert(ordered_map_file_find_key(omf, expected_key) == i);
+
+            ByteBuffer *key;
+            ByteBuffer value;
+            err = ordered_map_file_get(omf, i, &key, value);
+            assert(err == 0);
+            assert(ByteBuffer::compare(value, expected_value) == 0);
+        }
+        ordered_map_file_done_reading(omf);
+        ordered_map_file_close(omf);
+        delete_tmp_file();
+
+        if (!killed)
+            break;
+    }
+}
+
+// A value rewritten while reading lands past the end of the mapping, which
+// must be mapped again without invalidating views into the old one.
+static void test_views_across_growth(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    ordered_map_file_done_reading(omf);
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    put_number(batch, 0, 1);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    ordered_map_file_close(omf);
+
+    err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    assert(ordered_map_file_count(omf) == 1);
+    ByteView old_value;
+    err = ordered_map_file_get_view(omf, 0, nullptr, &old_value);
+    assert(err == 0);
+    assert(old_value.length() == 8);
+    assert(memcmp(old_value.raw(), "0000001", 8) == 0);
+
+    batch = ordered_map_file_batch_create(omf);
+    put_number(batch, 0, 2);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    ordered_map_file_flush(omf);
+
+    ByteView new_value;
+    err = ordered_map_file_get_view(omf, 0, nullptr, &new_value);
+    assert(err == 0);
+    assert(memcmp(new_value.raw(), "0000002", 8) == 0);
+    assert(memcmp(old_value.raw(), "0000001", 8) == 0);
+
+    ordered_map_file_done_reading(omf);
+    ordered_map_file_close(omf);
+    delete_tmp_file();
+}
+
+// A key deleted while reading keeps its entry, and the value it had, until
+// ordered_map_file_done_reading, while the reader keeps getting other keys.
+static void test_del_while_reading(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    ordered_map_file_done_reading(omf);
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    for (int i = 0; i < 3; i += 1)
+        put_number(batch, i, i);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    ordered_map_file_close(omf);
+
+    err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    assert(ordered_map_file_count(omf) == 3);
+
+    for (int round = 0; round < 100; round += 1) {
+        batch = ordered_map_file_batch_create(omf);
+        OrderedMapFileBuffer *key = ordered_map_file_buffer_create(4);
+        sprintf(key->data, "%03d", 1);
+        ordered_map_file_batch_del(batch, key);
+        put_number(batch, 1, round);
+        put_number(batch, 2, round);
+        err = ordered_map_file_batch_exec(batch);
+        assert(err == 0);
+
+        for (int i = 0; i < 3; i += 1) {
+            ByteBuffer value;
+            err = ordered_map_file_get(omf, i, nullptr, value);
+            assert(err == 0);
+            assert(value.length() == 8);
+        }
+    }
+    ordered_map_file_flush(omf);
+
+    ByteBuffer value;
+    err = ordered_map_file_get(omf, 2, nullptr, value);
+    assert(err == 0);
+    assert(memcmp(value.raw(), "0000099", 8) == 0);
+
+    ordered_map_file_done_reading(omf);
+    ordered_map_file_close(omf);
+    delete_tmp_file();
+}
+
+// After compaction the file opens from its index plus the transactions
+// appended since, which may overwrite and delete indexed keys.
+static void test_index_with_tail(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    ordered_map_file_done_reading(omf);
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    for (int i = 0; i < 10; i += 1)
+        put_number(batch, i, i);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    err = ordered_map_file_compact(omf);
+    assert(err == 0);
+
+    batch = ordered_map_file_batch_create(omf);
+    put_number(batch, 3, 33);
+    put_number(batch, 10, 10);
+    OrderedMapFileBuffer *key = ordered_map_file_buffer_create(4);
+    sprintf(key->data, "%03d", 5);
+    ordered_map_file_batch_del(batch, key);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    ordered_map_file_close(omf);
+
+    err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    assert(ordered_map_file_count(omf) == 10);
+    int expected[] = {0, 1, 2, 33, 4, 6, 7, 8, 9, 10};
+    for (int i = 0; i < 10; i += 1) {
+        ByteBuffer expected_value;
+        expected_value.format("%07d", expected[i]);
+        expected_value.resize(8);
+        ByteBuffer value;
+        err = ordered_map_file_get(omf, i, nullptr, value);
+        assert(err == 0);
+        assert(ByteBuffer::compare(value, expected_value) == 0);
+    }
+    ordered_map_file_done_reading(omf);
+    ordered_map_file_close(omf);
+    delete_tmp_file();
+}
+
+static void test_read_after_done_reading(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    ordered_map_file_done_reading(omf);
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    for (int i = 0; i < 10; i += 1)
+        put_number(batch, i, i);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+    err = ordered_map_file_compact(omf);
+    assert(err == 0);
+
+    // still queued when the read is requested
+    batch = ordered_map_file_batch_create(omf);
+    put_number(batch, 4, 44);
+    err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+
+    ByteBuffer key;
+    key.format("%03d", 4);
+    key.resize(4);
+    ByteBuffer expected_value;
+    expected_value.format("%07d", 44);
+    expected_value.resize(8);
+    ByteBuffer value;
+    err = ordered_map_file_read(omf, key, value);
+    assert(err == 0);
+    assert(ByteBuffer::compare(value, expected_value) == 0);
+
+    key.format("%03d", 7);
+    key.resize(4);
+    expected_value.format("%07d", 7);
+    expected_value.resize(8);
+    err = ordered_map_file_read(omf, key, value);
+    assert(err == 0);
+    assert(ByteBuffer::compare(value, expected_value) == 0);
+
+    key.format("%03d", 10);
+    key.resize(4);
+    err = ordered_map_file_read(omf, key, value);
+    assert(err == GenesisErrorKeyNotFound);
+
+    ordered_map_file_close(omf);
+    delete_tmp_file();
+}
+
+static const char *crash_file_path = "/tmp/genesis_test_crash.gdaw";
+
+// Copies what the operating system has of the file, which is what is left of
+// it if the process dies now.
+static void simulate_crash(void) {
+    FILE *in = fopen(tmp_file_path, "rb");
+    FILE *out = fopen(crash_file_path, "wb");
+    assert(in && out);
+    char buf[4096];
+    size_t amt;
+    while ((amt = fread(buf, 1, sizeof(buf), in))) {
+        size_t amt_written = fwrite(buf, 1, amt, out);
+        assert(amt_written == amt);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static int crash_file_key_count(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(crash_file_path, &omf);
+    assert(err == 0);
+    int count = ordered_map_file_count(omf);
+    ordered_map_file_done_reading(omf);
+    ordered_map_file_close(omf);
+    os_delete(crash_file_path);
+    return count;
+}
+
+static void exec_number(OrderedMapFile *omf, int key_number, OrderedMapFileDurability durability) {
+    OrderedMapFileBatch *batch = ordered_map_file_batch_create(omf);
+    put_number(batch, key_number, key_number);
+    batch->durability = durability;
+    int err = ordered_map_file_batch_exec(batch);
+    assert(err == 0);
+}
+
+// A committed batch survives the process dying, unless it is only buffered;
+// then it survives once a later batch is flushed.
+static void test_durability_after_crash(void) {
+    OrderedMapFile *omf;
+    int err = ordered_map_file_open(tmp_file_path, &omf);
+    assert(err == 0);
+    ordered_map_file_done_reading(omf);
+
+    exec_number(omf, 0, OrderedMapFileDurabilitySynced);
+    exec_number(omf, 1, OrderedMapFileDurabilityBuffered);
+    ordered_map_file_wait(omf);
+    simulate_crash();
+    int count = crash_file_key_count();
+    assert(count == 1 || count == 2);
+
+    exec_number(omf, 2, OrderedMapFileDurabilityFlushed);
+    ordered_map_file_wait(omf);
+    simulate_crash();
+    assert(crash_file_key_count() == 3);
+
+    OrderedMapFileCommitStats stats;
+    ordered_map_file_get_commit_stats(omf, &stats);
+    assert(stats.batch_count == 3);
+    assert(stats.write_count >= 2 && stats.write_count <= 3);
+    long histogram_total = 0;
+    for (int i = 0; i < ORDERED_MAP_FILE_DURABILITY_COUNT; i += 1) {
+        for (int j = 0; j < ORDERED_MAP_FILE_LATENCY_BUCKET_COUNT; j += 1)
+            histogram_total += stats.latency_buckets[i][j];
+    }
+    assert(histogram_total == 3);
+
+    ordered_map_file_close(omf);
+    delete_tmp_file();
+}
+
 void test_ordered_map_file(void) {
     delete_tmp_file();
     test_open_close();
     test_bogus_file();
     test_simple_data();
     test_many_data();
+    test_compaction_killed();
+    test_views_across_growth();
+    test_del_while_reading();
+    test_index_with_tail();
+    test_read_after_done_reading();
+    test_durability_after_crash();
 }
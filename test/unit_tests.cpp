@@ -7,6 +7,7 @@
 #include "ring_buffer_test.hpp"
 #include "error.h"
 #include "thread_safe_queue_test.hpp"
+#include "work_stealing_queue_test.hpp"
 #include "sort_key.hpp"
 #include "locked_queue.hpp"
 #include "crc32.hpp"
@@ -15,8 +16,17 @@
 #include "settings_file.hpp"
 #include "project.hpp"
 #include "genesis.h"
+#include "genesis.hpp"
+#include "audio_file.hpp"
 #include "atomic_value.hpp"
 #include "atomic_double.hpp"
+#include "mixer_node.hpp"
+#include "resample.hpp"
+#include "sample_convert.hpp"
+#include "peak_pyramid.hpp"
+#include "tempo_map.hpp"
+#include "sample_cache.hpp"
+#include "audio_graph.hpp"
 
 #include <stdio.h>
 #include <assert.h>
@@ -119,6 +129,179 @@ static void test_gcd(void) {
     assert(greatest_common_denominator(44100, 96000) == 300);
 }
 
+static void test_mixer_mix(void) {
+    // odd sizes to cover the partial vector and partial block tails
+    static const int sample_count = 2 * 1024 + 7;
+    static const int max_input_count = 9;
+    float *inputs[max_input_count];
+    float gains[max_input_count];
+    for (int i = 0; i < max_input_count; i += 1) {
+        inputs[i] = ok_mem(allocate_zero<float>(sample_count));
+        for (int sample = 0; sample < sample_count; sample += 1)
+            inputs[i][sample] = sinf(sample * 0.01f + i);
+        gains[i] = 1.0f - i * 0.125f;
+    }
+    float *out = ok_mem(allocate_zero<float>(sample_count));
+    float *expected = ok_mem(allocate_zero<float>(sample_count));
+
+    // every implementation the CPU supports must match the scalar one
+    MixerIsa original_isa = mixer_isa();
+    MixerIsa isas[] = {MixerIsaScalar, MixerIsaSse, MixerIsaAvx};
+    for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+        if (!mixer_select(isas[isa_i]))
+            continue;
+        for (int input_count = 0; input_count <= max_input_count; input_count += 1) {
+            mixer_mix_scalar(expected, inputs, gains, input_count, sample_count);
+            mixer_mix(out, inputs, gains, input_count, sample_count);
+            for (int sample = 0; sample < sample_count; sample += 1)
+                assert(fabsf(out[sample] - expected[sample]) < 0.0001f);
+        }
+    }
+    assert(mixer_select(original_isa));
+
+    destroy(out, sample_count);
+    destroy(expected, sample_count);
+    for (int i = 0; i < max_input_count; i += 1)
+        destroy(inputs[i], sample_count);
+}
+
+// every filter implementation the CPU supports must match the scalar one, and
+// a sine must come out as the same sine at the new rate
+static void test_resample(void) {
+    static const int in_rate = 44100;
+    static const int out_rate = 48000;
+    static const int channel_count = 2;
+    static const int in_frame_count = in_rate / 10;
+    static const int out_frame_count = out_rate / 10;
+    static const double freq = 1000.0;
+    float *in = ok_mem(allocate_zero<float>(in_frame_count * channel_count));
+    for (int frame = 0; frame < in_frame_count; frame += 1) {
+        for (int ch = 0; ch < channel_count; ch += 1)
+            in[frame * channel_count + ch] = 0.5f * sin(2.0 * M_PI * freq * frame / in_rate);
+    }
+    float *expected = ok_mem(allocate_zero<float>(out_frame_count * channel_count));
+    float *out = ok_mem(allocate_zero<float>(out_frame_count * channel_count));
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    ResampleIsa original_isa = resample_isa();
+    ResampleIsa isas[] = {ResampleIsaScalar, ResampleIsaSse, ResampleIsaAvx};
+    for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+        if (!resample_select(isas[isa_i]))
+            continue;
+        ResampleContext *stream;
+        ok_or_panic(resample_stream_create(context, in_rate, out_rate, channel_count,
+                    GenesisResampleQualityNormal, &stream));
+        // odd chunk sizes so the filter history carries across calls
+        int in_frames_read = 0;
+        int out_frames_written = 0;
+        for (;;) {
+            int in_count = min(333, in_frame_count - in_frames_read);
+            int out_count = min(301, out_frame_count - out_frames_written);
+            int read_count;
+            int written_count;
+            resample_stream_process(stream, &in[in_frames_read * channel_count], in_count,
+                    &out[out_frames_written * channel_count], out_count, &read_count, &written_count);
+            if (read_count == 0 && written_count == 0)
+                break;
+            in_frames_read += read_count;
+            out_frames_written += written_count;
+        }
+        assert(in_frames_read == in_frame_count);
+        resample_stream_destroy(stream);
+        // all but the frames the filter delay holds back
+        assert(out_frames_written > out_frame_count * 9 / 10);
+
+        if (isas[isa_i] == ResampleIsaScalar) {
+            memcpy(expected, out, out_frame_count * channel_count * sizeof(float));
+            // skip the filter delay at the start and the missing input at the end
+            for (int frame = out_frame_count / 4; frame < out_frames_written - out_frame_count / 4; frame += 1) {
+                double ideal = 0.5 * sin(2.0 * M_PI * freq * frame / out_rate);
+                for (int ch = 0; ch < channel_count; ch += 1)
+                    assert(fabs(out[frame * channel_count + ch] - ideal) < 0.001);
+            }
+        } else {
+            for (int i = 0; i < out_frames_written * channel_count; i += 1)
+                assert(fabsf(out[i] - expected[i]) < 0.00001f);
+        }
+    }
+    assert(resample_select(original_isa));
+
+    genesis_context_destroy(context);
+    destroy(in, in_frame_count * channel_count);
+    destroy(expected, out_frame_count * channel_count);
+    destroy(out, out_frame_count * channel_count);
+}
+
+// every vector implementation the CPU supports must match the scalar one
+static void test_sample_convert(void) {
+    // odd size to cover the partial vector tails
+    static const int count = 1024 + 13;
+    float *src = ok_mem(allocate_zero<float>(count));
+    for (int i = 0; i < count; i += 1)
+        src[i] = 1.25f * sinf(i * 0.1f); // includes out of range samples
+    uint8_t *raw = ok_mem(allocate_zero<uint8_t>(count * 8));
+    for (int i = 0; i < count * 8; i += 1)
+        raw[i] = (uint8_t)(i * 37 + 11);
+    double *doubles = ok_mem(allocate_zero<double>(count));
+    for (int i = 0; i < count; i += 1)
+        doubles[i] = src[i];
+
+    SampleConvertFromFloatFn **from_fns[] = {
+        &sample_convert_float_to_u8,
+        &sample_convert_float_to_s16,
+        &sample_convert_float_to_s24,
+        &sample_convert_float_to_s32,
+        &sample_convert_float_to_double,
+    };
+    SampleConvertToFloatFn **to_fns[] = {
+        &sample_convert_u8_to_float,
+        &sample_convert_s16_to_float,
+        &sample_convert_s32_to_float,
+        &sample_convert_double_to_float,
+    };
+    uint8_t *expected = ok_mem(allocate_zero<uint8_t>(count * 8));
+    uint8_t *actual = ok_mem(allocate_zero<uint8_t>(count * 8));
+    SampleConvertIsa original_isa = sample_convert_isa();
+    SampleConvertIsa isas[] = {SampleConvertIsaSse2, SampleConvertIsaAvx2};
+
+    for (int fn_i = 0; fn_i < array_length(from_fns); fn_i += 1) {
+        assert(sample_convert_select(SampleConvertIsaScalar));
+        (*from_fns[fn_i])(expected, src, count);
+        for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+            if (!sample_convert_select(isas[isa_i]))
+                continue;
+            (*from_fns[fn_i])(actual, src, count);
+            assert(memcmp(expected, actual, count * 8) == 0);
+        }
+    }
+    for (int fn_i = 0; fn_i < array_length(to_fns); fn_i += 1) {
+        const void *fn_src = (fn_i == 3) ? (const void *)doubles : (const void *)raw;
+        assert(sample_convert_select(SampleConvertIsaScalar));
+        (*to_fns[fn_i])((float *)expected, fn_src, count);
+        for (int isa_i = 0; isa_i < array_length(isas); isa_i += 1) {
+            if (!sample_convert_select(isas[isa_i]))
+                continue;
+            (*to_fns[fn_i])((float *)actual, fn_src, count);
+            assert(memcmp(expected, actual, count * sizeof(float)) == 0);
+        }
+    }
+    assert(sample_convert_select(original_isa));
+
+    // float to u8 and back is within one step
+    sample_convert_float_to_u8(raw, src, count);
+    sample_convert_u8_to_float((float *)actual, raw, count);
+    for (int i = 0; i < count; i += 1)
+        assert(fabsf(((float *)actual)[i] - clamp(-1.0f, src[i], 1.0f)) < 1.01f / 127.5f);
+
+    destroy(src, count);
+    destroy(raw, count * 8);
+    destroy(doubles, count);
+    destroy(expected, count * 8);
+    destroy(actual, count * 8);
+}
+
 static void test_sort_keys_basic(void) {
     SortKey b = SortKey::single(nullptr, nullptr);
     SortKey d = SortKey::single(&b, nullptr);
@@ -359,13 +542,13 @@ static void test_basic_project_editing(void) {
     assert(project->track_list.length() == 2);
     assert(project->undo_stack.length() == 1);
 
-    project_undo(project);
+    ok_or_panic(project_undo(project));
     assert(project->track_list.length() == 1);
 
-    project_redo(project);
+    ok_or_panic(project_redo(project));
     assert(project->track_list.length() == 2);
 
-    project_undo(project);
+    ok_or_panic(project_undo(project));
     assert(project->track_list.length() == 1);
 
     project_close(project);
@@ -380,7 +563,12 @@ static void test_basic_project_editing(void) {
     assert(project->id == project_id);
     assert(project->track_list.length() == 1);
 
-    project_redo(project);
+    // of the add track, undo, redo and undo commands in the file only the
+    // one to redo is loaded
+    assert(project->commands.size() == 1);
+    assert(project_get_next_revision(project) == 5);
+
+    ok_or_panic(project_redo(project));
     assert(project->track_list.length() == 2);
 
     project_close(project);
@@ -390,6 +578,191 @@ static void test_basic_project_editing(void) {
     genesis_context_destroy(context);
 }
 
+static void assert_project_lists_sorted(Project *project) {
+    assert(project->track_list.length() == project->tracks.size());
+    for (int i = 0; i < project->track_list.length() - 1; i += 1) {
+        assert(SortKey::compare(project->track_list.at(i)->sort_key,
+                    project->track_list.at(i + 1)->sort_key) <= 0);
+    }
+    assert(project->command_list.length() == project->commands.size());
+    for (int i = 0; i < project->command_list.length() - 1; i += 1)
+        assert(project->command_list.at(i)->revision < project->command_list.at(i + 1)->revision);
+}
+
+// Edits keep the sorted lists up to date without sorting them again, and
+// they match what a freshly opened project sorts them into.
+static void test_project_indexes(void) {
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+    static const char *tmp_proj_path = "/tmp/test_genesis_project.gdaw";
+    os_delete(tmp_proj_path);
+
+    User *user = user_create(uint256::random(), os_get_user_name());
+    Project *project;
+    ok_or_panic(project_create(context, tmp_proj_path, uint256::random(), user, &project));
+
+    for (int i = 0; i < 200; i += 1) {
+        int index = (i * 7) % project->track_list.length();
+        Track *before = project->track_list.at(index);
+        Track *after = (index + 1 < project->track_list.length()) ? project->track_list.at(index + 1) : nullptr;
+        project_insert_track(project, before, after);
+    }
+    for (int i = 0; i < 50; i += 1)
+        ok_or_panic(project_undo(project));
+    for (int i = 0; i < 20; i += 1)
+        ok_or_panic(project_redo(project));
+    assert(project->track_list.length() == 171);
+    assert_project_lists_sorted(project);
+
+    List<uint256> track_ids;
+    for (int i = 0; i < project->track_list.length(); i += 1)
+        ok_or_panic(track_ids.append(project->track_list.at(i)->id));
+    project_close(project);
+
+    int err = project_open(context, tmp_proj_path, user, &project);
+    assert(err == 0);
+    assert_project_lists_sorted(project);
+    assert(project->track_list.length() == track_ids.length());
+    for (int i = 0; i < track_ids.length(); i += 1)
+        assert(project->track_list.at(i)->id == track_ids.at(i));
+
+    // older history is read from the file when undo walks back through it
+    assert(project->commands.size() == 2);
+    for (int i = 0; i < 30; i += 1)
+        ok_or_panic(project_undo(project));
+    assert(project->track_list.length() == 141);
+    assert(project->commands.size() == 61);
+    assert_project_lists_sorted(project);
+
+    // the command of the next undo is read in the background and picked up
+    // by project_flush_events
+    Command *next_undo;
+    ordered_map_file_wait(project->omf);
+    project_flush_events(project);
+    assert(project->commands.size() == 62);
+    ok_or_panic(project_peek_undo_command(project, project->undo_stack_index - 1, &next_undo));
+    assert(next_undo);
+    project_close(project);
+
+    user_destroy(user);
+    os_delete(tmp_proj_path);
+    genesis_context_destroy(context);
+}
+
+static void test_tempo_map(void) {
+    TempoMap tempo_map;
+    GenesisTempoSegment bad[2] = {{1.0, 2.0}, {2.0, 2.0}};
+    assert(tempo_map_set(&tempo_map, bad, 2) == GenesisErrorInvalidParam);
+
+    // 2 whole notes per second for 4 whole notes, then 1 per second
+    GenesisTempoSegment segments[2] = {{0.0, 2.0}, {4.0, 1.0}};
+    ok_or_panic(tempo_map_set(&tempo_map, segments, 2));
+    assert(tempo_map_whole_notes_to_seconds(&tempo_map, 2.0, nullptr) == 1.0);
+    assert(tempo_map_whole_notes_to_seconds(&tempo_map, 6.0, nullptr) == 4.0);
+    assert(tempo_map_seconds_to_whole_notes(&tempo_map, 4.0, nullptr) == 6.0);
+    assert(tempo_map_seconds_to_whole_notes(&tempo_map, -1.0, nullptr) == -2.0);
+
+    // the cursor gives the same results going forwards and jumping back
+    List<GenesisTempoSegment> many;
+    for (int i = 0; i < 1000; i += 1)
+        ok_or_panic(many.append({i * 0.5, 1.0 + (i % 7)}));
+    ok_or_panic(tempo_map_set(&tempo_map, many.raw(), many.length()));
+    int cursor = 0;
+    for (int i = 0; i < 2000; i += 1) {
+        double whole_notes = (i < 1000) ? i * 0.3 : (i - 1000) * 0.1;
+        double seconds = tempo_map_whole_notes_to_seconds(&tempo_map, whole_notes, nullptr);
+        assert(tempo_map_whole_notes_to_seconds(&tempo_map, whole_notes, &cursor) == seconds);
+        double back = tempo_map_seconds_to_whole_notes(&tempo_map, seconds, &cursor);
+        assert(fabs(back - whole_notes) < 0.000001);
+    }
+}
+
+static void add_clip_event(AudioGraphClipEvents *clip_events, double start,
+        long segment_start, double end)
+{
+    ok_or_panic(clip_events->events.add_one());
+    GenesisMidiEvent *event = &clip_events->events.last();
+    event->event_type = GenesisMidiEventTypeSegment;
+    event->start = start;
+    event->data.segment_data.start = segment_start;
+    event->data.segment_data.end = segment_start + 1;
+    ok_or_panic(clip_events->ends.append(end));
+}
+
+static void test_event_cursor(void) {
+    // one event from 0 to 1000, and a short one on each whole note
+    AudioGraphClipEvents clip_events;
+    clip_events.version = 1;
+    add_clip_event(&clip_events, 0.0, 0, 1000.0);
+    for (int i = 0; i < 100; i += 1)
+        add_clip_event(&clip_events, i, i + 1, i + 0.5);
+    audio_graph_clip_events_build_end_tree(&clip_events);
+
+    // steady playback sends every event once, in order
+    GenesisMidiEvent out[4];
+    AudioGraphEventCursor cursor = {};
+    audio_graph_event_cursor_seek(&cursor, 0.0);
+    long next_segment = 0;
+    for (int block = 0; block < 400; block += 1) {
+        double time_requested = 0.25;
+        int count = audio_graph_event_cursor_run(&cursor, &clip_events, out, 4, &time_requested);
+        assert(time_requested == 0.25);
+        for (int i = 0; i < count; i += 1) {
+            assert(out[i].data.segment_data.start == next_segment);
+            next_segment += 1;
+        }
+    }
+    assert(next_segment == 101);
+
+    // a seek first sends the events still playing, then carries on
+    audio_graph_event_cursor_seek(&cursor, 50.25);
+    double time_requested = 0.25;
+    assert(audio_graph_event_cursor_run(&cursor, &clip_events, out, 4, &time_requested) == 2);
+    assert(out[0].data.segment_data.start == 0);
+    assert(out[1].data.segment_data.start == 51);
+    time_requested = 1.0;
+    assert(audio_graph_event_cursor_run(&cursor, &clip_events, out, 4, &time_requested) == 1);
+    assert(out[0].data.segment_data.start == 52);
+    audio_graph_event_cursor_seek(&cursor, 50.75);
+    time_requested = 0.125;
+    assert(audio_graph_event_cursor_run(&cursor, &clip_events, out, 4, &time_requested) == 1);
+    assert(out[0].data.segment_data.start == 0);
+
+    // a full buffer ends the block at the first event left out
+    AudioGraphClipEvents same_start;
+    same_start.version = 1;
+    add_clip_event(&same_start, 10.0, 0, 11.0);
+    add_clip_event(&same_start, 10.0, 0, 11.0);
+    add_clip_event(&same_start, 10.0, 1, 11.0);
+    add_clip_event(&same_start, 10.0, 2, 11.0);
+    audio_graph_clip_events_build_end_tree(&same_start);
+    audio_graph_event_cursor_seek(&cursor, 9.0);
+    time_requested = 2.0;
+    assert(audio_graph_event_cursor_run(&cursor, &same_start, out, 2, &time_requested) == 2);
+    assert(time_requested == 1.0);
+    assert(out[0].data.segment_data.start == 0);
+    assert(out[1].data.segment_data.start == 0);
+    time_requested = 2.0;
+    assert(audio_graph_event_cursor_run(&cursor, &same_start, out, 2, &time_requested) == 2);
+    assert(time_requested == 2.0);
+    assert(out[0].data.segment_data.start == 1);
+    assert(out[1].data.segment_data.start == 2);
+
+    // a new version of the events after a full buffer does not send the
+    // events at the cursor again
+    audio_graph_event_cursor_seek(&cursor, 9.0);
+    time_requested = 2.0;
+    assert(audio_graph_event_cursor_run(&cursor, &same_start, out, 2, &time_requested) == 2);
+    add_clip_event(&same_start, 10.5, 3, 11.0);
+    audio_graph_clip_events_build_end_tree(&same_start);
+    same_start.version = 2;
+    time_requested = 2.0;
+    assert(audio_graph_event_cursor_run(&cursor, &same_start, out, 4, &time_requested) == 3);
+    assert(out[0].data.segment_data.start == 1);
+    assert(out[1].data.segment_data.start == 2);
+    assert(out[2].data.segment_data.start == 3);
+}
+
 static void test_string_compare(void) {
     String a("67 fps");
     String b("69 fps");
@@ -425,6 +798,559 @@ static void test_audio_file(void) {
     os_delete(tmp_file_path);
 }
 
+static void test_audio_file_streaming(void) {
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    GenesisAudioFile *full_file;
+    ok_or_panic(genesis_audio_file_load(context, "../test/tiny-sine.ogg", &full_file));
+    GenesisAudioFile *stream_file;
+    ok_or_panic(genesis_audio_file_load_streaming(context, "../test/tiny-sine.ogg", &stream_file));
+    assert(genesis_audio_file_is_streaming(stream_file));
+
+    // the container duration may round differently than the decoded length
+    long frame_count = min(genesis_audio_file_frame_count(full_file),
+            genesis_audio_file_frame_count(stream_file));
+    assert(frame_count > 0);
+
+    struct GenesisAudioFileIterator full_it = genesis_audio_file_iterator(full_file, 0, 0);
+    struct GenesisAudioFileIterator stream_it = genesis_audio_file_iterator(stream_file, 0, 0);
+    long frame_index = 0;
+    while (frame_index < frame_count) {
+        if (!stream_it.ptr) {
+            // not decoded yet; ask again
+            stream_it = genesis_audio_file_iterator(stream_file, 0, frame_index);
+            continue;
+        }
+        long end = min(stream_it.end, frame_count);
+        for (; frame_index < end; frame_index += 1) {
+            float expected = full_it.ptr[frame_index - full_it.start];
+            float actual = stream_it.ptr[frame_index - stream_it.start];
+            assert(abs(expected - actual) < 0.0001f);
+        }
+        genesis_audio_file_iterator_next(&stream_it);
+    }
+    genesis_audio_file_iterator_release(&stream_it);
+
+    genesis_audio_file_destroy(stream_file);
+    genesis_audio_file_destroy(full_file);
+    genesis_context_destroy(context);
+}
+
+// reads the whole file, waiting for windows which are not decoded yet.
+// leaves the last window pinned.
+static void read_streaming_file(GenesisAudioFile *audio_file, GenesisAudioFileIterator *it) {
+    long frame_count = genesis_audio_file_frame_count(audio_file);
+    *it = genesis_audio_file_iterator(audio_file, 0, 0);
+    for (;;) {
+        if (!it->ptr) {
+            *it = genesis_audio_file_iterator(audio_file, 0, it->start);
+            continue;
+        }
+        if (it->end >= frame_count)
+            return;
+        genesis_audio_file_iterator_next(it);
+    }
+}
+
+// streaming files of a context share one memory budget
+static void test_audio_file_stream_pool(void) {
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+    AudioFileStreamPool *pool = context->stream_pool;
+
+    GenesisAudioFile *file_a;
+    ok_or_panic(genesis_audio_file_load_streaming(context, "../test/tiny-sine.ogg", &file_a));
+    GenesisAudioFile *file_b;
+    ok_or_panic(genesis_audio_file_load_streaming(context, "../test/tiny-sine.ogg", &file_b));
+    int channel_count = genesis_audio_file_channel_layout(file_a)->channel_count;
+    // room for one chunk
+    audio_file_stream_pool_set_budget(pool, channel_count);
+
+    GenesisAudioFileIterator it_a;
+    read_streaming_file(file_a, &it_a);
+    genesis_audio_file_iterator_release(&it_a);
+
+    // b can only get memory by evicting a
+    GenesisAudioFileIterator it_b;
+    read_streaming_file(file_b, &it_b);
+    {
+        OsMutexLocker locker(pool->mutex);
+        assert(pool->channel_chunks_used <= pool->channel_chunk_budget);
+    }
+    long miss_count = genesis_audio_file_cache_miss_count(file_a);
+    it_a = genesis_audio_file_iterator(file_a, 0, 0);
+    assert(!it_a.ptr);
+    assert(genesis_audio_file_cache_miss_count(file_a) == miss_count + 1);
+    genesis_audio_file_iterator_release(&it_b);
+
+    // destroying a file gives its memory back
+    genesis_audio_file_destroy(file_b);
+    genesis_audio_file_destroy(file_a);
+    {
+        OsMutexLocker locker(pool->mutex);
+        assert(pool->channel_chunks_used == 0);
+    }
+    genesis_context_destroy(context);
+}
+
+static void write_test_file(const ByteBuffer &path, int size, long mtime) {
+    FILE *f = fopen(path.raw(), "wb");
+    assert(f);
+    for (int i = 0; i < size; i += 1)
+        fputc(0, f);
+    fclose(f);
+    ok_or_panic(os_file_set_mtime(path.raw(), mtime));
+}
+
+static bool test_file_exists(const ByteBuffer &path) {
+    int64_t size;
+    long mtime;
+    return os_file_stat(path.raw(), &size, &mtime) == 0;
+}
+
+static void clear_test_dir(const ByteBuffer &dir) {
+    ok_or_panic(os_mkdirp(dir));
+    List<OsDirEntry *> entries;
+    ok_or_panic(os_readdir(dir.raw(), entries));
+    for (int i = 0; i < entries.length(); i += 1) {
+        ByteBuffer path;
+        os_path_join(path, dir, entries.at(i)->name);
+        os_delete(path.raw());
+        os_dir_entry_unref(entries.at(i));
+    }
+}
+
+// the key sample_cache_open checks an entry against
+static void get_sample_cache_key(ByteBuffer &out, const ByteBuffer &digest, const ByteBuffer &source_path) {
+    int64_t size;
+    long mtime;
+    ok_or_panic(os_file_stat(source_path.raw(), &size, &mtime));
+    out.clear();
+    out.append(digest);
+    out.append_uint64be(size);
+    out.append_uint64be(mtime);
+}
+
+static void test_sample_cache_trim(void) {
+    ByteBuffer cache_dir("/tmp/test_genesis_sample_cache");
+    clear_test_dir(cache_dir);
+    static const char *names[] = {"a", "b", "c", "d"};
+    ByteBuffer pcm_paths[4];
+    ByteBuffer peaks_paths[4];
+    for (int i = 0; i < 4; i += 1) {
+        ByteBuffer name(names[i]);
+        name.append(".pcm");
+        os_path_join(pcm_paths[i], cache_dir, name);
+        // oldest first
+        write_test_file(pcm_paths[i], 1000, 100000 + i * 100);
+        name = names[i];
+        name.append(".peaks");
+        os_path_join(peaks_paths[i], cache_dir, name);
+        write_test_file(peaks_paths[i], 10, 100000 + i * 100);
+    }
+    // only .pcm files and their .peaks files count
+    ByteBuffer other_path;
+    os_path_join(other_path, cache_dir, "other.txt");
+    write_test_file(other_path, 5000, 0);
+
+    // least recently used first, skipping the kept entry, until under the
+    // cap. without the peaks the first deletion would be enough.
+    ok_or_panic(sample_cache_trim(cache_dir, 3020, pcm_paths[0]));
+    assert(test_file_exists(pcm_paths[0]));
+    assert(!test_file_exists(pcm_paths[1]));
+    assert(!test_file_exists(peaks_paths[1]));
+    assert(!test_file_exists(pcm_paths[2]));
+    assert(!test_file_exists(peaks_paths[2]));
+    assert(test_file_exists(pcm_paths[3]));
+    assert(test_file_exists(peaks_paths[3]));
+    assert(test_file_exists(other_path));
+
+    // the newest entry stays even when it alone is over the cap
+    ok_or_panic(sample_cache_trim(cache_dir, 0, pcm_paths[3]));
+    assert(!test_file_exists(pcm_paths[0]));
+    assert(test_file_exists(pcm_paths[3]));
+    assert(test_file_exists(other_path));
+
+    clear_test_dir(cache_dir);
+}
+
+static void test_sample_cache_open(void) {
+    ByteBuffer cache_dir("/tmp/test_genesis_sample_cache");
+    ByteBuffer source_path("/tmp/test_genesis_sample_cache_source.ogg");
+    clear_test_dir(cache_dir);
+    ok_or_panic(os_copy("../test/tiny-sine.ogg", source_path.raw(), nullptr));
+    ok_or_panic(os_file_set_mtime(source_path.raw(), 1000000));
+
+    ByteBuffer digest;
+    for (int i = 0; i < 32; i += 1)
+        digest.append_uint8(i + 1);
+    ByteBuffer entry_path;
+    List<OsDirEntry *> entries;
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    // the first open decodes into the cache
+    GenesisAudioFile *audio_file;
+    ok_or_panic(sample_cache_open(context, cache_dir, digest, source_path.raw(), &audio_file));
+    assert(!genesis_audio_file_is_streaming(audio_file));
+    genesis_audio_file_destroy(audio_file);
+    ok_or_panic(os_readdir(cache_dir.raw(), entries));
+    assert(entries.length() == 1);
+    os_path_join(entry_path, cache_dir, entries.at(0)->name);
+    os_dir_entry_unref(entries.at(0));
+    entries.clear();
+
+    // the second open uses the entry and marks it as recently used
+    ok_or_panic(os_file_set_mtime(entry_path.raw(), 1000));
+    ok_or_panic(sample_cache_open(context, cache_dir, digest, source_path.raw(), &audio_file));
+    genesis_audio_file_destroy(audio_file);
+    int64_t entry_size;
+    long entry_mtime;
+    ok_or_panic(os_file_stat(entry_path.raw(), &entry_size, &entry_mtime));
+    assert(entry_mtime > 1000);
+
+    // a different modification time of the source replaces the entry
+    ByteBuffer old_key;
+    get_sample_cache_key(old_key, digest, source_path);
+    ok_or_panic(os_file_set_mtime(source_path.raw(), 2000000));
+    ok_or_panic(sample_cache_open(context, cache_dir, digest, source_path.raw(), &audio_file));
+    genesis_audio_file_destroy(audio_file);
+    ByteBuffer new_key;
+    get_sample_cache_key(new_key, digest, source_path);
+    assert(genesis_audio_file_load_decoded(context, entry_path.raw(), old_key.raw(), old_key.length(),
+                &audio_file) == GenesisErrorInvalidFormat);
+    ok_or_panic(genesis_audio_file_load_decoded(context, entry_path.raw(), new_key.raw(), new_key.length(),
+                &audio_file));
+    genesis_audio_file_destroy(audio_file);
+
+    // so does a different size with the same modification time
+    old_key = new_key;
+    FILE *f = fopen(source_path.raw(), "ab");
+    assert(f);
+    fputc(0, f);
+    fclose(f);
+    ok_or_panic(os_file_set_mtime(source_path.raw(), 2000000));
+    ok_or_panic(sample_cache_open(context, cache_dir, digest, source_path.raw(), &audio_file));
+    genesis_audio_file_destroy(audio_file);
+    get_sample_cache_key(new_key, digest, source_path);
+    assert(genesis_audio_file_load_decoded(context, entry_path.raw(), old_key.raw(), old_key.length(),
+                &audio_file) == GenesisErrorInvalidFormat);
+    ok_or_panic(genesis_audio_file_load_decoded(context, entry_path.raw(), new_key.raw(), new_key.length(),
+                &audio_file));
+    genesis_audio_file_destroy(audio_file);
+
+    genesis_context_destroy(context);
+    clear_test_dir(cache_dir);
+    os_delete(source_path.raw());
+}
+
+static void test_audio_file_decoded(void) {
+    static const char *tmp_file_path = "/tmp/test_genesis_decoded.pcm";
+    static const char key[] = "key";
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    GenesisAudioFile *full_file;
+    ok_or_panic(genesis_audio_file_load(context, "../test/tiny-sine.ogg", &full_file));
+    ok_or_panic(genesis_audio_file_write_decoded(context, "../test/tiny-sine.ogg", tmp_file_path,
+                key, strlen(key)));
+
+    GenesisAudioFile *mapped_file;
+    assert(genesis_audio_file_load_decoded(context, tmp_file_path, "other", 5, &mapped_file) ==
+            GenesisErrorInvalidFormat);
+    ok_or_panic(genesis_audio_file_load_decoded(context, tmp_file_path, key, strlen(key), &mapped_file));
+
+    long frame_count = genesis_audio_file_frame_count(full_file);
+    assert(genesis_audio_file_frame_count(mapped_file) == frame_count);
+    assert(genesis_audio_file_sample_rate(mapped_file) == genesis_audio_file_sample_rate(full_file));
+    int channel_count = genesis_audio_file_channel_layout(full_file)->channel_count;
+    assert(genesis_audio_file_channel_layout(mapped_file)->channel_count == channel_count);
+
+    for (int ch = 0; ch < channel_count; ch += 1) {
+        struct GenesisAudioFileIterator full_it = genesis_audio_file_iterator(full_file, ch, 0);
+        struct GenesisAudioFileIterator mapped_it = genesis_audio_file_iterator(mapped_file, ch, 0);
+        for (long frame_index = 0; frame_index < frame_count; frame_index += 1) {
+            if (frame_index >= mapped_it.end)
+                genesis_audio_file_iterator_next(&mapped_it);
+            assert(full_it.ptr[frame_index - full_it.start] ==
+                    mapped_it.ptr[frame_index - mapped_it.start]);
+        }
+    }
+
+    genesis_audio_file_destroy(mapped_file);
+    genesis_audio_file_destroy(full_file);
+    genesis_context_destroy(context);
+
+    os_delete(tmp_file_path);
+}
+
+static void test_peak_pyramid(void) {
+    static const char *tmp_file_path = "/tmp/test_genesis.peaks";
+    ByteBuffer key("key");
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    GenesisAudioFile *audio_file;
+    ok_or_panic(genesis_audio_file_load(context, "../test/tiny-sine.ogg", &audio_file));
+    ok_or_panic(peak_pyramid_write(audio_file, tmp_file_path, key));
+
+    PeakPyramid *pyramid;
+    assert(peak_pyramid_open(tmp_file_path, "other", &pyramid) == GenesisErrorInvalidFormat);
+    ok_or_panic(peak_pyramid_open(tmp_file_path, key, &pyramid));
+
+    long frame_count = genesis_audio_file_frame_count(audio_file);
+    assert(pyramid->frame_count == frame_count);
+    assert(pyramid->levels[pyramid->level_count - 1].peak_count == 1);
+
+    // pixels which line up with level 0 peaks must match the samples exactly
+    static const int pixel_count = 8;
+    WaveformPeak peaks[pixel_count];
+    double frames_per_pixel = PEAK_PYRAMID_BASE_FRAMES;
+    peak_pyramid_get_peaks(pyramid, 0, 0.0, frames_per_pixel * pixel_count, pixel_count, peaks);
+    GenesisAudioFileIterator it = genesis_audio_file_iterator(audio_file, 0, 0);
+    for (int pixel = 0; pixel < pixel_count; pixel += 1) {
+        long start = pixel * PEAK_PYRAMID_BASE_FRAMES;
+        long end = min(start + PEAK_PYRAMID_BASE_FRAMES, frame_count);
+        if (start >= frame_count) {
+            assert(peaks[pixel].min == 0.0f && peaks[pixel].max == 0.0f);
+            continue;
+        }
+        float expected_min = it.ptr[start - it.start];
+        float expected_max = expected_min;
+        for (long frame = start; frame < end; frame += 1) {
+            expected_min = min(expected_min, it.ptr[frame - it.start]);
+            expected_max = max(expected_max, it.ptr[frame - it.start]);
+        }
+        assert(peaks[pixel].min == expected_min);
+        assert(peaks[pixel].max == expected_max);
+        assert(peaks[pixel].rms >= 0.0f && peaks[pixel].rms <= max(-expected_min, expected_max));
+    }
+
+    // zoomed all the way out, one pixel covers every sample
+    WaveformPeak whole;
+    peak_pyramid_get_peaks(pyramid, 0, 0.0, frame_count, 1, &whole);
+    for (long frame = 0; frame < frame_count; frame += 1) {
+        assert(it.ptr[frame - it.start] >= whole.min);
+        assert(it.ptr[frame - it.start] <= whole.max);
+    }
+    genesis_audio_file_iterator_release(&it);
+
+    peak_pyramid_destroy(pyramid);
+    genesis_audio_file_destroy(audio_file);
+    genesis_context_destroy(context);
+
+    os_delete(tmp_file_path);
+}
+
+static void read_test_file(const char *path, ByteBuffer &out) {
+    FILE *f = fopen(path, "rb");
+    assert(f);
+    out.clear();
+    char buf[4096];
+    size_t amt;
+    while ((amt = fread(buf, 1, sizeof(buf), f)))
+        out.append(buf, amt);
+    fclose(f);
+}
+
+static void render_project(GenesisContext *context, Project *project, const char *out_path,
+        int worker_count)
+{
+    RenderOutput output;
+    output.out_path = out_path;
+    output.export_format.codec = genesis_guess_audio_file_codec(context, out_path, nullptr, nullptr);
+    assert(output.export_format.codec);
+    output.export_format.sample_format =
+        genesis_audio_file_codec_sample_format_index(output.export_format.codec, 0);
+    output.export_format.sample_rate = project->sample_rate;
+    output.export_format.bit_rate = 320 * 1000;
+
+    AudioGraph *ag;
+    ok_or_panic(audio_graph_create_render(project, context, &output, 1, &ag));
+    ok_or_panic(genesis_pipeline_set_worker_count(ag->pipeline, worker_count));
+    audio_graph_start_pipeline(ag);
+    OsMutex *mutex = ok_mem(os_mutex_create());
+    os_mutex_lock(mutex);
+    while (ag->render_frame_index.load() != ag->render_frame_count)
+        os_cond_timed_wait(ag->render_cond, mutex, 0.01);
+    os_mutex_unlock(mutex);
+    os_mutex_destroy(mutex);
+    audio_graph_destroy(ag);
+}
+
+// Offline renders wait for streaming chunks instead of writing silence, so
+// the file is the same whatever the number of workers.
+static void test_render_worker_count(void) {
+    static const char *tmp_proj_path = "/tmp/test_genesis_render.gdaw";
+    static const char *out_path_1 = "/tmp/test_genesis_render_1.wav";
+    static const char *out_path_n = "/tmp/test_genesis_render_n.wav";
+    os_delete(tmp_proj_path);
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+    User *user = user_create(uint256::random(), os_get_user_name());
+    Project *project;
+    ok_or_panic(project_create(context, tmp_proj_path, uint256::random(), user, &project));
+
+    AudioAsset *audio_asset;
+    ok_or_panic(project_add_audio_asset(project, "../test/tiny-sine.ogg", &audio_asset));
+    ByteBuffer asset_path;
+    os_path_join(asset_path, os_path_dirname(project->path), audio_asset->path);
+    project_add_audio_clip(project, audio_asset);
+    AudioClip *audio_clip = project->audio_clip_list.at(0);
+
+    // the loader threads are done with the asset once it is counted
+    os_mutex_lock(project->asset_loader_mutex);
+    while (project->asset_loader_done_count.load() < project->asset_loader_queue.length())
+        os_cond_timed_wait(project->asset_loader_cond, project->asset_loader_mutex, 0.01);
+    os_mutex_unlock(project->asset_loader_mutex);
+
+    long frame_count = genesis_audio_file_frame_count(audio_asset->audio_file);
+    Track *track = project->track_list.at(0);
+    for (int i = 0; i < 4; i += 1)
+        project_add_audio_clip_segment(project, audio_clip, track, 0, frame_count, i * 0.25);
+
+    int worker_counts[] = {1, max(2, os_concurrency())};
+    const char *out_paths[] = {out_path_1, out_path_n};
+    for (int i = 0; i < array_length(worker_counts); i += 1) {
+        // a fresh streaming file has nothing decoded, so the first window of
+        // every voice misses
+        genesis_audio_file_destroy(audio_asset->audio_file);
+        ok_or_panic(genesis_audio_file_load_streaming(context, asset_path.raw(),
+                    &audio_asset->audio_file));
+        assert(genesis_audio_file_is_streaming(audio_asset->audio_file));
+        render_project(context, project, out_paths[i], worker_counts[i]);
+        assert(genesis_audio_file_cache_miss_count(audio_asset->audio_file) > 0);
+    }
+
+    ByteBuffer rendered_1;
+    ByteBuffer rendered_n;
+    read_test_file(out_path_1, rendered_1);
+    read_test_file(out_path_n, rendered_n);
+    assert(rendered_1.length() > 0);
+    assert(rendered_1 == rendered_n);
+
+    project_close(project);
+    user_destroy(user);
+    genesis_context_destroy(context);
+    os_delete(asset_path.raw());
+    os_delete(out_path_1);
+    os_delete(out_path_n);
+    os_delete(tmp_proj_path);
+}
+
+static void write_test_wav(GenesisContext *context, const char *path, bool passthrough,
+        const float *frames, int frame_count)
+{
+    GenesisExportFormat format;
+    format.codec = genesis_guess_audio_file_codec(context, path, nullptr, nullptr);
+    assert(format.codec);
+    format.sample_format = SoundIoFormatFloat32NE;
+    assert(genesis_audio_file_codec_supports_sample_format(format.codec, format.sample_format));
+    format.sample_rate = 48000;
+    format.bit_rate = 320 * 1000;
+
+    GenesisAudioFileStream *stream = ok_mem(genesis_audio_file_stream_create(context));
+    genesis_audio_file_stream_set_sample_rate(stream, format.sample_rate);
+    genesis_audio_file_stream_set_channel_layout(stream, soundio_channel_layout_get_builtin(SoundIoChannelLayoutIdStereo));
+    genesis_audio_file_stream_set_export_format(stream, &format);
+    ok_or_panic(genesis_audio_file_stream_open(stream, path, strlen(path)));
+    assert(stream->pcm_passthrough);
+    // the encoder thread looks at this only once frames are queued
+    stream->pcm_passthrough = passthrough;
+
+    // uneven writes, ending partway through a codec frame
+    int frame_index = 0;
+    for (int write_count = 1; frame_index < frame_count; write_count = write_count * 3 + 1) {
+        int count = min(write_count, frame_count - frame_index);
+        ok_or_panic(genesis_audio_file_stream_write(stream, &frames[frame_index * 2], count));
+        frame_index += count;
+    }
+    ok_or_panic(genesis_audio_file_stream_close(stream));
+    genesis_audio_file_stream_destroy(stream);
+}
+
+// Float WAV frames are written without going through the encoder, which
+// must not change a single byte of the file.
+static void test_wav_passthrough(void) {
+    static const char *codec_path = "/tmp/test_genesis_codec.wav";
+    static const char *passthrough_path = "/tmp/test_genesis_passthrough.wav";
+    static const int frame_count = 48000 + 123;
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    float *frames = ok_mem(allocate_zero<float>(frame_count * 2));
+    for (int i = 0; i < frame_count; i += 1) {
+        frames[i * 2] = sinf(i * 0.01f);
+        frames[i * 2 + 1] = 0.5f * cosf(i * 0.03f);
+    }
+    write_test_wav(context, codec_path, false, frames, frame_count);
+    write_test_wav(context, passthrough_path, true, frames, frame_count);
+
+    ByteBuffer codec_bytes;
+    ByteBuffer passthrough_bytes;
+    read_test_file(codec_path, codec_bytes);
+    read_test_file(passthrough_path, passthrough_bytes);
+    // every frame made it into the file, including the partial last codec frame
+    assert(codec_bytes.length() >= frame_count * 2 * (int)sizeof(float));
+    assert(codec_bytes == passthrough_bytes);
+
+    destroy(frames, frame_count * 2);
+    genesis_context_destroy(context);
+    os_delete(codec_path);
+    os_delete(passthrough_path);
+}
+
+// A stream written at one rate and exported at another resamples on the
+// encoder thread, and the file covers exactly the written duration.
+static void test_stream_resample(void) {
+    static const char *path = "/tmp/test_genesis_resample.wav";
+    static const int in_sample_rate = 44100;
+    static const int out_sample_rate = 48000;
+    static const int frame_count = in_sample_rate;
+
+    GenesisContext *context;
+    ok_or_panic(genesis_context_create(&context));
+
+    GenesisExportFormat format;
+    format.codec = genesis_guess_audio_file_codec(context, path, nullptr, nullptr);
+    assert(format.codec);
+    format.sample_format = SoundIoFormatFloat32NE;
+    format.sample_rate = out_sample_rate;
+    format.bit_rate = 320 * 1000;
+
+    float *frames = ok_mem(allocate_zero<float>(frame_count * 2));
+    for (int i = 0; i < frame_count; i += 1) {
+        frames[i * 2] = 0.5f * sinf(i * 0.01f);
+        frames[i * 2 + 1] = frames[i * 2];
+    }
+
+    GenesisAudioFileStream *stream = ok_mem(genesis_audio_file_stream_create(context));
+    genesis_audio_file_stream_set_sample_rate(stream, in_sample_rate);
+    genesis_audio_file_stream_set_channel_layout(stream, soundio_channel_layout_get_builtin(SoundIoChannelLayoutIdStereo));
+    genesis_audio_file_stream_set_export_format(stream, &format);
+    ok_or_panic(genesis_audio_file_stream_open(stream, path, strlen(path)));
+    assert(stream->resampler);
+    ok_or_panic(genesis_audio_file_stream_write(stream, frames, frame_count));
+    ok_or_panic(genesis_audio_file_stream_close(stream));
+    genesis_audio_file_stream_destroy(stream);
+
+    GenesisAudioFile *audio_file;
+    ok_or_panic(genesis_audio_file_load(context, path, &audio_file));
+    assert(genesis_audio_file_sample_rate(audio_file) == out_sample_rate);
+    assert(genesis_audio_file_frame_count(audio_file) == out_sample_rate);
+    genesis_audio_file_destroy(audio_file);
+
+    destroy(frames, frame_count * 2);
+    genesis_context_destroy(context);
+    os_delete(path);
+}
+
 static void test_path_extension(void) {
     assert(ByteBuffer::compare(os_path_extension("foo"), "") == 0);
     assert(ByteBuffer::compare(os_path_extension("foo.ogg"), ".ogg") == 0);
@@ -491,7 +1417,11 @@ static struct Test tests[] = {
     {"RingBuffer", test_ring_buffer},
     {"euclidean_mod", test_euclidean_mod},
     {"ThreadSafeQueue", test_thread_safe_queue},
+    {"WorkStealingQueue", test_work_stealing_queue},
     {"greatest_common_denominator", test_gcd},
+    {"mixer_mix", test_mixer_mix},
+    {"resample", test_resample},
+    {"sample format conversion", test_sample_convert},
     {"sort keys basic", test_sort_keys_basic},
     {"sort keys count", test_sort_keys_count},
     {"LockedQueue", test_locked_queue},
@@ -503,8 +1433,20 @@ static struct Test tests[] = {
     {"ByteBuffer::to_string", test_byte_buffer_to_string},
     {"List::sort", test_list_sort},
     {"basic project editing", test_basic_project_editing},
+    {"incremental project indexes", test_project_indexes},
+    {"tempo map", test_tempo_map},
+    {"clip event cursor", test_event_cursor},
     {"String::compare", test_string_compare},
     {"basic audio file loading and saving", test_audio_file},
+    {"streaming audio file loading", test_audio_file_streaming},
+    {"streaming audio file prefetch pool", test_audio_file_stream_pool},
+    {"decoded audio file cache", test_audio_file_decoded},
+    {"sample cache trim", test_sample_cache_trim},
+    {"sample cache open", test_sample_cache_open},
+    {"waveform peak pyramid", test_peak_pyramid},
+    {"render with any number of workers", test_render_worker_count},
+    {"float wav passthrough", test_wav_passthrough},
+    {"resample on the encoder thread", test_stream_resample},
     {"os_path_extension", test_path_extension},
     {"AtomicValue", test_atomic_value},
     {"AtomicDouble", test_atomic_double},
@@ -0,0 +1,149 @@
+#include "work_stealing_queue_test.hpp"
+#include "work_stealing_queue.hpp"
+#include "list.hpp"
+#include "os.hpp"
+#include "random.hpp"
+
+// Runs randomly generated DAGs through the scheduler the same way the
+// pipeline does: a node is enqueued exactly once when its last input
+// finishes, and workers enqueue the nodes they make ready.
+
+static const int GRAPH_COUNT = 20;
+static const int ITERATION_COUNT = 50;
+static const int MAX_NODE_COUNT = 200;
+
+struct StressNode {
+    List<StressNode *> inputs;
+    List<StressNode *> outputs;
+    atomic_int inputs_remaining;
+    atomic_int run_count;
+};
+
+struct StressGraph {
+    WorkStealingQueue<StressNode *> queue;
+    List<StressNode *> nodes;
+    atomic_int nodes_remaining;
+    atomic_int iteration;
+};
+
+struct StressWorker {
+    StressGraph *graph;
+    int index;
+};
+
+static void test_assert(bool expr, const char *explain) {
+    if (!expr)
+        panic("assertion failure: %s", explain);
+}
+
+static void assert_no_err(int err) {
+    if (err)
+        panic("Error: %s", genesis_strerror(err));
+}
+
+static void stress_worker_run(void *userdata) {
+    StressWorker *worker = (StressWorker *)userdata;
+    StressGraph *graph = worker->graph;
+    for (;;) {
+        StressNode *node = graph->queue.dequeue(worker->index);
+        if (!node)
+            return;
+
+        int iteration = graph->iteration.load();
+        test_assert(node->inputs_remaining.load() == 0, "node run before its inputs");
+        for (int i = 0; i < node->inputs.length(); i += 1) {
+            test_assert(node->inputs.at(i)->run_count.load() == iteration + 1, "input not run");
+        }
+        int old_run_count = node->run_count.fetch_add(1);
+        test_assert(old_run_count == iteration, "node run more than once");
+
+        for (int i = 0; i < node->outputs.length(); i += 1) {
+            StressNode *output = node->outputs.at(i);
+            if (output->inputs_remaining.fetch_sub(1) == 1)
+                graph->queue.enqueue(output);
+        }
+
+        if (graph->nodes_remaining.fetch_sub(1) == 1)
+            os_futex_wake(reinterpret_cast<int*>(&graph->nodes_remaining), 1);
+    }
+}
+
+static void run_random_graph(RandomState *random_state, int worker_count) {
+    StressGraph *graph = create<StressGraph>();
+
+    int node_count = 1 + get_random(random_state) % MAX_NODE_COUNT;
+    for (int i = 0; i < node_count; i += 1) {
+        StressNode *node = create<StressNode>();
+        node->run_count.store(0);
+        ok_or_panic(graph->nodes.append(node));
+    }
+    // edges only point from lower to higher indexes, so the graph is acyclic
+    int edge_percent = 1 + get_random(random_state) % 10;
+    for (int src = 0; src < node_count; src += 1) {
+        for (int dest = src + 1; dest < node_count; dest += 1) {
+            if ((int)(get_random(random_state) % 100) < edge_percent) {
+                StressNode *src_node = graph->nodes.at(src);
+                StressNode *dest_node = graph->nodes.at(dest);
+                ok_or_panic(src_node->outputs.append(dest_node));
+                ok_or_panic(dest_node->inputs.append(src_node));
+            }
+        }
+    }
+
+    assert_no_err(graph->queue.resize(worker_count, node_count));
+
+    StressWorker *workers = ok_mem(allocate_zero<StressWorker>(worker_count));
+    OsThread **threads = ok_mem(allocate_zero<OsThread *>(worker_count));
+    for (int i = 0; i < worker_count; i += 1) {
+        workers[i].graph = graph;
+        workers[i].index = i;
+        assert_no_err(os_thread_create(stress_worker_run, &workers[i], false, &threads[i]));
+    }
+
+    for (int iteration = 0; iteration < ITERATION_COUNT; iteration += 1) {
+        graph->iteration.store(iteration);
+        for (int i = 0; i < node_count; i += 1) {
+            StressNode *node = graph->nodes.at(i);
+            node->inputs_remaining.store(node->inputs.length());
+        }
+        graph->nodes_remaining.store(node_count);
+
+        for (int i = 0; i < node_count; i += 1) {
+            StressNode *node = graph->nodes.at(i);
+            if (node->inputs.length() == 0)
+                graph->queue.enqueue(node);
+        }
+
+        for (;;) {
+            int nodes_remaining = graph->nodes_remaining.load();
+            if (nodes_remaining == 0)
+                break;
+            os_futex_wait(reinterpret_cast<int*>(&graph->nodes_remaining), nodes_remaining);
+        }
+
+        for (int i = 0; i < node_count; i += 1) {
+            test_assert(graph->nodes.at(i)->run_count.load() == iteration + 1, "node not run");
+        }
+    }
+
+    graph->queue.wakeup_all();
+    for (int i = 0; i < worker_count; i += 1)
+        os_thread_destroy(threads[i]);
+
+    for (int i = 0; i < node_count; i += 1)
+        destroy(graph->nodes.at(i), 1);
+    destroy(threads, 0);
+    destroy(workers, 0);
+    destroy(graph, 1);
+}
+
+void test_work_stealing_queue(void) {
+    RandomState random_state;
+    init_random_state(&random_state, 0x6a9e5153);
+
+    int max_worker_count = max(8, os_concurrency() * 2);
+    for (int i = 0; i < GRAPH_COUNT; i += 1) {
+        int worker_count = 1 + get_random(&random_state) % max_worker_count;
+        run_random_graph(&random_state, worker_count);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef WORK_STEALING_QUEUE_TEST_HPP
+#define WORK_STEALING_QUEUE_TEST_HPP
+
+void test_work_stealing_queue(void);
+
+#endif